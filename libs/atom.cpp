@@ -0,0 +1,130 @@
+#include "atom.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// Append-only table of interned strings.
+//
+// Atom-to-string lookups are lock-free: the strings are stored in blocks that
+// never move once allocated, and the blocks are published via atomic
+// pointers. String-to-atom lookups use a reader-writer lock, so that
+// concurrent lookups of already-interned strings don't block each other.
+//
+class AtomTable {
+public:
+    static constexpr uint32_t blockBits = 12;
+    static constexpr uint32_t blockSize = 1 << blockBits;
+    static constexpr uint32_t maxBlocks = 1 << 14;
+
+    AtomTable() {
+        intern("");
+    }
+
+    std::string_view str(uint32_t id) const {
+        const std::string_view* block =
+            blocks_[id >> blockBits].load(std::memory_order_acquire);
+        return block[id & (blockSize - 1)];
+    }
+
+    std::optional<uint32_t> find(std::string_view str) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(str);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    uint32_t intern(std::string_view str) {
+        if (std::optional<uint32_t> id = find(str)) {
+            return *id;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(str); // might have been inserted by another thread
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        uint32_t id = size_;
+        uint32_t blockIndex = id >> blockBits;
+        if (blockIndex >= maxBlocks) {
+            throw std::length_error("Too many atoms.");
+        }
+        std::string_view* block = blocks_[blockIndex].load(std::memory_order_relaxed);
+        if (!block) {
+            block = new std::string_view[blockSize];
+        }
+        std::string_view stored = storeChars_(str);
+        block[id & (blockSize - 1)] = stored;
+        blocks_[blockIndex].store(block, std::memory_order_release);
+        ids_.emplace(stored, id);
+        ++size_;
+        return id;
+    }
+
+private:
+    static constexpr size_t charBlockSize = 64 * 1024;
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::string_view, uint32_t> ids_;
+    std::atomic<std::string_view*> blocks_[maxBlocks] = {};
+    uint32_t size_ = 0;
+
+    // Characters of all strings, allocated in large blocks
+    std::vector<std::unique_ptr<char[]>> chars_;
+    char* current_ = nullptr;
+    size_t remaining_ = 0;
+
+    std::string_view storeChars_(std::string_view str) {
+        size_t n = str.size();
+        if (n > remaining_) {
+            if (n > charBlockSize / 4) {
+                // Large strings get their own allocation
+                chars_.emplace_back(new char[n]);
+                str.copy(chars_.back().get(), n);
+                return std::string_view(chars_.back().get(), n);
+            }
+            chars_.emplace_back(new char[charBlockSize]);
+            current_ = chars_.back().get();
+            remaining_ = charBlockSize;
+        }
+        char* p = current_;
+        str.copy(p, n);
+        current_ += n;
+        remaining_ -= n;
+        return std::string_view(p, n);
+    }
+};
+
+AtomTable& atomTable() {
+    static AtomTable* table = new AtomTable(); // intentionally leaked, see below
+    return *table;
+}
+
+// Note: the table is never destroyed, since atoms may still be used by
+// objects destroyed after static destruction starts (e.g., objects owned by
+// Python, which may be collected after this library is finalized).
+
+} // namespace
+
+Atom::Atom(std::string_view str)
+    : id_(atomTable().intern(str)) {
+}
+
+std::optional<Atom> Atom::find(std::string_view str) {
+    if (std::optional<uint32_t> id = atomTable().find(str)) {
+        return Atom(IdKey(), *id);
+    }
+    return std::nullopt;
+}
+
+std::string_view Atom::str() const {
+    return atomTable().str(id_);
+}
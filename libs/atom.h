@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <functional> // hash
+#include <optional>
+#include <string_view>
+
+#include "common.h"
+
+// An Atom is a small integer identifying an interned string.
+//
+// All atoms are stored in a global, thread-safe, append-only table: interning
+// the same string twice gives the same atom, so comparing two atoms is just
+// an integer comparison, and each distinct string is only stored once,
+// regardless of how many objects use it.
+//
+// Strings are never removed from the table, so this should only be used for
+// values that are expected to repeat a lot (e.g., node names), not arbitrary
+// user input.
+//
+// Note: the table is defined in atom.cpp, which must be compiled in exactly
+// one library per process-wide "domain" of atoms (in this repository: each
+// experiment library that uses it).
+//
+class API Atom {
+public:
+    // The atom of the empty string.
+    Atom() = default;
+
+    // Interns the given string. This acquires a lock only if the string has
+    // never been interned before.
+    explicit Atom(std::string_view str);
+
+    // Returns the atom of the given string if it has already been interned,
+    // without interning it otherwise.
+    static std::optional<Atom> find(std::string_view str);
+
+    // The returned string_view is valid for the rest of the program.
+    // This never acquires a lock.
+    std::string_view str() const;
+
+    uint32_t id() const {
+        return id_;
+    }
+
+    friend bool operator==(Atom a, Atom b) {
+        return a.id_ == b.id_;
+    }
+
+    friend bool operator!=(Atom a, Atom b) {
+        return a.id_ != b.id_;
+    }
+
+private:
+    uint32_t id_ = 0;
+
+    struct IdKey {};
+    Atom(IdKey, uint32_t id)
+        : id_(id) {
+    }
+};
+
+namespace std {
+
+template<>
+struct hash<Atom> {
+    size_t operator()(Atom atom) const {
+        return std::hash<uint32_t>()(atom.id());
+    }
+};
+
+} // namespace std
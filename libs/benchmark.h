@@ -0,0 +1,215 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility> // pair
+#include <vector>
+
+// Utilities shared by the C++ benchmarks (the <lib>_bench targets), so that
+// they run the same standardized workloads, and report them in the same
+// format:
+//
+// - build: create N objects (e.g., nodes of a tree)
+// - dfs: depth-first traversal of all the nodes
+// - randomChildAccess: random walk from the root to a leaf, repeatedly
+// - clearChildren: remove all the nodes under the root
+// - destroy: destroy the whole tree, or all the objects
+// - weakLock: std::weak_ptr::lock() throughput, with 1 to N threads
+//
+// Experiments without a tree (e.g., Action and Widget) replace dfs and
+// randomChildAccess by:
+//
+// - trigger: trigger the actions of all the widgets, in order
+// - randomTrigger: trigger the actions of randomly chosen widgets
+//
+// Workloads that don't apply to an experiment (e.g., weakLock without weak
+// pointers) are omitted.
+//
+// Each result is printed as it is measured, and all of them are saved as
+// JSON if the benchmark is given `--json <path>`:
+//
+//   {
+//     "experiment": "x03",
+//     "results": [
+//       {"workload": "build", "params": {"numNodes": 1000000, "numThreads": 1},
+//        "value": 81.2, "unit": "ns/node"},
+//       ...
+//     ]
+//   }
+//
+namespace benchmark {
+
+using Clock = std::chrono::steady_clock;
+
+inline double nanosecondsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Command line of a benchmark: positional arguments, and the optional
+// `--json <path>`.
+//
+struct Args {
+    std::vector<std::string> positional;
+    std::string jsonPath;
+
+    Args(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--json" && i + 1 < argc) {
+                jsonPath = argv[++i];
+            }
+            else {
+                positional.push_back(arg);
+            }
+        }
+    }
+
+    // Returns the positional argument at the given index as an integer, or
+    // the given default value.
+    size_t get(size_t index, size_t defaultValue) const {
+        return index < positional.size() ? std::strtoull(positional[index].c_str(), nullptr, 10)
+                                         : defaultValue;
+    }
+};
+
+using Params = std::vector<std::pair<std::string, uint64_t>>;
+
+class Report {
+public:
+    explicit Report(std::string experiment)
+        : experiment_(std::move(experiment)) {
+    }
+
+    void add(std::string workload, Params params, double value, std::string unit) {
+        std::cout << "  " << workload;
+        for (const auto& [name, param] : params) {
+            std::cout << " " << name << "=" << param;
+        }
+        std::cout << ": " << value << " " << unit << std::endl;
+        results_.push_back({std::move(workload), std::move(params), value, std::move(unit)});
+    }
+
+    // Writes the results as JSON to the given path, if not empty. Returns
+    // false if the file cannot be written.
+    //
+    bool save(const std::string& path) const {
+        if (path.empty()) {
+            return true;
+        }
+        std::ofstream out(path);
+        out << "{\n  \"experiment\": \"" << experiment_ << "\",\n  \"results\": [";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const Result& r = results_[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"workload\": \"" << r.workload
+                << "\", \"params\": {";
+            for (size_t j = 0; j < r.params.size(); ++j) {
+                out << (j == 0 ? "" : ", ") << "\"" << r.params[j].first
+                    << "\": " << r.params[j].second;
+            }
+            out << "}, \"value\": " << r.value << ", \"unit\": \"" << r.unit << "\"}";
+        }
+        out << "\n  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct Result {
+        std::string workload;
+        Params params;
+        double value;
+        std::string unit;
+    };
+
+    std::string experiment_;
+    std::vector<Result> results_;
+};
+
+// Starts and joins a thread, since libstdc++ uses non-atomic counts for
+// shared_ptr as long as the process never started a second thread (see
+// x08/bench.cpp). Call this first for single-threaded workloads to be
+// comparable across experiments.
+//
+inline void useAtomicRefCounts() {
+    std::thread([]() {}).join();
+}
+
+// 1, 2, 4, ... up to the number of hardware threads, which is always included.
+//
+inline std::vector<size_t> threadCounts() {
+    size_t maxThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    std::vector<size_t> res;
+    for (size_t n = 1; n < maxThreads; n *= 2) {
+        res.push_back(n);
+    }
+    res.push_back(maxThreads);
+    return res;
+}
+
+// Runs `f(threadIndex)` in `numThreads` threads started at the same time, and
+// returns the elapsed time in nanoseconds between the start and the end of the
+// slowest thread.
+//
+template<typename F>
+double runThreads(size_t numThreads, F f) {
+    std::atomic<size_t> numReady = 0;
+    std::atomic<bool> isStarted = false;
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i]() {
+            ++numReady;
+            while (!isStarted.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            f(i);
+        });
+    }
+    while (numReady.load() < numThreads) {
+        std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    isStarted.store(true, std::memory_order_release);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return nanosecondsSince(start);
+}
+
+// Prevents the compiler from optimizing away the computation of a value that
+// is otherwise unused, by storing it into a volatile variable.
+//
+inline const void* volatile sink = nullptr;
+
+inline void doNotOptimize(const void* p) {
+    sink = p;
+}
+
+// Small, fast pseudo-random generator, so that the cost of generating random
+// indices doesn't dominate the measured access times.
+//
+class Random {
+public:
+    explicit Random(uint64_t seed = 42)
+        : state_(seed ? seed : 1) {
+    }
+
+    // Returns a number in [0, n), n > 0.
+    size_t operator()(size_t n) {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return static_cast<size_t>(state_ % n);
+    }
+
+private:
+    uint64_t state_;
+};
+
+} // namespace benchmark
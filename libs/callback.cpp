@@ -0,0 +1,3 @@
+#include "callback.h"
+
+CallbackObject::~CallbackObject() = default;
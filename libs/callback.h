@@ -0,0 +1,245 @@
+#pragma once
+
+#include <cstddef>
+#include <functional> // bad_function_call
+#include <new>
+#include <type_traits>
+#include <utility> // forward
+
+#include "common.h"
+
+namespace detail {
+
+// Whether D declares `static constexpr bool isPythonCallable = true`.
+template<typename D, typename = void>
+struct IsPythonCallable : std::false_type {};
+
+template<typename D>
+struct IsPythonCallable<D, std::void_t<decltype(D::isPythonCallable)>>
+    : std::bool_constant<D::isPythonCallable> {};
+
+} // namespace detail
+
+// A BasicCallback is a move-only, type-erased `void()` callable, like
+// `std::function<void(void)>`, except that any callable of up to
+// `inlineSize` bytes, which can be moved without throwing, is stored inside
+// the callback itself instead of being allocated on the heap. Larger callables
+// are still allocated on the heap.
+//
+// For reference, libstdc++ only stores callables of up to 16 bytes (e.g., a
+// lambda capturing two pointers) inline in a `std::function`, and requires
+// them to be copyable.
+//
+// The default inline size makes `Callback` the same size as `std::function`
+// on 64-bit platforms, but is large enough for a lambda capturing a
+// `shared_ptr` and a pointer.
+//
+template<size_t inlineSize = 3 * sizeof(void*)>
+class BasicCallback {
+public:
+    static_assert(inlineSize >= sizeof(void*), "inlineSize must fit at least a pointer");
+
+    BasicCallback() noexcept = default;
+
+    BasicCallback(std::nullptr_t) noexcept {
+    }
+
+    // Stores the given callable. A null function pointer gives an empty
+    // callback, like std::function.
+    //
+    template<
+        typename F,
+        typename D = std::decay_t<F>,
+        typename = std::enable_if_t<
+            !std::is_same_v<D, BasicCallback> && std::is_invocable_r_v<void, D&>>>
+    BasicCallback(F&& f) {
+        if constexpr (std::is_pointer_v<std::remove_reference_t<F>>) {
+            if (!f) {
+                return;
+            }
+        }
+        if constexpr (isInline_<D>) {
+            new (&storage_) D(std::forward<F>(f));
+        }
+        else {
+            new (&storage_) D*(new D(std::forward<F>(f)));
+        }
+        ops_ = &ops<D>;
+    }
+
+    BasicCallback(BasicCallback&& other) noexcept
+        : ops_(other.ops_) {
+
+        if (ops_) {
+            ops_->move(&other.storage_, &storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    BasicCallback& operator=(BasicCallback&& other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.ops_) {
+                other.ops_->move(&other.storage_, &storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    BasicCallback(const BasicCallback&) = delete;
+    BasicCallback& operator=(const BasicCallback&) = delete;
+
+    ~BasicCallback() {
+        reset();
+    }
+
+    // Destroys the stored callable, if any. The callback is already empty
+    // while the callable is destroyed.
+    //
+    void reset() noexcept {
+        if (const Ops* ops = ops_) {
+            ops_ = nullptr;
+            ops->destroy(&storage_);
+        }
+    }
+
+    explicit operator bool() const noexcept {
+        return ops_ != nullptr;
+    }
+
+    // Throws std::bad_function_call if empty.
+    void operator()() {
+        if (!ops_) {
+            throw std::bad_function_call();
+        }
+        ops_->call(&storage_);
+    }
+
+    // Whether the callable is stored inline, rather than on the heap. Returns
+    // true if empty.
+    //
+    bool isInline() const noexcept {
+        return !ops_ || ops_->isInline;
+    }
+
+    // Returns the stored callable if it is of type F, otherwise nullptr, like
+    // `std::function::target()`. Note that callables stored in a different
+    // shared library are never considered of type F, since the type is
+    // identified by the address of its Ops table.
+    //
+    template<typename F>
+    F* target() noexcept {
+        return ops_ == &ops<F> ? &get_<F>(&storage_) : nullptr;
+    }
+
+    template<typename F>
+    const F* target() const noexcept {
+        return const_cast<BasicCallback*>(this)->template target<F>();
+    }
+
+    // Whether the callable is a Python callable (see ../callbackcaster.h),
+    // which must hold the GIL while it is called. It acquires it itself if
+    // needed, but schedulers can use this to group such callables under a
+    // single acquisition (see x06/actionqueue.h). Returns false if empty.
+    //
+    bool isPython() const noexcept {
+        return ops_ && ops_->isPython;
+    }
+
+private:
+    template<typename D>
+    static constexpr bool isInline_ = sizeof(D) <= inlineSize
+                                      && alignof(D) <= alignof(std::max_align_t)
+                                      && std::is_nothrow_move_constructible_v<D>;
+
+    // Operations on a stored callable of type D, where `storage` is either
+    // the callable itself, or a pointer to it.
+    //
+    struct Ops {
+        void (*call)(void* storage);
+        void (*move)(void* from, void* to) noexcept;
+        void (*destroy)(void* storage) noexcept;
+        bool isInline;
+        bool isPython;
+    };
+
+    template<typename D>
+    static D& get_(void* storage) noexcept {
+        if constexpr (isInline_<D>) {
+            return *std::launder(static_cast<D*>(storage));
+        }
+        else {
+            return **std::launder(static_cast<D**>(storage));
+        }
+    }
+
+    template<typename D>
+    static void call_(void* storage) {
+        std::invoke(get_<D>(storage));
+    }
+
+    template<typename D>
+    static void move_(void* from, void* to) noexcept {
+        if constexpr (isInline_<D>) {
+            D& f = get_<D>(from);
+            new (to) D(std::move(f));
+            f.~D();
+        }
+        else {
+            new (to) D*(*static_cast<D**>(from));
+        }
+    }
+
+    template<typename D>
+    static void destroy_(void* storage) noexcept {
+        if constexpr (isInline_<D>) {
+            get_<D>(storage).~D();
+        }
+        else {
+            delete &get_<D>(storage);
+        }
+    }
+
+    template<typename D>
+    static constexpr Ops ops = {
+        &call_<D>, &move_<D>, &destroy_<D>, isInline_<D>, detail::IsPythonCallable<D>::value};
+
+    alignas(std::max_align_t) unsigned char storage_[inlineSize];
+    const Ops* ops_ = nullptr;
+};
+
+using Callback = BasicCallback<>;
+
+// Base class for C++ function objects exported to Python. Passing an instance
+// of a subclass to `Action.setCallback()` stores it as a C++ callable, which
+// is then called without going through Python at all (see
+// callbackcaster.h).
+//
+// Note: the key function is defined in callback.cpp, which must be compiled
+// in each experiment library that uses it, like atom.cpp.
+//
+class API CallbackObject {
+public:
+    virtual ~CallbackObject();
+    virtual void operator()() = 0;
+};
+
+// Callback object counting how many times it was called.
+//
+// Utility class for unit tests and benchmarks.
+//
+class API CallCounter : public CallbackObject {
+public:
+    void operator()() override {
+        ++count_;
+    }
+
+    size_t count() const {
+        return count_;
+    }
+
+private:
+    size_t count_ = 0;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <memory>
+#include <utility> // move
+
+#include <pybind11/pybind11.h>
+
+#include "callback.h"
+
+// pybind11 type caster converting Python callables to BasicCallback (see
+// callback.h), replacing the caster of std::function from
+// pybind11/functional.h.
+//
+// - None gives an empty callback.
+//
+// - Instances of CallbackObject subclasses exported to Python (e.g.,
+//   CallCounter) are stored as C++ callables holding a shared_ptr to the
+//   object, so calling the callback doesn't involve Python at all.
+//
+// - Other callables are stored in a PyCallback, see below.
+//
+// Only Python to C++ conversions are supported.
+//
+namespace callbackcaster {
+
+namespace py = pybind11;
+
+// Python callable stored in a callback. Unlike the wrapper of
+// pybind11/functional.h, this only acquires the GIL if the calling thread
+// doesn't already hold it (e.g., when `executeCallback()` is called from
+// Python), and calls the callable without building an argument tuple.
+//
+class PyCallback {
+public:
+    static constexpr bool isPythonCallable = true;
+
+    explicit PyCallback(py::object f)
+        : f_(std::move(f)) {
+    }
+
+    PyCallback(PyCallback&& other) noexcept = default;
+    PyCallback& operator=(PyCallback&& other) = delete;
+
+    // The callback may be destroyed in a thread that doesn't hold the GIL.
+    ~PyCallback() {
+        if (f_) {
+            py::gil_scoped_acquire gil;
+            f_ = py::object();
+        }
+    }
+
+    const py::object& object() const {
+        return f_;
+    }
+
+    void operator()() {
+        if (PyGILState_Check()) {
+            call_();
+        }
+        else {
+            py::gil_scoped_acquire gil;
+            call_();
+        }
+    }
+
+private:
+    py::object f_;
+
+    void call_() {
+        PyObject* res = PyObject_CallObject(f_.ptr(), nullptr);
+        if (!res) {
+            throw py::error_already_set();
+        }
+        Py_DECREF(res);
+    }
+};
+
+// Visits the Python callable stored in the callback, if any. This is meant to
+// be used by the tp_traverse of the wrapper owning the callback, see
+// ../pygc.h.
+//
+template<size_t inlineSize>
+int traverse(const BasicCallback<inlineSize>& callback, visitproc visit, void* arg) {
+    if (const PyCallback* f = callback.template target<PyCallback>()) {
+        Py_VISIT(f->object().ptr());
+    }
+    return 0;
+}
+
+// Returns whether `src` is an instance of CallbackObject, if exported.
+//
+inline bool isCallbackObject(py::handle src) {
+    static const py::detail::type_info* info =
+        py::detail::get_type_info(typeid(CallbackObject));
+    return info && PyObject_TypeCheck(src.ptr(), info->type);
+}
+
+} // namespace callbackcaster
+
+namespace pybind11 {
+namespace detail {
+
+template<size_t inlineSize>
+class type_caster<BasicCallback<inlineSize>> {
+    using Type = BasicCallback<inlineSize>;
+
+public:
+    PYBIND11_TYPE_CASTER(Type, const_name("Callable[[], None]"));
+
+    bool load(handle src, bool) {
+        if (src.is_none()) {
+            value = nullptr;
+            return true;
+        }
+        if (callbackcaster::isCallbackObject(src)) {
+            auto f = src.cast<std::shared_ptr<CallbackObject>>();
+            value = [f = std::move(f)]() { (*f)(); };
+            return true;
+        }
+        if (PyCallable_Check(src.ptr())) {
+            value = callbackcaster::PyCallback(reinterpret_borrow<object>(src));
+            return true;
+        }
+        return false;
+    }
+
+    static handle cast(const Type&, return_value_policy, handle) {
+        throw type_error("callbacks cannot be converted to Python");
+    }
+};
+
+} // namespace detail
+} // namespace pybind11
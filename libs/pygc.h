@@ -0,0 +1,77 @@
+#pragma once
+
+#include <memory>
+
+#include <pybind11/pybind11.h>
+
+// Support of Python's cyclic garbage collector for wrappers of C++ objects
+// bound with std::shared_ptr<T> as holder type, whose C++ object stores
+// Python objects, directly or indirectly (e.g., a callback wrapping a Python
+// callable, see callbackcaster.h).
+//
+// By default, pybind11 wrappers are not tracked by the GC, so a cycle going
+// through C++ (e.g., a widget owning an action, whose callback captures the
+// wrapper of the widget) is never collected. With `setupType<T>`, the wrapper
+// reports the Python objects stored in its C++ object via tp_traverse, and
+// releases them via tp_clear.
+//
+// This is only done if the wrapper is the only owner of the C++ object, that
+// is, if the use count of its holder is 1. Otherwise, the object may be kept
+// alive by C++ code that is invisible to the GC, so the Python objects it
+// stores must be considered reachable. The same rule applies to objects
+// owned by the object itself (e.g., the action of a widget): they should only
+// be traversed if they have no other owner.
+//
+// A wrapped class T must have the following functions, found via ADL:
+//
+// - `int traversePython(const T& object, visitproc visit, void* arg)`:
+//   visits the Python objects stored in `object`, like tp_traverse.
+//
+// - `void clearPython(T& object)`: releases them, like tp_clear.
+//
+// Usage, possibly combined with other type setups:
+//
+//   py::class_<T, std::shared_ptr<T>>(m, "T", py::custom_type_setup(&pygc::setupType<T>))
+//
+namespace pygc {
+
+namespace py = pybind11;
+
+// Returns the object wrapped by `self` if the wrapper is its only owner,
+// otherwise nullptr.
+//
+template<typename T>
+T* uniquelyOwnedObject(PyObject* self) {
+    auto* inst = reinterpret_cast<py::detail::instance*>(self);
+    py::detail::value_and_holder v_h = inst->get_value_and_holder();
+    if (!v_h.holder_constructed()) {
+        return nullptr;
+    }
+    const std::shared_ptr<T>& holder = v_h.template holder<std::shared_ptr<T>>();
+    return holder.use_count() == 1 ? holder.get() : nullptr;
+}
+
+// To be passed to py::custom_type_setup().
+//
+template<typename T>
+void setupType(PyHeapTypeObject* heapType) {
+    PyTypeObject* type = &heapType->ht_type;
+    type->tp_flags |= Py_TPFLAGS_HAVE_GC;
+    type->tp_traverse = [](PyObject* self, visitproc visit, void* arg) -> int {
+#if PY_VERSION_HEX >= 0x03090000
+        Py_VISIT(Py_TYPE(self)); // instances of heap types own a reference to their type
+#endif
+        if (const T* object = uniquelyOwnedObject<T>(self)) {
+            return traversePython(*object, visit, arg);
+        }
+        return 0;
+    };
+    type->tp_clear = [](PyObject* self) -> int {
+        if (T* object = uniquelyOwnedObject<T>(self)) {
+            clearPython(*object);
+        }
+        return 0;
+    };
+}
+
+} // namespace pygc
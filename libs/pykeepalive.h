@@ -0,0 +1,85 @@
+#pragma once
+
+#include <pybind11/pybind11.h>
+
+// Keep-alive of an owner by the Python wrappers of the objects it owns (e.g.,
+// the tree owning a node), for types whose wrappers do not own their object.
+//
+// This replaces rvp::reference_internal and py::keep_alive, which pybind11
+// implements by appending the owner to a list of "patients" of the returned
+// wrapper, stored in a global hash map of the internals of pybind11, then
+// removed when the wrapper is destroyed. Instead, `setupType<T>` reserves one
+// extra field in the wrappers of T, which stores a strong reference to their
+// owner. It is set once per wrapper, in O(1), and released when the wrapper
+// is destroyed. The owner can be any Python object, not only the `self` of
+// the call returning the object.
+//
+// Usage, possibly combined with other type setups:
+//
+//   py::class_<T>(m, "T", py::custom_type_setup(&pykeepalive::setupType<T>))
+//
+// Then, typically in the type caster of T (see x02/wrap.cpp):
+//
+//   if (!pykeepalive::hasOwner<T>(wrapper)) {
+//       pykeepalive::setOwner<T>(wrapper, owner);
+//   }
+//
+namespace pykeepalive {
+
+namespace py = pybind11;
+
+namespace detail {
+
+// Offset of the owner field in the wrappers of T.
+template<typename T>
+inline Py_ssize_t ownerOffset = 0;
+
+template<typename T>
+inline destructor baseDealloc = nullptr;
+
+template<typename T>
+PyObject*& owner(PyObject* self) {
+    return *reinterpret_cast<PyObject**>(reinterpret_cast<char*>(self) + ownerOffset<T>);
+}
+
+} // namespace detail
+
+// To be passed to py::custom_type_setup(). Appends the owner field to the
+// wrappers of T, which Python zero-initializes, and wraps the tp_dealloc of
+// the type so that it releases the owner after destroying the wrapper.
+//
+// Note: pybind11 calls this before PyType_Ready(), so tp_dealloc may not be
+// inherited from the base type yet.
+//
+template<typename T>
+void setupType(PyHeapTypeObject* heapType) {
+    PyTypeObject* type = &heapType->ht_type;
+    detail::ownerOffset<T> = type->tp_basicsize;
+    type->tp_basicsize += static_cast<Py_ssize_t>(sizeof(PyObject*));
+    detail::baseDealloc<T> = type->tp_dealloc ? type->tp_dealloc : type->tp_base->tp_dealloc;
+    type->tp_dealloc = [](PyObject* self) {
+        PyObject* owner = detail::owner<T>(self);
+        detail::owner<T>(self) = nullptr;
+        detail::baseDealloc<T>(self);
+        Py_XDECREF(owner);
+    };
+}
+
+// Whether the given wrapper of T already keeps alive an owner.
+//
+template<typename T>
+bool hasOwner(py::handle wrapper) {
+    return detail::owner<T>(wrapper.ptr()) != nullptr;
+}
+
+// Makes the given wrapper of T keep alive `owner`, replacing its previous
+// owner, if any.
+//
+template<typename T>
+void setOwner(py::handle wrapper, py::handle owner) {
+    PyObject* oldOwner = detail::owner<T>(wrapper.ptr());
+    detail::owner<T>(wrapper.ptr()) = owner.inc_ref().ptr();
+    Py_XDECREF(oldOwner);
+}
+
+} // namespace pykeepalive
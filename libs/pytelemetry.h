@@ -0,0 +1,47 @@
+#pragma once
+
+#include <initializer_list>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+#include "telemetry.h"
+
+// Python bindings of telemetry.h.
+//
+namespace pytelemetry {
+
+namespace py = pybind11;
+
+// Defines in `m`:
+//
+// - `TELEMETRY_ENABLED`: whether the library was built with telemetry.
+//
+// - `stats()`: returns a dict mapping the name of each of the given types
+//   (e.g., "Node") to a dict of its counters (e.g., "live", "peak"), see
+//   telemetry::TypeStats. All counters are zero if telemetry is disabled.
+//
+inline void defStats(py::module& m, std::initializer_list<telemetry::ObjectType> types) {
+    m.attr("TELEMETRY_ENABLED") = telemetry::snapshot().isEnabled;
+    std::vector<telemetry::ObjectType> typesVector(types);
+    m.def("stats", [typesVector]() {
+        telemetry::Snapshot snapshot = telemetry::snapshot();
+        py::dict res;
+        for (telemetry::ObjectType type : typesVector) {
+            const telemetry::TypeStats& s = snapshot[type];
+            py::dict d;
+            d["live"] = s.live;
+            d["peak"] = s.peak;
+            d["created"] = s.created;
+            d["destroyed"] = s.destroyed;
+            d["liveBytes"] = s.liveBytes;
+            d["allocatedBytes"] = s.allocatedBytes;
+            d["locks"] = s.locks;
+            d["failedLocks"] = s.failedLocks;
+            res[telemetry::name(type)] = d;
+        }
+        return res;
+    });
+}
+
+} // namespace pytelemetry
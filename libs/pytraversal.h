@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+
+#include <pybind11/pybind11.h>
+
+#include "atom.h"
+
+// Helpers for the bulk traversals of the node bindings (see x02/wrap.cpp and
+// x03/wrap.cpp).
+//
+// Iterating over a subtree from Python by calling `child(i)` in a loop goes
+// through the pybind11 dispatcher (argument conversion, overload resolution,
+// return value policy, ...) once per node, which dominates the cost of the
+// traversal itself. Instead, `children()`, `descendants()`, `walk()` and
+// `subtreeNames()` traverse the subtree in C++ and return a single Python list
+// built in one call. The lists are snapshots: modifying the tree afterwards
+// does not affect them.
+//
+// Names are converted to Python strings at most once per call: since names
+// are interned (see atom.h), nodes sharing the same name share the same
+// Python string.
+//
+namespace pytraversal {
+
+namespace py = pybind11;
+
+enum class Order {
+    DepthFirst,
+    BreadthFirst
+};
+
+// Parses the `order` argument of `descendants()`: "dfs" or "bfs". Raises a
+// ValueError otherwise.
+//
+inline Order parseOrder(std::string_view order) {
+    if (order == "dfs") {
+        return Order::DepthFirst;
+    }
+    else if (order == "bfs") {
+        return Order::BreadthFirst;
+    }
+    else {
+        throw py::value_error("order must be \"dfs\" or \"bfs\"");
+    }
+}
+
+// Python strings of the names visited by one call.
+//
+class NameCache {
+public:
+    py::str get(Atom name) {
+        auto [it, inserted] = strings_.try_emplace(name);
+        if (inserted) {
+            std::string_view s = name.str();
+            it->second = py::str(s.data(), s.size());
+        }
+        return it->second;
+    }
+
+private:
+    std::unordered_map<Atom, py::str> strings_;
+};
+
+// Calls `f(node, depth)` for `node` and its descendants in the given order,
+// via `TNode::visitDepthFirst()` or `TNode::visitBreadthFirst()`.
+//
+template<typename TNode, typename F>
+void visit(TNode& node, Order order, F&& f) {
+    if (order == Order::DepthFirst) {
+        node.visitDepthFirst(f);
+    }
+    else {
+        node.visitBreadthFirst(f);
+    }
+}
+
+} // namespace pytraversal
@@ -0,0 +1,294 @@
+#include "snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#if defined(OS_WINDOWS)
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace snapshot {
+
+namespace {
+
+constexpr char magic[8] = {'T', 'R', 'E', 'E', 'S', 'N', 'A', 'P'};
+constexpr uint32_t byteOrderMark = 0x01020304;
+constexpr uint32_t version = 1;
+
+struct Header {
+    char magic[8];
+    uint32_t byteOrderMark;
+    uint32_t version;
+    uint64_t numNodes;
+    uint64_t numNames;
+    uint64_t nameBlobSize;
+};
+
+static_assert(sizeof(Header) % 8 == 0, "sections must start 8-byte aligned");
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+// Offsets of the sections in the file, given the sizes from the header.
+//
+struct Layout {
+    uint64_t parents;
+    uint64_t nameIds;
+    uint64_t nameOffsets;
+    uint64_t nameBlob;
+    uint64_t end;
+
+    Layout(uint64_t numNodes, uint64_t numNames, uint64_t nameBlobSize) {
+        parents = sizeof(Header);
+        nameIds = align8(parents + numNodes * sizeof(uint32_t));
+        nameOffsets = align8(nameIds + numNodes * sizeof(uint32_t));
+        nameBlob = nameOffsets + (numNames + 1) * sizeof(uint64_t);
+        end = nameBlob + nameBlobSize;
+    }
+};
+
+struct FileCloser {
+    void operator()(std::FILE* file) const {
+        std::fclose(file);
+    }
+};
+
+[[noreturn]] void throwInvalid(const std::string& path, const char* reason) {
+    throw std::runtime_error("Invalid snapshot file " + path + ": " + reason);
+}
+
+} // namespace
+
+uint32_t Writer::addNode(uint32_t parent, uint32_t nameKey, std::string_view name) {
+    uint32_t index = static_cast<uint32_t>(parents_.size());
+    if (index == noParent) {
+        throw std::length_error("Too many nodes in the snapshot.");
+    }
+    if (index == 0 ? parent != noParent : parent >= index) {
+        throw std::invalid_argument("The root must be added first, and each node after its parent.");
+    }
+    if (nameKey >= nameIdsByKey_.size()) {
+        nameIdsByKey_.resize(size_t(nameKey) + 1, noName);
+    }
+    uint32_t& nameId = nameIdsByKey_[nameKey];
+    if (nameId == noName) {
+        nameId = static_cast<uint32_t>(names_.size());
+        names_.push_back(name);
+    }
+    parents_.push_back(parent);
+    nameIds_.push_back(nameId);
+    return index;
+}
+
+void Writer::write(const std::string& path) const {
+    std::vector<uint64_t> nameOffsets;
+    nameOffsets.reserve(names_.size() + 1);
+    uint64_t nameBlobSize = 0;
+    for (std::string_view name : names_) {
+        nameOffsets.push_back(nameBlobSize);
+        nameBlobSize += name.size();
+    }
+    nameOffsets.push_back(nameBlobSize);
+
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.byteOrderMark = byteOrderMark;
+    header.version = version;
+    header.numNodes = parents_.size();
+    header.numNames = names_.size();
+    header.nameBlobSize = nameBlobSize;
+    Layout layout(header.numNodes, header.numNames, header.nameBlobSize);
+
+    std::unique_ptr<std::FILE, FileCloser> file(std::fopen(path.c_str(), "wb"));
+    if (!file) {
+        throw std::runtime_error("Cannot open snapshot file for writing: " + path);
+    }
+    uint64_t offset = 0;
+    bool ok = true;
+    auto writeAt = [&](uint64_t sectionOffset, const void* data, size_t size) {
+        static const char padding[8] = {};
+        size_t paddingSize = static_cast<size_t>(sectionOffset - offset);
+        ok = ok && std::fwrite(padding, 1, paddingSize, file.get()) == paddingSize;
+        ok = ok && std::fwrite(data, 1, size, file.get()) == size;
+        offset = sectionOffset + size;
+    };
+    writeAt(0, &header, sizeof(header));
+    writeAt(layout.parents, parents_.data(), parents_.size() * sizeof(uint32_t));
+    writeAt(layout.nameIds, nameIds_.data(), nameIds_.size() * sizeof(uint32_t));
+    writeAt(layout.nameOffsets, nameOffsets.data(), nameOffsets.size() * sizeof(uint64_t));
+    for (std::string_view name : names_) {
+        writeAt(offset, name.data(), name.size());
+    }
+    ok = ok && std::fclose(file.release()) == 0;
+    if (!ok) {
+        throw std::runtime_error("Cannot write snapshot file: " + path);
+    }
+}
+
+Reader::Reader(const std::string& path) {
+    map_(path);
+    try {
+        parse_(path);
+    }
+    catch (...) {
+        unmap_();
+        throw;
+    }
+}
+
+Reader::~Reader() {
+    unmap_();
+}
+
+#if defined(OS_WINDOWS)
+
+void Reader::map_(const std::string& path) {
+    HANDLE file = CreateFileA(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open snapshot file: " + path);
+    }
+    file_ = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        unmap_();
+        throw std::runtime_error("Cannot read snapshot file: " + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    if (size_ < sizeof(Header)) {
+        unmap_();
+        throwInvalid(path, "truncated header");
+    }
+    fileMapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    mapping_ = fileMapping_ ? MapViewOfFile(fileMapping_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!mapping_) {
+        unmap_();
+        throw std::runtime_error("Cannot map snapshot file: " + path);
+    }
+}
+
+void Reader::unmap_() {
+    if (mapping_) {
+        UnmapViewOfFile(mapping_);
+        mapping_ = nullptr;
+    }
+    if (fileMapping_) {
+        CloseHandle(fileMapping_);
+        fileMapping_ = nullptr;
+    }
+    if (file_) {
+        CloseHandle(file_);
+        file_ = nullptr;
+    }
+}
+
+#else
+
+// The file descriptor can be closed right after mapping the file: the
+// mapping stays valid until munmap().
+//
+void Reader::map_(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open snapshot file: " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read snapshot file: " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ < sizeof(Header)) {
+        ::close(fd);
+        throwInvalid(path, "truncated header");
+    }
+    void* mapping = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map snapshot file: " + path);
+    }
+    mapping_ = mapping;
+
+    // Loading reads the whole file, from start to end.
+    ::posix_madvise(mapping_, size_, POSIX_MADV_SEQUENTIAL);
+    ::posix_madvise(mapping_, size_, POSIX_MADV_WILLNEED);
+}
+
+void Reader::unmap_() {
+    if (mapping_) {
+        ::munmap(mapping_, size_);
+        mapping_ = nullptr;
+    }
+}
+
+#endif
+
+void Reader::parse_(const std::string& path) {
+    const char* data = static_cast<const char*>(mapping_);
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        throwInvalid(path, "not a snapshot");
+    }
+    if (header.byteOrderMark != byteOrderMark) {
+        throwInvalid(path, "written with a different byte order");
+    }
+    if (header.version != version) {
+        throwInvalid(path, "unsupported version");
+    }
+    if (header.numNodes == 0 || header.numNodes >= noParent
+        || header.numNames >= UINT32_MAX || header.nameBlobSize > size_) {
+
+        throwInvalid(path, "invalid sizes");
+    }
+    Layout layout(header.numNodes, header.numNames, header.nameBlobSize);
+    if (layout.end > size_) {
+        throwInvalid(path, "truncated sections");
+    }
+    numNodes_ = static_cast<size_t>(header.numNodes);
+    numNames_ = static_cast<size_t>(header.numNames);
+    parents_ = reinterpret_cast<const uint32_t*>(data + layout.parents);
+    nameIds_ = reinterpret_cast<const uint32_t*>(data + layout.nameIds);
+    nameOffsets_ = reinterpret_cast<const uint64_t*>(data + layout.nameOffsets);
+    nameBlob_ = data + layout.nameBlob;
+
+    if (parents_[0] != noParent) {
+        throwInvalid(path, "the first node must be the root");
+    }
+    for (size_t i = 1; i < numNodes_; ++i) {
+        if (parents_[i] >= i) {
+            throwInvalid(path, "a node comes before its parent");
+        }
+    }
+    for (size_t i = 0; i < numNodes_; ++i) {
+        if (nameIds_[i] >= numNames_) {
+            throwInvalid(path, "name id out of range");
+        }
+    }
+    if (nameOffsets_[0] != 0 || nameOffsets_[numNames_] != header.nameBlobSize) {
+        throwInvalid(path, "invalid name offsets");
+    }
+    for (size_t i = 0; i < numNames_; ++i) {
+        if (nameOffsets_[i] > nameOffsets_[i + 1]) {
+            throwInvalid(path, "invalid name offsets");
+        }
+    }
+}
+
+} // namespace snapshot
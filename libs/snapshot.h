@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "common.h"
+
+// Binary snapshot of the names and topology of a tree, used by the
+// `Tree::save()` and `Tree::load()` functions of the experiments.
+//
+// The root is node 0, and each node comes after its parent: the trees of this
+// repository write their nodes in depth-first pre-order. The file consists
+// of a fixed-size header followed by four sections, each starting at a
+// multiple of 8 bytes:
+//
+// - parents:     uint32_t[numNodes], the index of the parent of each node,
+//                or `noParent` for the root
+// - nameIds:     uint32_t[numNodes], the index of the name of each node
+// - nameOffsets: uint64_t[numNames + 1], where name `i` is made of the bytes
+//                [nameOffsets[i], nameOffsets[i + 1]) of the name blob
+// - nameBlob:    char[nameBlobSize], the distinct names, concatenated
+//
+// Integers are stored in the byte order of the machine that wrote the file,
+// and loading a snapshot written with another byte order fails. This makes
+// it possible to use the sections in place once the file is mapped in
+// memory, without decoding them.
+//
+// Note: these are defined in snapshot.cpp, which must be compiled in each
+// experiment library that uses it, like atom.cpp.
+//
+namespace snapshot {
+
+inline constexpr uint32_t noParent = UINT32_MAX;
+
+// Collects the nodes of a tree, then writes them to a file.
+//
+// Names are deduplicated by a key given by the caller, typically the id of
+// the name in an existing table (e.g., an Atom), which is faster than hashing
+// the names themselves. The writer only stores views of the names: they must
+// remain valid until write() returns.
+//
+class API Writer {
+public:
+    // Adds a node and returns its index. The first node must be the root,
+    // whose parent is `noParent`, and each other node must be added after its
+    // parent (e.g., in depth-first pre-order). Throws std::invalid_argument
+    // otherwise.
+    //
+    // `nameKey` must be a small integer such that two nodes have the same key
+    // if and only if they have the same name.
+    //
+    uint32_t addNode(uint32_t parent, uint32_t nameKey, std::string_view name);
+
+    size_t numNodes() const {
+        return parents_.size();
+    }
+
+    // Throws std::runtime_error if the file cannot be written.
+    void write(const std::string& path) const;
+
+private:
+    std::vector<uint32_t> parents_;
+    std::vector<uint32_t> nameIds_;
+    std::vector<std::string_view> names_;
+    std::vector<uint32_t> nameIdsByKey_; // noName if not seen yet
+
+    static constexpr uint32_t noName = UINT32_MAX;
+};
+
+// Read-only view of a snapshot file, which is mapped in memory for the
+// lifetime of the reader.
+//
+// The constructor validates the whole file, so that users can then access
+// the sections without any check: there is at least one node, the root is
+// node 0, `parents()[i] < i` for all other nodes, and all name ids and
+// offsets are in range.
+//
+class API Reader {
+public:
+    // Throws std::runtime_error if the file cannot be read or is not a valid
+    // snapshot.
+    explicit Reader(const std::string& path);
+
+    ~Reader();
+
+    DISABLE_COPY_AND_MOVE(Reader);
+
+    size_t numNodes() const {
+        return numNodes_;
+    }
+
+    const uint32_t* parents() const {
+        return parents_;
+    }
+
+    const uint32_t* nameIds() const {
+        return nameIds_;
+    }
+
+    size_t numNames() const {
+        return numNames_;
+    }
+
+    // The returned string_view is valid for the lifetime of the reader.
+    std::string_view name(uint32_t nameId) const {
+        return std::string_view(
+            nameBlob_ + nameOffsets_[nameId],
+            nameOffsets_[nameId + 1] - nameOffsets_[nameId]);
+    }
+
+private:
+    void* mapping_ = nullptr;
+    size_t size_ = 0;
+#if defined(OS_WINDOWS)
+    void* file_ = nullptr;
+    void* fileMapping_ = nullptr;
+#endif
+
+    size_t numNodes_ = 0;
+    size_t numNames_ = 0;
+    const uint32_t* parents_ = nullptr;
+    const uint32_t* nameIds_ = nullptr;
+    const uint64_t* nameOffsets_ = nullptr;
+    const char* nameBlob_ = nullptr;
+
+    void map_(const std::string& path);
+    void unmap_();
+    void parse_(const std::string& path);
+};
+
+} // namespace snapshot
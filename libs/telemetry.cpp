@@ -0,0 +1,217 @@
+#include "telemetry.h"
+
+#include <algorithm> // max
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace telemetry {
+
+#ifdef TELEMETRY_ENABLED
+
+namespace {
+
+// A thread flushes its net number of created objects to the global live
+// count when it reaches this threshold (in absolute value), or a new peak.
+constexpr int64_t flushThreshold = 64;
+
+struct Counters {
+    std::atomic<uint64_t> created{0};
+    std::atomic<uint64_t> destroyed{0};
+    std::atomic<uint64_t> allocatedBytes{0};
+    std::atomic<uint64_t> freedBytes{0};
+    std::atomic<uint64_t> locks{0};
+    std::atomic<uint64_t> failedLocks{0};
+};
+
+// Only written by its owner thread, so increments don't need to be atomic
+// read-modify-write operations.
+void increment(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void add(Counters& to, const Counters& from) {
+    auto addTo = [](std::atomic<uint64_t>& a, const std::atomic<uint64_t>& b) {
+        a.fetch_add(b.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    };
+    addTo(to.created, from.created);
+    addTo(to.destroyed, from.destroyed);
+    addTo(to.allocatedBytes, from.allocatedBytes);
+    addTo(to.freedBytes, from.freedBytes);
+    addTo(to.locks, from.locks);
+    addTo(to.failedLocks, from.failedLocks);
+}
+
+struct ThreadCounters {
+    Counters types[numObjectTypes];
+    int64_t unflushedLive[numObjectTypes] = {};
+};
+
+// Global state. The counters of each thread are allocated once and never
+// freed: when a thread exits, its counters are recycled for the next new
+// thread, and keep accumulating. Leaked, so that objects destroyed after the
+// destruction of static objects can still be counted.
+//
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> all;
+    std::vector<ThreadCounters*> unused;
+    std::atomic<int64_t> live[numObjectTypes] = {};
+    std::atomic<int64_t> peak[numObjectTypes] = {};
+};
+
+Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+// Returns the new global live count.
+int64_t flushLive(ThreadCounters& t, size_t i) {
+    int64_t delta = t.unflushedLive[i];
+    t.unflushedLive[i] = 0;
+    return registry().live[i].fetch_add(delta, std::memory_order_relaxed) + delta;
+}
+
+ThreadCounters* acquireCounters() {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.unused.empty()) {
+        r.all.push_back(new ThreadCounters());
+        return r.all.back();
+    }
+    ThreadCounters* res = r.unused.back();
+    r.unused.pop_back();
+    return res;
+}
+
+void releaseCounters(ThreadCounters* t) {
+    for (size_t i = 0; i < numObjectTypes; ++i) {
+        flushLive(*t, i);
+    }
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.unused.push_back(t);
+}
+
+// Trivially destructible, so they can still be used while the thread exits.
+thread_local ThreadCounters* currentCounters = nullptr;
+thread_local bool hasExited = false;
+
+struct ThreadExit {
+    ~ThreadExit() {
+        releaseCounters(currentCounters);
+        currentCounters = nullptr;
+        hasExited = true;
+    }
+};
+
+ThreadCounters& threadCounters() {
+    if (!currentCounters) {
+        currentCounters = acquireCounters();
+        if (!hasExited) {
+            thread_local ThreadExit exit;
+            static_cast<void>(exit);
+        }
+        // Otherwise, objects are used while the thread exits (e.g., during
+        // the destruction of static objects), and the counters are never
+        // recycled.
+    }
+    return *currentCounters;
+}
+
+} // namespace
+
+#endif // TELEMETRY_ENABLED
+
+const char* name(ObjectType type) {
+    switch (type) {
+    case ObjectType::Node:
+        return "Node";
+    case ObjectType::Action:
+        return "Action";
+    case ObjectType::Widget:
+        return "Widget";
+    }
+    return "";
+}
+
+Snapshot snapshot() {
+    Snapshot res;
+#ifdef TELEMETRY_ENABLED
+    res.isEnabled = true;
+    Registry& r = registry();
+    Counters total[numObjectTypes];
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (ThreadCounters* t : r.all) {
+            for (size_t i = 0; i < numObjectTypes; ++i) {
+                add(total[i], t->types[i]);
+            }
+        }
+    }
+    for (size_t i = 0; i < numObjectTypes; ++i) {
+        const Counters& c = total[i];
+        TypeStats& stats = res.types[i];
+        stats.created = c.created.load(std::memory_order_relaxed);
+        stats.destroyed = c.destroyed.load(std::memory_order_relaxed);
+        stats.live = static_cast<int64_t>(stats.created - stats.destroyed);
+        stats.peak = std::max(r.peak[i].load(std::memory_order_relaxed), stats.live);
+        stats.allocatedBytes = c.allocatedBytes.load(std::memory_order_relaxed);
+        stats.liveBytes = static_cast<int64_t>(
+            stats.allocatedBytes - c.freedBytes.load(std::memory_order_relaxed));
+        stats.locks = c.locks.load(std::memory_order_relaxed);
+        stats.failedLocks = c.failedLocks.load(std::memory_order_relaxed);
+    }
+#endif
+    return res;
+}
+
+#ifdef TELEMETRY_ENABLED
+
+namespace detail {
+
+void onCreated(ObjectType type, size_t bytes) {
+    size_t i = static_cast<size_t>(type);
+    ThreadCounters& t = threadCounters();
+    Counters& c = t.types[i];
+    increment(c.created);
+    increment(c.allocatedBytes, bytes);
+
+    // Flush if this may be a new peak, as seen from this thread.
+    Registry& r = registry();
+    int64_t unflushed = ++t.unflushedLive[i];
+    int64_t peak = r.peak[i].load(std::memory_order_relaxed);
+    if (unflushed >= flushThreshold
+        || r.live[i].load(std::memory_order_relaxed) + unflushed > peak) {
+
+        int64_t live = flushLive(t, i);
+        while (live > peak
+               && !r.peak[i].compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+void onDestroyed(ObjectType type, size_t bytes) {
+    size_t i = static_cast<size_t>(type);
+    ThreadCounters& t = threadCounters();
+    Counters& c = t.types[i];
+    increment(c.destroyed);
+    increment(c.freedBytes, bytes);
+    if (--t.unflushedLive[i] <= -flushThreshold) {
+        flushLive(t, i);
+    }
+}
+
+void onLocked(ObjectType type, bool success) {
+    Counters& c = threadCounters().types[static_cast<size_t>(type)];
+    increment(c.locks);
+    if (!success) {
+        increment(c.failedLocks);
+    }
+}
+
+} // namespace detail
+
+#endif // TELEMETRY_ENABLED
+
+} // namespace telemetry
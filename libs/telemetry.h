@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "common.h"
+
+// Aggregate counters of live objects and weak pointer locks, for watching
+// leaks and refcount hot spots in running programs.
+//
+// This is enabled by building with `-DTELEMETRY=ON`, which defines
+// TELEMETRY_ENABLED. Otherwise, the macros below expand to nothing and
+// `telemetry::lock()` is just `std::weak_ptr::lock()`, so the instrumentation
+// is compiled out completely. The snapshot API is always available, but then
+// returns zeros.
+//
+// An instrumented class T must:
+//
+// - declare `static constexpr telemetry::ObjectType objectType`,
+// - call TELEMETRY_CREATED(T) in each of its constructors,
+// - call TELEMETRY_DESTROYED(T) in its destructor,
+//
+// and its weak pointers should be locked with `telemetry::lock()`.
+//
+// All counters are per thread, only written by their own thread with relaxed
+// atomic operations, and summed by snapshot(). The only shared counters are
+// the global live counts used to track peaks, which a thread only updates
+// when it reaches a new peak, or when it has created or destroyed many
+// objects since its last update.
+//
+// Note: the counters are defined in telemetry.cpp, which must be compiled in
+// each experiment library that uses them, like atom.cpp.
+//
+namespace telemetry {
+
+enum class ObjectType : uint8_t {
+    Node,
+    Action,
+    Widget
+};
+
+inline constexpr size_t numObjectTypes = 3;
+
+// Returns "Node", "Action", or "Widget".
+API const char* name(ObjectType type);
+
+struct TypeStats {
+    // Number of live objects, and the largest number of live objects so far.
+    //
+    // The peak is exact in a single-threaded program. Otherwise, it may be
+    // underestimated by up to 64 objects per thread.
+    //
+    int64_t live = 0;
+    int64_t peak = 0;
+
+    uint64_t created = 0;
+    uint64_t destroyed = 0;
+
+    // Size of the live objects, and of all the objects created so far, as
+    // given by sizeof. This doesn't include the memory they own (e.g.,
+    // children vectors) or the control blocks of shared pointers.
+    //
+    int64_t liveBytes = 0;
+    uint64_t allocatedBytes = 0;
+
+    // Number of calls to `telemetry::lock()`, and how many of them returned
+    // null because the object was already destroyed.
+    //
+    uint64_t locks = 0;
+    uint64_t failedLocks = 0;
+};
+
+struct Snapshot {
+    bool isEnabled = false;
+    TypeStats types[numObjectTypes];
+
+    const TypeStats& operator[](ObjectType type) const {
+        return types[static_cast<size_t>(type)];
+    }
+};
+
+// Sums the counters of all the threads, including the ones that have exited.
+// The counters of other threads may be concurrently modified, so the result
+// may not be consistent across types or counters (e.g., `live` may not be
+// equal to `created - destroyed` at any single point in time).
+//
+API Snapshot snapshot();
+
+namespace detail {
+
+API void onCreated(ObjectType type, size_t bytes);
+API void onDestroyed(ObjectType type, size_t bytes);
+API void onLocked(ObjectType type, bool success);
+
+} // namespace detail
+
+template<typename T>
+std::shared_ptr<T> lock(const std::weak_ptr<T>& p) {
+#ifdef TELEMETRY_ENABLED
+    std::shared_ptr<T> res = p.lock();
+    detail::onLocked(T::objectType, res != nullptr);
+    return res;
+#else
+    return p.lock();
+#endif
+}
+
+} // namespace telemetry
+
+#ifdef TELEMETRY_ENABLED
+#    define TELEMETRY_CREATED(T) ::telemetry::detail::onCreated(T::objectType, sizeof(T))
+#    define TELEMETRY_DESTROYED(T) ::telemetry::detail::onDestroyed(T::objectType, sizeof(T))
+#else
+#    define TELEMETRY_CREATED(T) static_cast<void>(0)
+#    define TELEMETRY_DESTROYED(T) static_cast<void>(0)
+#endif
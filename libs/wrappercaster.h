@@ -0,0 +1,191 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+
+#include <pybind11/pybind11.h>
+
+#include "wrapperslot.h"
+
+// pybind11 type casters returning the existing Python wrapper of an object
+// from its WrapperSlot (see wrapperslot.h), instead of looking it up in the
+// registered instances of pybind11, which is a global hash map keyed by
+// address. This matters for bindings returning nodes in hot loops, e.g.,
+// `child()` or `parent`.
+//
+// A wrapped class T must provide:
+//
+// - `void* wrapper() const`: the content of its slot
+// - `void setWrapper(void* wrapper) const`: sets its slot
+//
+// Usage, in the bindings, before any use of T or of its holder:
+//
+//   WRAPPER_SLOT_CASTER(T);                 // for T, T&, and T*
+//   WRAPPER_SLOT_HOLDER_CASTER(T);          // for std::shared_ptr<T>
+//
+//   py::class_<T>(m, "T", py::custom_type_setup(&wrapperslot::setupType<T>))
+//
+// The type setup clears the slot when the wrapper is destroyed, and installs
+// the hook detaching the wrapper when the object is destroyed first.
+//
+// Note that, like pybind11, an existing wrapper is returned regardless of the
+// return value policy, so the policy is only applied when the wrapper is
+// created (including keep-alive for rvp::reference_internal).
+//
+namespace wrapperslot {
+
+namespace py = pybind11;
+
+// Whether `wrapper` is the wrapper of `object` itself, rather than of a copy.
+//
+inline bool wraps(py::handle wrapper, const void* object) {
+    auto* inst = reinterpret_cast<py::detail::instance*>(wrapper.ptr());
+    return inst->get_value_and_holder().value_ptr() == object;
+}
+
+// Hook called when an object is destroyed while it has a wrapper. This
+// detaches the wrapper from the object: it is deregistered from pybind11, and
+// its value pointer is reset, so that using it raises an exception instead of
+// accessing a destroyed object, and destroying it does not clear the slot of
+// a destroyed object.
+//
+// The object may be destroyed in a thread that does not hold the GIL, while
+// the wrapper is concurrently destroyed (clearing the slot) in another
+// thread, so we check the slot again once the GIL is acquired.
+//
+inline bool onObjectDestroyed(WrapperSlot& slot) {
+    py::gil_scoped_acquire gil;
+    void* wrapper = slot.get();
+    if (!wrapper) {
+        return false;
+    }
+    slot.set(nullptr);
+    auto* inst = static_cast<py::detail::instance*>(wrapper);
+    py::detail::value_and_holder v_h = inst->get_value_and_holder();
+    if (v_h.instance_registered()) {
+        py::detail::deregister_instance(inst, v_h.value_ptr(), v_h.type);
+        v_h.set_instance_registered(false);
+    }
+    v_h.value_ptr() = nullptr;
+    return true;
+}
+
+// To be passed to py::custom_type_setup(). Wraps the tp_dealloc of the type so
+// that it clears the slot of the object, if still alive, before destroying the
+// wrapper.
+//
+// Note: pybind11 calls this before PyType_Ready(), so tp_dealloc may not be
+// inherited from the base type yet.
+//
+template<typename T>
+void setupType(PyHeapTypeObject* heapType) {
+    static destructor baseDealloc = nullptr;
+    PyTypeObject* type = &heapType->ht_type;
+    baseDealloc = type->tp_dealloc ? type->tp_dealloc : type->tp_base->tp_dealloc;
+    type->tp_dealloc = [](PyObject* self) {
+        auto* inst = reinterpret_cast<py::detail::instance*>(self);
+        if (void* value = inst->get_value_and_holder().value_ptr()) {
+            const T* object = static_cast<const T*>(value);
+            if (object->wrapper() == self) {
+                object->setWrapper(nullptr);
+            }
+        }
+        baseDealloc(self);
+    };
+    WrapperSlot::setDestroyedHook(&onObjectDestroyed);
+}
+
+// Caster for T, T&, and T*.
+//
+// Loading a wrapper detached by onObjectDestroyed() raises a RuntimeError.
+// Otherwise, pybind11 would take its null value pointer for an instance whose
+// __init__ was not called yet, and lazily allocate an uninitialized object.
+//
+template<typename T>
+class Caster : public py::detail::type_caster_base<T> {
+    using Base = py::detail::type_caster_base<T>;
+
+public:
+    using Base::cast;
+
+    bool load(py::handle src, bool convert) {
+        if (this->typeinfo && PyObject_TypeCheck(src.ptr(), this->typeinfo->type)) {
+            auto* inst = reinterpret_cast<py::detail::instance*>(src.ptr());
+            py::detail::value_and_holder v_h = inst->get_value_and_holder(this->typeinfo, false);
+            if (v_h && !v_h.value_ptr()) {
+                throw std::runtime_error(
+                    "Cannot use the wrapper: its C++ object has been destroyed.");
+            }
+        }
+        return Base::load(src, convert);
+    }
+
+    static py::handle cast(const T* src, py::return_value_policy policy, py::handle parent) {
+        if (!src) {
+            return py::none().release();
+        }
+        if (void* wrapper = src->wrapper()) {
+            return py::handle(static_cast<PyObject*>(wrapper)).inc_ref();
+        }
+        return remember(src, Base::cast(src, policy, parent));
+    }
+
+    static py::handle cast(const T& src, py::return_value_policy policy, py::handle parent) {
+        if (void* wrapper = src.wrapper()) {
+            return py::handle(static_cast<PyObject*>(wrapper)).inc_ref();
+        }
+        return remember(&src, Base::cast(src, policy, parent));
+    }
+
+    static py::handle remember(const T* src, py::handle wrapper) {
+        if (wrapper && wraps(wrapper, src)) {
+            src->setWrapper(wrapper.ptr());
+        }
+        return wrapper;
+    }
+};
+
+// Caster for std::shared_ptr<T>, when T is bound with this holder type.
+//
+template<typename T>
+class HolderCaster : public py::detail::copyable_holder_caster<T, std::shared_ptr<T>> {
+    using Base = py::detail::copyable_holder_caster<T, std::shared_ptr<T>>;
+
+public:
+    static py::handle cast(
+        const std::shared_ptr<T>& src,
+        py::return_value_policy policy,
+        py::handle parent) {
+
+        if (src) {
+            if (void* wrapper = src->wrapper()) {
+                return py::handle(static_cast<PyObject*>(wrapper)).inc_ref();
+            }
+        }
+        py::handle wrapper = Base::cast(src, policy, parent);
+        if (src && wrapper && wraps(wrapper, src.get())) {
+            src->setWrapper(wrapper.ptr());
+        }
+        return wrapper;
+    }
+};
+
+} // namespace wrapperslot
+
+#define WRAPPER_SLOT_CASTER(T)                                                           \
+    namespace pybind11 {                                                                 \
+    namespace detail {                                                                   \
+    template<>                                                                           \
+    class type_caster<T> : public ::wrapperslot::Caster<T> {};                           \
+    }                                                                                    \
+    }                                                                                    \
+    static_assert(true, "")
+
+#define WRAPPER_SLOT_HOLDER_CASTER(T)                                                    \
+    namespace pybind11 {                                                                 \
+    namespace detail {                                                                   \
+    template<>                                                                           \
+    class type_caster<std::shared_ptr<T>> : public ::wrapperslot::HolderCaster<T> {};    \
+    }                                                                                    \
+    }                                                                                    \
+    static_assert(true, "")
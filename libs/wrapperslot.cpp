@@ -0,0 +1,21 @@
+#include "wrapperslot.h"
+
+namespace {
+
+std::atomic<WrapperSlot::DestroyedHook> destroyedHook{nullptr};
+
+} // namespace
+
+void WrapperSlot::setDestroyedHook(DestroyedHook hook) {
+    destroyedHook.store(hook);
+}
+
+// Without hook (i.e., no bindings loaded), nobody else can read the slot.
+//
+bool WrapperSlot::notifyDestroyed_() {
+    if (DestroyedHook hook = destroyedHook.load()) {
+        return hook(*this);
+    }
+    set(nullptr);
+    return true;
+}
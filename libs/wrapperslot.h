@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+
+#include "common.h"
+
+// A WrapperSlot is a back-pointer from a C++ object to its Python wrapper, if
+// any, so that the bindings can return the existing wrapper of an object in
+// O(1), instead of looking it up by address in the global hash map of
+// registered instances of pybind11. See wrappercaster.h for the pybind11 side.
+//
+// The slot does not own the wrapper (that would be a reference cycle). The
+// bindings clear it when the wrapper is destroyed. If instead the object is
+// destroyed first, which is possible when the wrapper does not own it (e.g.,
+// nodes in x02), the slot calls the hook set via setDestroyedHook(), so that
+// the bindings can detach the wrapper from the object.
+//
+// The slot is atomic so that an object can be destroyed in a thread that does
+// not hold the GIL (e.g., the reclaimer thread of x02) while the bindings
+// read the slot. The hook is responsible for synchronizing with them.
+//
+// Copying an object does not copy its slot: the copy has no wrapper yet.
+//
+// Note: the hook is stored in wrapperslot.cpp, which must be compiled in each
+// experiment library that uses it, like atom.cpp.
+//
+class API WrapperSlot {
+public:
+    // Called with the slot of an object being destroyed while it has a
+    // wrapper. Must clear the slot, and return whether the object still had a
+    // wrapper after synchronizing with the bindings.
+    //
+    using DestroyedHook = bool (*)(WrapperSlot& slot);
+
+    WrapperSlot() = default;
+
+    WrapperSlot(const WrapperSlot&) noexcept {
+    }
+
+    WrapperSlot& operator=(const WrapperSlot&) noexcept {
+        return *this;
+    }
+
+    ~WrapperSlot() {
+        notifyDestroyed();
+    }
+
+    // The wrapper of the object, or nullptr if it has none.
+    void* get() const {
+        return wrapper_.load(std::memory_order_relaxed);
+    }
+
+    void set(void* wrapper) {
+        wrapper_.store(wrapper, std::memory_order_relaxed);
+    }
+
+    // Calls the hook if the object has a wrapper, and returns whether it had
+    // one. Called by the destructor, but objects that keep track of their
+    // wrapped instances may call it earlier (see x02).
+    //
+    bool notifyDestroyed() {
+        return get() && notifyDestroyed_();
+    }
+
+    static void setDestroyedHook(DestroyedHook hook);
+
+private:
+    std::atomic<void*> wrapper_{nullptr};
+
+    bool notifyDestroyed_();
+};
@@ -0,0 +1,297 @@
+// Build-and-destroy benchmark comparing the arena owned by the tree with a
+// plain new/delete per node, child vector and name, and measuring the latency
+// of clearChildren() with deferred reclamation, both on the root (which
+// releases the arena in bulk) and on another node.
+//
+// Also measures the memory used per node, with names drawn from a small set
+// of distinct names, as is typical in practice, the time to build the same
+// tree with Tree::buildFrom(), and the time to save and load a snapshot of the
+// tree (written to the current directory).
+//
+// Finally, runs the standardized workloads of ../benchmark.h, except weakLock
+// since there are no weak pointers to nodes in this experiment.
+//
+// Usage: x02_bench [numNodes] [branchingFactor] [--json path]
+//
+// Use a branching factor of 1 to build a deep tree (a linked list).
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../benchmark.h"
+#include "tree.h"
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Names of the nodes: a few thousand distinct names, long enough not to fit
+// in the small string optimization buffer.
+//
+const std::vector<std::string>& names() {
+    static std::vector<std::string> res = []() {
+        std::vector<std::string> names;
+        for (int i = 0; i < 2000; ++i) {
+            names.push_back("transform_group_" + std::to_string(i));
+        }
+        return names;
+    }();
+    return res;
+}
+
+// Builds a subtree of `numNodes` nodes (including `root`) in breadth-first
+// order, where each node has `branchingFactor` children, except possibly in
+// the last level.
+//
+void build(Node& root, size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    std::vector<Node*> queue;
+    queue.reserve(numNodes);
+    queue.push_back(&root);
+    size_t i = 0;
+    while (queue.size() < numNodes) {
+        Node* parent = queue[i++];
+        for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+            const std::string& name = names_[queue.size() % names_.size()];
+            queue.push_back(&parent->createChild(name));
+        }
+    }
+}
+
+void build(Tree& tree, size_t numNodes, size_t branchingFactor) {
+    build(tree.root(), numNodes, branchingFactor);
+}
+
+// Forwards to another memory resource, keeping track of the number of bytes
+// currently allocated.
+//
+class CountingResource : public std::pmr::memory_resource {
+public:
+    explicit CountingResource(std::pmr::memory_resource* upstream)
+        : upstream_(upstream) {
+    }
+
+    size_t bytes() const {
+        return bytes_;
+    }
+
+private:
+    std::pmr::memory_resource* upstream_;
+    size_t bytes_ = 0;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        bytes_ += bytes;
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        bytes_ -= bytes;
+        upstream_->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+void measureMemory(size_t numNodes, size_t branchingFactor) {
+    CountingResource counting(std::pmr::new_delete_resource());
+    {
+        Tree tree(&counting);
+        build(tree, numNodes, branchingFactor);
+        std::cout << "new/delete    : " << double(counting.bytes()) / numNodes
+                  << " bytes/node (requested)" << std::endl;
+    }
+    {
+        std::pmr::unsynchronized_pool_resource arena(&counting);
+        Tree tree(&arena);
+        build(tree, numNodes, branchingFactor);
+        std::cout << "arena         : " << double(counting.bytes()) / numNodes
+                  << " bytes/node (including arena overhead)" << std::endl;
+    }
+}
+
+enum class Mode {
+    NewDelete,
+    Arena,
+    ArenaDeferred,
+};
+
+void run(const char* label, size_t numNodes, size_t branchingFactor, Mode mode) {
+    std::optional<Tree> tree;
+    auto start = Clock::now();
+    if (mode == Mode::NewDelete) {
+        tree.emplace(std::pmr::new_delete_resource());
+    }
+    else {
+        tree.emplace();
+    }
+    tree->setDeferredReclamation(mode == Mode::ArenaDeferred);
+    build(*tree, numNodes, branchingFactor);
+    double buildTime = secondsSince(start);
+
+    start = Clock::now();
+    tree->root().clearChildren();
+    double clearTime = secondsSince(start);
+
+    // Clearing a node other than the root never releases the arena in bulk.
+    Node& subtree = tree->root().createChild("subtree");
+    build(subtree, numNodes, branchingFactor);
+    start = Clock::now();
+    subtree.clearChildren();
+    double clearSubtreeTime = secondsSince(start);
+
+    build(*tree, numNodes, branchingFactor);
+    start = Clock::now();
+    tree.reset();
+    double destroyTime = secondsSince(start);
+
+    std::cout << label << ": build " << buildTime << "s, clearChildren " << clearTime
+              << "s (root), " << clearSubtreeTime << "s (subtree), ~Tree " << destroyTime
+              << "s" << std::endl;
+}
+
+// Measures the time to build a tree with one createChild() call per node, and
+// with a single call to Tree::buildFrom(), in the same breadth-first order. In
+// Python, the binding overhead of each createChild() call comes on top of the
+// former, see bench.py.
+//
+void measureBuildFrom(size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    std::vector<int64_t> parents;
+    std::vector<std::string_view> names;
+    parents.reserve(numNodes);
+    names.reserve(numNodes);
+    for (size_t i = 1; i < numNodes; ++i) {
+        parents.push_back(static_cast<int64_t>((i - 1) / branchingFactor) - 1);
+        names.push_back(names_[i % names_.size()]);
+    }
+
+    double loopTime;
+    {
+        Tree tree;
+        auto start = Clock::now();
+        build(tree, numNodes, branchingFactor);
+        loopTime = secondsSince(start);
+    }
+    Tree tree;
+    auto start = Clock::now();
+    tree.buildFrom(parents, names);
+    double buildFromTime = secondsSince(start);
+
+    std::cout << "buildFrom     : createChild loop " << loopTime << "s, buildFrom "
+              << buildFromTime << "s" << std::endl;
+}
+
+// Measures the time to save a tree to a snapshot file, then to load it, which
+// is the cold-start time of a process whose tree is stored in a snapshot.
+// Note that the file is likely still in the page cache when loading it.
+//
+void measureSnapshot(size_t numNodes, size_t branchingFactor, const std::string& path) {
+    Tree tree;
+    auto start = Clock::now();
+    build(tree, numNodes, branchingFactor);
+    double buildTime = secondsSince(start);
+
+    start = Clock::now();
+    tree.save(path);
+    double saveTime = secondsSince(start);
+
+    start = Clock::now();
+    std::unique_ptr<Tree> loaded = Tree::load(path);
+    double loadTime = secondsSince(start);
+    std::remove(path.c_str());
+
+    std::cout << "snapshot      : build " << buildTime << "s, save " << saveTime
+              << "s, load " << loadTime << "s" << std::endl;
+}
+
+// Returns the number of visited nodes.
+size_t dfs(const Node& root) {
+    size_t count = 0;
+    std::vector<const Node*> stack;
+    stack.push_back(&root);
+    while (!stack.empty()) {
+        const Node* node = stack.back();
+        stack.pop_back();
+        ++count;
+        for (size_t i = node->numChildren(); i-- > 0;) {
+            stack.push_back(&node->child(i));
+        }
+    }
+    return count;
+}
+
+void runWorkloads(benchmark::Report& report, size_t numNodes, size_t branchingFactor) {
+    using benchmark::Clock;
+    using benchmark::nanosecondsSince;
+    benchmark::Params params = {{"numNodes", numNodes}, {"branchingFactor", branchingFactor}};
+
+    std::optional<Tree> tree;
+    auto start = Clock::now();
+    tree.emplace();
+    build(*tree, numNodes, branchingFactor);
+    report.add("build", params, nanosecondsSince(start) / numNodes, "ns/node");
+
+    Node& root = tree->root();
+    start = Clock::now();
+    size_t count = dfs(root);
+    report.add("dfs", params, nanosecondsSince(start) / count, "ns/node");
+
+    benchmark::Random random;
+    size_t numAccesses = numNodes;
+    const Node* node = &root;
+    start = Clock::now();
+    for (size_t i = 0; i < numAccesses; ++i) {
+        size_t n = node->numChildren();
+        node = n > 0 ? &node->child(random(n)) : &root;
+    }
+    benchmark::doNotOptimize(node);
+    report.add("randomChildAccess", params, nanosecondsSince(start) / numAccesses, "ns/access");
+
+    start = Clock::now();
+    root.clearChildren();
+    report.add("clearChildren", params, nanosecondsSince(start) / numNodes, "ns/node");
+
+    build(*tree, numNodes, branchingFactor);
+    start = Clock::now();
+    tree.reset();
+    report.add("destroy", params, nanosecondsSince(start) / numNodes, "ns/node");
+}
+
+int main(int argc, char* argv[]) {
+    benchmark::Args args(argc, argv);
+    size_t numNodes = args.get(0, 1000000);
+    size_t branchingFactor = args.get(1, 8);
+    if (branchingFactor == 0) {
+        std::cerr << "The branching factor must be at least 1" << std::endl;
+        return 1;
+    }
+
+    std::cout << numNodes << " nodes, branching factor " << branchingFactor << std::endl;
+    run("new/delete    ", numNodes, branchingFactor, Mode::NewDelete);
+    run("arena         ", numNodes, branchingFactor, Mode::Arena);
+    run("arena+deferred", numNodes, branchingFactor, Mode::ArenaDeferred);
+    measureMemory(numNodes, branchingFactor);
+    measureBuildFrom(numNodes, branchingFactor);
+    measureSnapshot(numNodes, branchingFactor, "x02_bench.snap");
+
+    std::cout << "Standard workloads:" << std::endl;
+    benchmark::Report report("x02");
+    runWorkloads(report, numNodes, branchingFactor);
+    if (!report.save(args.jsonPath)) {
+        std::cerr << "Cannot write " << args.jsonPath << std::endl;
+        return 1;
+    }
+}
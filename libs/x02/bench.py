@@ -0,0 +1,116 @@
+#!/usr/bin/python3
+
+# Compares building a tree from Python with one createChild() call per node,
+# and with a single Tree.buildFrom() call, for x02 and x03.
+#
+# Also measures the time and memory of `numCalls` calls to `child()` in x02,
+# returning nodes with or without existing wrapper, where memory should stay
+# flat (see "Keep-alive" in README.md).
+#
+# Usage: bench.py [numNodes] [branchingFactor] [numCalls]
+#
+# Requires the x02 and x03 modules to be in the PYTHONPATH. If numpy is
+# available, also measures buildFrom() with a numpy array of parents.
+#
+# Each module is measured in its own Python process, since both register a
+# `Node` and a `Tree` type with pybind11, which cannot be imported in the same
+# process.
+
+import array
+import importlib
+import os
+import subprocess
+import sys
+import time
+
+def makeArrays(numNodes, branchingFactor):
+    # Breadth-first order: the parent of node i is (i - 1) // branchingFactor,
+    # and the first node is a child of the root.
+    parents = [-1] + [(i - 1) // branchingFactor for i in range(1, numNodes)]
+    names = ["node_" + str(i % 2000) for i in range(numNodes)]
+    return parents, names
+
+def buildLoop(tree, parents, names):
+    root = tree.root
+    nodes = []
+    for parent, name in zip(parents, names):
+        nodes.append((root if parent == -1 else nodes[parent]).createChild(name))
+
+# Resident memory of the process in bytes, or None if unknown.
+def currentRss():
+    try:
+        with open("/proc/self/statm") as f:
+            return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+    except (OSError, ValueError, AttributeError):
+        return None
+
+def timeit(label, f):
+    start = time.perf_counter()
+    f()
+    elapsed = time.perf_counter() - start
+    print(f"  {label}: {elapsed:.3f}s")
+    return elapsed
+
+def main():
+    if len(sys.argv) > 1 and sys.argv[1] == "--module":
+        benchModule(sys.argv[2], *[int(arg) for arg in sys.argv[3:]])
+        return
+    numNodes = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    branchingFactor = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+    numCalls = int(sys.argv[3]) if len(sys.argv) > 3 else 10000000
+    print(f"{numNodes} nodes, branching factor {branchingFactor}", flush=True)
+    args = [str(numNodes), str(branchingFactor), str(numCalls)]
+    for name in ["x02", "x03"]:
+        subprocess.run([sys.executable, __file__, "--module", name] + args, check=True)
+
+def benchModule(name, numNodes, branchingFactor, numCalls):
+    module = importlib.import_module(name)
+    parents, names = makeArrays(numNodes, branchingFactor)
+    buffers = [("list", parents), ("array.array", array.array("q", parents))]
+    try:
+        import numpy
+        buffers.append(("numpy", numpy.array(parents, dtype=numpy.int64)))
+    except ImportError:
+        pass
+    print(f"{name}:")
+    tree = module.Tree()
+    loop = timeit("createChild loop", lambda: buildLoop(tree, parents, names))
+    tree.root.clearChildren()
+    for label, p in buffers:
+        tree = module.Tree()
+        t = timeit(f"buildFrom ({label})", lambda: tree.buildFrom(p, names))
+        print(f"    speedup: {loop / t:.1f}x")
+        tree.root.clearChildren()
+    if name == "x02":
+        benchChild(module, numCalls)
+
+# Without holding the returned nodes, each call creates a new wrapper, which
+# is destroyed before the next call. Holding them, each call returns the
+# existing wrapper. Fails if the memory of the process grows by more than
+# `maxGrowth` bytes during the calls, since nothing should be leaked per call.
+#
+def benchChild(module, numCalls, numChildren=1000, maxGrowth=4000000):
+    print(f"x02 child() ({numCalls} calls, {numChildren} children):")
+    tree = module.Tree()
+    root = tree.root
+    for i in range(numChildren):
+        root.createChild("node")
+    def callChild(n):
+        for i in range(n):
+            root.child(i % numChildren)
+    callChild(numChildren)  # warm up
+    for label in ["new wrappers", "existing wrappers"]:
+        if label == "existing wrappers":
+            children = root.children()
+        before = currentRss()
+        t = timeit(label, lambda: callChild(numCalls))
+        after = currentRss()
+        print(f"    {t / numCalls * 1e9:.0f} ns/call", end="")
+        if before is not None:
+            print(f", memory growth: {(after - before) / 1e6:.1f} MB", end="")
+        print()
+        if before is not None and after - before > maxGrowth:
+            sys.exit(f"child() leaks memory with {label}")
+
+if __name__ == '__main__':
+    main()
@@ -1,5 +1,9 @@
 #!/usr/bin/python3
 
+import array
+import os
+import sys
+import tempfile
 import unittest
 from x02 import Node, Tree
 
@@ -12,6 +16,13 @@ def getNodeOfNewTree():
     node = tree.root.createChild("node1")
     return node
 
+# The returned parent has no wrapper yet, and neither has any of its
+# ancestors once the function returns.
+def getParentOfNodeOfNewTree():
+    tree = Tree()
+    node = tree.root.createChild("node1").createChild("node2")
+    return node.parent
+
 class TestTree(unittest.TestCase):
 
     def testConstructor(self):
@@ -22,29 +33,264 @@ class TestTree(unittest.TestCase):
         node = getRootOfNewTree()
         self.assertEqual(node.name, "root")
 
-    # This test passes but it's unclear whether this behavior is guaranteed?
     def testKeepAliveNodeToTree(self):
         node = getNodeOfNewTree()
         self.assertEqual(node.name, "node1")
 
-    # The following test is UB.
-    #
-    # When uncommenting it, not only the test may fail, possible output:
-    #
-    # 1/1 Test #2: x02_test.py ......................***Exception: SegFault  0.03 sec
-    #
-    # But in some cases, we've seen it fail less "violently", such as:
+    # With reference_internal, the parent was returned without keeping
+    # anything alive, so the tree was destroyed and the node detached.
+    def testKeepAliveParentToTree(self):
+        node = getParentOfNodeOfNewTree()
+        self.assertEqual(node.name, "node1")
+        self.assertEqual(node.child(0).name, "node2")
+
+    # Each wrapper holds one reference to the tree, regardless of how many
+    # times it is returned.
+    def testKeepAliveDoesNotGrow(self):
+        tree = Tree()
+        root = tree.root
+        for i in range(10):
+            root.createChild("node")
+        refcount = sys.getrefcount(tree)
+        for i in range(1000):
+            root.child(i % 10)
+        self.assertEqual(sys.getrefcount(tree), refcount)
+        children = root.children()
+        for i in range(1000):
+            root.child(i % 10)
+        self.assertEqual(sys.getrefcount(tree), refcount + 10)
+        del children
+        self.assertEqual(sys.getrefcount(tree), refcount)
+
+    def testClearChildren(self):
+        tree = Tree()
+        root = tree.root
+        for i in range(100):
+            root.createChild("node").createChild("grandchild")
+        self.assertEqual(root.numChildren, 100)
+        root.clearChildren()
+        self.assertEqual(root.numChildren, 0)
+        node = root.createChild("node1")
+        self.assertEqual(node.name, "node1")
+
+    def testDeferredReclamation(self):
+        tree = Tree()
+        self.assertFalse(tree.deferredReclamation)
+        tree.deferredReclamation = True
+        self.assertTrue(tree.deferredReclamation)
+        root = tree.root
+        for i in range(10):
+            for j in range(100):
+                root.createChild("node").createChild("grandchild")
+            root.clearChildren()
+            self.assertEqual(root.numChildren, 0)
+        node = root.createChild("node1")
+        self.assertEqual(node.name, "node1")
+        tree.deferredReclamation = False
+        self.assertFalse(tree.deferredReclamation)
+        self.assertEqual(root.numChildren, 1)
+
+    # ~Node() and clearChildren() are iterative, so destroying a deep chain
+    # does not overflow the stack.
     #
-    # "AssertionError: '' != 'node1')
+    def testClearDeepChain(self):
+        n = 1000000
+        for deferred in [False, True]:
+            tree = Tree()
+            tree.deferredReclamation = deferred
+            root = tree.buildFrom(range(-1, n - 1), ["n"] * n)
+            self.assertEqual(root.child(0).child(0).name, "n")
+            root.clearChildren()
+            self.assertEqual(root.numChildren, 0)
+            tree.deferredReclamation = False
+
+    def testFindChild(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        b = root.createChild("b")
+        self.assertEqual(root.findChild("a"), a)
+        self.assertEqual(root.findChild("b"), b)
+        self.assertIsNone(root.findChild("c"))
+        self.assertIsNone(root.findChild("neverUsedName"))
+
+    def testFindChildLarge(self):
+        tree = Tree()
+        root = tree.root
+        nodes = [root.createChild("node" + str(i % 50)) for i in range(100)]
+        self.assertEqual(root.findChild("node3"), nodes[3])
+        self.assertIsNone(root.findChild("node50"))
+        nodes[3].name = "renamed"
+        self.assertEqual(root.findChild("node3"), nodes[53])
+        self.assertEqual(root.findChild("renamed"), nodes[3])
+        nodes[1].name = "renamed"
+        self.assertEqual(root.findChild("renamed"), nodes[1])
+        last = root.createChild("last")
+        self.assertEqual(root.findChild("last"), last)
+        root.clearChildren()
+        self.assertIsNone(root.findChild("node3"))
+
+    def testFind(self):
+        tree = Tree()
+        a = tree.root.createChild("a")
+        b = a.createChild("b")
+        self.assertEqual(tree.find(""), tree.root)
+        self.assertEqual(tree.find("a"), a)
+        self.assertEqual(tree.find("a/b"), b)
+        self.assertEqual(tree.find("/a//b/"), b)
+        self.assertIsNone(tree.find("a/c"))
+        self.assertIsNone(tree.find("b"))
+
+    def testTraversals(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        b = root.createChild("b")
+        a1 = a.createChild("a1")
+        a2 = a.createChild("a2")
+        b1 = b.createChild("b1")
+        self.assertEqual(root.children(), [a, b])
+        self.assertEqual(a1.children(), [])
+        self.assertEqual(root.descendants(), [a, a1, a2, b, b1])
+        self.assertEqual(root.descendants(order="dfs"), [a, a1, a2, b, b1])
+        self.assertEqual(root.descendants(order="bfs"), [a, b, a1, a2, b1])
+        self.assertEqual(a.descendants(), [a1, a2])
+        with self.assertRaises(ValueError):
+            root.descendants(order="xyz")
+        self.assertEqual(
+            root.walk(),
+            [(0, "root"), (1, "a"), (2, "a1"), (2, "a2"), (1, "b"), (2, "b1")])
+        self.assertEqual(b.walk(), [(0, "b"), (1, "b1")])
+        self.assertEqual(root.subtreeNames(), ["root", "a", "a1", "a2", "b", "b1"])
+
+    def testTraversalsAreSnapshots(self):
+        tree = Tree()
+        root = tree.root
+        root.createChild("a")
+        children = root.children()
+        names = root.subtreeNames()
+        root.createChild("b")
+        self.assertEqual(len(children), 1)
+        self.assertEqual(names, ["root", "a"])
+        self.assertEqual(len(root.children()), 2)
+
+    def testTraversalsDeep(self):
+        tree = Tree()
+        node = tree.root
+        for i in range(10000):
+            node = node.createChild("n")
+        self.assertEqual(len(tree.root.descendants()), 10000)
+        self.assertEqual(tree.root.walk()[-1], (10000, "n"))
+
+    def testBuildFrom(self):
+        tree = Tree()
+        root = tree.buildFrom([-1, 0, 0, -1, 3], ["a", "a1", "a2", "b", "b1"])
+        self.assertEqual(root, tree.root)
+        self.assertEqual(
+            root.walk(),
+            [(0, "root"), (1, "a"), (2, "a1"), (2, "a2"), (1, "b"), (2, "b1")])
+        self.assertEqual(tree.find("b/b1").name, "b1")
+
+        # appends to the existing children of the root
+        tree.buildFrom(parents=(-1,), names=("c",))
+        self.assertEqual(root.subtreeNames(), ["root", "a", "a1", "a2", "b", "b1", "c"])
+
+    def testBuildFromBuffer(self):
+        for typecode in ["b", "h", "i", "l", "q"]:
+            tree = Tree()
+            tree.buildFrom(array.array(typecode, [-1, 0, 1]), ["a", "b", "c"])
+            self.assertEqual(tree.root.subtreeNames(), ["root", "a", "b", "c"])
+
+    def testBuildFromInvalid(self):
+        tree = Tree()
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-1, 1], ["a", "b"])  # parent must be less than index
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-2], ["a"])
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-1, 0], ["a"])  # size mismatch
+        with self.assertRaises(TypeError):
+            tree.buildFrom([-1], [42])
+        with self.assertRaises(TypeError):
+            tree.buildFrom([-1.0], ["a"])
+        with self.assertRaises(TypeError):
+            tree.buildFrom(array.array("d", [-1.0]), ["a"])
+        with self.assertRaises(TypeError):
+            tree.buildFrom(array.array("I", [0]), ["a"])  # unsigned
+        self.assertEqual(tree.root.numChildren, 0)  # unchanged
+
+    def testSaveLoad(self):
+        tree = Tree()
+        a = tree.root.createChild("a")
+        a.createChild("b")
+        a.createChild("a")
+        tree.root.createChild("b")
+        tree.root.name = "top"
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            tree.save(path)
+            loaded = Tree.load(path)
+        self.assertEqual(loaded.root.subtreeNames(), ["top", "a", "b", "a", "b"])
+        self.assertEqual(loaded.root.subtreeNames(), tree.root.subtreeNames())
+
+    def testLoadInvalid(self):
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)  # does not exist
+            with open(path, "wb") as f:
+                f.write(b"not a snapshot, but long enough to have a header")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)
+
+    def testWrapperIsReused(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        self.assertIs(root.child(0), a)
+        self.assertIs(a.parent, root)
+        self.assertIs(tree.find("a"), a)
+        self.assertIs(root.children()[0], a)
+
+    # Before wrapper slots (see [2] in wrap.cpp), this test was UB: the wrapper
+    # still pointed to the destroyed node, and could also be returned for
+    # another node allocated at the same address. Now, the wrapper is detached
+    # from the node when the node is destroyed.
     #
-    # Or even making other unrelated tests fail.
+    def testAccessingClearedChild(self):
+        tree = Tree()
+        root = tree.root
+        node = root.createChild("node1")
+        root.clearChildren()
+        with self.assertRaises(RuntimeError):
+            node.name
+        newNode = root.createChild("node2")
+        self.assertIsNot(newNode, node)
+        self.assertEqual(newNode.name, "node2")
+
+    # With deferred reclamation, the cleared nodes are destroyed later by
+    # another thread, but their wrappers must be detached immediately.
     #
-    #def testAccessingClearedChild(self):
-    #    tree = Tree()
-    #    root = tree.root
-    #    node = root.createChild("node1")
-    #    root.clearChildren()
-    #    self.assertEqual(node.name, "node1")
+    def testAccessingClearedChildDeferred(self):
+        tree = Tree()
+        tree.deferredReclamation = True
+        root = tree.root
+        node = root.createChild("node1")
+        grandchild = node.createChild("grandchild")
+        for i in range(1000):
+            node.createChild("other").createChild("other")
+        root.clearChildren()
+        for wrapper in [node, grandchild]:
+            with self.assertRaises(RuntimeError):
+                wrapper.name
+            with self.assertRaises(RuntimeError):
+                wrapper.createChild("a")
+            with self.assertRaises(RuntimeError):
+                wrapper.child(0)
+            with self.assertRaises(RuntimeError):
+                wrapper.parent
+        tree.deferredReclamation = False
+        self.assertEqual(root.numChildren, 0)
 
 if __name__ == '__main__':
     unittest.main()
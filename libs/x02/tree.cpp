@@ -1 +1,456 @@
 #include "tree.h"
+
+#include <condition_variable>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "../snapshot.h"
+
+namespace detail {
+
+void* TreeMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+    if (isSynchronized_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return upstream_->allocate(bytes, alignment);
+    }
+    return upstream_->allocate(bytes, alignment);
+}
+
+void TreeMemoryResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+    if (isSynchronized_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        upstream_->deallocate(p, bytes, alignment);
+        return;
+    }
+    upstream_->deallocate(p, bytes, alignment);
+}
+
+bool TreeMemoryResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+// Index of the children of a node by name: maps each name to the index of
+// the first child with this name.
+//
+struct ChildIndex {
+    explicit ChildIndex(std::pmr::memory_resource* resource)
+        : map(resource) {
+    }
+
+    std::pmr::unordered_map<Atom, uint32_t> map;
+};
+
+// Background thread destroying the subtrees detached from a tree with
+// deferred reclamation. Subtrees are processed in the order they were
+// detached.
+//
+class Reclaimer {
+public:
+    Reclaimer()
+        : thread_([this]() { run_(); }) {
+    }
+
+    DISABLE_COPY_AND_MOVE(Reclaimer);
+
+    // Stops the thread. Pending subtrees must have been either drained or
+    // abandoned before.
+    ~Reclaimer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            isStopping_ = true;
+        }
+        condition_.notify_one();
+        thread_.join();
+    }
+
+    // O(1) if `nodes` uses the same memory resource as the queue, which is
+    // always the case for the children of a node.
+    void push(std::pmr::vector<NodePtr> nodes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(nodes));
+        }
+        condition_.notify_one();
+    }
+
+    // Blocks until all the subtrees pushed so far are destroyed.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        drained_.wait(lock, [this]() { return queue_.empty() && !isBusy_; });
+    }
+
+    // Gives up destroying the pending subtrees, including the one currently
+    // being destroyed, then blocks until the thread is idle.
+    void abandon() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cancel_ = true;
+        for (std::pmr::vector<NodePtr>& nodes : queue_) {
+            for (NodePtr& node : nodes) {
+                (void)node.release();
+            }
+        }
+        queue_.clear();
+        drained_.wait(lock, [this]() { return !isBusy_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::condition_variable drained_;
+    std::deque<std::pmr::vector<NodePtr>> queue_;
+    std::atomic<bool> cancel_{false};
+    bool isBusy_ = false;
+    bool isStopping_ = false;
+    std::thread thread_; // must be last: started once all the above is initialized
+
+    void run_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            condition_.wait(lock, [this]() { return isStopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return; // isStopping_
+            }
+            std::pmr::vector<NodePtr> nodes = std::move(queue_.front());
+            queue_.pop_front();
+            isBusy_ = true;
+            lock.unlock();
+            Node::destroySubtrees_(std::move(nodes), &cancel_);
+            lock.lock();
+            isBusy_ = false;
+            drained_.notify_all();
+        }
+    }
+};
+
+} // namespace detail
+
+Node::~Node() {
+    destroyChildIndex_();
+    if (!children_.empty()) {
+        destroySubtrees_(std::move(children_));
+    }
+    if (wrapperSlot_.notifyDestroyed()) {
+        --tree_.numWrappedNodes_;
+    }
+}
+
+// Called by the Python bindings, with the GIL held, which serializes it with
+// the notification of ~Node() if the node is destroyed concurrently.
+//
+void Node::setWrapper(void* wrapper) const {
+    void* oldWrapper = wrapperSlot_.get();
+    if (!oldWrapper && wrapper) {
+        ++tree_.numWrappedNodes_;
+    }
+    else if (oldWrapper && !wrapper) {
+        --tree_.numWrappedNodes_;
+    }
+    wrapperSlot_.set(wrapper);
+}
+
+Node* Node::findChild(Atom name) const {
+    if (children_.size() < childIndexThreshold) {
+        for (const NodePtr& child : children_) {
+            if (child->name_ == name) {
+                return child.get();
+            }
+        }
+        return nullptr;
+    }
+    if (!childIndex_) {
+        std::pmr::memory_resource* resource = tree_.memoryResource();
+        std::pmr::polymorphic_allocator<detail::ChildIndex> allocator(resource);
+        detail::ChildIndex* index = allocator.allocate(1);
+        new (index) detail::ChildIndex(resource);
+        childIndex_ = index;
+        try {
+            index->map.reserve(children_.size());
+            for (const NodePtr& child : children_) {
+                addToChildIndex_(*child);
+            }
+        }
+        catch (...) {
+            const_cast<Node*>(this)->destroyChildIndex_();
+            throw;
+        }
+    }
+    auto it = childIndex_->map.find(name);
+    return it == childIndex_->map.end() ? nullptr : children_[it->second].get();
+}
+
+void Node::addToChildIndex_(const Node& child) const {
+    // Does nothing if a previous child already has the same name
+    childIndex_->map.emplace(child.name_, child.indexInParent_);
+}
+
+void Node::renameInChildIndex_(const Node& child, Atom newName) {
+    std::pmr::unordered_map<Atom, uint32_t>& map = childIndex_->map;
+    uint32_t i = child.indexInParent_;
+
+    // If the child was the first with its old name, the index must now point
+    // to the next child with this name, if any.
+    auto it = map.find(child.name_);
+    if (it != map.end() && it->second == i) {
+        map.erase(it);
+        for (size_t j = i + 1; j < children_.size(); ++j) {
+            if (children_[j]->name_ == child.name_) {
+                map.emplace(child.name_, static_cast<uint32_t>(j));
+                break;
+            }
+        }
+    }
+
+    // The child may now be the first with its new name.
+    auto [it2, inserted] = map.emplace(newName, i);
+    if (!inserted && it2->second > i) {
+        it2->second = i;
+    }
+}
+
+void Node::destroyChildIndex_() {
+    if (childIndex_) {
+        std::pmr::polymorphic_allocator<detail::ChildIndex> allocator(
+            tree_.memoryResource());
+        childIndex_->~ChildIndex();
+        allocator.deallocate(childIndex_, 1);
+        childIndex_ = nullptr;
+    }
+}
+
+void Node::clearChildren() {
+    if (!parent_ && !children_.empty() && tree_.canReleaseDescendants_()) {
+        tree_.releaseDescendants_();
+        return;
+    }
+    destroyChildIndex_();
+    if (!children_.empty()) {
+        tree_.destroy_(std::move(children_));
+        children_.clear(); // moved-from vector is valid but unspecified
+    }
+}
+
+void Node::destroySubtrees_(
+    std::pmr::vector<NodePtr> nodes,
+    const std::atomic<bool>* cancel) {
+
+    // Before destroying a node, we move its children to the stack of nodes
+    // to destroy. This way, ~Node() never has any children left to destroy
+    // recursively. Note that `nodes` itself is used as stack, so this does not
+    // allocate unless its capacity has to grow.
+    //
+    while (!nodes.empty()) {
+        if (cancel && cancel->load(std::memory_order_relaxed)) {
+            for (NodePtr& node : nodes) {
+                (void)node.release();
+            }
+            return;
+        }
+        NodePtr node = std::move(nodes.back());
+        nodes.pop_back();
+        for (NodePtr& child : node->children_) {
+            nodes.push_back(std::move(child));
+        }
+        node->children_.clear();
+    }
+}
+
+Tree::Tree()
+    : arena_(std::make_unique<std::pmr::unsynchronized_pool_resource>())
+    , resource_(arena_.get())
+    , root_(detail::NodeCreateKey::create(*this, nullptr, Atom("root"))) {
+}
+
+Tree::Tree(std::pmr::memory_resource* resource)
+    : resource_(resource)
+    , root_(detail::NodeCreateKey::create(*this, nullptr, Atom("root"))) {
+}
+
+// The nodes are only released in bulk if none of them has a Python wrapper.
+// This is always the case for trees destroyed from Python, since the wrapper
+// of a node keeps alive the tree (see [5] in wrap.cpp).
+//
+Tree::~Tree() {
+    bool releaseInBulk = arena_ && numWrappedNodes_ == 0;
+    if (reclaimer_) {
+        if (releaseInBulk) {
+            reclaimer_->abandon();
+        }
+        else {
+            reclaimer_->drain();
+        }
+        reclaimer_.reset();
+    }
+    if (releaseInBulk) {
+        // All nodes but the root live in the arena, and none of them owns
+        // resources outside of it. Therefore, there is no need to run their
+        // destructors: we simply give up their ownership, and the whole
+        // memory is then released in bulk by ~unsynchronized_pool_resource().
+        //
+        abandonDescendants_();
+    }
+}
+
+bool Tree::canReleaseDescendants_() const {
+    size_t numWrappedDescendants = numWrappedNodes_ - (root_->wrapper() ? 1 : 0);
+    return arena_ && !reclaimer_ && numWrappedDescendants == 0;
+}
+
+void Tree::abandonDescendants_() {
+    root_->destroyChildIndex_();
+    for (NodePtr& child : root_->children_) {
+        (void)child.release();
+    }
+    std::pmr::vector<NodePtr>(&resource_).swap(root_->children_); // deallocates the buffer
+}
+
+void Tree::releaseDescendants_() {
+    auto arena = std::make_unique<std::pmr::unsynchronized_pool_resource>();
+    abandonDescendants_();
+    resource_.setUpstream(arena.get());
+    arena_.swap(arena); // the old arena is released when `arena` goes out of scope
+}
+
+namespace {
+
+// Checks that `parents` and `names` are valid arguments for Tree::buildFrom(),
+// and returns the number of children of each node, where index 0 is the root
+// and index `i + 1` is node `i`.
+//
+std::vector<uint32_t> countChildren(
+    const std::vector<int64_t>& parents,
+    const std::vector<std::string_view>& names) {
+
+    size_t n = parents.size();
+    if (names.size() != n) {
+        throw std::invalid_argument("parents and names must have the same size");
+    }
+    std::vector<uint32_t> numChildren(n + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t parent = parents[i];
+        if (parent < -1 || parent >= static_cast<int64_t>(i)) {
+            throw std::invalid_argument(
+                "invalid parent " + std::to_string(parent) + " for node "
+                + std::to_string(i) + ": must be -1 or less than " + std::to_string(i));
+        }
+        ++numChildren[static_cast<size_t>(parent + 1)];
+    }
+    return numChildren;
+}
+
+} // namespace
+
+Node* Tree::find(std::string_view path) {
+    Node* node = root_.get();
+    while (node && !path.empty()) {
+        size_t i = path.find('/');
+        std::string_view component = path.substr(0, i);
+        path = (i == std::string_view::npos) ? std::string_view() : path.substr(i + 1);
+        if (!component.empty()) {
+            node = node->findChild(component);
+        }
+    }
+    return node;
+}
+
+template<typename ParentOf, typename NameOf>
+void Tree::build_(const std::vector<uint32_t>& numChildren, ParentOf parentOf, NameOf nameOf) {
+    std::vector<Node*> nodes(numChildren.size());
+    nodes[0] = root_.get();
+    root_->children_.reserve(root_->children_.size() + numChildren[0]);
+    for (size_t k = 1; k < nodes.size(); ++k) {
+        Node& child = nodes[parentOf(k)]->createChild(nameOf(k));
+        child.children_.reserve(numChildren[k]);
+        nodes[k] = &child;
+    }
+}
+
+void Tree::buildFrom(
+    const std::vector<int64_t>& parents,
+    const std::vector<std::string_view>& names) {
+
+    build_(
+        countChildren(parents, names),
+        [&](size_t k) { return static_cast<size_t>(parents[k - 1] + 1); },
+        [&](size_t k) { return Atom(names[k - 1]); });
+}
+
+void Tree::save(const std::string& path) const {
+    snapshot::Writer writer;
+    std::vector<uint32_t> ancestors; // index in the snapshot, by depth
+    root_->visitDepthFirst([&](Node& node, size_t depth) {
+        ancestors.resize(depth);
+        uint32_t parent = depth == 0 ? snapshot::noParent : ancestors.back();
+        Atom name = node.nameAtom();
+        ancestors.push_back(writer.addNode(parent, name.id(), name.str()));
+    });
+    writer.write(path);
+}
+
+std::unique_ptr<Tree> Tree::load(const std::string& path) {
+    snapshot::Reader reader(path);
+    const uint32_t* parents = reader.parents();
+    const uint32_t* nameIds = reader.nameIds();
+    std::vector<Atom> atoms;
+    atoms.reserve(reader.numNames());
+    for (uint32_t i = 0; i < reader.numNames(); ++i) {
+        atoms.emplace_back(reader.name(i));
+    }
+    std::vector<uint32_t> numChildren(reader.numNodes(), 0);
+    for (size_t k = 1; k < reader.numNodes(); ++k) {
+        ++numChildren[parents[k]];
+    }
+    auto tree = std::make_unique<Tree>();
+    tree->root_->name_ = atoms[nameIds[0]];
+    tree->build_(
+        numChildren,
+        [&](size_t k) { return parents[k]; },
+        [&](size_t k) { return atoms[nameIds[k]]; });
+    return tree;
+}
+
+void Tree::setDeferredReclamation(bool enabled) {
+    if (enabled && !reclaimer_) {
+        resource_.setSynchronized(true);
+        reclaimer_ = std::make_unique<detail::Reclaimer>();
+    }
+    else if (!enabled && reclaimer_) {
+        reclaimer_->drain();
+        reclaimer_.reset();
+        resource_.setSynchronized(false);
+    }
+}
+
+void Tree::destroy_(std::pmr::vector<NodePtr> nodes) {
+    if (reclaimer_) {
+        detachWrappers_(nodes);
+        reclaimer_->push(std::move(nodes));
+    }
+    else {
+        Node::destroySubtrees_(std::move(nodes));
+    }
+}
+
+void Tree::detachWrappers_(const std::pmr::vector<NodePtr>& nodes) {
+    size_t remaining = numWrappedNodes_.load();
+    if (remaining == 0) {
+        return;
+    }
+    std::vector<const Node*> stack;
+    for (const NodePtr& node : nodes) {
+        stack.push_back(node.get());
+    }
+    while (!stack.empty() && remaining > 0) {
+        const Node* node = stack.back();
+        stack.pop_back();
+        if (node->wrapperSlot_.notifyDestroyed()) {
+            --numWrappedNodes_;
+            --remaining;
+        }
+        for (const NodePtr& child : node->children_) {
+            stack.push_back(child.get());
+        }
+    }
+}
@@ -1,21 +1,82 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <exception>
 #include <memory> // unique_ptr
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <utility> // pair
 #include <vector>
 
+#include "../atom.h"
 #include "../common.h"
+#include "../wrapperslot.h"
 
 class Tree;
 class Node;
 
 namespace detail {
 
+class Reclaimer;
+struct ChildIndex;
+
+// Memory resource through which all the memory of a tree is allocated. It
+// forwards to another resource (either the arena of the tree, or a resource
+// given by the user), optionally serializing all calls with a mutex.
+//
+// Synchronization is only enabled while the tree has a background reclaimer
+// thread (see Tree::setDeferredReclamation()), since nodes may then be
+// deallocated concurrently with the allocation of other nodes.
+//
+class API TreeMemoryResource final : public std::pmr::memory_resource {
+public:
+    explicit TreeMemoryResource(std::pmr::memory_resource* upstream)
+        : upstream_(upstream) {
+    }
+
+    DISABLE_COPY_AND_MOVE(TreeMemoryResource);
+
+    void setSynchronized(bool isSynchronized) {
+        isSynchronized_ = isSynchronized;
+    }
+
+    // Must only be called once all the memory allocated from the previous
+    // upstream resource has been deallocated or released in bulk.
+    void setUpstream(std::pmr::memory_resource* upstream) {
+        upstream_ = upstream;
+    }
+
+private:
+    std::pmr::memory_resource* upstream_;
+    std::mutex mutex_;
+    bool isSynchronized_ = false;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+// Nodes are not allocated via new/delete, but via the memory resource of
+// their tree (see Tree::memoryResource()). This deleter is what allows us to
+// still use unique_ptr for the ownership of nodes.
+//
+struct NodeDeleter {
+    void operator()(Node* node) const;
+};
+
+} // namespace detail
+
+using NodePtr = std::unique_ptr<Node, detail::NodeDeleter>;
+
+namespace detail {
+
 // Constructor of Node must be private-like to satisfy parent-child invariants.
 // We use the passkey idiom to give access to both Tree and Node, as well
-// as enabling make_unique(args) instead of unique_ptr(new Node(args)).
+// as enabling placement-new within the tree's memory resource.
 //
 struct NodeCreateKey {
 private:
@@ -23,25 +84,32 @@ private:
     friend Node;
     NodeCreateKey() = default;
 
-    static std::unique_ptr<Node> create(Tree& tree, Node* parent, std::string_view name) {
-        NodeCreateKey key;
-        return std::make_unique<Node>(key, tree, parent, name);
-    }
+    static NodePtr create(Tree& tree, Node* parent, Atom name);
 };
 
 } // namespace detail
 
 class API Node {
 public:
-    Node(detail::NodeCreateKey, Tree& tree, Node* parent, std::string_view name)
+    // Note: the children vector is allocated from the same memory resource as
+    // the node itself, while the name is interned in the global atom table.
+    //
+    Node(
+        detail::NodeCreateKey,
+        Tree& tree,
+        Node* parent,
+        Atom name,
+        std::pmr::memory_resource* resource)
         : tree_(tree)
         , parent_(parent)
+        , children_(resource)
         , name_(name) {
     }
 
-    // Ideally, we'd also want to implement ~Node() too to avoid
-    // stack overflow when destructing vector<unique_ptr<Node>>, see:
+    // Non-recursive, to avoid stack overflow when destructing deep trees, see:
     // https://www.youtube.com/watch?v=JfmTagWcqoE&t=1012s
+    //
+    ~Node();
 
     // Cannot be copied or moved because tree/nodes store the addresses of
     // nodes. Would otherwise require custom copy/move implementations.
@@ -61,11 +129,20 @@ public:
     }
 
     std::string_view name() const {
+        return name_.str();
+    }
+
+    // Comparing the atoms of two names is faster than comparing the names.
+    Atom nameAtom() const {
         return name_;
     }
 
     void setName(std::string_view name) {
-        name_ = name;
+        Atom newName(name);
+        if (parent_ && parent_->childIndex_) {
+            parent_->renameInChildIndex_(*this, newName);
+        }
+        name_ = newName;
     }
 
     size_t numChildren() const {
@@ -77,21 +154,129 @@ public:
         return *children_.at(index);
     }
 
+    // Returns the first child with the given name, or nullptr if there is
+    // none.
+    //
+    // For nodes with at least `childIndexThreshold` children, this is O(1):
+    // a hash index of the children by name is built on first call, then kept
+    // up to date by createChild(), setName() and clearChildren(). Nodes with
+    // fewer children use a linear scan comparing atoms, which is faster for
+    // small sizes and doesn't cost any memory.
+    //
+    Node* findChild(std::string_view name) const {
+        std::optional<Atom> atom = Atom::find(name);
+        return atom ? findChild(*atom) : nullptr;
+    }
+
+    // Same as findChild(std::string_view), but without having to look up the
+    // atom of the name.
+    Node* findChild(Atom name) const;
+
+    static constexpr size_t childIndexThreshold = 16;
+
     // guaranteed non-null, throws if memory allocation fails
     Node& createChild(std::string_view name) {
-        children_.push_back(detail::NodeCreateKey::create(tree(), this, name));
+        return createChild(Atom(name));
+    }
+
+    // Same as createChild(std::string_view), but without having to intern
+    // the name.
+    Node& createChild(Atom name) {
+        NodePtr child = detail::NodeCreateKey::create(tree(), this, name);
+        child->indexInParent_ = static_cast<uint32_t>(children_.size());
+        children_.push_back(std::move(child));
+        if (childIndex_) {
+            addToChildIndex_(*children_.back());
+        }
         return *children_.back();
     }
 
-    void clearChildren() {
-        children_.clear();
+    // When the tree uses its own arena, destroying the children does not call
+    // the global operator delete: the memory of each node and child vector
+    // is returned to the pools of the arena, to be reused by subsequent
+    // calls to createChild(). This is done node by node, which is not faster
+    // than new/delete (see README.md).
+    //
+    // The exception is clearing the children of the root of a tree using its
+    // own arena, without deferred reclamation, while no node other than the
+    // root has a Python wrapper: the nodes are then not visited at all, and
+    // the whole arena is released in bulk and replaced by a new one.
+    //
+    // If the tree uses deferred reclamation, the children are only detached
+    // from this node in O(1), and destroyed later by the reclaimer thread.
+    // Descendants that have a Python wrapper are still detached from it
+    // immediately, which requires visiting the subtree while there are any.
+    //
+    void clearChildren();
+
+    // Calls `f(node, depth)` for this node and all its descendants, in
+    // depth-first pre-order, where `depth` is relative to this node. The tree
+    // must not be modified during the traversal.
+    //
+    template<typename F>
+    void visitDepthFirst(F&& f) {
+        std::vector<std::pair<Node*, size_t>> stack;
+        stack.emplace_back(this, 0);
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            f(*node, depth);
+            const auto& children = node->children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                stack.emplace_back(it->get(), depth + 1); // reversed: visited in order
+            }
+        }
+    }
+
+    // Same as visitDepthFirst(), but in breadth-first order.
+    //
+    template<typename F>
+    void visitBreadthFirst(F&& f) {
+        std::vector<std::pair<Node*, size_t>> queue;
+        queue.emplace_back(this, 0);
+        for (size_t i = 0; i < queue.size(); ++i) {
+            auto [node, depth] = queue[i];
+            f(*node, depth);
+            for (const auto& child : node->children_) {
+                queue.emplace_back(child.get(), depth + 1);
+            }
+        }
+    }
+
+    // Python wrapper of this node, if any (see ../wrapperslot.h). The tree
+    // keeps count of its nodes that have one, see ~Tree().
+    //
+    void* wrapper() const {
+        return wrapperSlot_.get();
     }
 
+    void setWrapper(void* wrapper) const;
+
 private:
     Tree& tree_; // we assume nodes cannot change trees
     Node* parent_ = nullptr;
-    std::vector<std::unique_ptr<Node>> children_;
-    std::string name_;
+    std::pmr::vector<NodePtr> children_;
+    Atom name_;
+    uint32_t indexInParent_ = 0;
+    mutable WrapperSlot wrapperSlot_;
+
+    // Allocated from the memory resource of the tree, see findChild().
+    mutable detail::ChildIndex* childIndex_ = nullptr;
+
+    void addToChildIndex_(const Node& child) const;
+    void renameInChildIndex_(const Node& child, Atom newName);
+    void destroyChildIndex_();
+
+    // Destroys the given nodes and all their descendants, iteratively. If
+    // `cancel` becomes true, the remaining nodes are abandoned rather than
+    // destroyed, which is only valid if their memory is about to be released
+    // in bulk anyway.
+    //
+    friend Tree;
+    friend detail::Reclaimer;
+    static void destroySubtrees_(
+        std::pmr::vector<NodePtr> nodes,
+        const std::atomic<bool>* cancel = nullptr);
 };
 
 class API Tree {
@@ -101,19 +286,172 @@ public:
     //
     DISABLE_COPY_AND_MOVE(Tree);
 
-    Tree()
-        : root_(detail::NodeCreateKey::create(*this, nullptr, "root")) {
-    }
+    // Creates a tree whose nodes and child vectors are allocated from an
+    // arena owned by the tree. Destroying the tree releases the whole arena
+    // at once, without visiting the nodes.
+    //
+    Tree();
+
+    // Creates a tree whose nodes and child vectors are allocated from the
+    // given memory resource, which must outlive the tree. In this case,
+    // destroying the tree destroys and deallocates each node individually.
+    //
+    // Passing std::pmr::new_delete_resource() gives the same allocation
+    // pattern as a plain `std::make_unique<Node>()` per node.
+    //
+    explicit Tree(std::pmr::memory_resource* resource);
+
+    // Waits for the reclaimer thread, if any. Pending subtrees are destroyed
+    // first, unless the tree uses its own arena, in which case they are simply
+    // released with the rest of the arena.
+    //
+    ~Tree();
 
     // guaranteed non-null: our tree is assumed to always has a root.
     Node& root() {
         return *root_;
     };
 
+    // Returns the node at the given path relative to the root, e.g., "a/b/c",
+    // or nullptr if there is none. Each path component is resolved via
+    // Node::findChild(). Empty components are ignored, so "" is the root.
+    //
+    Node* find(std::string_view path);
+
+    // Creates nodes under the root from flat arrays, in a single call: node
+    // `i` is named `names[i]`, and its parent is the root if `parents[i]` is
+    // -1, otherwise the node created for `parents[i]`, which must be less than
+    // `i` (e.g., nodes listed in pre-order or breadth-first order).
+    //
+    // This is faster than calling createChild() for each node, since each
+    // child vector is allocated once with its final capacity.
+    //
+    // Throws std::invalid_argument if the arrays have different sizes or if a
+    // parent index is invalid, in which case the tree is left unchanged.
+    //
+    void buildFrom(const std::vector<int64_t>& parents, const std::vector<std::string_view>& names);
+
+    // Writes the names and topology of the tree to the given file, see
+    // ../snapshot.h. Throws std::runtime_error if the file cannot be written.
+    //
+    void save(const std::string& path) const;
+
+    // Creates a tree from a file written by save(), using its own arena.
+    //
+    // The file is mapped in memory, and the tree is rebuilt in one linear
+    // pass over it, like buildFrom(). Each distinct name is only interned
+    // once. Throws std::runtime_error if the file cannot be read or is not a
+    // valid snapshot.
+    //
+    static std::unique_ptr<Tree> load(const std::string& path);
+
+    // guaranteed non-null: all the memory of the tree, except the root node
+    // itself, is allocated from this resource, which forwards to either the
+    // arena of the tree or the memory resource given at construction. Since
+    // the arena may be replaced by clearChildren(), memory allocated from
+    // this resource by other code must be deallocated before clearing the
+    // children of the root.
+    std::pmr::memory_resource* memoryResource() {
+        return &resource_;
+    }
+
+    // Whether detached subtrees are destroyed by a background thread rather
+    // than by the thread calling Node::clearChildren(). Disabled by default.
+    //
+    bool hasDeferredReclamation() const {
+        return reclaimer_ != nullptr;
+    }
+
+    // Enables or disables deferred reclamation. Enabling it starts a
+    // background thread owned by the tree. Disabling it waits until all
+    // pending subtrees are destroyed, then stops the thread.
+    //
+    // Note that in this mode, all memory allocations of the tree are
+    // serialized with a mutex. This is required if the memory resource given
+    // at construction is not itself thread-safe.
+    //
+    void setDeferredReclamation(bool enabled);
+
 private:
-    std::unique_ptr<Node> root_;
+    // Note: the order of declaration matters: root_ must be destroyed before
+    // the resources it is allocated from, and before numWrappedNodes_.
+    //
+    std::unique_ptr<std::pmr::unsynchronized_pool_resource> arena_;
+    detail::TreeMemoryResource resource_;
+    std::unique_ptr<detail::Reclaimer> reclaimer_;
+
+    // Number of nodes that have a Python wrapper. The wrapper of a node does
+    // not own it, so these nodes must be destroyed properly (not released
+    // with the arena), to detach them from their wrapper. Atomic since nodes
+    // may be destroyed by the reclaimer thread.
+    //
+    std::atomic<size_t> numWrappedNodes_{0};
+
+    NodePtr root_;
+
+    // Destroys the given subtrees, either immediately or via the reclaimer.
+    friend Node;
+    void destroy_(std::pmr::vector<NodePtr> nodes);
+
+    // The root is not allocated from the arena of the tree, so that the arena
+    // can be released without the root, see releaseDescendants_().
+    friend detail::NodeCreateKey;
+    friend detail::NodeDeleter;
+    std::pmr::memory_resource* nodeResource_(const Node* parent) {
+        return (parent || !arena_) ? &resource_ : arena_->upstream_resource();
+    }
+
+    // Whether releaseDescendants_() can be used.
+    bool canReleaseDescendants_() const;
+
+    // Gives up ownership of all the descendants of the root without
+    // destroying them, which is only valid if their memory is about to be
+    // released in bulk.
+    void abandonDescendants_();
+
+    // Removes all the descendants of the root by releasing the arena in bulk,
+    // and replacing it by a new one.
+    void releaseDescendants_();
+
+    // Detaches the nodes of the given subtrees from their Python wrapper, if
+    // any, so that the reclaimer thread never destroys a node that Python can
+    // still access. Stops as soon as all the wrapped nodes of the tree have
+    // been found, so this is free if no node has a wrapper.
+    //
+    void detachWrappers_(const std::pmr::vector<NodePtr>& nodes);
+
+    // Creates nodes under the root, where node `k` (for `0 < k < n`, with
+    // `n = numChildren.size()`) has `numChildren[k]` children, is named
+    // `nameOf(k)`, and has for parent the node `parentOf(k) < k`, where 0 is
+    // the root. The arguments must have been validated.
+    //
+    template<typename ParentOf, typename NameOf>
+    void build_(const std::vector<uint32_t>& numChildren, ParentOf parentOf, NameOf nameOf);
 };
 
+namespace detail {
+
+inline void NodeDeleter::operator()(Node* node) const {
+    std::pmr::memory_resource* resource = node->tree().nodeResource_(node->parent());
+    node->~Node();
+    resource->deallocate(node, sizeof(Node), alignof(Node));
+}
+
+inline NodePtr NodeCreateKey::create(Tree& tree, Node* parent, Atom name) {
+    NodeCreateKey key;
+    std::pmr::memory_resource* nodeResource = tree.nodeResource_(parent);
+    void* p = nodeResource->allocate(sizeof(Node), alignof(Node));
+    try {
+        return NodePtr(new (p) Node(key, tree, parent, name, tree.memoryResource()));
+    }
+    catch (...) {
+        nodeResource->deallocate(p, sizeof(Node), alignof(Node));
+        throw;
+    }
+}
+
+} // namespace detail
+
 // Side questions about constness:
 //
 // - Should `Node::firstChild() const` return a const Node*?
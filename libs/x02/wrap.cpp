@@ -2,11 +2,20 @@
 namespace py = pybind11;
 using rvp = py::return_value_policy;
 
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../pykeepalive.h"
+#include "../pytraversal.h"
+#include "../wrappercaster.h"
 #include "tree.h"
 
-// [1] Major issue:
+// [1] Major issue (now solved, see [5]):
 //
-// In `child` and `createChild`, we use reference_internal so that the child
+// In `child` and `createChild`, we used reference_internal so that the child
 // keeps alive `self` (that is, the parent node).
 //
 // This is at least better than the default (rvp::automatic) which would
@@ -36,13 +45,79 @@ using rvp = py::return_value_policy;
 //   in memory), it will return the existing Python object wrapper rather than
 //   creating a new copy.
 //
+// [2] Wrapper slots:
+//
+// Finding out whether pybind11 "knows the instance already" is a lookup in a
+// global hash map keyed by address, for each returned node. Instead, each
+// node stores a pointer to its wrapper, if any (see ../wrapperslot.h), which
+// our type caster returns directly. This also fixes a subtle issue: when a
+// node is destroyed while its wrapper is alive (e.g., after clearChildren()),
+// the wrapper is detached from it, so that using it raises an exception, and
+// a new node allocated at the same address gets a new wrapper, rather than
+// the stale one.
+//
+// [5] Keep-alive of the tree:
+//
+// Instead of reference_internal [1], each wrapper of a node stores a strong
+// reference to the wrapper of its tree (see ../pykeepalive.h), set by the type
+// caster of Node below when the wrapper is created. This keeps alive the whole
+// tree, regardless of how the node was obtained (including `parent` and
+// `Tree.root`), and since nodes cannot change trees, it never needs to be
+// updated. It costs one extra pointer per wrapper, and nothing for calls
+// returning an existing wrapper. In contrast, reference_internal adds an
+// entry to the global patients map of pybind11 for each new wrapper.
+//
+// All the bindings returning nodes therefore use rvp::reference.
+//
+namespace {
+
+class NodeCaster : public wrapperslot::Caster<Node> {
+    using Base = wrapperslot::Caster<Node>;
+
+public:
+    using Base::cast;
+
+    // Nodes are never owned by their wrapper, so we ignore the policy.
+    static py::handle cast(const Node* src, rvp, py::handle) {
+        py::handle wrapper = Base::cast(src, rvp::reference, py::handle());
+        if (src && wrapper && !pykeepalive::hasOwner<Node>(wrapper)) {
+            py::object tree = py::cast(&src->tree(), rvp::reference);
+            pykeepalive::setOwner<Node>(wrapper, tree);
+        }
+        return wrapper;
+    }
+
+    static py::handle cast(const Node& src, rvp policy, py::handle parent) {
+        return cast(&src, policy, parent);
+    }
+};
+
+void setupNodeType(PyHeapTypeObject* heapType) {
+    wrapperslot::setupType<Node>(heapType); // [2]
+    pykeepalive::setupType<Node>(heapType); // [5]
+}
+
+} // namespace
+
+namespace pybind11 {
+namespace detail {
+template<>
+class type_caster<Node> : public NodeCaster {};
+} // namespace detail
+} // namespace pybind11
+
+// [3] Bulk traversals:
+//
+// `children()`, `descendants()`, `walk()` and `subtreeNames()` traverse the
+// subtree in C++ and return a single Python list, see ../pytraversal.h.
+//
 void wrap_node(py::module& m) {
-    py::class_<Node>(m, "Node")
+    py::class_<Node>(m, "Node", py::custom_type_setup(&setupNodeType)) // [2] [5]
 
         // the tree should not keep alive the node, hence rvp::reference
         .def_property_readonly("tree", &Node::tree, rvp::reference)
 
-        // the parent should not keep alive the child, hence rvp::reference
+        // the parent keeps alive the tree [5]
         .def_property_readonly("parent", &Node::parent, rvp::reference)
 
         // the rvp does not matter here: pybind11 will make a copy into a Python string
@@ -51,25 +126,234 @@ void wrap_node(py::module& m) {
         // the rvp does not matter here: pybind11 will make a copy into a Python integer
         .def_property_readonly("numChildren", &Node::numChildren)
 
-        // the returned child should keep alive its parent [1].
-        .def("child", &Node::child, rvp::reference_internal)
+        // the returned child keeps alive the tree [5]
+        .def("child", &Node::child, rvp::reference)
+
+        // the found child keeps alive the tree [5]. Returns None if there is
+        // no child with this name.
+        .def(
+            "findChild",
+            py::overload_cast<std::string_view>(&Node::findChild, py::const_),
+            rvp::reference)
+
+        // Bulk traversals [3]. The returned nodes keep alive the tree [5].
+        .def(
+            "children",
+            [](Node& self) {
+                size_t n = self.numChildren();
+                py::list res(n);
+                for (size_t i = 0; i < n; ++i) {
+                    res[i] = py::cast(&self.child(i), rvp::reference);
+                }
+                return res;
+            })
+        .def(
+            "descendants",
+            [](Node& self, std::string_view order) {
+                py::list res;
+                pytraversal::visit(self, pytraversal::parseOrder(order), [&](Node& n, size_t depth) {
+                    if (depth > 0) {
+                        res.append(py::cast(&n, rvp::reference));
+                    }
+                });
+                return res;
+            },
+            py::arg("order") = "dfs")
+        .def(
+            "walk",
+            [](Node& self) {
+                pytraversal::NameCache names;
+                py::list res;
+                self.visitDepthFirst([&](Node& n, size_t depth) {
+                    res.append(py::make_tuple(depth, names.get(n.nameAtom())));
+                });
+                return res;
+            })
+        .def(
+            "subtreeNames",
+            [](Node& self) {
+                pytraversal::NameCache names;
+                py::list res;
+                self.visitDepthFirst([&](Node& n, size_t) { res.append(names.get(n.nameAtom())); });
+                return res;
+            })
 
-        // the created child should keep alive its parent [1].
-        .def("createChild", &Node::createChild, rvp::reference_internal)
+        // the created child keeps alive the tree [5]
+        .def(
+            "createChild",
+            py::overload_cast<std::string_view>(&Node::createChild),
+            rvp::reference)
 
-        // the rvp does not matter here: no returned value
-        .def("clearChildren", &Node::clearChildren);
+        // the rvp does not matter here: no returned value. Destroying a large
+        // subtree may take a while, so we release the GIL. It is re-acquired
+        // only to detach the wrappers of the destroyed nodes, if any [2].
+        .def(
+            "clearChildren",
+            &Node::clearChildren,
+            py::call_guard<py::gil_scoped_release>());
 }
 
+// [4] Bulk construction:
+//
+// `Tree.buildFrom(parents, names)` first copies its arguments into C++
+// vectors with the GIL held, then builds the whole tree with the GIL released
+// (see Tree::buildFrom()). As with `clearChildren`, the tree must not be
+// accessed from other Python threads during the call.
+//
+// `parents` can be any one-dimensional buffer of signed integers (e.g., a
+// numpy array or an `array.array`), which is copied without creating any Python
+// object, or any sequence of integers. `names` can be any sequence of
+// strings. We keep our own list of references to the strings so that their
+// UTF-8 representation, cached by Python in the string objects, remains valid
+// while the GIL is released.
+//
+namespace {
+
+template<typename T>
+void appendIndices(const py::buffer_info& info, std::vector<int64_t>& indices) {
+    const char* data = static_cast<const char*>(info.ptr);
+    for (py::ssize_t i = 0; i < info.shape[0]; ++i) {
+        T index;
+        std::memcpy(&index, data + i * info.strides[0], sizeof(T));
+        indices.push_back(static_cast<int64_t>(index));
+    }
+}
+
+// Only native signed integers are supported, since -1 denotes the root.
+//
+std::vector<int64_t> indicesFromBuffer(const py::buffer_info& info) {
+    const uint16_t one = 1;
+    const char nativeByteOrder = *reinterpret_cast<const char*>(&one) == 1 ? '<' : '>';
+    std::string_view format = info.format;
+    if (!format.empty()
+        && (format[0] == '@' || format[0] == '=' || format[0] == nativeByteOrder)) {
+        format.remove_prefix(1);
+    }
+    if (info.ndim != 1 || format.size() != 1
+        || std::string_view("bhilqn").find(format[0]) == std::string_view::npos) {
+        throw py::type_error("parents must be a one-dimensional buffer of signed integers");
+    }
+    std::vector<int64_t> indices;
+    indices.reserve(static_cast<size_t>(info.shape[0]));
+    switch (info.itemsize) {
+    case 1:
+        appendIndices<int8_t>(info, indices);
+        break;
+    case 2:
+        appendIndices<int16_t>(info, indices);
+        break;
+    case 4:
+        appendIndices<int32_t>(info, indices);
+        break;
+    case 8:
+        appendIndices<int64_t>(info, indices);
+        break;
+    default:
+        throw py::type_error("unsupported integer size in parents buffer");
+    }
+    return indices;
+}
+
+std::vector<int64_t> toIndices(py::handle parents) {
+    if (PyObject_CheckBuffer(parents.ptr())) {
+        return indicesFromBuffer(py::reinterpret_borrow<py::buffer>(parents).request());
+    }
+    std::vector<int64_t> indices;
+    for (py::handle item : py::reinterpret_borrow<py::sequence>(parents)) {
+        if (!PyLong_Check(item.ptr())) {
+            throw py::type_error("parents must contain integers");
+        }
+        indices.push_back(item.cast<int64_t>());
+    }
+    return indices;
+}
+
+// Fills `names` with views of the strings in `list`, which must stay alive
+// while the views are in use.
+//
+void toNames(const py::list& list, std::vector<std::string_view>& names) {
+    names.reserve(list.size());
+    for (py::handle item : list) {
+        if (!PyUnicode_Check(item.ptr())) {
+            throw py::type_error("names must contain strings");
+        }
+        Py_ssize_t size = 0;
+        const char* data = PyUnicode_AsUTF8AndSize(item.ptr(), &size);
+        if (!data) {
+            throw py::error_already_set();
+        }
+        names.emplace_back(data, static_cast<size_t>(size));
+    }
+}
+
+} // namespace
+
+// Releases the GIL while destroying the tree, which may take a while for
+// large trees not using their own arena, or when waiting for the reclaimer
+// thread.
+//
+struct TreeDeleter {
+    void operator()(Tree* tree) const {
+        py::gil_scoped_release release;
+        delete tree;
+    }
+};
+
+using TreeHolder = std::unique_ptr<Tree, TreeDeleter>;
+
 void wrap_tree(py::module& m) {
-    py::class_<Tree>(m, "Tree")
+    py::class_<Tree, TreeHolder>(m, "Tree")
 
         // constructor
         .def(py::init<>())
 
-        // the root should keep alive the tree (note: reference_internal is already the default
-        // for def_property, but we write it anyway for clarifying intent)
-        .def_property_readonly("root", &Tree::root, rvp::reference_internal);
+        // Enabling starts a background thread; disabling waits for it to
+        // finish, so we release the GIL for both.
+        .def_property(
+            "deferredReclamation",
+            &Tree::hasDeferredReclamation,
+            [](Tree& self, bool enabled) {
+                py::gil_scoped_release release;
+                self.setDeferredReclamation(enabled);
+            })
+
+        // the root keeps alive the tree [5] (note: we override the default
+        // reference_internal of def_property, which would be redundant)
+        .def_property_readonly("root", &Tree::root, rvp::reference)
+
+        // the found node keeps alive the tree, like the root [5]. Returns None
+        // if there is no node at this path.
+        .def("find", &Tree::find, rvp::reference)
+
+        // Builds the nodes described by the given arrays under the root, and
+        // returns the root [4].
+        .def(
+            "buildFrom",
+            [](Tree& self, py::handle parents, py::handle names) -> Node& {
+                std::vector<int64_t> indices = toIndices(parents);
+                py::list nameList = py::reinterpret_steal<py::list>(PySequence_List(names.ptr()));
+                if (!nameList) {
+                    throw py::error_already_set();
+                }
+                std::vector<std::string_view> nameViews;
+                toNames(nameList, nameViews);
+                {
+                    py::gil_scoped_release release;
+                    self.buildFrom(indices, nameViews);
+                }
+                return self.root();
+            },
+            py::arg("parents"),
+            py::arg("names"),
+            rvp::reference)
+
+        // Snapshots (see ../snapshot.h). Neither touches Python objects, so
+        // we release the GIL.
+        .def("save", &Tree::save, py::call_guard<py::gil_scoped_release>())
+        .def_static(
+            "load",
+            [](const std::string& path) { return TreeHolder(Tree::load(path).release()); },
+            py::call_guard<py::gil_scoped_release>());
 }
 
 PYBIND11_MODULE(x02, m) {
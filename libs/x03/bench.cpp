@@ -0,0 +1,440 @@
+// Memory-per-node benchmark, with names drawn from a small set of distinct
+// names, as is typical in practice, followed by a benchmark of the time it
+// takes to remove a large subtree for different shapes of trees, and of the
+// time to save and load a snapshot of the tree (written to the current
+// directory), and of the cost of change notifications.
+//
+// Finally, runs the standardized workloads of ../benchmark.h, where accessing
+// a child includes locking its weak_ptr, as required for memory safety.
+//
+// Usage: x03_bench [numNodes] [branchingFactor] [--json path]
+
+#include <atomic>
+#include <chrono>
+#include <cstddef> // max_align_t
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../benchmark.h"
+#include "tree.h"
+
+#if defined(OS_WINDOWS)
+#    include <malloc.h> // _msize
+#elif defined(OS_MACOS)
+#    include <malloc/malloc.h> // malloc_size
+#else
+#    include <malloc.h> // malloc_usable_size
+#endif
+
+// Replace the global operator new/delete to keep track of the number of bytes
+// currently allocated, as reported by the system allocator (that is, including
+// rounding to its size classes, but not its per-allocation header).
+//
+// All the forms (array, aligned, nothrow) are replaced, so that they are all
+// counted, and so that memory is always released by the allocator which
+// allocated it.
+//
+// The counter is atomic since the multithreaded workloads also allocate. Only
+// measureMemory() reads it, while no other thread is running, so relaxed
+// operations are enough.
+//
+namespace {
+
+std::atomic<size_t> allocatedBytes = 0;
+
+// Alignment guaranteed by malloc(), above which the aligned allocation
+// functions of the system are used.
+constexpr size_t mallocAlignment = alignof(std::max_align_t);
+
+size_t allocationSize(void* p, [[maybe_unused]] size_t alignment) {
+#if defined(OS_WINDOWS)
+    return alignment > mallocAlignment ? _aligned_msize(p, alignment, 0) : _msize(p);
+#elif defined(OS_MACOS)
+    return malloc_size(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+// Returns nullptr if the allocation fails.
+void* allocate(size_t size, size_t alignment) noexcept {
+    if (size == 0) {
+        size = 1; // must return a unique pointer
+    }
+    void* p = nullptr;
+    if (alignment <= mallocAlignment) {
+        p = std::malloc(size);
+    }
+    else {
+#if defined(OS_WINDOWS)
+        p = _aligned_malloc(size, alignment);
+#else
+        if (posix_memalign(&p, alignment, size) != 0) {
+            p = nullptr;
+        }
+#endif
+    }
+    if (p) {
+        allocatedBytes.fetch_add(allocationSize(p, alignment), std::memory_order_relaxed);
+    }
+    return p;
+}
+
+void* allocateOrThrow(size_t size, size_t alignment) {
+    void* p = allocate(size, alignment);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void deallocate(void* p, size_t alignment) noexcept {
+    if (!p) {
+        return;
+    }
+    allocatedBytes.fetch_sub(allocationSize(p, alignment), std::memory_order_relaxed);
+#if defined(OS_WINDOWS)
+    if (alignment > mallocAlignment) {
+        _aligned_free(p);
+        return;
+    }
+#endif
+    std::free(p);
+}
+
+size_t toSize(std::align_val_t alignment) {
+    return static_cast<size_t>(alignment);
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    return allocateOrThrow(size, mallocAlignment);
+}
+
+void* operator new[](size_t size) {
+    return allocateOrThrow(size, mallocAlignment);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, mallocAlignment);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size, mallocAlignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, toSize(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, toSize(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, toSize(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, toSize(alignment));
+}
+
+void operator delete(void* p) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete[](void* p) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    deallocate(p, mallocAlignment);
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    deallocate(p, toSize(alignment));
+}
+
+// Names of the nodes: a few thousand distinct names, long enough not to fit
+// in the small string optimization buffer.
+//
+const std::vector<std::string>& names() {
+    static std::vector<std::string> res = []() {
+        std::vector<std::string> names;
+        for (int i = 0; i < 2000; ++i) {
+            names.push_back("transform_group_" + std::to_string(i));
+        }
+        return names;
+    }();
+    return res;
+}
+
+// Builds a tree of `numNodes` nodes (including the root) in breadth-first
+// order, where each node has `branchingFactor` children, except possibly in
+// the last level.
+//
+void build(Tree& tree, size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    std::vector<NodeSharedPtr> queue;
+    queue.reserve(numNodes);
+    queue.push_back(tree.root().lock());
+    size_t i = 0;
+    while (queue.size() < numNodes) {
+        NodeSharedPtr parent = queue[i++];
+        for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+            const std::string& name = names_[queue.size() % names_.size()];
+            queue.push_back(parent->createChild(name).lock());
+        }
+    }
+}
+
+void measureMemory(size_t numNodes, size_t branchingFactor) {
+    names();
+    size_t before = allocatedBytes.load(std::memory_order_relaxed);
+    Tree tree;
+    build(tree, numNodes, branchingFactor);
+    size_t after = allocatedBytes.load(std::memory_order_relaxed);
+    std::cout << double(after - before) / numNodes << " bytes/node" << std::endl;
+}
+
+// Builds a chain of `numNodes` nodes (including the root).
+//
+void buildDeep(Tree& tree, size_t numNodes) {
+    const std::vector<std::string>& names_ = names();
+    NodeSharedPtr node = tree.root().lock();
+    for (size_t i = 1; i < numNodes; ++i) {
+        node = node->createChild(names_[i % names_.size()]).lock();
+    }
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Measures the time of clearChildren() on the root, and of ~Tree() on a tree
+// of the same shape.
+//
+template<typename Build>
+void measureDestroy(const char* shape, size_t numNodes, Build build) {
+    double clearMs = 0;
+    double destroyMs = 0;
+    {
+        Tree tree;
+        build(tree);
+        auto start = std::chrono::steady_clock::now();
+        tree.root().lock()->clearChildren();
+        clearMs = elapsedMs(start);
+    }
+    {
+        auto tree = std::make_unique<Tree>();
+        build(*tree);
+        auto start = std::chrono::steady_clock::now();
+        tree.reset();
+        destroyMs = elapsedMs(start);
+    }
+    std::cout << "  " << shape << ": clearChildren " << clearMs << " ms ("
+              << clearMs * 1e6 / numNodes << " ns/node), ~Tree " << destroyMs << " ms"
+              << std::endl;
+}
+
+// Measures the time to save a tree to a snapshot file, then to load it, which
+// is the cold-start time of a process whose tree is stored in a snapshot.
+// Note that the file is likely still in the page cache when loading it.
+//
+void measureSnapshot(size_t numNodes, size_t branchingFactor, const std::string& path) {
+    Tree tree;
+    auto start = std::chrono::steady_clock::now();
+    build(tree, numNodes, branchingFactor);
+    double buildMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    tree.save(path);
+    double saveMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    std::unique_ptr<Tree> loaded = Tree::load(path);
+    double loadMs = elapsedMs(start);
+    std::remove(path.c_str());
+
+    std::cout << "Snapshot: build " << buildMs << " ms, save " << saveMs << " ms, load "
+              << loadMs << " ms" << std::endl;
+}
+
+// Measures the time to build a tree, then to rename all its nodes twice,
+// without and with a subscriber to its changes. With a subscriber, the
+// changes are flushed after each step, and the flush is included in the time.
+//
+void measureChanges(size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    for (bool observed : {false, true}) {
+        Tree tree;
+        size_t numDelivered = 0;
+        if (observed) {
+            tree.subscribe([&](const std::vector<Change>& changes) {
+                numDelivered += changes.size();
+            });
+        }
+        auto start = std::chrono::steady_clock::now();
+        build(tree, numNodes, branchingFactor);
+        tree.flushChanges();
+        double buildMs = elapsedMs(start);
+
+        std::vector<NodeSharedPtr> nodes;
+        tree.root().lock()->visitDepthFirst([&](Node& node, size_t) {
+            nodes.push_back(node.shared_from_this());
+        });
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < 2; ++i) {
+            for (size_t j = 0; j < nodes.size(); ++j) {
+                nodes[j]->setName(names_[(i + j) % names_.size()]);
+            }
+        }
+        tree.flushChanges();
+        double renameMs = elapsedMs(start);
+
+        std::cout << "Changes (" << (observed ? "observed" : "unobserved") << "): build "
+                  << buildMs << " ms, rename " << renameMs << " ms, " << numDelivered
+                  << " changes delivered" << std::endl;
+    }
+}
+
+// Visits all the nodes in depth-first order, and appends them to `nodes`.
+//
+void dfs(const NodeSharedPtr& root, std::vector<NodeWeakPtr>& nodes) {
+    std::vector<NodeSharedPtr> stack;
+    stack.push_back(root);
+    while (!stack.empty()) {
+        NodeSharedPtr node = std::move(stack.back());
+        stack.pop_back();
+        for (size_t i = node->numChildren(); i-- > 0;) {
+            stack.push_back(node->child(i).lock());
+        }
+        nodes.push_back(std::move(node));
+    }
+}
+
+void runWorkloads(benchmark::Report& report, size_t numNodes, size_t branchingFactor) {
+    using benchmark::Clock;
+    using benchmark::nanosecondsSince;
+    benchmark::Params params = {{"numNodes", numNodes}, {"branchingFactor", branchingFactor}};
+
+    auto tree = std::make_unique<Tree>();
+    auto start = Clock::now();
+    build(*tree, numNodes, branchingFactor);
+    report.add("build", params, nanosecondsSince(start) / numNodes, "ns/node");
+
+    NodeSharedPtr root = tree->root().lock();
+    std::vector<NodeWeakPtr> nodes;
+    nodes.reserve(numNodes);
+    start = Clock::now();
+    dfs(root, nodes);
+    report.add("dfs", params, nanosecondsSince(start) / nodes.size(), "ns/node");
+
+    benchmark::Random random;
+    size_t numAccesses = numNodes;
+    NodeSharedPtr node = root;
+    start = Clock::now();
+    for (size_t i = 0; i < numAccesses; ++i) {
+        size_t n = node->numChildren();
+        node = n > 0 ? node->child(random(n)).lock() : root;
+    }
+    report.add("randomChildAccess", params, nanosecondsSince(start) / numAccesses, "ns/access");
+    node = nullptr;
+
+    // All threads lock the same nodes, starting at different offsets.
+    size_t locksPerThread = std::max<size_t>(numNodes, 1000000);
+    for (size_t numThreads : benchmark::threadCounts()) {
+        double ns = benchmark::runThreads(numThreads, [&](size_t threadIndex) {
+            size_t j = threadIndex * nodes.size() / numThreads;
+            for (size_t i = 0; i < locksPerThread; ++i) {
+                NodeSharedPtr p = nodes[j].lock();
+                j = (j + 1 == nodes.size()) ? 0 : j + 1;
+            }
+        });
+        double locksPerSecond = numThreads * locksPerThread / (ns * 1e-9);
+        benchmark::Params threadParams = params;
+        threadParams.push_back({"numThreads", numThreads});
+        report.add("weakLock", threadParams, locksPerSecond * 1e-6, "Mlocks/s");
+    }
+    nodes.clear();
+
+    start = Clock::now();
+    root->clearChildren();
+    report.add("clearChildren", params, nanosecondsSince(start) / numNodes, "ns/node");
+    root = nullptr;
+
+    build(*tree, numNodes, branchingFactor);
+    start = Clock::now();
+    tree.reset();
+    report.add("destroy", params, nanosecondsSince(start) / numNodes, "ns/node");
+}
+
+int main(int argc, char* argv[]) {
+    benchmark::Args args(argc, argv);
+    size_t numNodes = args.get(0, 1000000);
+    size_t branchingFactor = args.get(1, 8);
+    if (branchingFactor == 0) {
+        std::cerr << "The branching factor must be at least 1" << std::endl;
+        return 1;
+    }
+
+    std::cout << numNodes << " nodes, branching factor " << branchingFactor << std::endl;
+    measureMemory(numNodes, branchingFactor);
+
+    benchmark::useAtomicRefCounts();
+
+    std::cout << "Removing all nodes:" << std::endl;
+    measureDestroy("wide", numNodes, [&](Tree& tree) { build(tree, numNodes, numNodes); });
+    measureDestroy("deep", numNodes, [&](Tree& tree) { buildDeep(tree, numNodes); });
+    measureDestroy("balanced", numNodes, [&](Tree& tree) {
+        build(tree, numNodes, branchingFactor);
+    });
+    measureSnapshot(numNodes, branchingFactor, "x03_bench.snap");
+    measureChanges(numNodes, branchingFactor);
+
+    std::cout << "Standard workloads:" << std::endl;
+    benchmark::Report report("x03");
+    runWorkloads(report, numNodes, branchingFactor);
+    if (!report.save(args.jsonPath)) {
+        std::cerr << "Cannot write " << args.jsonPath << std::endl;
+        return 1;
+    }
+}
@@ -1,7 +1,11 @@
 #!/usr/bin/python3
 
+import array
+import os
+import tempfile
 import unittest
-from x03 import Node, Tree
+import x03
+from x03 import ChangeType, Node, Tree
 
 def getRootOfNewTree():
     tree = Tree()
@@ -39,5 +43,345 @@ class TestTree(unittest.TestCase):
         root.clearChildren()
         self.assertEqual(node.name, "node1")
 
+    def testClearChildrenKeepsObservedNodesAlive(self):
+        tree = Tree()
+        root = tree.root
+        node = root
+        for i in range(10000):
+            node = node.createChild("node" + str(i))
+        middle = root.child(0).child(0)
+        middle.name = "middle"
+        root.clearChildren()
+        self.assertEqual(root.numChildren, 0)
+        self.assertEqual(middle.name, "middle")
+        self.assertEqual(middle.numChildren, 0)
+        self.assertIsNone(middle.parent)
+        self.assertEqual(node.name, "node9999")
+        self.assertIsNone(node.parent)
+
+    def testFindChild(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        b = root.createChild("b")
+        self.assertEqual(root.findChild("a"), a)
+        self.assertEqual(root.findChild("b"), b)
+        self.assertIsNone(root.findChild("c"))
+        self.assertIsNone(root.findChild("neverUsedName"))
+
+    def testFindChildLarge(self):
+        tree = Tree()
+        root = tree.root
+        nodes = [root.createChild("node" + str(i % 50)) for i in range(100)]
+        self.assertEqual(root.findChild("node3"), nodes[3])
+        self.assertIsNone(root.findChild("node50"))
+        nodes[3].name = "renamed"
+        self.assertEqual(root.findChild("node3"), nodes[53])
+        self.assertEqual(root.findChild("renamed"), nodes[3])
+        nodes[1].name = "renamed"
+        self.assertEqual(root.findChild("renamed"), nodes[1])
+        last = root.createChild("last")
+        self.assertEqual(root.findChild("last"), last)
+        root.clearChildren()
+        self.assertIsNone(root.findChild("node3"))
+
+    def testFind(self):
+        tree = Tree()
+        a = tree.root.createChild("a")
+        b = a.createChild("b")
+        self.assertEqual(tree.find(""), tree.root)
+        self.assertEqual(tree.find("a"), a)
+        self.assertEqual(tree.find("a/b"), b)
+        self.assertEqual(tree.find("/a//b/"), b)
+        self.assertIsNone(tree.find("a/c"))
+        self.assertIsNone(tree.find("b"))
+
+    def testTraversals(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        b = root.createChild("b")
+        a1 = a.createChild("a1")
+        a2 = a.createChild("a2")
+        b1 = b.createChild("b1")
+        self.assertEqual(root.children(), [a, b])
+        self.assertEqual(a1.children(), [])
+        self.assertEqual(root.descendants(), [a, a1, a2, b, b1])
+        self.assertEqual(root.descendants(order="dfs"), [a, a1, a2, b, b1])
+        self.assertEqual(root.descendants(order="bfs"), [a, b, a1, a2, b1])
+        self.assertEqual(a.descendants(), [a1, a2])
+        with self.assertRaises(ValueError):
+            root.descendants(order="xyz")
+        self.assertEqual(
+            root.walk(),
+            [(0, "root"), (1, "a"), (2, "a1"), (2, "a2"), (1, "b"), (2, "b1")])
+        self.assertEqual(b.walk(), [(0, "b"), (1, "b1")])
+        self.assertEqual(root.subtreeNames(), ["root", "a", "a1", "a2", "b", "b1"])
+
+    def testTraversalsAreSnapshots(self):
+        tree = Tree()
+        root = tree.root
+        root.createChild("a")
+        children = root.children()
+        names = root.subtreeNames()
+        root.createChild("b")
+        self.assertEqual(len(children), 1)
+        self.assertEqual(names, ["root", "a"])
+        self.assertEqual(len(root.children()), 2)
+
+    def testTraversalsDeep(self):
+        tree = Tree()
+        node = tree.root
+        for i in range(10000):
+            node = node.createChild("n")
+        self.assertEqual(len(tree.root.descendants()), 10000)
+        self.assertEqual(tree.root.walk()[-1], (10000, "n"))
+
+    def testBuildFrom(self):
+        tree = Tree()
+        root = tree.buildFrom([-1, 0, 0, -1, 3], ["a", "a1", "a2", "b", "b1"])
+        self.assertEqual(root, tree.root)
+        self.assertEqual(
+            root.walk(),
+            [(0, "root"), (1, "a"), (2, "a1"), (2, "a2"), (1, "b"), (2, "b1")])
+        self.assertEqual(tree.find("b/b1").name, "b1")
+
+        # appends to the existing children of the root
+        tree.buildFrom(parents=(-1,), names=("c",))
+        self.assertEqual(root.subtreeNames(), ["root", "a", "a1", "a2", "b", "b1", "c"])
+
+    def testBuildFromBuffer(self):
+        for typecode in ["b", "h", "i", "l", "q"]:
+            tree = Tree()
+            tree.buildFrom(array.array(typecode, [-1, 0, 1]), ["a", "b", "c"])
+            self.assertEqual(tree.root.subtreeNames(), ["root", "a", "b", "c"])
+
+    def testBuildFromInvalid(self):
+        tree = Tree()
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-1, 1], ["a", "b"])  # parent must be less than index
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-2], ["a"])
+        with self.assertRaises(ValueError):
+            tree.buildFrom([-1, 0], ["a"])  # size mismatch
+        with self.assertRaises(TypeError):
+            tree.buildFrom([-1], [42])
+        with self.assertRaises(TypeError):
+            tree.buildFrom([-1.0], ["a"])
+        with self.assertRaises(TypeError):
+            tree.buildFrom(array.array("d", [-1.0]), ["a"])
+        with self.assertRaises(TypeError):
+            tree.buildFrom(array.array("I", [0]), ["a"])  # unsigned
+        self.assertEqual(tree.root.numChildren, 0)  # unchanged
+
+    def testWrapperIsReused(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        self.assertIs(root.child(0), a)
+        self.assertIs(a.parent, root)
+        self.assertIs(tree.find("a"), a)
+        del a
+        a = root.child(0)  # new wrapper, since the previous one was destroyed
+        self.assertEqual(a.name, "a")
+        self.assertIs(root.child(0), a)
+
+    def testSaveLoad(self):
+        tree = Tree()
+        a = tree.root.createChild("a")
+        a.createChild("b")
+        a.createChild("a")
+        tree.root.createChild("b")
+        tree.root.name = "top"
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            tree.save(path)
+            loaded = Tree.load(path)
+        self.assertEqual(loaded.root.subtreeNames(), ["top", "a", "b", "a", "b"])
+        self.assertEqual(loaded.root.subtreeNames(), tree.root.subtreeNames())
+
+    def testLoadInvalid(self):
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)  # does not exist
+            with open(path, "wb") as f:
+                f.write(b"not a snapshot, but long enough to have a header")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)
+
+    def testOpenLazy(self):
+        tree = Tree()
+        tree.buildFrom([-1] + [(i - 1) // 4 for i in range(1, 1000)],
+                       ["n" + str(i % 37) for i in range(1000)])
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            tree.save(path)
+            lazy = Tree.openLazy(path, maxLoadedNodes=100)
+        self.assertTrue(lazy.isLazy)
+        self.assertFalse(tree.isLazy)
+        self.assertEqual(lazy.numLoadedNodes, 1)
+        root = lazy.root
+        self.assertEqual(root.numChildren, 1)
+        self.assertEqual(lazy.numLoadedNodes, 2)
+        self.assertEqual(root.subtreeNames(), tree.root.subtreeNames())
+        self.assertLessEqual(lazy.numLoadedNodes, 100)
+
+        # held nodes are not evicted
+        node = root.child(0).child(1).child(2)
+        node.name = "renamed"
+        for i in range(200):
+            n = root
+            while n.numChildren > 0:
+                n = n.child(i % n.numChildren)
+        self.assertIs(node.tree, lazy)
+        self.assertEqual(root.child(0).child(1).child(2).name, "renamed")
+        del node, n
+        self.assertEqual(lazy.find("n0/n2/renamed").name, "renamed")
+
+        # modified nodes are never evicted
+        root.child(0).createChild("extra")
+        root.subtreeNames()
+        self.assertEqual(root.child(0).child(root.child(0).numChildren - 1).name, "extra")
+
+    def testOpenLazyInvalid(self):
+        with tempfile.TemporaryDirectory() as dir:
+            with self.assertRaises(RuntimeError):
+                Tree.openLazy(os.path.join(dir, "tree.snap"), 100)
+
+    def testChangesAreBatched(self):
+        tree = Tree()
+        root = tree.root
+        batches = []
+        tree.subscribe(lambda changes: batches.append([(c.type, c.node) for c in changes]))
+        a = root.createChild("a")
+        b = root.createChild("b")
+        self.assertEqual(tree.numPendingChanges, 2)
+        self.assertEqual(batches, [])
+        tree.flushChanges()
+        self.assertEqual(batches, [[(ChangeType.ChildCreated, a), (ChangeType.ChildCreated, b)]])
+        self.assertEqual(tree.numPendingChanges, 0)
+        tree.flushChanges()  # nothing pending: no call
+        self.assertEqual(len(batches), 1)
+
+    def testChangesAreCoalesced(self):
+        tree = Tree()
+        root = tree.root
+        a = root.createChild("a")
+        batches = []
+        tree.subscribe(lambda changes: batches.append([(c.type, c.node.name) for c in changes]))
+        for i in range(10):
+            a.name = "a" + str(i)
+        b = root.createChild("b")
+        b.name = "b1"  # created in the same batch
+        c = a.createChild("c")
+        c.name = "c1"
+        a.clearChildren()  # c is removed
+        a.clearChildren()
+        a.createChild("d")
+        tree.flushChanges()
+        self.assertEqual(batches, [[
+            (ChangeType.Renamed, "a9"),
+            (ChangeType.ChildCreated, "b1"),
+            (ChangeType.ChildrenCleared, "a9"),
+            (ChangeType.ChildCreated, "d")]])
+        a.name = "a10"  # recorded again after the flush
+        tree.flushChanges()
+        self.assertEqual(batches[1], [(ChangeType.Renamed, "a10")])
+
+    def testChangesBuildFrom(self):
+        tree = Tree()
+        changes = []
+        tree.subscribe(changes.extend)
+        tree.buildFrom([-1, 0, -1], ["a", "b", "c"])
+        tree.flushChanges()
+        self.assertEqual([c.node.name for c in changes], ["a", "b", "c"])
+        self.assertTrue(all(c.type == ChangeType.ChildCreated for c in changes))
+
+    def testUnsubscribe(self):
+        tree = Tree()
+        root = tree.root
+        changes1 = []
+        changes2 = []
+        id1 = tree.subscribe(changes1.extend)
+        id2 = tree.subscribe(changes2.extend)
+        self.assertNotEqual(id1, id2)
+        root.createChild("a")
+        tree.unsubscribe(id1)
+        tree.flushChanges()
+        self.assertEqual(len(changes1), 0)
+        self.assertEqual(len(changes2), 1)
+        tree.unsubscribe(id2)
+        tree.unsubscribe(id2)  # no-op
+        root.createChild("b")
+        self.assertEqual(tree.numPendingChanges, 0)  # nothing recorded
+
+    def testChangesDuringFlush(self):
+        tree = Tree()
+        root = tree.root
+        batches = []
+        def subscriber(changes):
+            batches.append([c.node.name for c in changes])
+            if len(batches) == 1:
+                root.createChild("b")
+                tree.flushChanges()  # nested: does nothing
+        tree.subscribe(subscriber)
+        root.createChild("a")
+        tree.flushChanges()
+        self.assertEqual(batches, [["a"]])
+        self.assertEqual(tree.numPendingChanges, 1)
+        tree.flushChanges()
+        self.assertEqual(batches, [["a"], ["b"]])
+
+    def testSubscriberException(self):
+        tree = Tree()
+        def subscriber(changes):
+            raise ValueError("subscriber error")
+        id = tree.subscribe(subscriber)
+        tree.root.createChild("a")
+        with self.assertRaises(ValueError):
+            tree.flushChanges()
+        self.assertEqual(tree.numPendingChanges, 0)
+        tree.unsubscribe(id)
+
+    def testPendingChangesDoNotKeepNodesAlive(self):
+        if not x03.TELEMETRY_ENABLED:
+            self.skipTest("requires telemetry")
+        tree = Tree()
+        batches = []
+        id = tree.subscribe(lambda changes: batches.append([c.node.name for c in changes]))
+        live = x03.stats()["Node"]["live"]
+        for i in range(10):
+            tree.root.createChild(f"n{i}")
+        tree.root.clearChildren()
+        self.assertEqual(x03.stats()["Node"]["live"], live)  # destroyed before the flush
+        self.assertEqual(tree.numPendingChanges, 11)
+        tree.flushChanges()
+        self.assertEqual(batches, [["root"]])
+        tree.unsubscribe(id)
+
+    def testStats(self):
+        stats = x03.stats()["Node"]
+        self.assertEqual(set(stats.keys()), {
+            "live", "peak", "created", "destroyed",
+            "liveBytes", "allocatedBytes", "locks", "failedLocks"})
+        if not x03.TELEMETRY_ENABLED:
+            self.assertEqual(stats["created"], 0)
+            return
+        tree = Tree()
+        root = tree.root
+        for i in range(10):
+            root.createChild(f"n{i}")
+        child = root.child(0)
+        after = x03.stats()["Node"]
+        self.assertEqual(after["created"] - stats["created"], 11)
+        self.assertGreaterEqual(after["peak"], after["live"])
+        self.assertGreater(after["locks"], stats["locks"])
+        del root, child
+        del tree
+        final = x03.stats()["Node"]
+        self.assertEqual(final["live"], stats["live"])
+        self.assertEqual(final["liveBytes"], stats["liveBytes"])
+
 if __name__ == '__main__':
     unittest.main()
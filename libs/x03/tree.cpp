@@ -1 +1,542 @@
 #include "tree.h"
+
+#include <algorithm> // find_if
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility> // move
+
+#include "../snapshot.h"
+
+namespace {
+
+// Stack used by Node::detachSubtrees_(), reused across calls so that
+// removing a subtree doesn't allocate in the common case.
+//
+// To be reentrant, a call takes the buffer by swapping it with an empty
+// vector, and gives it back when done. A nested call (e.g., from the
+// destructor of a node released by an outer call, if it still has
+// children) simply finds an empty buffer and allocates its own.
+//
+// Only buffers up to a given capacity are kept, so that removing a huge
+// subtree once doesn't hold on to its memory for the lifetime of the thread.
+//
+// Trivially destructible, so they can still be used while the thread exits
+// (e.g., when a tree is destroyed by the destructor of a static or
+// thread_local object), as in ../telemetry.cpp. The buffer is then simply not
+// reused anymore.
+//
+thread_local std::vector<NodeSharedPtr>* detachStack = nullptr;
+thread_local bool hasExited = false;
+
+constexpr size_t maxRetainedCapacity = 1 << 16;
+
+struct DetachStackExit {
+    ~DetachStackExit() {
+        delete detachStack;
+        detachStack = nullptr;
+        hasExited = true;
+    }
+};
+
+// Returns the buffer of this thread, or nullptr if the thread is exiting.
+//
+std::vector<NodeSharedPtr>* threadDetachStack() {
+    if (!detachStack && !hasExited) {
+        detachStack = new std::vector<NodeSharedPtr>();
+        thread_local DetachStackExit exit;
+        static_cast<void>(exit);
+    }
+    return detachStack;
+}
+
+// Checks that `parents` and `names` are valid arguments for Tree::buildFrom(),
+// and returns the number of children of each node, where index 0 is the root
+// and index `i + 1` is node `i`.
+//
+std::vector<uint32_t> countChildren(
+    const std::vector<int64_t>& parents,
+    const std::vector<std::string_view>& names) {
+
+    size_t n = parents.size();
+    if (names.size() != n) {
+        throw std::invalid_argument("parents and names must have the same size");
+    }
+    std::vector<uint32_t> numChildren(n + 1, 0);
+    for (size_t i = 0; i < n; ++i) {
+        int64_t parent = parents[i];
+        if (parent < -1 || parent >= static_cast<int64_t>(i)) {
+            throw std::invalid_argument(
+                "invalid parent " + std::to_string(parent) + " for node "
+                + std::to_string(i) + ": must be -1 or less than " + std::to_string(i));
+        }
+        ++numChildren[static_cast<size_t>(parent + 1)];
+    }
+    return numChildren;
+}
+
+// Bit of the given type in Node::pendingChanges_.
+//
+uint8_t changeBit(ChangeType type) {
+    return static_cast<uint8_t>(1u << static_cast<unsigned>(type));
+}
+
+} // namespace
+
+namespace detail {
+
+// Backing store of a lazy tree, see Tree::openLazy().
+//
+// The snapshot only stores the parent of each node, so we build the reverse
+// mapping once when opening it, as two flat arrays: the children of node `i`
+// are `children[childOffsets[i]]` to `children[childOffsets[i + 1] - 1]`, in
+// their original order. Names are interned the first time a node with this
+// name is loaded.
+//
+// Loaded nodes whose children can be evicted are tracked in `clock`, in the
+// order their children were loaded, see evict().
+//
+struct LazyStore {
+    snapshot::Reader reader;
+    std::vector<uint32_t> childOffsets;
+    std::vector<uint32_t> children;
+    std::vector<std::optional<Atom>> atoms; // by name id
+
+    size_t maxLoadedNodes;
+    size_t numLoadedNodes = 1; // the root
+    int evictionSuspended = 0;
+
+    std::vector<NodeWeakPtr> clock;
+    size_t clockHand = 0;
+
+    LazyStore(const std::string& path, size_t maxLoadedNodes_)
+        : reader(path)
+        , childOffsets(reader.numNodes() + 1, 0)
+        , children(reader.numNodes() - 1)
+        , atoms(reader.numNames())
+        , maxLoadedNodes(maxLoadedNodes_) {
+
+        const uint32_t* parents = reader.parents();
+        size_t n = reader.numNodes();
+        for (size_t k = 1; k < n; ++k) {
+            ++childOffsets[parents[k] + 1];
+        }
+        for (size_t i = 0; i < n; ++i) {
+            childOffsets[i + 1] += childOffsets[i];
+        }
+        std::vector<uint32_t> next(childOffsets.begin(), childOffsets.end() - 1);
+        for (size_t k = 1; k < n; ++k) {
+            children[next[parents[k]]++] = static_cast<uint32_t>(k);
+        }
+    }
+
+    size_t numChildren(uint32_t index) const {
+        return childOffsets[index + 1] - childOffsets[index];
+    }
+
+    Atom atom(uint32_t index) {
+        std::optional<Atom>& atom = atoms[reader.nameIds()[index]];
+        if (!atom) {
+            atom = Atom(reader.name(reader.nameIds()[index]));
+        }
+        return *atom;
+    }
+
+    // Evicts the children of loaded nodes until the budget is met, or until
+    // nothing more can be evicted.
+    //
+    // This approximates LRU with the CLOCK algorithm: accessing the children
+    // of a node sets its `isReferenced_` bit, and the clock hand goes over the
+    // loaded nodes, giving a second chance to those whose bit is set (clearing
+    // it), and evicting the children of the others if possible. So each entry
+    // is visited at most twice per call.
+    //
+    // The children of `except` are never evicted, nor any ancestor of it, so
+    // that the caller of Node::materialize_() is not destroyed.
+    //
+    void evict(const Node* except) {
+        if (evictionSuspended > 0) {
+            return;
+        }
+        size_t steps = 2 * clock.size();
+        while (numLoadedNodes > maxLoadedNodes && !clock.empty() && steps-- > 0) {
+            if (clockHand >= clock.size()) {
+                clockHand = 0;
+            }
+            NodeSharedPtr node = telemetry::lock(clock[clockHand]);
+            if (!node || !node->tree_ || node->isStub_ || node->isPinned_) {
+                // Destroyed, removed from the tree, or never evictable again
+                clock[clockHand] = std::move(clock.back());
+                clock.pop_back();
+            }
+            else if (node.get() == except || node->isReferenced_) {
+                node->isReferenced_ = false;
+                ++clockHand;
+            }
+            else if (canEvictChildren(*node, except)) {
+                node->childIndex_.reset();
+                Node::detachSubtrees_(node->children_);
+                node->isStub_ = true;
+                clock[clockHand] = std::move(clock.back());
+                clock.pop_back();
+            }
+            else {
+                ++clockHand;
+            }
+        }
+    }
+
+    // Whether all descendants of `node` are unmodified nodes from the store
+    // that nobody but their parent references.
+    //
+    static bool canEvictChildren(const Node& node, const Node* except) {
+        std::vector<const Node*> stack = {&node};
+        while (!stack.empty()) {
+            const Node* n = stack.back();
+            stack.pop_back();
+            for (const NodeSharedPtr& child : n->children_) {
+                if (child.use_count() > 1 || child.get() == except || child->isPinned_
+                    || child->storeIndex_ == Node::noStoreIndex) {
+
+                    return false;
+                }
+                stack.push_back(child.get());
+            }
+        }
+        return true;
+    }
+};
+
+// Subscribers and pending changes of a tree, see Tree::subscribe(). Only
+// allocated while the tree has subscribers.
+//
+// Subscribers are shared so that flushChanges() can iterate over a copy of
+// the list, which subscribers may modify during the flush.
+//
+// Pending changes only hold a weak pointer to their node, so that recording
+// a change doesn't keep alive a node removed before the flush, nor prevent
+// the eviction of a lazily loaded node (see LazyStore::evict()). Only the
+// memory of the node is retained until the flush, since it is allocated
+// together with its control block by make_shared.
+//
+struct ChangeLog {
+    struct Subscriber {
+        Tree::SubscriptionId id;
+        Tree::ChangeCallback callback;
+        bool isActive = true; // false once unsubscribed
+    };
+
+    struct PendingChange {
+        ChangeType type;
+        NodeWeakPtr node;
+    };
+
+    std::vector<std::shared_ptr<Subscriber>> subscribers;
+    std::vector<PendingChange> changes;
+    std::vector<Change> batch; // delivered by flushChanges(), empty otherwise
+    bool isFlushing = false;
+
+    ChangeLog() = default;
+    DISABLE_COPY_AND_MOVE(ChangeLog);
+
+    // Discarded changes must not prevent the nodes from being recorded again.
+    ~ChangeLog() {
+        for (const PendingChange& change : changes) {
+            if (NodeSharedPtr node = change.node.lock()) {
+                node->pendingChanges_ = 0;
+            }
+        }
+    }
+};
+
+EvictionGuard::EvictionGuard(Tree* tree, const Node* node)
+    : store_(tree ? tree->lazy_.get() : nullptr)
+    , node_(node) {
+    if (store_) {
+        ++store_->evictionSuspended;
+    }
+}
+
+EvictionGuard::~EvictionGuard() {
+    if (store_) {
+        --store_->evictionSuspended;
+        if (store_->numLoadedNodes > store_->maxLoadedNodes) {
+            store_->evict(node_);
+        }
+    }
+}
+
+} // namespace detail
+
+// Removed from its tree, a stub cannot be loaded anymore, so it behaves as
+// if it had no children, like any other removed node.
+//
+void Node::materialize_() const {
+    // Only the children are modified, like when lazily creating childIndex_.
+    Node& self = const_cast<Node&>(*this);
+    self.isStub_ = false;
+    if (!tree_ || !tree_->lazy_) {
+        return;
+    }
+    detail::LazyStore& store = *tree_->lazy_;
+    uint32_t begin = store.childOffsets[storeIndex_];
+    uint32_t end = store.childOffsets[storeIndex_ + 1];
+    self.children_.reserve(end - begin);
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t index = store.children[i];
+        NodeSharedPtr child = detail::NodeCreateKey::create(tree_, &self, store.atom(index));
+        child->indexInParent_ = static_cast<uint32_t>(self.children_.size());
+        child->storeIndex_ = index;
+        child->isStub_ = store.numChildren(index) > 0;
+        self.children_.push_back(std::move(child));
+    }
+    store.numLoadedNodes += end - begin;
+    store.clock.push_back(self.weak_from_this());
+    if (store.numLoadedNodes > store.maxLoadedNodes) {
+        store.evict(this);
+    }
+}
+
+// The subtrees are walked once, depth-first. Ownership of each node is moved
+// (not copied) from its parent to the stack, then released once its children
+// have been moved to the stack. Therefore, the only atomic operations are the
+// final release of each node and the reset of its parent weak pointer, and
+// nodes that are not referenced elsewhere are destroyed during the walk,
+// without recursion since they have no children anymore.
+//
+void Node::detachSubtrees_(std::vector<NodeSharedPtr>& nodes) {
+    std::vector<NodeSharedPtr> stack;
+    if (std::vector<NodeSharedPtr>* buffer = threadDetachStack()) {
+        stack.swap(*buffer);
+    }
+
+    for (NodeSharedPtr& node : nodes) {
+        stack.push_back(std::move(node));
+    }
+    nodes.clear();
+
+    while (!stack.empty()) {
+        NodeSharedPtr node = std::move(stack.back());
+        stack.pop_back();
+        if (node->tree_ && node->storeIndex_ != noStoreIndex) {
+            --node->tree_->lazy_->numLoadedNodes;
+        }
+        node->tree_ = nullptr;
+        node->parent_.reset();
+        node->childIndex_.reset();
+        for (NodeSharedPtr& child : node->children_) {
+            stack.push_back(std::move(child));
+        }
+        node->children_.clear();
+    }
+
+    std::vector<NodeSharedPtr>* buffer = threadDetachStack();
+    if (buffer
+        && stack.capacity() <= maxRetainedCapacity
+        && stack.capacity() > buffer->capacity()) {
+
+        buffer->swap(stack);
+    }
+}
+
+Tree::Tree()
+    : root_(detail::NodeCreateKey::create(this, nullptr, Atom("root"))) {
+}
+
+Tree::~Tree() {
+    root_->tree_ = nullptr;
+    root_->clearChildren();
+}
+
+// Same as Node::createChild(), except that the child vectors are reserved
+// upfront, and that the children are moved into their parent rather than
+// copied, saving an atomic increment and decrement per node.
+//
+template<typename ParentOf, typename NameOf>
+void Tree::build_(const std::vector<uint32_t>& numChildren, ParentOf parentOf, NameOf nameOf) {
+    root_->ensureChildren_();
+    root_->markModified_();
+    std::vector<Node*> nodes(numChildren.size());
+    nodes[0] = root_.get();
+    root_->children_.reserve(root_->children_.size() + numChildren[0]);
+    for (size_t k = 1; k < nodes.size(); ++k) {
+        Node* parent = nodes[parentOf(k)];
+        NodeSharedPtr child = detail::NodeCreateKey::create(this, parent, nameOf(k));
+        child->indexInParent_ = static_cast<uint32_t>(parent->children_.size());
+        child->children_.reserve(numChildren[k]);
+        if (parent->childIndex_) {
+            parent->childIndex_->emplace(child->name_, child->indexInParent_);
+        }
+        nodes[k] = child.get();
+        parent->children_.push_back(std::move(child));
+        if (changeLog_) {
+            recordChange_(ChangeType::ChildCreated, *nodes[k]);
+        }
+    }
+}
+
+void Tree::buildFrom(
+    const std::vector<int64_t>& parents,
+    const std::vector<std::string_view>& names) {
+
+    build_(
+        countChildren(parents, names),
+        [&](size_t k) { return static_cast<size_t>(parents[k - 1] + 1); },
+        [&](size_t k) { return Atom(names[k - 1]); });
+}
+
+void Tree::save(const std::string& path) const {
+    snapshot::Writer writer;
+    std::vector<uint32_t> ancestors; // index in the snapshot, by depth
+    root_->visitDepthFirst([&](Node& node, size_t depth) {
+        ancestors.resize(depth);
+        uint32_t parent = depth == 0 ? snapshot::noParent : ancestors.back();
+        Atom name = node.nameAtom();
+        ancestors.push_back(writer.addNode(parent, name.id(), name.str()));
+    });
+    writer.write(path);
+}
+
+std::unique_ptr<Tree> Tree::load(const std::string& path) {
+    snapshot::Reader reader(path);
+    const uint32_t* parents = reader.parents();
+    const uint32_t* nameIds = reader.nameIds();
+    std::vector<Atom> atoms;
+    atoms.reserve(reader.numNames());
+    for (uint32_t i = 0; i < reader.numNames(); ++i) {
+        atoms.emplace_back(reader.name(i));
+    }
+    std::vector<uint32_t> numChildren(reader.numNodes(), 0);
+    for (size_t k = 1; k < reader.numNodes(); ++k) {
+        ++numChildren[parents[k]];
+    }
+    auto tree = std::make_unique<Tree>();
+    tree->root_->name_ = atoms[nameIds[0]];
+    tree->build_(
+        numChildren,
+        [&](size_t k) { return parents[k]; },
+        [&](size_t k) { return atoms[nameIds[k]]; });
+    return tree;
+}
+
+std::unique_ptr<Tree> Tree::openLazy(const std::string& path, size_t maxLoadedNodes) {
+    auto store = std::make_unique<detail::LazyStore>(path, maxLoadedNodes);
+    auto tree = std::make_unique<Tree>();
+    Node& root = *tree->root_;
+    root.name_ = store->atom(0);
+    root.storeIndex_ = 0;
+    root.isStub_ = store->numChildren(0) > 0;
+    tree->lazy_ = std::move(store);
+    return tree;
+}
+
+size_t Tree::numLoadedNodes() const {
+    return lazy_ ? lazy_->numLoadedNodes : 0;
+}
+
+Tree::SubscriptionId Tree::subscribe(ChangeCallback callback) {
+    if (!changeLog_) {
+        changeLog_ = std::make_unique<detail::ChangeLog>();
+    }
+    auto subscriber = std::make_shared<detail::ChangeLog::Subscriber>();
+    subscriber->id = ++lastSubscriptionId_;
+    subscriber->callback = std::move(callback);
+    changeLog_->subscribers.push_back(std::move(subscriber));
+    return lastSubscriptionId_;
+}
+
+void Tree::unsubscribe(SubscriptionId id) {
+    if (!changeLog_) {
+        return;
+    }
+    auto& subscribers = changeLog_->subscribers;
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [id](const auto& subscriber) {
+        return subscriber->id == id;
+    });
+    if (it != subscribers.end()) {
+        (*it)->isActive = false;
+        subscribers.erase(it);
+        if (subscribers.empty() && !changeLog_->isFlushing) {
+            changeLog_.reset();
+        }
+    }
+}
+
+// A rename is redundant if the node was already renamed or created since the
+// last flush, and clearing children is redundant if they were already cleared
+// since the last flush, since the nodes created in between are removed too.
+// Creations are never redundant.
+//
+void Tree::recordChange_(ChangeType type, Node& node) {
+    uint8_t redundant = changeBit(type);
+    if (type == ChangeType::Renamed) {
+        redundant |= changeBit(ChangeType::ChildCreated);
+    }
+    if (node.pendingChanges_ & redundant) {
+        return;
+    }
+    changeLog_->changes.push_back({type, node.weak_from_this()});
+    node.pendingChanges_ |= changeBit(type);
+}
+
+// The buffers of pending and delivered changes are given back to the log
+// after the flush (the former only if no changes were made in the meantime),
+// so that their capacity is reused by the next batch.
+//
+void Tree::flushChanges() {
+    detail::ChangeLog* log = changeLog_.get();
+    if (!log || log->isFlushing || log->changes.empty()) {
+        return;
+    }
+    std::vector<detail::ChangeLog::PendingChange> pending;
+    pending.swap(log->changes);
+    std::vector<Change> batch;
+    batch.swap(log->batch);
+    batch.reserve(pending.size());
+    for (const detail::ChangeLog::PendingChange& change : pending) {
+        NodeSharedPtr node = change.node.lock();
+        if (!node) { // destroyed since recorded
+            continue;
+        }
+        node->pendingChanges_ = 0;
+        if (node->tree_ == this) { // otherwise removed since recorded
+            batch.push_back({change.type, std::move(node)});
+        }
+    }
+
+    if (!batch.empty()) {
+        auto subscribers = log->subscribers;
+        log->isFlushing = true;
+        try {
+            for (const auto& subscriber : subscribers) {
+                if (subscriber->isActive) {
+                    subscriber->callback(batch);
+                }
+            }
+        }
+        catch (...) {
+            endFlush_();
+            throw;
+        }
+        endFlush_();
+    }
+    if (changeLog_) {
+        batch.clear();
+        changeLog_->batch.swap(batch);
+        if (changeLog_->changes.empty()) {
+            pending.clear();
+            changeLog_->changes.swap(pending);
+        }
+    }
+}
+
+void Tree::endFlush_() {
+    changeLog_->isFlushing = false;
+    if (changeLog_->subscribers.empty()) {
+        changeLog_.reset();
+    }
+}
+
+size_t Tree::numPendingChanges() const {
+    return changeLog_ ? changeLog_->changes.size() : 0;
+}
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cstdint>
 #include <exception>
+#include <functional>
 #include <memory> // shared_ptr
+#include <optional>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <utility> // pair
 #include <vector>
 
+#include "../atom.h"
 #include "../common.h"
+#include "../telemetry.h"
+#include "../wrapperslot.h"
 
 class Tree;
 class Node;
@@ -14,6 +22,20 @@ class Node;
 using NodeSharedPtr = std::shared_ptr<Node>;
 using NodeWeakPtr = std::weak_ptr<Node>;
 
+// Kind of modification of a tree, as delivered to subscribers, see
+// Tree::subscribe().
+//
+enum class ChangeType : uint8_t {
+    ChildCreated,   // `node` was created
+    Renamed,        // `node` was renamed
+    ChildrenCleared // all children of `node` were removed
+};
+
+struct Change {
+    ChangeType type;
+    NodeSharedPtr node;
+};
+
 namespace detail {
 
 // Constructor of Node must be private-like to enforce that it is created via
@@ -25,24 +47,48 @@ private:
     friend Node;
     NodeCreateKey() = default;
 
-    static NodeSharedPtr create(Tree* tree, Node* parent, std::string_view name) {
+    static NodeSharedPtr create(Tree* tree, Node* parent, Atom name) {
         NodeCreateKey key;
         return std::make_shared<Node>(key, tree, parent, name);
     }
 };
 
+struct LazyStore;
+struct ChangeLog;
+
+// Prevents the eviction of lazily loaded nodes (see Tree::openLazy()) for
+// its lifetime, so that raw pointers to nodes can be used safely, e.g.,
+// during a traversal. On destruction, evicts what is over budget, except
+// `node` and its ancestors. Does nothing if the tree is not lazy.
+//
+class API EvictionGuard {
+public:
+    EvictionGuard(Tree* tree, const Node* node);
+    ~EvictionGuard();
+
+    DISABLE_COPY_AND_MOVE(EvictionGuard);
+
+private:
+    LazyStore* store_;
+    const Node* node_;
+};
+
 } // namespace detail
 
 class API Node : public std::enable_shared_from_this<Node> {
 public:
+    static constexpr telemetry::ObjectType objectType = telemetry::ObjectType::Node;
+
     // Note: we cannot just write parent_(parent) since weak_ptr doesn't have
     // a constructor from a raw pointer, and we cannot write
     // parent->weak_from_this() directly since parent might be nullptr.
     //
-    Node(detail::NodeCreateKey, Tree* tree, Node* parent, std::string_view name)
+    Node(detail::NodeCreateKey, Tree* tree, Node* parent, Atom name)
         : tree_(tree)
         , parent_(parent ? parent->weak_from_this() : NodeWeakPtr())
         , name_(name) {
+
+        TELEMETRY_CREATED(Node);
     }
 
     // As opposed to x02, it is now mandatory to implement ~Node() in order to
@@ -55,6 +101,7 @@ public:
     //
     ~Node() {
         clearChildren();
+        TELEMETRY_DESTROYED(Node);
     }
 
     // Cannot be copied or moved because tree/nodes store the addresses of
@@ -81,63 +128,247 @@ public:
     }
 
     std::string_view name() const {
+        return name_.str();
+    }
+
+    // Comparing the atoms of two names is faster than comparing the names.
+    Atom nameAtom() const {
         return name_;
     }
 
     void setName(std::string_view name) {
-        name_ = name;
+        markModified_();
+        Atom newName(name);
+        if (NodeSharedPtr parent = telemetry::lock(parent_); parent && parent->childIndex_) {
+            parent->renameInChildIndex_(*this, newName);
+        }
+        name_ = newName;
+        recordChange_(ChangeType::Renamed);
     }
 
     size_t numChildren() const {
+        ensureChildren_();
         return children_.size();
     }
 
     // Guaranteed non-null if it exists, otherwise throws.
     // Might be deleted from another thread by the time you call `lock()` though.
+    // In a lazy tree, might also be evicted once no longer locked.
     NodeWeakPtr child(size_t index) const {
+        ensureChildren_();
         return children_.at(index);
     }
 
+    // Returns the first child with the given name, or null if there is none.
+    //
+    // Same strategy as in x02: linear scan comparing atoms for nodes with
+    // fewer than `childIndexThreshold` children, otherwise a hash index built
+    // on first call and kept up to date by createChild(), setName() and
+    // clearChildren().
+    //
+    NodeWeakPtr findChild(std::string_view name) const {
+        std::optional<Atom> atom = Atom::find(name);
+        return atom ? findChild(*atom) : NodeWeakPtr();
+    }
+
+    NodeWeakPtr findChild(Atom name) const {
+        ensureChildren_();
+        if (children_.size() < childIndexThreshold) {
+            for (const NodeSharedPtr& child : children_) {
+                if (child->name_ == name) {
+                    return child;
+                }
+            }
+            return NodeWeakPtr();
+        }
+        if (!childIndex_) {
+            auto index = std::make_unique<ChildIndex>();
+            index->reserve(children_.size());
+            for (size_t i = 0; i < children_.size(); ++i) {
+                index->emplace(children_[i]->name_, i);
+            }
+            childIndex_ = std::move(index);
+        }
+        auto it = childIndex_->find(name);
+        return it == childIndex_->end() ? NodeWeakPtr() : children_[it->second];
+    }
+
+    static constexpr size_t childIndexThreshold = 16;
+
     // Guaranteed non-null, throws if memory allocation fails.
     // Might be deleted from another thread by the time you call `lock()` though.
     NodeWeakPtr createChild(std::string_view name) {
-        children_.push_back(detail::NodeCreateKey::create(tree(), this, name));
-        return children_.back();
+        return createChild(Atom(name));
     }
 
+    // Same as createChild(std::string_view), but without having to intern
+    // the name.
+    NodeWeakPtr createChild(Atom name) {
+        ensureChildren_();
+        markModified_();
+        NodeSharedPtr child = detail::NodeCreateKey::create(tree(), this, name);
+        child->indexInParent_ = static_cast<uint32_t>(children_.size());
+        children_.push_back(child);
+        if (childIndex_) {
+            childIndex_->emplace(child->name_, child->indexInParent_);
+        }
+        child->recordChange_(ChangeType::ChildCreated);
+        return child;
+    }
+
+    // Removes all descendants from the tree in a single non-recursive pass.
+    // Nodes that are not referenced elsewhere are then destroyed.
     void clearChildren() {
-        for (auto child : children_) {
-            child->detach_();
+        bool hadChildren = isStub_ || !children_.empty();
+        isStub_ = false; // no need to load children only to remove them
+        markModified_();
+        childIndex_.reset();
+        if (!children_.empty()) {
+            detachSubtrees_(children_);
+        }
+        if (hadChildren) {
+            recordChange_(ChangeType::ChildrenCleared);
         }
-        children_.clear();
+    }
+
+    // Calls `f(node, depth)` for this node and all its descendants, in
+    // depth-first pre-order, where `depth` is relative to this node. The tree
+    // must not be modified during the traversal. In a lazy tree, this loads
+    // the whole subtree, and nothing is evicted during the traversal.
+    //
+    template<typename F>
+    void visitDepthFirst(F&& f) {
+        detail::EvictionGuard guard(tree_, this);
+        std::vector<std::pair<Node*, size_t>> stack;
+        stack.emplace_back(this, 0);
+        while (!stack.empty()) {
+            auto [node, depth] = stack.back();
+            stack.pop_back();
+            f(*node, depth);
+            node->ensureChildren_();
+            const auto& children = node->children_;
+            for (auto it = children.rbegin(); it != children.rend(); ++it) {
+                stack.emplace_back(it->get(), depth + 1); // reversed: visited in order
+            }
+        }
+    }
+
+    // Same as visitDepthFirst(), but in breadth-first order.
+    //
+    template<typename F>
+    void visitBreadthFirst(F&& f) {
+        detail::EvictionGuard guard(tree_, this);
+        std::vector<std::pair<Node*, size_t>> queue;
+        queue.emplace_back(this, 0);
+        for (size_t i = 0; i < queue.size(); ++i) {
+            auto [node, depth] = queue[i];
+            f(*node, depth);
+            node->ensureChildren_();
+            for (const auto& child : node->children_) {
+                queue.emplace_back(child.get(), depth + 1);
+            }
+        }
+    }
+
+    // Python wrapper of this node, if any, see ../wrapperslot.h.
+    void* wrapper() const {
+        return wrapperSlot_.get();
+    }
+
+    void setWrapper(void* wrapper) const {
+        wrapperSlot_.set(wrapper);
     }
 
 private:
     Tree* tree_;
     NodeWeakPtr parent_;
     std::vector<NodeSharedPtr> children_;
-    std::string name_;
+    Atom name_; // interned, see ../atom.h
+    uint32_t indexInParent_ = 0;
 
-    // Note: Node::shared_from_this() cannot be called from the destructor of
-    // Node (bad_weak_ptr exception). This is why in ~Node(), we call this for
-    // each children (which we know are still alive C++ objects since we still
-    // own a non-null shared_ptr to them), but not on the current node itself.
+    // Lazy trees only (see Tree::openLazy()). These fit in what would
+    // otherwise be padding, so they cost no memory to other trees.
     //
-    friend Tree;
-    void detach_() {
-        std::vector<NodeSharedPtr> stack; // allows non-recursive implementation
-        stack.push_back(shared_from_this());
-        while (!stack.empty()) {
-            NodeSharedPtr node = stack.back();
-            stack.pop_back();
-            for (const auto& child : node->children_) {
-                stack.push_back(child);
+    // - storeIndex_: index of the node in the snapshot, or noStoreIndex if
+    //   the node was not loaded from the snapshot
+    // - isStub_: whether the children are still to be loaded
+    // - isReferenced_: whether the children have been accessed since the
+    //   last eviction pass (see LazyStore::evict())
+    // - isPinned_: whether the name or the children have been modified, in
+    //   which case the children cannot be evicted anymore, since they would
+    //   be reloaded without the modifications
+    //
+    // Same for pendingChanges_, used by observed trees only: one bit per
+    // ChangeType of this node recorded since the last flush, see
+    // Tree::recordChange_().
+    //
+    static constexpr uint32_t noStoreIndex = UINT32_MAX;
+    uint32_t storeIndex_ = noStoreIndex;
+    mutable bool isStub_ = false;
+    mutable bool isReferenced_ = false;
+    bool isPinned_ = false;
+    uint8_t pendingChanges_ = 0;
+
+    void ensureChildren_() const {
+        if (storeIndex_ != noStoreIndex) {
+            if (isStub_) {
+                materialize_();
             }
-            node->tree_ = nullptr;
-            node->parent_.reset();
-            node->children_.clear();
+            isReferenced_ = true;
         }
     }
+
+    void markModified_() {
+        if (storeIndex_ != noStoreIndex) {
+            isPinned_ = true;
+        }
+    }
+
+    // Loads the children from the snapshot, then evicts other nodes if the
+    // tree exceeds its budget. See tree.cpp.
+    void materialize_() const;
+
+    friend detail::LazyStore;
+    friend detail::ChangeLog;
+
+    // Records the change for the subscribers of the tree, if any. Defined
+    // after Tree.
+    void recordChange_(ChangeType type);
+
+    // Maps each name to the index of the first child with this name.
+    using ChildIndex = std::unordered_map<Atom, size_t>;
+    mutable std::unique_ptr<ChildIndex> childIndex_;
+
+    // The wrapper holds a NodeSharedPtr, so it never outlives the node.
+    mutable WrapperSlot wrapperSlot_;
+
+    void renameInChildIndex_(const Node& child, Atom newName) {
+        ChildIndex& index = *childIndex_;
+        size_t i = child.indexInParent_;
+        auto it = index.find(child.name_);
+        if (it != index.end() && it->second == i) {
+            index.erase(it);
+            for (size_t j = i + 1; j < children_.size(); ++j) {
+                if (children_[j]->name_ == child.name_) {
+                    index.emplace(child.name_, j);
+                    break;
+                }
+            }
+        }
+        auto [it2, inserted] = index.emplace(newName, i);
+        if (!inserted && it2->second > i) {
+            it2->second = i;
+        }
+    }
+
+    // Removes the given nodes and all their descendants from the tree, then
+    // releases them. On return, `nodes` is empty. See tree.cpp.
+    //
+    // Note: this doesn't need Node::shared_from_this(), which couldn't be
+    // called from ~Node() anyway (bad_weak_ptr exception).
+    //
+    friend Tree;
+    static void detachSubtrees_(std::vector<NodeSharedPtr>& nodes);
 };
 
 class API Tree {
@@ -147,26 +378,160 @@ public:
     //
     DISABLE_COPY_AND_MOVE(Tree);
 
-    Tree()
-        : root_(detail::NodeCreateKey::create(this, nullptr, "root")) {
-    }
+    Tree();
 
-    ~Tree() {
-        // Note: no need to pin here: Tree has no mutator of root_ In fact,
-        // `root_` could be made a `NonNullSharedPtr`: a custom shared_ptr that
-        // does not have a reset_() function and throws if constructed with a
-        // nullptr.
-        root_->detach_();
-    }
+    // Note: no need to pin root_ here: Tree has no mutator of root_ In fact,
+    // `root_` could be made a `NonNullSharedPtr`: a custom shared_ptr that
+    // does not have a reset_() function and throws if constructed with a
+    // nullptr.
+    //
+    ~Tree();
 
     // guaranteed non-null: our tree is assumed to always has a root.
     NodeWeakPtr root() {
         return root_;
     };
 
+    // Returns the node at the given path relative to the root, e.g., "a/b/c",
+    // or null if there is none. Empty components are ignored, so "" is the
+    // root.
+    //
+    NodeWeakPtr find(std::string_view path) {
+        NodeSharedPtr node = root_;
+        while (node && !path.empty()) {
+            size_t i = path.find('/');
+            std::string_view component = path.substr(0, i);
+            path = (i == std::string_view::npos) ? std::string_view() : path.substr(i + 1);
+            if (!component.empty()) {
+                node = telemetry::lock(node->findChild(component));
+            }
+        }
+        return node;
+    }
+
+    // Creates nodes under the root from flat arrays, in a single call: node
+    // `i` is named `names[i]`, and its parent is the root if `parents[i]` is
+    // -1, otherwise the node created for `parents[i]`, which must be less than
+    // `i` (e.g., nodes listed in pre-order or breadth-first order).
+    //
+    // This is faster than calling createChild() for each node, since each
+    // child vector is allocated once with its final capacity.
+    //
+    // Throws std::invalid_argument if the arrays have different sizes or if a
+    // parent index is invalid, in which case the tree is left unchanged.
+    //
+    void buildFrom(const std::vector<int64_t>& parents, const std::vector<std::string_view>& names);
+
+    // Writes the names and topology of the tree to the given file, see
+    // ../snapshot.h. Throws std::runtime_error if the file cannot be written.
+    //
+    void save(const std::string& path) const;
+
+    // Creates a tree from a file written by save().
+    //
+    // The file is mapped in memory, and the tree is rebuilt in one linear
+    // pass over it, like buildFrom(). Each distinct name is only interned
+    // once. Throws std::runtime_error if the file cannot be read or is not a
+    // valid snapshot.
+    //
+    static std::unique_ptr<Tree> load(const std::string& path);
+
+    // Creates a lazy tree backed by a file written by save(), which stays
+    // mapped in memory for the lifetime of the tree.
+    //
+    // Initially, only the root is loaded. The children of a node are loaded
+    // the first time they are accessed (numChildren(), child(), findChild(),
+    // traversals, ...).
+    //
+    // Once more than `maxLoadedNodes` nodes are loaded, the children of the
+    // least recently accessed nodes are evicted, that is, removed from the
+    // tree then loaded again if accessed later, like after clearChildren().
+    // Only subtrees that are not locked (no other shared pointer than their
+    // parent's) and not modified can be evicted, so `maxLoadedNodes` is a
+    // soft limit.
+    //
+    // Throws std::runtime_error if the file cannot be read or is not a valid
+    // snapshot.
+    //
+    static std::unique_ptr<Tree> openLazy(const std::string& path, size_t maxLoadedNodes);
+
+    // Whether the tree was created by openLazy().
+    bool isLazy() const {
+        return lazy_ != nullptr;
+    }
+
+    // Number of nodes currently loaded from the snapshot, including the root,
+    // or 0 if the tree is not lazy.
+    size_t numLoadedNodes() const;
+
+    using ChangeCallback = std::function<void(const std::vector<Change>&)>;
+    using SubscriptionId = uint64_t;
+
+    // Calls `callback` with the changes of the tree (createChild(),
+    // setName(), clearChildren(), buildFrom()), in batches: changes are
+    // recorded into a buffer, which is delivered to all subscribers at the
+    // next call to flushChanges().
+    //
+    // Redundant changes are coalesced when recorded: a node renamed several
+    // times, or created then renamed, only appears once in a batch, and so
+    // does a node cleared several times. At flush time, changes of nodes that
+    // are no longer in the tree (e.g., created then removed) are dropped.
+    // Pending changes do not keep their nodes alive.
+    // Therefore, subscribers should read the current state of the nodes
+    // (e.g., their name) rather than expect one change per modification.
+    //
+    // Changes made by lazy loading or eviction (see openLazy()) are not
+    // recorded, since the tree is logically unchanged.
+    //
+    // Trees without subscribers record nothing: each modification only
+    // costs a null check.
+    //
+    SubscriptionId subscribe(ChangeCallback callback);
+
+    // Removes the given subscriber, if it exists. Once there are no
+    // subscribers left, pending changes are discarded.
+    //
+    void unsubscribe(SubscriptionId id);
+
+    // Delivers the pending changes, if any, as one batch to each subscriber.
+    //
+    // Changes made by subscribers during the flush are delivered at the next
+    // flush, and nested calls to flushChanges() do nothing. If a subscriber
+    // throws, the exception is propagated, and the remaining subscribers do
+    // not receive this batch. Subscribers must not destroy the tree.
+    //
+    void flushChanges();
+
+    // Number of changes recorded since the last flush, before dropping those
+    // of removed nodes.
+    size_t numPendingChanges() const;
+
 private:
     NodeSharedPtr root_;
+    std::unique_ptr<detail::LazyStore> lazy_;
+    std::unique_ptr<detail::ChangeLog> changeLog_; // null if no subscribers
+    SubscriptionId lastSubscriptionId_ = 0;
+    friend detail::EvictionGuard;
+    friend Node;
+
+    void recordChange_(ChangeType type, Node& node);
+    void endFlush_();
+
+    // Creates nodes under the root, where node `k` (for `0 < k < n`, with
+    // `n = numChildren.size()`) has `numChildren[k]` children, is named
+    // `nameOf(k)`, and has for parent the node `parentOf(k) < k`, where 0 is
+    // the root. The arguments must have been validated.
+    //
+    template<typename ParentOf, typename NameOf>
+    void build_(const std::vector<uint32_t>& numChildren, ParentOf parentOf, NameOf nameOf);
 };
 
+// Only a null check if nobody is subscribed to the changes of the tree.
+inline void Node::recordChange_(ChangeType type) {
+    if (tree_ && tree_->changeLog_) {
+        tree_->recordChange_(type, *this);
+    }
+}
+
 // Note: same questions about constness as in x02.
 // We could have SharedConstPtr and WeakConstPtr.
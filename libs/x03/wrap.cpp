@@ -1,8 +1,18 @@
+#include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 namespace py = pybind11;
 using rvp = py::return_value_policy;
 
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../pytelemetry.h"
+#include "../pytraversal.h"
+#include "../wrappercaster.h"
 #include "tree.h"
 
 // [1] Major issue:
@@ -56,9 +66,23 @@ using rvp = py::return_value_policy;
 //   TypeError: Unable to convert function return value to a Python type! The signature was
 //   	(arg0: x03.Tree) -> std::__1::weak_ptr<Node>
 //
+// [5] Wrapper slots:
+//
+// Finding out whether pybind11 "knows the instance already" [1] is a lookup in
+// a global hash map keyed by address, for each returned node. Instead, each
+// node stores a pointer to its wrapper, if any (see ../wrapperslot.h), which
+// our type caster for NodeSharedPtr returns directly.
+//
+WRAPPER_SLOT_HOLDER_CASTER(Node);
 
+// [3] Bulk traversals:
+//
+// `children()`, `descendants()`, `walk()` and `subtreeNames()` traverse the
+// subtree in C++ and return a single Python list, see ../pytraversal.h.
+//
 void wrap_node(py::module& m) {
-    py::class_<Node, NodeSharedPtr>(m, "Node")
+    py::class_<Node, NodeSharedPtr>(
+        m, "Node", py::custom_type_setup(&wrapperslot::setupType<Node>)) // [5]
 
         // the tree should not keep alive the node, hence rvp::reference
         .def_property_readonly("tree", &Node::tree, rvp::reference)
@@ -66,7 +90,7 @@ void wrap_node(py::module& m) {
         // the parent should not keep alive the child, hence rvp::reference
         .def_property_readonly(
             "parent",
-            [](Node& self) -> NodeSharedPtr { return self.parent().lock(); },
+            [](Node& self) -> NodeSharedPtr { return telemetry::lock(self.parent()); },
             rvp::reference)
 
         // the rvp does not matter here: pybind11 will make a copy into a Python string
@@ -78,14 +102,66 @@ void wrap_node(py::module& m) {
         // the returned child should keep alive its parent [1].
         .def(
             "child",
-            [](Node& self, size_t i) -> NodeSharedPtr { return self.child(i).lock(); },
+            [](Node& self, size_t i) -> NodeSharedPtr { return telemetry::lock(self.child(i)); },
+            rvp::reference_internal)
+
+        // the found child should keep alive its parent [1]. Returns None if
+        // there is no child with this name.
+        .def(
+            "findChild",
+            [](Node& self, std::string_view name) -> NodeSharedPtr {
+                return telemetry::lock(self.findChild(name));
+            },
             rvp::reference_internal)
 
+        // Bulk traversals [3]. The returned nodes are shared pointers, like
+        // `child`.
+        .def(
+            "children",
+            [](Node& self) {
+                size_t n = self.numChildren();
+                py::list res(n);
+                for (size_t i = 0; i < n; ++i) {
+                    res[i] = py::cast(telemetry::lock(self.child(i)));
+                }
+                return res;
+            })
+        .def(
+            "descendants",
+            [](Node& self, std::string_view order) {
+                py::list res;
+                pytraversal::visit(self, pytraversal::parseOrder(order), [&](Node& n, size_t depth) {
+                    if (depth > 0) {
+                        res.append(py::cast(n.shared_from_this()));
+                    }
+                });
+                return res;
+            },
+            py::arg("order") = "dfs")
+        .def(
+            "walk",
+            [](Node& self) {
+                pytraversal::NameCache names;
+                py::list res;
+                self.visitDepthFirst([&](Node& n, size_t depth) {
+                    res.append(py::make_tuple(depth, names.get(n.nameAtom())));
+                });
+                return res;
+            })
+        .def(
+            "subtreeNames",
+            [](Node& self) {
+                pytraversal::NameCache names;
+                py::list res;
+                self.visitDepthFirst([&](Node& n, size_t) { res.append(names.get(n.nameAtom())); });
+                return res;
+            })
+
         // the created child should keep alive its parent [1].
         .def(
             "createChild",
             [](Node& self, std::string_view name) -> NodeSharedPtr {
-                return self.createChild(name).lock();
+                return telemetry::lock(self.createChild(name));
             }, // [2]
             rvp::reference_internal)
 
@@ -93,6 +169,125 @@ void wrap_node(py::module& m) {
         .def("clearChildren", &Node::clearChildren);
 }
 
+// [4] Bulk construction:
+//
+// `Tree.buildFrom(parents, names)` first copies its arguments into C++
+// vectors with the GIL held, then builds the whole tree with the GIL released
+// (see Tree::buildFrom()). As with `clearChildren`, the tree must not be
+// accessed from other Python threads during the call.
+//
+// `parents` can be any one-dimensional buffer of signed integers (e.g., a
+// numpy array or an `array.array`), which is copied without creating any Python
+// object, or any sequence of integers. `names` can be any sequence of
+// strings. We keep our own list of references to the strings so that their
+// UTF-8 representation, cached by Python in the string objects, remains valid
+// while the GIL is released.
+//
+namespace {
+
+template<typename T>
+void appendIndices(const py::buffer_info& info, std::vector<int64_t>& indices) {
+    const char* data = static_cast<const char*>(info.ptr);
+    for (py::ssize_t i = 0; i < info.shape[0]; ++i) {
+        T index;
+        std::memcpy(&index, data + i * info.strides[0], sizeof(T));
+        indices.push_back(static_cast<int64_t>(index));
+    }
+}
+
+// Only native signed integers are supported, since -1 denotes the root.
+//
+std::vector<int64_t> indicesFromBuffer(const py::buffer_info& info) {
+    const uint16_t one = 1;
+    const char nativeByteOrder = *reinterpret_cast<const char*>(&one) == 1 ? '<' : '>';
+    std::string_view format = info.format;
+    if (!format.empty()
+        && (format[0] == '@' || format[0] == '=' || format[0] == nativeByteOrder)) {
+        format.remove_prefix(1);
+    }
+    if (info.ndim != 1 || format.size() != 1
+        || std::string_view("bhilqn").find(format[0]) == std::string_view::npos) {
+        throw py::type_error("parents must be a one-dimensional buffer of signed integers");
+    }
+    std::vector<int64_t> indices;
+    indices.reserve(static_cast<size_t>(info.shape[0]));
+    switch (info.itemsize) {
+    case 1:
+        appendIndices<int8_t>(info, indices);
+        break;
+    case 2:
+        appendIndices<int16_t>(info, indices);
+        break;
+    case 4:
+        appendIndices<int32_t>(info, indices);
+        break;
+    case 8:
+        appendIndices<int64_t>(info, indices);
+        break;
+    default:
+        throw py::type_error("unsupported integer size in parents buffer");
+    }
+    return indices;
+}
+
+std::vector<int64_t> toIndices(py::handle parents) {
+    if (PyObject_CheckBuffer(parents.ptr())) {
+        return indicesFromBuffer(py::reinterpret_borrow<py::buffer>(parents).request());
+    }
+    std::vector<int64_t> indices;
+    for (py::handle item : py::reinterpret_borrow<py::sequence>(parents)) {
+        if (!PyLong_Check(item.ptr())) {
+            throw py::type_error("parents must contain integers");
+        }
+        indices.push_back(item.cast<int64_t>());
+    }
+    return indices;
+}
+
+// Fills `names` with views of the strings in `list`, which must stay alive
+// while the views are in use.
+//
+void toNames(const py::list& list, std::vector<std::string_view>& names) {
+    names.reserve(list.size());
+    for (py::handle item : list) {
+        if (!PyUnicode_Check(item.ptr())) {
+            throw py::type_error("names must contain strings");
+        }
+        Py_ssize_t size = 0;
+        const char* data = PyUnicode_AsUTF8AndSize(item.ptr(), &size);
+        if (!data) {
+            throw py::error_already_set();
+        }
+        names.emplace_back(data, static_cast<size_t>(size));
+    }
+}
+
+} // namespace
+
+// [6] Change notifications:
+//
+// Subscribers are Python callables taking a list of `Change`, converted by
+// pybind11/functional.h, which holds the GIL while calling or destroying
+// them. Each flush converts the batch to a Python list once per subscriber,
+// so Python code is called once per batch rather than once per modification.
+//
+// Note: the tree owns its subscribers, so a subscriber referencing the tree
+// (e.g., a lambda using `tree`) creates a reference cycle that Python's GC
+// cannot see through the C++ tree. Call `unsubscribe()` to break it.
+//
+void wrap_change(py::module& m) {
+    py::enum_<ChangeType>(m, "ChangeType")
+        .value("ChildCreated", ChangeType::ChildCreated)
+        .value("Renamed", ChangeType::Renamed)
+        .value("ChildrenCleared", ChangeType::ChildrenCleared);
+
+    py::class_<Change>(m, "Change")
+        .def_readonly("type", &Change::type)
+
+        // the rvp does not matter here: the holder is copied, like `children()`
+        .def_property_readonly("node", [](const Change& self) { return self.node; });
+}
+
 void wrap_tree(py::module& m) {
     py::class_<Tree>(m, "Tree")
 
@@ -103,11 +298,66 @@ void wrap_tree(py::module& m) {
         // for def_property, but we write it anyway for clarifying intent)
         .def_property_readonly(
             "root",
-            [](Tree& self) -> NodeSharedPtr { return self.root().lock(); }, // [2]
-            rvp::reference_internal);
+            [](Tree& self) -> NodeSharedPtr { return telemetry::lock(self.root()); }, // [2]
+            rvp::reference_internal)
+
+        // the found node should keep alive the tree, like the root. Returns
+        // None if there is no node at this path.
+        .def(
+            "find",
+            [](Tree& self, std::string_view path) -> NodeSharedPtr {
+                return telemetry::lock(self.find(path));
+            },
+            rvp::reference_internal)
+
+        // Builds the nodes described by the given arrays under the root, and
+        // returns the root [4].
+        .def(
+            "buildFrom",
+            [](Tree& self, py::handle parents, py::handle names) -> NodeSharedPtr {
+                std::vector<int64_t> indices = toIndices(parents);
+                py::list nameList = py::reinterpret_steal<py::list>(PySequence_List(names.ptr()));
+                if (!nameList) {
+                    throw py::error_already_set();
+                }
+                std::vector<std::string_view> nameViews;
+                toNames(nameList, nameViews);
+                {
+                    py::gil_scoped_release release;
+                    self.buildFrom(indices, nameViews);
+                }
+                return telemetry::lock(self.root());
+            },
+            py::arg("parents"),
+            py::arg("names"),
+            rvp::reference_internal)
+
+        // Snapshots (see ../snapshot.h). Neither touches Python objects, so
+        // we release the GIL.
+        .def("save", &Tree::save, py::call_guard<py::gil_scoped_release>())
+        .def_static("load", &Tree::load, py::call_guard<py::gil_scoped_release>())
+
+        // Lazy trees. Python objects hold a shared pointer to their node, so
+        // nodes observed from Python (and their ancestors) are never evicted.
+        .def_static(
+            "openLazy",
+            &Tree::openLazy,
+            py::arg("path"),
+            py::arg("maxLoadedNodes"),
+            py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("isLazy", &Tree::isLazy)
+        .def_property_readonly("numLoadedNodes", &Tree::numLoadedNodes)
+
+        // Change notifications [6]
+        .def("subscribe", &Tree::subscribe, py::arg("callback"))
+        .def("unsubscribe", &Tree::unsubscribe, py::arg("id"))
+        .def("flushChanges", &Tree::flushChanges)
+        .def_property_readonly("numPendingChanges", &Tree::numPendingChanges);
 }
 
 PYBIND11_MODULE(x03, m) {
     wrap_node(m);
+    wrap_change(m);
     wrap_tree(m);
+    pytelemetry::defStats(m, {telemetry::ObjectType::Node});
 }
@@ -1,13 +1,13 @@
 #pragma once
 
-#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <utility> // swap
 
+#include "../callback.h"
 #include "../common.h"
-
-using Callback = std::function<void(void)>;
+#include "../wrapperslot.h"
 
 class Action;
 using ActionSharedPtr = std::shared_ptr<Action>;
@@ -45,21 +45,39 @@ public:
         name_ = name;
     }
 
+    // The previous callback is destroyed once the new one is set, since this
+    // may destroy this action (e.g., if the previous callback is a Python
+    // callable owning the last reference to a widget owning this action).
+    //
     void setCallback(Callback callback) {
-        callback_ = std::move(callback);
+        std::swap(callback_, callback);
     }
 
     void executeCallback() {
         callback_();
     }
 
+    const Callback& callback() const {
+        return callback_;
+    }
+
     ActionRefCounter refCounter() {
         return *this;
     }
 
+    // Python wrapper of this action, if any, see ../wrapperslot.h.
+    void* wrapper() const {
+        return wrapperSlot_.get();
+    }
+
+    void setWrapper(void* wrapper) const {
+        wrapperSlot_.set(wrapper);
+    }
+
 private:
     std::string name_;
     Callback callback_;
+    mutable WrapperSlot wrapperSlot_;
 };
 
 inline ActionRefCounter::ActionRefCounter(Action& action)
@@ -0,0 +1,178 @@
+// Throughput of Action::executeCallback() with C++ callbacks, and cost of
+// setting callbacks with captures of various sizes, comparing Callback (see
+// ../callback.h) with std::function.
+//
+// Finally, runs the standardized workloads of ../benchmark.h on widgets.
+//
+// Usage: x04_bench [numIterations] [numWidgets] [--json path]
+//
+// See bench.py for Python callbacks.
+
+#include <algorithm> // max
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../benchmark.h"
+#include "action.h"
+#include "widget.h"
+
+namespace {
+
+template<typename T>
+void doNotOptimize(const T& value) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+template<typename F>
+void measureTime(const char* name, size_t numIterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numIterations; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << "  " << name << ": " << ns / numIterations << " ns" << std::endl;
+}
+
+// Lambdas capturing, respectively, a pointer (8 bytes), a shared_ptr and a
+// pointer (24 bytes), and 64 bytes.
+//
+auto makeSmall(size_t* count) {
+    return [count]() { ++*count; };
+}
+
+auto makeMedium(size_t* count) {
+    static auto keepAlive = std::make_shared<int>(0);
+    return [keepAlive = keepAlive, count]() { ++*count; };
+}
+
+auto makeLarge(size_t* count) {
+    std::array<size_t*, 8> counts;
+    counts.fill(count);
+    return [counts]() { ++*counts[7]; };
+}
+
+template<typename CallbackType, typename MakeLambda>
+void measureCallback(const char* name, size_t numIterations, MakeLambda makeLambda) {
+    size_t count = 0;
+    std::cout << name << std::endl;
+    measureTime("set", numIterations / 10, [&]() {
+        CallbackType callback = makeLambda(&count);
+        doNotOptimize(callback);
+    });
+    CallbackType callback = makeLambda(&count);
+    measureTime("call", numIterations, [&]() { callback(); });
+    doNotOptimize(count);
+}
+
+template<typename MakeLambda>
+void measureCallbacks(const char* name, size_t numIterations, MakeLambda makeLambda) {
+    std::cout << "--- " << name << " capture ---" << std::endl;
+    measureCallback<std::function<void(void)>>("std::function", numIterations, makeLambda);
+    measureCallback<Callback>("Callback", numIterations, makeLambda);
+}
+
+// Standardized workloads, see ../benchmark.h. Each widget owns its own
+// action, whose callback increments a counter.
+//
+void runWorkloads(benchmark::Report& report, size_t numWidgets) {
+    using benchmark::Clock;
+    using benchmark::nanosecondsSince;
+    benchmark::Params params = {{"numWidgets", numWidgets}};
+    benchmark::useAtomicRefCounts();
+    size_t count = 0;
+
+    std::vector<WidgetSharedPtr> widgets;
+    widgets.reserve(numWidgets);
+    auto start = Clock::now();
+    for (size_t i = 0; i < numWidgets; ++i) {
+        ActionSharedPtr action = Action::create();
+        action->setCallback(makeSmall(&count));
+        widgets.push_back(Widget::create());
+        widgets.back()->setAction(*action);
+    }
+    report.add("build", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    start = Clock::now();
+    for (const WidgetSharedPtr& widget : widgets) {
+        widget->triggerAction();
+    }
+    report.add("trigger", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+    benchmark::Random random;
+    start = Clock::now();
+    for (size_t i = 0; i < numWidgets; ++i) {
+        widgets[random(numWidgets)]->triggerAction();
+    }
+    report.add("randomTrigger", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    // All threads lock the same actions, starting at different offsets.
+    std::vector<ActionWeakPtr> actions;
+    actions.reserve(numWidgets);
+    for (const WidgetSharedPtr& widget : widgets) {
+        actions.push_back(widget->action());
+    }
+    size_t locksPerThread = std::max<size_t>(numWidgets, 1000000);
+    for (size_t numThreads : benchmark::threadCounts()) {
+        double ns = benchmark::runThreads(numThreads, [&](size_t threadIndex) {
+            size_t j = threadIndex * actions.size() / numThreads;
+            for (size_t i = 0; i < locksPerThread; ++i) {
+                ActionSharedPtr p = actions[j].lock();
+                j = (j + 1 == actions.size()) ? 0 : j + 1;
+            }
+        });
+        double locksPerSecond = numThreads * locksPerThread / (ns * 1e-9);
+        benchmark::Params threadParams = params;
+        threadParams.push_back({"numThreads", numThreads});
+        report.add("weakLock", threadParams, locksPerSecond * 1e-6, "Mlocks/s");
+    }
+    actions.clear();
+
+    start = Clock::now();
+    widgets.clear();
+    report.add("destroy", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+    doNotOptimize(count);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    benchmark::Args args(argc, argv);
+    size_t numIterations = args.get(0, 100000000);
+    size_t numWidgets = args.get(1, 1000000);
+
+    std::cout << "sizeof(std::function<void(void)>): " << sizeof(std::function<void(void)>)
+              << std::endl;
+    std::cout << "sizeof(Callback): " << sizeof(Callback) << std::endl;
+
+    measureCallbacks("small", numIterations, makeSmall);
+    measureCallbacks("medium", numIterations, makeMedium);
+    measureCallbacks("large", numIterations, makeLarge);
+
+    std::cout << "--- Action::executeCallback() ---" << std::endl;
+    size_t count = 0;
+    ActionSharedPtr action = Action::create();
+    action->setCallback(makeMedium(&count));
+    measureTime("C++ lambda", numIterations, [&]() { action->executeCallback(); });
+    auto counter = std::make_shared<CallCounter>();
+    action->setCallback([counter]() { (*counter)(); });
+    measureTime("CallCounter", numIterations, [&]() { action->executeCallback(); });
+    doNotOptimize(count);
+
+    std::cout << "--- Standard workloads ---" << std::endl;
+    benchmark::Report report("x04");
+    runWorkloads(report, numWidgets);
+    if (!report.save(args.jsonPath)) {
+        std::cerr << "Cannot write " << args.jsonPath << std::endl;
+        return 1;
+    }
+}
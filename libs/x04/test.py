@@ -1,9 +1,10 @@
 #!/usr/bin/python3
 
 import gc
+import os
 import sys
 import unittest
-from x04 import Action, Widget
+from x04 import Action, CallCounter, Widget
 
 def changeName(x):
     x.name = "newName"
@@ -11,6 +12,14 @@ def changeName(x):
 def pyRefcount(obj):
     return sys.getrefcount(obj) - 2
 
+# Resident memory of the process in bytes, or None if unknown.
+def currentRss():
+    try:
+        with open("/proc/self/statm") as f:
+            return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+    except (OSError, ValueError, AttributeError):
+        return None
+
 class Tests(unittest.TestCase):
 
     def testAction(self):
@@ -33,6 +42,41 @@ class Tests(unittest.TestCase):
         widget.triggerAction()
         self.assertEqual(action.name, "newName")
 
+    def testCallCounter(self):
+        action = Action()
+        counter = CallCounter()
+        action.setCallback(counter)
+        action.executeCallback()
+        action.executeCallback()
+        self.assertEqual(counter.count, 2)
+        counter()
+        self.assertEqual(counter.count, 3)
+
+    def testEmptyCallback(self):
+        action = Action()
+        action.setCallback(None)
+        with self.assertRaises(Exception):
+            action.executeCallback()
+        with self.assertRaises(TypeError):
+            action.setCallback(42)
+
+    def testCallbackException(self):
+        def f():
+            raise ValueError("error in callback")
+        action = Action()
+        action.setCallback(f)
+        with self.assertRaises(ValueError):
+            action.executeCallback()
+
+    def testWrapperIsReused(self):
+        action = Action()
+        widget = Widget()
+        widget.action = action
+        self.assertIs(widget.action, action)
+        del action
+        action = widget.action  # new wrapper, since the previous one was destroyed
+        self.assertIs(widget.action, action)
+
     def testWidgetRefCounter(self):
         widget = Widget()
         refCounter = widget.refCounter()
@@ -61,7 +105,7 @@ class Tests(unittest.TestCase):
         del widget
         self.assertEqual(refCounter.count, 0)
 
-    def testMemoryLeak(self):
+    def testCallbackCycleIsCollected(self):
         widget = Widget()
         widget.name = "myWidget"
         widgetRefCounter = widget.refCounter()
@@ -87,15 +131,70 @@ class Tests(unittest.TestCase):
         self.assertEqual(widget.name, "newName")
 
         del action
-        del widget
         gc.collect()
+        self.assertEqual(widgetRefCounter.count, 1) # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 1) # `widget.action_`
+
+        del widget
 
-        # Memory leak due to cyclic dependency:
+        # Cyclic dependency:
         # - The widget instance stores a `shared_ptr<Action>` in the Widget::action_ data member
         # - the action instance stores a PyObject that indirectly stores a `shared_ptr<Widget>`
         #
-        self.assertEqual(widgetRefCounter.count, 1)  # pybind11 holder for `widget`
-        self.assertEqual(actionRefCounter.count, 1)  # `widget.action_`
+        # Without GC support, this would leak. With it, the wrapper of the
+        # widget reports the lambda stored in its action to the GC, since
+        # nothing else owns them.
+        #
+        gc.collect()
+        self.assertEqual(widgetRefCounter.count, 0)
+        self.assertEqual(actionRefCounter.count, 0)
+
+    def testCycleOwnedByCppIsNotCollected(self):
+        widget = Widget()
+        action = Action()
+        action.setCallback(lambda x = widget : changeName(x))
+        widget.action = action
+        widgetRefCounter = widget.refCounter()
+        del widget
+
+        # `action` also owns the action, so the GC must consider its callback
+        # reachable, even though the wrapper of the widget is not.
+        gc.collect()
+        self.assertEqual(widgetRefCounter.count, 1)
+        action.executeCallback()
+
+        # Once the action is only owned by the widget, the cycle is collected.
+        del action
+        gc.collect()
+        self.assertEqual(widgetRefCounter.count, 0)
+
+    def testSelfReferencingAction(self):
+        action = Action()
+        action.setCallback(lambda x = action : changeName(x))
+        actionRefCounter = action.refCounter()
+        del action
+        gc.collect()
+        self.assertEqual(actionRefCounter.count, 0)
+
+    def testCycleSoak(self):
+        def createCycles(n):
+            for _ in range(n):
+                widget = Widget()
+                action = Action()
+                action.setCallback(lambda x = widget : changeName(x))
+                widget.action = action
+
+        # Each leaked cycle would take several hundred bytes, so the resident
+        # memory would grow by tens of megabytes.
+        createCycles(10000)
+        gc.collect()
+        before = currentRss()
+        for _ in range(20):
+            createCycles(10000)
+            gc.collect()
+        after = currentRss()
+        if before is not None and after is not None:
+            self.assertLess(after - before, 8 * 1024 * 1024)
 
 
 if __name__ == '__main__':
@@ -6,6 +6,7 @@
 #include <string_view>
 
 #include "../common.h"
+#include "../wrapperslot.h"
 #include "action.h"
 
 class Widget;
@@ -75,9 +76,19 @@ public:
         return *this;
     }
 
+    // Python wrapper of this widget, if any, see ../wrapperslot.h.
+    void* wrapper() const {
+        return wrapperSlot_.get();
+    }
+
+    void setWrapper(void* wrapper) const {
+        wrapperSlot_.set(wrapper);
+    }
+
 private:
     std::string name_;
     ActionSharedPtr action_;
+    mutable WrapperSlot wrapperSlot_;
 };
 
 inline WidgetRefCounter::WidgetRefCounter(Widget& widget)
@@ -1,17 +1,72 @@
-#include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 namespace py = pybind11;
 using rvp = py::return_value_policy;
 
+#include "../callbackcaster.h"
+#include "../pygc.h"
+#include "../wrappercaster.h"
 #include "action.h"
 #include "widget.h"
 
+// Return the existing wrapper of actions and widgets via their wrapper slot,
+// rather than via the registered instances of pybind11 (see
+// ../wrappercaster.h).
+//
+WRAPPER_SLOT_HOLDER_CASTER(Action);
+WRAPPER_SLOT_HOLDER_CASTER(Widget);
+
+// Python objects stored in actions and widgets, for the GC (see ../pygc.h).
+// This makes the GC collect cycles such as a widget owning an action whose
+// callback captures the widget, as long as they are not owned by C++ code.
+
+int traversePython(const Action& action, visitproc visit, void* arg) {
+    return callbackcaster::traverse(action.callback(), visit, arg);
+}
+
+void clearPython(Action& action) {
+    action.setCallback(nullptr);
+}
+
+int traversePython(const Widget& widget, visitproc visit, void* arg) {
+    ActionWeakPtr action = widget.action();
+    if (action.use_count() == 1) { // only owned by this widget
+        return traversePython(*action.lock(), visit, arg);
+    }
+    return 0;
+}
+
+void clearPython(Widget& widget) {
+    ActionWeakPtr action = widget.action();
+    if (action.use_count() == 1) {
+        clearPython(*action.lock());
+    }
+}
+
+template<typename T>
+void setupType(PyHeapTypeObject* heapType) {
+    wrapperslot::setupType<T>(heapType);
+    pygc::setupType<T>(heapType);
+}
+
+// C++ function objects that can be passed to `Action.setCallback()` and are
+// then called without going through Python (see ../callbackcaster.h).
+//
+void wrap_callback(py::module& m) {
+    py::class_<CallbackObject, std::shared_ptr<CallbackObject>>(m, "CallbackObject")
+        .def("__call__", &CallbackObject::operator());
+
+    py::class_<CallCounter, CallbackObject, std::shared_ptr<CallCounter>>(m, "CallCounter")
+        .def(py::init<>())
+        .def_property_readonly("count", &CallCounter::count);
+}
+
 void wrap_action(py::module& m) {
     py::class_<ActionRefCounter>(m, "ActionRefCounter")
         .def_property_readonly("count", &ActionRefCounter::count);
 
-    py::class_<Action, ActionSharedPtr>(m, "Action")
+    py::class_<Action, ActionSharedPtr>(
+        m, "Action", py::custom_type_setup(&setupType<Action>))
         .def(py::init(&Action::create))
         .def_property("name", &Action::name, &Action::setName)
         .def("setCallback", &Action::setCallback)
@@ -23,7 +78,8 @@ void wrap_widget(py::module& m) {
     py::class_<WidgetRefCounter>(m, "WidgetRefCounter")
         .def_property_readonly("count", &WidgetRefCounter::count);
 
-    py::class_<Widget, WidgetSharedPtr>(m, "Widget")
+    py::class_<Widget, WidgetSharedPtr>(
+        m, "Widget", py::custom_type_setup(&setupType<Widget>))
         .def(py::init(&Widget::create))
         .def_property("name", &Widget::name, &Widget::setName)
         .def_property(
@@ -35,6 +91,7 @@ void wrap_widget(py::module& m) {
 }
 
 PYBIND11_MODULE(x04, m) {
+    wrap_callback(m);
     wrap_action(m);
     wrap_widget(m);
 }
@@ -0,0 +1,50 @@
+#!/usr/bin/python3
+
+# Compares the overhead of the different ways of binding functions involving
+# weak pointers: hand-written lambdas, macros, and the template adapter of
+# weakadapter.h.
+#
+# Usage: bench.py [numIterations] [numChildren]
+#
+# Requires the x05 module to be in the PYTHONPATH.
+
+import sys
+import time
+from x05 import Widget
+
+def timeit(label, f, n):
+    start = time.perf_counter()
+    for _ in range(n):
+        f()
+    elapsed = time.perf_counter() - start
+    print(f"  {label}: {elapsed / n * 1e9:.0f} ns/call")
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    numChildren = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+    widget = Widget()
+    parent = Widget()
+    children = [Widget() for _ in range(numChildren)]
+    widget.setChildren(children)
+
+    print("get parent:")
+    timeit("manual lambda", widget.getParentManualLambda, n)
+    timeit("macro", widget.getParentMacro, n)
+    timeit("template", widget.getParentTemplate, n)
+
+    print("set parent:")
+    timeit("manual lambda", lambda: widget.setParentManualLambda(parent), n)
+    timeit("macro", lambda: widget.setParentMacro(parent), n)
+    timeit("template", lambda: widget.setParentTemplate(parent), n)
+
+    m = max(1, n // numChildren)
+    print(f"get {numChildren} children:")
+    timeit("manual lambda", widget.childrenManualLambda, m)
+    timeit("template", widget.children, m)
+
+    print(f"set {numChildren} children:")
+    timeit("manual lambda", lambda: widget.setChildrenManualLambda(children), m)
+    timeit("template", lambda: widget.setChildren(children), m)
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,7 @@
 #!/usr/bin/python3
 
 import unittest
-from x05 import Widget
+from x05 import Widget, setParentOf
 
 class Tests(unittest.TestCase):
 
@@ -56,6 +56,60 @@ class Tests(unittest.TestCase):
         self.assertEqual(widget.getParentTemplate(), widget)
         self.assertEqual(widget.value, 1)
 
+    def testTemplateNone(self):
+        widget = Widget()
+        parent = Widget()
+        widget.setParentTemplate(parent)
+        widget.setParentTemplate(None)  # empty weak_ptr
+        self.assertIsNone(widget.getParentTemplate())
+
+    def testTemplateExpired(self):
+        widget = Widget()
+        widget.setParentTemplate(Widget())  # destroyed right away
+        self.assertIsNone(widget.getParentTemplate())
+
+    def testTemplateVector(self):
+        widget = Widget()
+        c1 = Widget()
+        c2 = Widget()
+        widget.setChildren([c1, None, c2])
+        self.assertEqual(widget.children(), [c1, None, c2])
+        widget.setChildren((c2,))
+        self.assertEqual(widget.children(), [c2])
+        with self.assertRaises(TypeError):
+            widget.setChildren([c1, 42])
+        self.assertEqual(widget.children(), [c2])  # unchanged
+        del c2
+        self.assertEqual(widget.children(), [None])
+
+    def testTemplateOptionalAndOverloads(self):
+        widget = Widget()
+        c1 = Widget()
+        c1.name = "c1"
+        c2 = Widget()
+        c2.name = "c2"
+        widget.setChildren([c1, c2])
+        self.assertEqual(widget.child(1), c2)
+        self.assertIsNone(widget.child(2))
+        self.assertEqual(widget.child("c1"), c1)
+        self.assertIsNone(widget.child("c3"))
+        self.assertEqual(widget.findChild("c2"), c2)
+        self.assertIsNone(widget.findChild("c3"))
+
+    def testTemplateFreeFunction(self):
+        widget = Widget()
+        parent = Widget()
+        setParentOf(widget, parent)
+        self.assertEqual(widget.getParentTemplate(), parent)
+        setParentOf(widget, None)  # nullopt
+        self.assertIsNone(widget.getParentTemplate())
+
+    def testManualLambdaVector(self):
+        widget = Widget()
+        c1 = Widget()
+        widget.setChildrenManualLambda([c1, None])
+        self.assertEqual(widget.childrenManualLambda(), [c1, None])
+
 
 if __name__ == '__main__':
     unittest.main()
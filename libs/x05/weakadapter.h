@@ -0,0 +1,293 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility> // forward
+#include <vector>
+
+#include <pybind11/pybind11.h>
+
+// Compile-time adapter for binding functions whose arguments or return value
+// involve std::weak_ptr<T>, where T inherits from enable_shared_from_this<T>
+// and is bound with std::shared_ptr<T> as holder type.
+//
+// Usage:
+//
+//   py::class_<Widget, WidgetSharedPtr> cl(m, "Widget");
+//   weakadapter::def(cl, "parent", &Widget::parent);
+//   weakadapter::def(cl, "child", py::overload_cast<size_t>(&Widget::child, py::const_));
+//   weakadapter::def(
+//       cl, "child", py::overload_cast<std::string_view>(&Widget::child, py::const_));
+//   weakadapter::def(m, "setParentOf", &setParentOf);
+//
+// Supported callables are free functions (bound as methods if their first
+// argument is the class) and member functions, including const, noexcept,
+// and lvalue-ref-qualified ones. Calling `def` several times with the same
+// name creates an overload set, like `cl.def`. Extra arguments (e.g.,
+// py::arg, return value policies) are forwarded to `cl.def`.
+//
+// Conversions, for arguments passed by value, const reference, or rvalue
+// reference:
+//
+// - `std::weak_ptr<T>`: passed from Python as a `T` or None (empty weak_ptr),
+//   returned as a `T`, or None if expired.
+//
+// - `std::optional<std::weak_ptr<T>>`: passed from Python as a `T` or None
+//   (nullopt), returned as a `T`, or None if nullopt or expired.
+//
+// - `std::vector<std::weak_ptr<T>>`: passed from Python as any sequence of
+//   `T` or None, returned as a list of `T` or None.
+//
+// Other types are unchanged.
+//
+// Arguments are loaded as `T*`, which doesn't change any refcount, then
+// converted with `weak_from_this()` directly into the argument of the
+// function, so there is only one (unavoidable) increment of the weak count
+// per weak_ptr. Sequences are converted in a single pass into a vector
+// reserved with the final size, without an intermediate `std::vector<T*>`,
+// and returned vectors are converted in a single pass into a preallocated
+// list.
+//
+namespace weakadapter {
+
+namespace py = pybind11;
+
+namespace detail {
+
+template<typename T>
+inline std::weak_ptr<T> toWeak(T* p) {
+    return p ? p->weak_from_this() : std::weak_ptr<T>();
+}
+
+// Conversion of the type `U = std::decay_t<P>` of an argument or return value
+// `P`. The default is no conversion.
+//
+template<typename U>
+struct Adapter {
+    static constexpr bool isAdapted = false;
+};
+
+template<typename T>
+struct Adapter<std::weak_ptr<T>> {
+    static constexpr bool isAdapted = true;
+    using PyArg = T*;
+    using PyRet = std::shared_ptr<T>;
+
+    static std::weak_ptr<T> toCpp(T* p) {
+        return toWeak(p);
+    }
+
+    static std::shared_ptr<T> toPy(const std::weak_ptr<T>& w) {
+        return w.lock();
+    }
+};
+
+template<typename T>
+struct Adapter<std::optional<std::weak_ptr<T>>> {
+    static constexpr bool isAdapted = true;
+    using PyArg = T*;
+    using PyRet = std::shared_ptr<T>;
+
+    static std::optional<std::weak_ptr<T>> toCpp(T* p) {
+        if (p) {
+            return p->weak_from_this();
+        }
+        return std::nullopt;
+    }
+
+    static std::shared_ptr<T> toPy(const std::optional<std::weak_ptr<T>>& w) {
+        return w ? w->lock() : std::shared_ptr<T>();
+    }
+};
+
+template<typename T>
+struct Adapter<std::vector<std::weak_ptr<T>>> {
+    static constexpr bool isAdapted = true;
+    using PyArg = py::sequence;
+    using PyRet = py::list;
+
+    static std::vector<std::weak_ptr<T>> toCpp(const py::sequence& seq) {
+        std::vector<std::weak_ptr<T>> res;
+        res.reserve(seq.size());
+        py::detail::make_caster<T*> caster;
+        for (py::handle item : seq) {
+            if (!caster.load(item, true)) {
+                throw py::type_error(
+                    "expected a sequence of " + py::type_id<T>()
+                    + " or None, got an item of type " + Py_TYPE(item.ptr())->tp_name);
+            }
+            res.push_back(toWeak(py::detail::cast_op<T*>(caster)));
+        }
+        return res;
+    }
+
+    static py::list toPy(const std::vector<std::weak_ptr<T>>& v) {
+        py::list res(v.size());
+        for (size_t i = 0; i < v.size(); ++i) {
+            py::ssize_t j = static_cast<py::ssize_t>(i);
+            PyList_SET_ITEM(res.ptr(), j, py::cast(v[i].lock()).release().ptr());
+        }
+        return res;
+    }
+};
+
+// Python-side type and conversion of an argument of C++ type `P`.
+//
+template<typename P, typename U = std::decay_t<P>, bool isAdapted = Adapter<U>::isAdapted>
+struct Arg {
+    using PyType = P;
+
+    template<typename A>
+    static A&& toCpp(A&& a) {
+        return std::forward<A>(a);
+    }
+};
+
+template<typename P, typename U>
+struct Arg<P, U, true> {
+    static_assert(
+        !std::is_lvalue_reference_v<P> || std::is_const_v<std::remove_reference_t<P>>,
+        "weakadapter: arguments of adapted types cannot be non-const lvalue references");
+
+    using PyType = typename Adapter<U>::PyArg;
+
+    static U toCpp(PyType a) {
+        return Adapter<U>::toCpp(a);
+    }
+};
+
+// Python-side type and conversion of a return value of C++ type `R`.
+//
+template<typename R, typename U = std::decay_t<R>, bool isAdapted = Adapter<U>::isAdapted>
+struct Ret {
+    using PyType = R;
+};
+
+template<typename R, typename U>
+struct Ret<R, U, true> {
+    using PyType = typename Adapter<U>::PyRet;
+};
+
+// Calls `f(args...)` and converts its return value.
+//
+template<typename R, typename F, typename... Args>
+typename Ret<R>::PyType callAndConvert(F&& f, Args&&... args) {
+    if constexpr (!Adapter<std::decay_t<R>>::isAdapted) {
+        return std::forward<F>(f)(std::forward<Args>(args)...);
+    }
+    else {
+        using U = std::decay_t<R>;
+        return Adapter<U>::toPy(std::forward<F>(f)(std::forward<Args>(args)...));
+    }
+}
+
+// Decomposition of the type of a callable into the type of `self` (void for
+// free functions), and a free function type with the same return type and
+// arguments, used as tag for deducing them.
+//
+template<typename F>
+struct Traits;
+
+template<typename R, typename... Args>
+struct Traits<R (*)(Args...)> {
+    using Self = void;
+    using Tag = R (*)(Args...);
+};
+
+template<typename R, typename... Args>
+struct Traits<R (*)(Args...) noexcept> : Traits<R (*)(Args...)> {};
+
+#define WEAKADAPTER_MEMBER_TRAITS(QUALIFIERS, SELF)                                      \
+    template<typename R, typename C, typename... Args>                                   \
+    struct Traits<R (C::*)(Args...) QUALIFIERS> {                                        \
+        using Self = SELF;                                                               \
+        using Tag = R (*)(Args...);                                                      \
+    };                                                                                   \
+    template<typename R, typename C, typename... Args>                                   \
+    struct Traits<R (C::*)(Args...) QUALIFIERS noexcept>                                 \
+        : Traits<R (C::*)(Args...) QUALIFIERS> {}
+
+WEAKADAPTER_MEMBER_TRAITS(, C&);
+WEAKADAPTER_MEMBER_TRAITS(&, C&);
+WEAKADAPTER_MEMBER_TRAITS(const, const C&);
+WEAKADAPTER_MEMBER_TRAITS(const&, const C&);
+
+#undef WEAKADAPTER_MEMBER_TRAITS
+
+// Python objects are never temporaries, so we cannot call rvalue-qualified
+// member functions on them.
+//
+template<typename R, typename C, typename... Args>
+struct Traits<R (C::*)(Args...) &&> {
+    static_assert(
+        sizeof(C) == 0,
+        "weakadapter: rvalue-qualified member functions cannot be bound");
+};
+
+template<typename R, typename C, typename... Args>
+struct Traits<R (C::*)(Args...) && noexcept> : Traits<R (C::*)(Args...) &&> {};
+
+template<typename R, typename C, typename... Args>
+struct Traits<R (C::*)(Args...) const&&> : Traits<R (C::*)(Args...) &&> {};
+
+template<typename R, typename C, typename... Args>
+struct Traits<R (C::*)(Args...) const && noexcept> : Traits<R (C::*)(Args...) &&> {};
+
+// Binds `f`, whose arguments are `Args...`, with the given extras.
+//
+template<typename Class, typename R, typename... Args, typename F, typename... Extra>
+void defFree(Class& cl, const char* name, F f, const Extra&... extra) {
+    cl.def(
+        name,
+        [f](typename Arg<Args>::PyType... args) -> typename Ret<R>::PyType {
+            return callAndConvert<R>(
+                f, Arg<Args>::toCpp(std::forward<typename Arg<Args>::PyType>(args))...);
+        },
+        extra...);
+}
+
+template<
+    typename Class,
+    typename Self,
+    typename R,
+    typename... Args,
+    typename F,
+    typename... Extra>
+void defMember(Class& cl, const char* name, F f, const Extra&... extra) {
+    cl.def(
+        name,
+        [f](Self self, typename Arg<Args>::PyType... args) -> typename Ret<R>::PyType {
+            return callAndConvert<R>(
+                [&](auto&&... cppArgs) -> R {
+                    return (self.*f)(std::forward<decltype(cppArgs)>(cppArgs)...);
+                },
+                Arg<Args>::toCpp(std::forward<typename Arg<Args>::PyType>(args))...);
+        },
+        extra...);
+}
+
+template<typename Class, typename F, typename R, typename... Args, typename... Extra>
+void defDispatch(Class& cl, const char* name, F f, R (*)(Args...), const Extra&... extra) {
+    using Self = typename Traits<F>::Self;
+    if constexpr (std::is_void_v<Self>) {
+        defFree<Class, R, Args...>(cl, name, f, extra...);
+    }
+    else {
+        defMember<Class, Self, R, Args...>(cl, name, f, extra...);
+    }
+}
+
+} // namespace detail
+
+// Binds the free or member function `f` as `name` in `cl`, which can be a
+// py::class_ or a py::module, converting weak pointers as described above.
+//
+template<typename Class, typename F, typename... Extra>
+void def(Class& cl, const char* name, F f, const Extra&... extra) {
+    using Tag = typename detail::Traits<F>::Tag;
+    detail::defDispatch(cl, name, f, Tag(nullptr), extra...);
+}
+
+} // namespace weakadapter
@@ -1 +1,23 @@
 #include "widget.h"
+
+WidgetWeakPtr Widget::child(std::string_view name) const {
+    std::optional<WidgetWeakPtr> res = findChild(name);
+    return res ? *res : WidgetWeakPtr();
+}
+
+std::optional<WidgetWeakPtr> Widget::findChild(std::string_view name) const {
+    for (const WidgetWeakPtr& child : children_) {
+        if (WidgetSharedPtr c = child.lock()) {
+            if (c->name() == name) {
+                return child;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+void setParentOf(const WidgetWeakPtr& child, std::optional<WidgetWeakPtr> parent) {
+    if (WidgetSharedPtr c = child.lock()) {
+        c->setParent(parent ? *parent : WidgetWeakPtr());
+    }
+}
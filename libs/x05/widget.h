@@ -1,8 +1,10 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "../common.h"
 
@@ -62,8 +64,36 @@ public:
         return value_;
     }
 
+    // The functions below are also for example only, showing other
+    // signatures involving weak pointers supported by weakadapter.h.
+
+    const std::vector<WidgetWeakPtr>& children() const& noexcept {
+        return children_;
+    }
+
+    void setChildren(std::vector<WidgetWeakPtr> children) {
+        children_ = std::move(children);
+    }
+
+    // Returns an empty weak pointer if out of range.
+    WidgetWeakPtr child(size_t i) const {
+        return i < children_.size() ? children_[i] : WidgetWeakPtr();
+    }
+
+    // Returns an empty weak pointer if there is no alive child with this name.
+    WidgetWeakPtr child(std::string_view name) const;
+
+    // Returns nullopt if there is no alive child with this name.
+    std::optional<WidgetWeakPtr> findChild(std::string_view name) const;
+
 private:
     std::string name_;
     WidgetWeakPtr parent_;
+    std::vector<WidgetWeakPtr> children_;
     int value_;
 };
+
+// Free function example: sets the parent of `child`, or clears it if `parent`
+// is nullopt.
+//
+API void setParentOf(const WidgetWeakPtr& child, std::optional<WidgetWeakPtr> parent);
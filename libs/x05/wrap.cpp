@@ -1,6 +1,8 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 namespace py = pybind11;
 
+#include "weakadapter.h"
 #include "widget.h"
 
 #define RET_SHARED(T, method) [](T& self) { return self.method().lock(); }
@@ -8,9 +10,12 @@ namespace py = pybind11;
 #define ARG_SHARED(T, method, U)                                                         \
     [](T& self, U& arg) { self.method(arg.weak_from_this()); }
 
-// Note: for convenience, all the template free function below could be
-// implement as member methods of a class that inherits py::class_, so we could
-// directly do the usual:
+// The template approach is implemented in weakadapter.h, which handles
+// weak_ptr, optional<weak_ptr>, and vector<weak_ptr> arguments and return
+// values, for free and member functions.
+//
+// Note: for convenience, it could be implemented as member methods of a class
+// that inherits py::class_, so we could directly do the usual:
 //
 //     cl.def(...)
 //
@@ -18,88 +23,7 @@ namespace py = pybind11;
 //
 //     def(cl, ...)
 //
-
-// Note: this needs to be a templated class with a static method, as opposed to
-// a templated free function, because template partial specialization of free
-// functions is not allowed.
-//
-template<typename T>
-struct Transform {
-    static T x(T t) {
-        return t;
-    }
-};
-
-template<typename T>
-struct Transform<std::weak_ptr<T>> {
-    static std::weak_ptr<T> x(T& t) {
-        return t.weak_from_this();
-    }
-};
-
-template<typename T>
-struct ArgInfo {
-    using CppType = T;
-    using PyType = T;
-};
-
-template<typename T>
-struct ArgInfo<std::weak_ptr<T>> {
-    using CppType = std::weak_ptr<T>;
-    using PyType = T&;
-};
-
-// invoke non-const method with transformed arguments
-template<typename Self, typename Ret, typename... ArgInfos>
-Ret invoke(
-    Self& self,
-    Ret (Self::*pm)(typename ArgInfos::CppType...),
-    typename ArgInfos::PyType... args) {
-
-    return (self.*pm)(Transform<typename ArgInfos::CppType>::x(args)...);
-}
-
-// invoke const method with transformed arguments
-template<typename Self, typename Ret, typename... ArgInfos>
-Ret invoke(
-    Self& self,
-    Ret (Self::*pm)(typename ArgInfos::CppType...) const,
-    typename ArgInfos::PyType... args) {
-
-    return (self.*pm)(Transform<typename ArgInfos::CppType>::x(args)...);
-}
-
-// wrap non-const method returning a weak_ptr
-template<typename C, typename Self, typename T, typename... Args>
-void def(C& cl, const char* name, std::weak_ptr<T> (Self::*pm)(Args...)) {
-    cl.def(name, [pm](Self& self, typename ArgInfo<Args>::PyType... args) {
-        return invoke<Self, std::weak_ptr<T>, ArgInfo<Args>...>(self, pm, args...).lock();
-    });
-}
-
-// wrap const method returning a weak_ptr
-template<typename C, typename Self, typename T, typename... Args>
-void def(C& cl, const char* name, std::weak_ptr<T> (Self::*pm)(Args...) const) {
-    cl.def(name, [pm](Self& self, typename ArgInfo<Args>::PyType... args) {
-        return invoke<Self, std::weak_ptr<T>, ArgInfo<Args>...>(self, pm, args...).lock();
-    });
-}
-
-// wrap non-const method not returning a weak_ptr
-template<typename C, typename Self, typename T, typename... Args>
-void def(C& cl, const char* name, T (Self::*pm)(Args...)) {
-    cl.def(name, [pm](Self& self, typename ArgInfo<Args>::PyType... args) {
-        return invoke<Self, T, ArgInfo<Args>...>(self, pm, args...);
-    });
-}
-
-// wrap const method not returning a weak_ptr
-template<typename C, typename Self, typename T, typename... Args>
-void def(C& cl, const char* name, T (Self::*pm)(Args...) const) {
-    cl.def(name, [pm](Self& self, typename ArgInfo<Args>::PyType... args) {
-        return invoke<Self, T, ArgInfo<Args>...>(self, pm, args...);
-    });
-}
+using weakadapter::def;
 
 void wrap_widget(py::module& m) {
     py::class_<Widget, WidgetSharedPtr> cl(m, "Widget");
@@ -142,6 +66,31 @@ void wrap_widget(py::module& m) {
     def(cl, "getWithArgs", &Widget::getWithArgs);
     def(cl, "getWithWeakArgs", &Widget::getWithWeakArgs);
     def(cl, "setWithWeakArgs", &Widget::setWithWeakArgs);
+
+    // Containers, optionals, overloads, and free functions
+    def(cl, "children", &Widget::children);
+    def(cl, "setChildren", &Widget::setChildren);
+    def(cl, "child", py::overload_cast<size_t>(&Widget::child, py::const_));
+    def(cl, "child", py::overload_cast<std::string_view>(&Widget::child, py::const_));
+    def(cl, "findChild", &Widget::findChild);
+    def(m, "setParentOf", &setParentOf);
+
+    // Hand-written equivalents of `children` and `setChildren`, for
+    // comparison in bench.py.
+    cl.def("childrenManualLambda", [](const Widget& self) {
+        std::vector<WidgetSharedPtr> res;
+        for (const WidgetWeakPtr& child : self.children()) {
+            res.push_back(child.lock());
+        }
+        return res;
+    });
+    cl.def("setChildrenManualLambda", [](Widget& self, const std::vector<Widget*>& children) {
+        std::vector<WidgetWeakPtr> res;
+        for (Widget* child : children) {
+            res.push_back(child ? child->weak_from_this() : WidgetWeakPtr());
+        }
+        self.setChildren(std::move(res));
+    });
 }
 
 PYBIND11_MODULE(x05, m) {
@@ -1,13 +1,13 @@
 #pragma once
 
-#include <functional>
 #include <memory>
 #include <string>
 #include <string_view>
 
+#include "../callback.h"
 #include "../common.h"
-
-using Callback = std::function<void(void)>;
+#include "../telemetry.h"
+#include "../wrapperslot.h"
 
 class Action;
 using ActionSharedPtr = std::shared_ptr<Action>;
@@ -30,9 +30,18 @@ class API Action : public std::enable_shared_from_this<Action> {
     struct CreateKey {};
 
 public:
+    static constexpr telemetry::ObjectType objectType = telemetry::ObjectType::Action;
+
     Action(CreateKey) {
+        TELEMETRY_CREATED(Action);
+    }
+
+    ~Action() {
+        TELEMETRY_DESTROYED(Action);
     }
 
+    DISABLE_COPY_AND_MOVE(Action);
+
     static ActionSharedPtr create() {
         return std::make_shared<Action>(CreateKey());
     }
@@ -53,13 +62,28 @@ public:
         callback_();
     }
 
+    // Whether the callback is a Python callable, see Callback::isPython().
+    bool hasPythonCallback() const {
+        return callback_.isPython();
+    }
+
     ActionRefCounter refCounter() {
         return *this;
     }
 
+    // Python wrapper of this action, if any, see ../wrapperslot.h.
+    void* wrapper() const {
+        return wrapperSlot_.get();
+    }
+
+    void setWrapper(void* wrapper) const {
+        wrapperSlot_.set(wrapper);
+    }
+
 private:
     std::string name_;
     Callback callback_;
+    mutable WrapperSlot wrapperSlot_;
 };
 
 inline ActionRefCounter::ActionRefCounter(Action& action)
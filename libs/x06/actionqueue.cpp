@@ -0,0 +1,405 @@
+#include "actionqueue.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace detail {
+
+using Clock = std::chrono::steady_clock;
+
+// An action waiting to be executed, with all the posts coalesced into it.
+//
+struct PendingAction {
+    ActionSharedPtr action;
+    ActionPriority priority;
+    uint64_t order; // order of the first post, for ties between priorities
+    Clock::time_point postTime;
+    std::vector<ActionQueue::Completion> completions;
+};
+
+class ActionQueueImpl {
+public:
+    explicit ActionQueueImpl(size_t numWorkers) {
+        if (numWorkers == 0) {
+            numWorkers = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        workers_.reserve(numWorkers);
+        for (size_t i = 0; i < numWorkers; ++i) {
+            workers_.push_back(std::make_unique<Worker>());
+        }
+        workerThreads_.reserve(numWorkers);
+        for (size_t i = 0; i < numWorkers; ++i) {
+            workerThreads_.emplace_back([this, i]() { runWorker_(i); });
+        }
+        dispatcherThread_ = std::thread([this]() { runDispatcher_(); });
+    }
+
+    DISABLE_COPY_AND_MOVE(ActionQueueImpl);
+
+    ~ActionQueueImpl() {
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            isStopping_ = true;
+        }
+        pendingCondition_.notify_one();
+        dispatcherThread_.join();
+        {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            areWorkersStopping_ = true;
+        }
+        idleCondition_.notify_all();
+        for (std::thread& thread : workerThreads_) {
+            thread.join();
+        }
+    }
+
+    void post(ActionSharedPtr action, ActionPriority priority, ActionQueue::Completion onDone) {
+        if (!action) {
+            throw std::invalid_argument("Cannot post a null action.");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++stats_.numPosted;
+        auto [it, isNew] = pendingIndex_.try_emplace(action.get(), pending_.size());
+        if (isNew) {
+            bool isRunning = running_.count(action.get()) > 0;
+            PendingAction& pending = pending_.emplace_back();
+            pending.action = std::move(action);
+            pending.priority = priority;
+            pending.order = nextOrder_++;
+            pending.postTime = Clock::now();
+            pending.completions.push_back(std::move(onDone));
+            ++stats_.depth;
+            stats_.maxDepth = std::max(stats_.maxDepth, stats_.depth);
+            if (isRunning) {
+                ++numBlocked_; // flushed once its execution is done
+            }
+            else {
+                lock.unlock();
+                pendingCondition_.notify_one();
+            }
+        }
+        else {
+            PendingAction& pending = pending_[it->second];
+            pending.priority = std::max(pending.priority, priority);
+            pending.completions.push_back(std::move(onDone));
+            ++stats_.numCoalesced;
+        }
+    }
+
+    void drain() {
+        if (isOwnThread()) {
+            throw std::logic_error(
+                "ActionQueue::drain() cannot be called from an action executed by the queue.");
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        drainedCondition_.wait(lock, [this]() { return stats_.depth == 0; });
+    }
+
+    ActionQueueStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    size_t numWorkers() const {
+        return workers_.size();
+    }
+
+    void setPythonBatchScope(ActionQueue::BatchScope scope) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pythonBatchScope_ = scope ? scope : &defaultBatchScope_;
+    }
+
+    // Whether the calling thread is the dispatcher or one of the workers.
+    bool isOwnThread() const {
+        std::thread::id id = std::this_thread::get_id();
+        if (id == dispatcherThread_.get_id()) {
+            return true;
+        }
+        for (const std::thread& thread : workerThreads_) {
+            if (id == thread.get_id()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<PendingAction> tasks;
+    };
+
+    // Protects all the data members below, except the workers.
+    mutable std::mutex mutex_;
+    std::condition_variable pendingCondition_;
+    std::condition_variable drainedCondition_;
+    std::vector<PendingAction> pending_;
+    std::unordered_map<Action*, size_t> pendingIndex_; // index in pending_
+
+    // Actions flushed but not executed yet. An action posted again in the
+    // meantime stays in pending_ (so later posts are still coalesced into
+    // it), but is blocked: it is only flushed once its previous execution is
+    // done, so that an action never runs concurrently with itself.
+    std::unordered_set<Action*> running_;
+    size_t numBlocked_ = 0; // number of actions of pending_ in running_
+
+    uint64_t nextOrder_ = 0;
+    ActionQueueStats stats_;
+    ActionQueue::BatchScope pythonBatchScope_ = &defaultBatchScope_;
+    bool isStopping_ = false;
+
+    // Each worker has its own deque, filled by the dispatcher. Idle workers
+    // sleep until the number of tasks in all deques is positive, reserve one
+    // of them by decrementing the count, then take the front of their own
+    // deque, or else steal the back of another deque.
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex idleMutex_;
+    std::condition_variable idleCondition_;
+    size_t numQueuedTasks_ = 0;
+    bool areWorkersStopping_ = false;
+    size_t nextWorker_ = 0; // only used by the dispatcher thread
+
+    // Must be last: started once all the above is initialized.
+    std::vector<std::thread> workerThreads_;
+    std::thread dispatcherThread_;
+
+    static void defaultBatchScope_(void (*batch)(void*), void* data) {
+        batch(data);
+    }
+
+    void runDispatcher_() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            pendingCondition_.wait(
+                lock, [this]() { return isStopping_ || pending_.size() > numBlocked_; });
+            if (pending_.size() == numBlocked_) {
+                return; // isStopping_, after drain(), so nothing is blocked
+            }
+            std::vector<PendingAction> batch;
+            std::vector<PendingAction> blocked;
+            blocked.reserve(numBlocked_);
+            batch.reserve(pending_.size() - numBlocked_);
+            for (PendingAction& pending : pending_) {
+                Action* action = pending.action.get();
+                if (running_.count(action)) {
+                    blocked.push_back(std::move(pending));
+                }
+                else {
+                    running_.insert(action);
+                    batch.push_back(std::move(pending));
+                }
+            }
+            pending_.swap(blocked);
+            pendingIndex_.clear();
+            for (size_t i = 0; i < pending_.size(); ++i) {
+                pendingIndex_.emplace(pending_[i].action.get(), i);
+            }
+            ActionQueue::BatchScope scope = pythonBatchScope_;
+            lock.unlock();
+            flush_(batch, scope);
+            lock.lock();
+        }
+    }
+
+    void flush_(std::vector<PendingAction>& batch, ActionQueue::BatchScope scope) {
+        std::sort(
+            batch.begin(), batch.end(), [](const PendingAction& a, const PendingAction& b) {
+                return a.priority != b.priority ? a.priority > b.priority : a.order < b.order;
+            });
+
+        // C++ callbacks first, so that they run in parallel with the Python
+        // batch, which is executed in this thread.
+        std::vector<PendingAction*> pythonBatch;
+        for (PendingAction& pending : batch) {
+            if (pending.action->hasPythonCallback()) {
+                pythonBatch.push_back(&pending);
+            }
+            else {
+                pushTask_(std::move(pending));
+            }
+        }
+        if (pythonBatch.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.numPythonBatches;
+        }
+        struct BatchData {
+            ActionQueueImpl* self;
+            std::vector<PendingAction*>* actions;
+        };
+        BatchData data = {this, &pythonBatch};
+        scope(
+            [](void* p) {
+                BatchData* data = static_cast<BatchData*>(p);
+                for (PendingAction* pending : *data->actions) {
+                    data->self->execute_(*pending);
+                }
+            },
+            &data);
+    }
+
+    void pushTask_(PendingAction&& pending) {
+        Worker& worker = *workers_[nextWorker_];
+        nextWorker_ = (nextWorker_ + 1) % workers_.size();
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(pending));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            ++numQueuedTasks_;
+        }
+        idleCondition_.notify_one();
+    }
+
+    void runWorker_(size_t index) {
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(idleMutex_);
+                idleCondition_.wait(
+                    lock, [this]() { return areWorkersStopping_ || numQueuedTasks_ > 0; });
+                if (numQueuedTasks_ == 0) {
+                    return; // areWorkersStopping_
+                }
+                --numQueuedTasks_;
+            }
+            // A task is reserved for us, but other workers may take the one we
+            // find first, so we may have to try several times.
+            PendingAction task;
+            while (!popTask_(index, task)) {
+                std::this_thread::yield();
+            }
+            execute_(task);
+        }
+    }
+
+    bool popTask_(size_t index, PendingAction& task) {
+        {
+            Worker& worker = *workers_[index];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (!worker.tasks.empty()) {
+                task = std::move(worker.tasks.front());
+                worker.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(index + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute_(PendingAction& pending) {
+        std::exception_ptr error;
+        try {
+            pending.action->executeCallback();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        for (ActionQueue::Completion& onDone : pending.completions) {
+            if (onDone) {
+                onDone(error);
+            }
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - pending.postTime);
+
+        // Release the action and completions before updating the depth, so
+        // that they are destroyed when drain() returns. The address of the
+        // action is only used as a key.
+        Action* action = pending.action.get();
+        pending.action.reset();
+        pending.completions.clear();
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        running_.erase(action);
+        bool isUnblocked = pendingIndex_.count(action) > 0;
+        if (isUnblocked) {
+            --numBlocked_;
+        }
+        ++stats_.numExecuted;
+        if (error) {
+            ++stats_.numFailed;
+        }
+        stats_.totalLatency += latency;
+        stats_.maxLatency = std::max(stats_.maxLatency, latency);
+        if (--stats_.depth == 0) {
+            drainedCondition_.notify_all();
+        }
+        lock.unlock();
+        if (isUnblocked) {
+            pendingCondition_.notify_one();
+        }
+    }
+};
+
+} // namespace detail
+
+ActionQueue::ActionQueue(size_t numWorkers)
+    : impl_(std::make_unique<detail::ActionQueueImpl>(numWorkers)) {
+}
+
+// Destroying the queue waits for its threads, which is impossible from one of
+// them, e.g., if an action releases the last reference to the queue. In this
+// case, the teardown is handed off to a detached thread.
+//
+ActionQueue::~ActionQueue() {
+    if (impl_->isOwnThread()) {
+        std::thread([impl = std::move(impl_)]() mutable { impl.reset(); }).detach();
+    }
+}
+
+std::future<void> ActionQueue::post(ActionSharedPtr action, ActionPriority priority) {
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> res = promise->get_future();
+    post(std::move(action), priority, [promise](std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        }
+        else {
+            promise->set_value();
+        }
+    });
+    return res;
+}
+
+void ActionQueue::post(ActionSharedPtr action, ActionPriority priority, Completion onDone) {
+    impl_->post(std::move(action), priority, std::move(onDone));
+}
+
+void ActionQueue::drain() {
+    impl_->drain();
+}
+
+size_t ActionQueue::depth() const {
+    return impl_->stats().depth;
+}
+
+ActionQueueStats ActionQueue::stats() const {
+    return impl_->stats();
+}
+
+size_t ActionQueue::numWorkers() const {
+    return impl_->numWorkers();
+}
+
+void ActionQueue::setPythonBatchScope(BatchScope scope) {
+    impl_->setPythonBatchScope(scope);
+}
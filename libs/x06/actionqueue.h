@@ -0,0 +1,138 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+
+#include "../common.h"
+#include "action.h"
+
+namespace detail {
+
+class ActionQueueImpl;
+
+} // namespace detail
+
+enum class ActionPriority : int8_t {
+    Low,
+    Normal,
+    High
+};
+
+// Statistics of an ActionQueue, see ActionQueue::stats().
+//
+struct ActionQueueStats {
+    // Number of actions posted but not executed yet, after coalescing.
+    size_t depth = 0;
+    size_t maxDepth = 0;
+
+    // Number of calls to post(), and how many of them were coalesced with an
+    // action that was already pending.
+    uint64_t numPosted = 0;
+    uint64_t numCoalesced = 0;
+
+    // Number of executed actions, including the ones whose callback threw.
+    uint64_t numExecuted = 0;
+    uint64_t numFailed = 0;
+
+    // Number of batches of Python callbacks, each executed under a single
+    // acquisition of the GIL.
+    uint64_t numPythonBatches = 0;
+
+    // Time between the first post() of an action and the end of its
+    // execution.
+    std::chrono::nanoseconds totalLatency{0};
+    std::chrono::nanoseconds maxLatency{0};
+};
+
+// Executes actions asynchronously, as an alternative to calling
+// `Action::executeCallback()` (e.g., via `Widget::triggerAction()`) in the
+// current thread.
+//
+// Posted actions are pending until the next flush, which is done by a
+// dispatcher thread as soon as it is idle. Posting an action that is already
+// pending doesn't execute it twice: the posts are coalesced, with the highest
+// of their priorities, and all their futures are satisfied when it is
+// executed. Once flushed, an action can be posted again.
+//
+// An action is never executed concurrently with itself: if it is posted again
+// while it is running, it stays pending (and later posts are still coalesced
+// into it) until its execution is done, then is flushed as usual. Different
+// actions sharing the same callable may still run concurrently.
+//
+// At each flush, pending actions are sorted by priority, then by order of
+// first post, and split in two lanes:
+//
+// - Actions whose callback is a C++ callable are distributed among a pool of
+//   worker threads, each with its own deque. Idle workers steal from the back
+//   of the deques of other workers. Execution starts in priority order, but
+//   actions may complete in any order.
+//
+// - Actions whose callback is a Python callable (see Callback::isPython())
+//   are executed in order by the dispatcher thread, in a single batch. The
+//   batch runs within the scope given to setPythonBatchScope(), which the
+//   Python module uses to acquire the GIL only once per batch, rather than
+//   once per callback.
+//
+// The actions are kept alive until executed. Like the rest of Action, the
+// callback of a posted action must not be modified concurrently.
+//
+class API ActionQueue {
+public:
+    // Called once the action is executed, with the exception thrown by its
+    // callback, if any. It is called in the thread that executed the action,
+    // and must not throw.
+    using Completion = std::function<void(std::exception_ptr)>;
+
+    // Function running `batch(data)`, e.g., while holding a lock.
+    using BatchScope = void (*)(void (*batch)(void* data), void* data);
+
+    // Starts the dispatcher thread and the given number of worker threads, or
+    // one per hardware thread if zero.
+    //
+    explicit ActionQueue(size_t numWorkers = 0);
+
+    // Waits until all the posted actions are executed, then stops the threads.
+    //
+    // If called from a thread of the queue (e.g., an action whose callback
+    // owns the last reference to the queue), this cannot wait for the thread
+    // itself, so this returns immediately, and a detached thread does the
+    // same once the action is done.
+    //
+    ~ActionQueue();
+
+    DISABLE_COPY_AND_MOVE(ActionQueue);
+
+    // Posts the action. The returned future becomes ready once the action is
+    // executed, and rethrows the exception thrown by its callback, if any.
+    //
+    std::future<void> post(ActionSharedPtr action, ActionPriority priority = ActionPriority::Normal);
+
+    // Posts the action, calling `onDone` once it is executed.
+    void post(ActionSharedPtr action, ActionPriority priority, Completion onDone);
+
+    // Blocks until all the actions posted so far are executed.
+    //
+    // Throws std::logic_error if called from an action executed by the
+    // queue, which would otherwise wait for itself.
+    //
+    void drain();
+
+    // Number of actions posted but not executed yet, after coalescing.
+    size_t depth() const;
+
+    ActionQueueStats stats() const;
+
+    size_t numWorkers() const;
+
+    // Sets the scope in which batches of Python callbacks are executed. The
+    // default scope simply calls `batch(data)`.
+    //
+    void setPythonBatchScope(BatchScope scope);
+
+private:
+    std::unique_ptr<detail::ActionQueueImpl> impl_;
+};
@@ -0,0 +1,123 @@
+// Standardized workloads of ../benchmark.h on widgets, including
+// Widget::triggerAll(), which is specific to this experiment.
+//
+// Usage: x06_bench [numWidgets] [--json path]
+//
+// See bench.py for Python callbacks.
+
+#include <algorithm> // max
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "../benchmark.h"
+#include "action.h"
+#include "widget.h"
+
+namespace {
+
+template<typename T>
+void doNotOptimize(const T& value) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+auto makeSmall(size_t* count) {
+    return [count]() { ++*count; };
+}
+
+// Standardized workloads, see ../benchmark.h. Each widget owns its own
+// action, whose callback increments a counter.
+//
+void runWorkloads(benchmark::Report& report, size_t numWidgets) {
+    using benchmark::Clock;
+    using benchmark::nanosecondsSince;
+    benchmark::Params params = {{"numWidgets", numWidgets}};
+    benchmark::useAtomicRefCounts();
+    size_t count = 0;
+
+    std::vector<WidgetSharedPtr> widgets;
+    widgets.reserve(numWidgets);
+    auto start = Clock::now();
+    for (size_t i = 0; i < numWidgets; ++i) {
+        ActionSharedPtr action = Action::create();
+        action->setCallback(makeSmall(&count));
+        widgets.push_back(Widget::create());
+        widgets.back()->setAction(*action);
+    }
+    report.add("build", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    start = Clock::now();
+    for (const WidgetSharedPtr& widget : widgets) {
+        widget->triggerAction();
+    }
+    report.add("trigger", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    std::vector<Widget*> pointers;
+    pointers.reserve(numWidgets);
+    for (const WidgetSharedPtr& widget : widgets) {
+        pointers.push_back(widget.get());
+    }
+    start = Clock::now();
+    Widget::triggerAll(pointers.data(), pointers.size());
+    report.add("triggerAll", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    // Subsequent calls reuse the buffers allocated by the first one.
+    start = Clock::now();
+    Widget::triggerAll(pointers.data(), pointers.size());
+    report.add("triggerAllAgain", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    benchmark::Random random;
+    start = Clock::now();
+    for (size_t i = 0; i < numWidgets; ++i) {
+        widgets[random(numWidgets)]->triggerAction();
+    }
+    report.add("randomTrigger", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+
+    // All threads lock the same actions, starting at different offsets.
+    std::vector<ActionWeakPtr> actions;
+    actions.reserve(numWidgets);
+    for (const WidgetSharedPtr& widget : widgets) {
+        actions.push_back(widget->action());
+    }
+    size_t locksPerThread = std::max<size_t>(numWidgets, 1000000);
+    for (size_t numThreads : benchmark::threadCounts()) {
+        double ns = benchmark::runThreads(numThreads, [&](size_t threadIndex) {
+            size_t j = threadIndex * actions.size() / numThreads;
+            for (size_t i = 0; i < locksPerThread; ++i) {
+                ActionSharedPtr p = actions[j].lock();
+                j = (j + 1 == actions.size()) ? 0 : j + 1;
+            }
+        });
+        double locksPerSecond = numThreads * locksPerThread / (ns * 1e-9);
+        benchmark::Params threadParams = params;
+        threadParams.push_back({"numThreads", numThreads});
+        report.add("weakLock", threadParams, locksPerSecond * 1e-6, "Mlocks/s");
+    }
+    actions.clear();
+
+    start = Clock::now();
+    widgets.clear();
+    report.add("destroy", params, nanosecondsSince(start) / numWidgets, "ns/widget");
+    doNotOptimize(count);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    benchmark::Args args(argc, argv);
+    size_t numWidgets = args.get(0, 1000000);
+
+    std::cout << numWidgets << " widgets" << std::endl;
+    benchmark::Report report("x06");
+    runWorkloads(report, numWidgets);
+    if (!report.save(args.jsonPath)) {
+        std::cerr << "Cannot write " << args.jsonPath << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,86 @@
+#!/usr/bin/python3
+
+# Compares attribute access through a weak pointer proxy (e.g., ActionWeakPtr)
+# with direct attribute access on the strong type (e.g., Action).
+#
+# Also compares triggering the actions of many widgets with a Python loop
+# calling `triggerAction()`, versus a single call to `Widget.triggerAll()`.
+#
+# Usage: bench.py [numIterations]
+#
+# Requires the x06 module to be in the PYTHONPATH.
+
+import sys
+import time
+from x06 import Action, CallCounter, Widget
+
+def getName(obj, n):
+    for _ in range(n):
+        obj.name
+
+def setName(obj, n):
+    for _ in range(n):
+        obj.name = "myAction"
+
+def callMethod(obj, n):
+    for _ in range(n):
+        obj.executeCallback()
+
+def timeit(label, f):
+    start = time.perf_counter()
+    f()
+    elapsed = time.perf_counter() - start
+    print(f"  {label}: {elapsed:.3f}s")
+    return elapsed
+
+def main():
+    n = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    print(f"{n} iterations")
+    action = Action()
+    action.setCallback(lambda: None)
+
+    # The proxy finds the wrapper of `action` via its wrapper slot. We also
+    # measure the case where the observed object has no Python wrapper, where
+    # the proxy has to create a temporary one for each access.
+    weak = action.toWeak()
+    widget = Widget()
+    widget.action = Action()  # only owned by the widget once its wrapper is destroyed
+    widget.action.setCallback(lambda: None)
+    unwrappedWeak = widget.action.toWeak()
+
+    for label, f in [("get", getName), ("set", setName), ("call", callMethod)]:
+        print(f"{label}:")
+        direct = timeit("direct", lambda: f(action, n))
+        proxied = timeit("proxied", lambda: f(weak, n))
+        print(f"    overhead: {proxied / direct:.1f}x")
+        proxied = timeit("proxied (no wrapper)", lambda: f(unwrappedWeak, n))
+        print(f"    overhead: {proxied / direct:.1f}x")
+
+    benchTriggerAll(n)
+
+def triggerLoop(widgets):
+    for widget in widgets:
+        widget.triggerAction()
+
+# Widgets share actions in groups of `groupSize`, which triggerAll() only
+# executes once per group.
+#
+def benchTriggerAll(n, numWidgets=1000):
+    numFrames = max(1, n // numWidgets)
+    print(f"triggerAll ({numFrames} frames of {numWidgets} widgets):")
+    for label, makeCallback in [("Python", lambda: (lambda: None)), ("C++", CallCounter)]:
+        for groupSize in [1, 10]:
+            widgets = [Widget() for _ in range(numWidgets)]
+            for i in range(0, numWidgets, groupSize):
+                action = Action()
+                action.setCallback(makeCallback())
+                for widget in widgets[i:i + groupSize]:
+                    widget.action = action
+            print(f"  {label} callbacks, actions shared by {groupSize} widget(s):")
+            loop = timeit("loop", lambda: [triggerLoop(widgets) for _ in range(numFrames)])
+            batched = timeit("triggerAll", lambda: [Widget.triggerAll(widgets) for _ in range(numFrames)])
+            perWidget = (loop - batched) / (numFrames * numWidgets) * 1e9
+            print(f"    speedup: {loop / batched:.1f}x ({perWidget:.0f}ns saved per widget)")
+
+if __name__ == '__main__':
+    main()
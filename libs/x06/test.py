@@ -1,9 +1,11 @@
 #!/usr/bin/python3
 
+import asyncio
 import gc
 import sys
 import unittest
-from x06 import Action, Widget
+import x06
+from x06 import Action, ActionPriority, ActionQueue, CallCounter, Widget
 
 def changeName(x):
     x.name = "newName"
@@ -133,6 +135,236 @@ class Tests(unittest.TestCase):
         self.assertEqual(action2, action)
         self.assertEqual(action, action2)
 
+    def testWeakPtrOwnAttributes(self):
+        action = Action()
+        weak = action.toWeak()
+        self.assertEqual(weak.refCount(), 1)
+        del action
+        self.assertEqual(weak.refCount(), 0)  # not forwarded, so works when expired
+
+    def testWeakPtrInheritedAttributes(self):
+        action = Action()
+        weak = action.toWeak()
+        self.assertIs(weak.__class__, x06.ActionWeakPtr)
+        self.assertIs(action.__class__, Action)
+        del action
+        self.assertIs(weak.__class__, x06.ActionWeakPtr)  # not forwarded either
+        self.assertTrue(callable(weak.__reduce_ex__))
+
+    def testExpiredWeakPtr(self):
+        action = Action()
+        weak = action.toWeak()
+        del action
+        with self.assertRaises(RuntimeError):
+            weak.name
+        with self.assertRaises(RuntimeError):
+            weak.name = "myAction"
+
+    def testWeakPtrBoundMethodKeepsObjectAlive(self):
+        action = Action()
+        action.setCallback(lambda: None)
+        actionRefCounter = action.refCounter()
+        weak = action.toWeak()
+        executeCallback = weak.executeCallback
+        del action
+        self.assertEqual(actionRefCounter.count, 1) # wrapper bound to `executeCallback`
+        executeCallback()
+        del executeCallback
+        self.assertEqual(actionRefCounter.count, 0)
+        with self.assertRaises(RuntimeError):
+            weak.executeCallback
+
+    def testHashAndId(self):
+        action = Action()
+        weak = action.toWeak()
+        weak2 = action.toShared().toWeak()
+        other = Action()
+        self.assertEqual(weak.id, action.id)
+        self.assertEqual(weak2.id, action.id)
+        self.assertNotEqual(other.id, action.id)
+        self.assertEqual(hash(weak), hash(weak2))
+        self.assertEqual(hash(weak), hash(action))
+        self.assertEqual(len({weak, weak2, action}), 1)
+        self.assertIn(weak, {action: 1})
+        self.assertNotIn(other.toWeak(), {weak})
+        self.assertNotEqual(weak, other)
+        self.assertNotEqual(weak, 42)
+
+    def testHashOfExpiredWeakPtr(self):
+        action = Action()
+        weak = action.toWeak()
+        h = hash(weak)
+        id = weak.id
+        handles = {weak}
+        del action
+        self.assertEqual(hash(weak), h)  # stable once expired
+        self.assertEqual(weak.id, id)
+        self.assertIn(weak, handles)
+
+    def testHashOfWeakPtrCreatedExpired(self):
+        action = Action()
+        widget = Widget()
+        widget.action = action
+        weak = action.toWeak()
+        h = hash(weak)
+        del action
+        expired = widget.action # created once expired: no ID
+        self.assertEqual(expired.id, 0)
+        self.assertEqual(expired, weak)
+        with self.assertRaises(TypeError):
+            hash(expired)
+        with self.assertRaises(TypeError):
+            {expired}
+        self.assertEqual(hash(weak), h)
+        with self.assertRaises(TypeError):
+            hash(Widget().action) # empty weak_ptr
+
+    def testEqualityOfExpiredWeakPtrs(self):
+        action = Action()
+        other = Action()
+        weak = action.toWeak()
+        weak2 = action.toWeak()
+        otherWeak = other.toWeak()
+        del action, other
+        self.assertEqual(weak, weak2)  # same control block
+        self.assertNotEqual(weak, otherWeak)
+        self.assertEqual(len({weak, weak2, otherWeak}), 2)
+
+    def testCallCounterThroughWeakPtr(self):
+        action = Action()
+        counter = CallCounter()
+        weak = action.toWeak()
+        weak.setCallback(counter)
+        weak.executeCallback()
+        self.assertEqual(counter.count, 1)
+
+    def testTriggerAll(self):
+        calls = []
+        shared = Action()
+        shared.setCallback(lambda: calls.append("shared"))
+        own = Action()
+        own.setCallback(lambda: calls.append("own"))
+        counter = CallCounter()
+        native = Action()
+        native.setCallback(counter)
+        widgets = [Widget() for _ in range(5)]
+        widgets[0].action = shared
+        widgets[1].action = own
+        widgets[2].action = shared
+        widgets[3].action = native
+        # widgets[4] has no action
+        Widget.triggerAll(widgets + [None])
+        self.assertEqual(calls, ["shared", "own"])
+        self.assertEqual(counter.count, 1)
+        Widget.triggerAll([])
+
+    def testActionQueue(self):
+        queue = ActionQueue(2)
+        action = Action()
+        action.setCallback(lambda x = action : changeName(x))
+        future = queue.post(action)
+        self.assertIsNone(future.result(timeout=10))
+        self.assertEqual(action.name, "newName")
+        queue.drain()
+        self.assertEqual(queue.depth, 0)
+        stats = queue.stats()
+        self.assertEqual(stats.numPosted, 1)
+        self.assertEqual(stats.numExecuted, 1)
+        self.assertGreaterEqual(stats.numPythonBatches, 1)
+        self.assertGreater(stats.maxLatency, 0)
+
+    def testActionQueueNativeCallback(self):
+        queue = ActionQueue(4)
+        counters = [CallCounter() for _ in range(100)]
+        futures = []
+        for counter in counters:
+            action = Action()
+            action.setCallback(counter)
+            futures.append(queue.post(action, ActionPriority.High))
+        queue.drain()
+        self.assertTrue(all(f.done() for f in futures))
+        self.assertTrue(all(c.count == 1 for c in counters))
+        self.assertEqual(queue.stats().numPythonBatches, 0)
+
+    def testActionQueueCoalescing(self):
+        queue = ActionQueue(1)
+        calls = []
+        action = Action()
+        action.setCallback(lambda: calls.append(1))
+        futures = [queue.post(action) for _ in range(1000)]
+        queue.drain()
+        self.assertTrue(all(f.done() for f in futures))
+        stats = queue.stats()
+        self.assertEqual(stats.numPosted, 1000)
+        self.assertEqual(len(calls), stats.numExecuted)
+        self.assertEqual(stats.numExecuted + stats.numCoalesced, 1000)
+
+    def testActionQueueException(self):
+        def f():
+            raise ValueError("error in callback")
+        queue = ActionQueue(1)
+        action = Action()
+        action.setCallback(f)
+        with self.assertRaises(ValueError):
+            queue.post(action).result(timeout=10)
+        with self.assertRaises(RuntimeError):
+            queue.post(Action()).result(timeout=10) # no callback
+        self.assertEqual(queue.stats().numFailed, 2)
+
+    def testActionQueueNoConcurrentExecution(self):
+        queue = ActionQueue(4)
+        counter = CallCounter()  # not thread-safe
+        action = Action()
+        action.setCallback(counter)
+        futures = [queue.post(action) for _ in range(10000)]
+        queue.drain()
+        self.assertTrue(all(f.done() for f in futures))
+        stats = queue.stats()
+        self.assertEqual(counter.count, stats.numExecuted)
+        self.assertEqual(stats.numExecuted + stats.numCoalesced, 10000)
+
+    def testActionQueueDrainFromCallback(self):
+        queue = ActionQueue(1)
+        action = Action()
+        action.setCallback(lambda: queue.drain())
+        with self.assertRaises(RuntimeError):  # would wait for itself
+            queue.post(action).result(timeout=10)
+
+    def testActionQueueDestroyedFromCallback(self):
+        queue = ActionQueue(1)
+        action = Action()
+        action.setCallback(lambda q=queue: None)  # last reference to the queue
+        future = queue.post(action)
+        del queue, action
+        self.assertIsNone(future.result(timeout=10))
+
+    def testActionQueueAwait(self):
+        queue = ActionQueue(1)
+        action = Action()
+        action.setCallback(lambda x = action : changeName(x))
+        async def run():
+            await asyncio.wrap_future(queue.post(action))
+        asyncio.run(run())
+        self.assertEqual(action.name, "newName")
+
+    def testStats(self):
+        stats = x06.stats()
+        self.assertEqual(set(stats.keys()), {"Action", "Widget"})
+        if not x06.TELEMETRY_ENABLED:
+            return
+        action = Action()
+        weak = action.toWeak()
+        weak.name
+        del action
+        with self.assertRaises(RuntimeError):
+            weak.name
+        after = x06.stats()
+        self.assertEqual(after["Action"]["created"] - stats["Action"]["created"], 1)
+        self.assertEqual(after["Action"]["live"], stats["Action"]["live"])
+        self.assertGreaterEqual(after["Action"]["locks"] - stats["Action"]["locks"], 2)
+        self.assertEqual(after["Action"]["failedLocks"] - stats["Action"]["failedLocks"], 1)
+        self.assertEqual(after["Widget"]["created"], stats["Widget"]["created"])
+
     def testMemoryLeak(self):
         widget = Widget()
         widget.name = "myWidget"
@@ -1 +1,124 @@
 #include "widget.h"
+
+#include <algorithm> // none_of
+#include <cstdint>
+#include <utility> // move
+#include <vector>
+
+namespace {
+
+// Buffers of triggerAll(), reused across calls in the same thread, so that
+// triggering many widgets, e.g. once per frame, doesn't allocate. Their
+// capacity is kept after each call.
+//
+struct TriggerScratch {
+    std::vector<const Action*> seen;     // open-addressing hash set
+    std::vector<ActionSharedPtr> actions; // distinct actions, in order
+    bool isUsed = false;
+};
+
+// Trivially destructible, so they can still be used while the thread exits,
+// as in ../telemetry.cpp.
+thread_local TriggerScratch* threadScratch = nullptr;
+thread_local bool hasExited = false;
+
+struct TriggerScratchExit {
+    ~TriggerScratchExit() {
+        delete threadScratch;
+        threadScratch = nullptr;
+        hasExited = true;
+    }
+};
+
+// Returns the buffers of this thread, or nullptr if they are already used by
+// an outer call (i.e., triggerAll() is called from a callback), or if the
+// thread is exiting.
+//
+TriggerScratch* acquireScratch() {
+    if (!threadScratch && !hasExited) {
+        threadScratch = new TriggerScratch();
+        thread_local TriggerScratchExit exit;
+        static_cast<void>(exit);
+    }
+    if (!threadScratch || threadScratch->isUsed) {
+        return nullptr;
+    }
+    threadScratch->isUsed = true;
+    return threadScratch;
+}
+
+// Releases the actions collected by a call, even if a callback throws.
+struct TriggerScratchGuard {
+    TriggerScratch& scratch;
+
+    ~TriggerScratchGuard() {
+        scratch.actions.clear();
+        scratch.isUsed = false;
+    }
+};
+
+// Below this number of widgets, duplicates are found by a linear scan of the
+// collected actions, rather than via the hash set.
+constexpr size_t maxLinearScan = 8;
+
+} // namespace
+
+void Widget::triggerAll(Widget* const* widgets, size_t count) {
+    TriggerScratch localScratch;
+    TriggerScratch* scratch = acquireScratch();
+    if (!scratch) {
+        scratch = &localScratch;
+    }
+    TriggerScratchGuard guard{*scratch};
+    std::vector<ActionSharedPtr>& actions = scratch->actions;
+    actions.reserve(count);
+
+    if (count <= maxLinearScan) {
+        for (size_t i = 0; i < count; ++i) {
+            const Widget* widget = widgets[i];
+            const Action* action = widget ? widget->action_.get() : nullptr;
+            if (!action) {
+                continue;
+            }
+            auto isSame = [action](const ActionSharedPtr& a) { return a.get() == action; };
+            if (std::none_of(actions.begin(), actions.end(), isSame)) {
+                actions.push_back(widget->action_);
+            }
+        }
+    }
+    else {
+        // Collect the distinct actions, using an open-addressing hash set of
+        // their address. Actions are created via make_shared, so their
+        // address identifies their owner, see owner_id() in wrap.cpp. Like
+        // owner_id_hash(), the hash only drops the (zero) low bits, so that
+        // actions allocated next to each other are in nearby slots, which
+        // avoids a cache miss per widget in the common case.
+        size_t capacity = 16;
+        while (capacity < 2 * count) {
+            capacity *= 2;
+        }
+        std::vector<const Action*>& seen = scratch->seen;
+        seen.assign(capacity, nullptr);
+        for (size_t i = 0; i < count; ++i) {
+            const Widget* widget = widgets[i];
+            const Action* action = widget ? widget->action_.get() : nullptr;
+            if (!action) {
+                continue;
+            }
+            size_t j = (reinterpret_cast<uintptr_t>(action) >> 4) & (capacity - 1);
+            while (seen[j] && seen[j] != action) {
+                j = (j + 1) & (capacity - 1);
+            }
+            if (!seen[j]) {
+                seen[j] = action;
+                actions.push_back(widget->action_);
+            }
+        }
+    }
+    // Each action is released as soon as it is executed, rather than in
+    // another pass over all of them, which would miss the cache again.
+    for (ActionSharedPtr& action : actions) {
+        ActionSharedPtr executed = std::move(action);
+        executed->executeCallback();
+    }
+}
@@ -6,6 +6,8 @@
 #include <string_view>
 
 #include "../common.h"
+#include "../telemetry.h"
+#include "../wrapperslot.h"
 #include "action.h"
 
 class Widget;
@@ -38,9 +40,18 @@ class API Widget : public std::enable_shared_from_this<Widget> {
     struct CreateKey {};
 
 public:
+    static constexpr telemetry::ObjectType objectType = telemetry::ObjectType::Widget;
+
     Widget(CreateKey) {
+        TELEMETRY_CREATED(Widget);
+    }
+
+    ~Widget() {
+        TELEMETRY_DESTROYED(Widget);
     }
 
+    DISABLE_COPY_AND_MOVE(Widget);
+
     static WidgetSharedPtr create() {
         return std::make_shared<Widget>(CreateKey());
     }
@@ -71,13 +82,34 @@ public:
         }
     }
 
+    // Triggers the actions of the given `count` widgets, in order. Null
+    // widgets and widgets without action are skipped, and an action shared by
+    // several widgets is only executed once, at its first occurrence.
+    //
+    // The distinct actions are all collected (and kept alive until executed)
+    // before executing any of them, so callbacks changing the action of a
+    // widget don't affect which actions are executed. If a callback throws,
+    // the remaining actions are not executed.
+    //
+    static void triggerAll(Widget* const* widgets, size_t count);
+
     WidgetRefCounter refCounter() {
         return *this;
     }
 
+    // Python wrapper of this widget, if any, see ../wrapperslot.h.
+    void* wrapper() const {
+        return wrapperSlot_.get();
+    }
+
+    void setWrapper(void* wrapper) const {
+        wrapperSlot_.set(wrapper);
+    }
+
 private:
     std::string name_;
     ActionSharedPtr action_;
+    mutable WrapperSlot wrapperSlot_;
 };
 
 inline WidgetRefCounter::WidgetRefCounter(Widget& widget)
@@ -1,12 +1,31 @@
-#include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 namespace py = pybind11;
 using rvp = py::return_value_policy;
 
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <string>
+#include <utility> // forward
+#include <vector>
+
+#include "../callbackcaster.h"
+#include "../pytelemetry.h"
+#include "../wrappercaster.h"
 #include "action.h"
+#include "actionqueue.h"
 #include "widget.h"
 
+// Return the existing wrapper of actions and widgets via their wrapper slot,
+// rather than via the registered instances of pybind11 (see
+// ../wrappercaster.h). This is also what WeakPtrProxy uses to find the
+// wrapper of the observed object.
+//
+WRAPPER_SLOT_HOLDER_CASTER(Action);
+WRAPPER_SLOT_HOLDER_CASTER(Widget);
+
 // Equality comparison between a weak_ptr and:
 // - another weak_ptr, or
 // - a shared_ptr, or
@@ -41,6 +60,45 @@ using rvp = py::return_value_policy;
 // - https://isocpp.org/files/papers/P1901R2.html
 // - https://github.com/cplusplus/papers/issues/649
 
+// Stable ID of the object managed by a shared_ptr, reference, or pointer,
+// which is simply its address.
+//
+// With the assumptions above, two objects are the same if and only if they
+// have the same ID, which makes it usable as hash. A weak_ptr, however, does
+// not give access to its stored pointer once expired, so the ID of a weak
+// pointer proxy is recorded when the proxy is created (see WeakPtrProxy),
+// while equality of weak pointers compares their control blocks via
+// owner_before(), which remains valid once expired.
+//
+template<typename T>
+inline uintptr_t owner_id(const std::shared_ptr<T>& t) {
+    return reinterpret_cast<uintptr_t>(t.get());
+}
+
+template<typename T>
+inline uintptr_t owner_id(const T& t) {
+    return reinterpret_cast<uintptr_t>(&t);
+}
+
+template<typename T>
+inline uintptr_t owner_id(const T* t) {
+    return reinterpret_cast<uintptr_t>(t);
+}
+
+// Hash consistent with owner_equal(). Objects are aligned, so we rotate their
+// address to move the (zero) low bits to the high bits, like CPython does for
+// the default hash of objects.
+//
+inline size_t owner_id_hash(uintptr_t id) {
+    return static_cast<size_t>((id >> 4) | (id << (8 * sizeof(uintptr_t) - 4)));
+}
+
+template<typename P>
+inline size_t owner_hash(const P& p) {
+    return owner_id_hash(owner_id(p));
+    // C++26: return p.owner_hash() for smart pointers
+}
+
 template<typename T, typename U>
 inline bool owner_equal(const std::weak_ptr<T>& t, const std::weak_ptr<U>& u) {
     return !t.owner_before(u) && !u.owner_before(t);
@@ -58,16 +116,13 @@ inline bool owner_equal(const std::shared_ptr<T>& t, const std::weak_ptr<U>& u)
     return owner_equal(u, t);
 }
 
+// Note: this creates a temporary weak_ptr, causing an increase then decrease
+// of the weak refcount. The weak pointer proxy avoids it by comparing with the
+// holder of the wrapper instead.
+//
 template<typename T, typename U>
 inline bool owner_equal(const std::weak_ptr<T>& t, const U& u) {
     return owner_equal(t, u.weak_from_this());
-
-    // Note: u.weak_from_this() creates a temporary weak_ptr causing an
-    // increase then decrease of the weak refcount. With a custom instrusive
-    // shared pointer implementation, we could avoid this extra cost by
-    // directly comparing the control block address. In fact, I think it could
-    // be possible for the standard to add
-    // `enable_shared_from_this<T>::owner_equal(...)`.
 }
 
 template<typename T, typename U>
@@ -96,6 +151,17 @@ void wrap_weak_and_shared_from_this(PyClass& c) {
     c.def("toShared", py::overload_cast<>(&T::shared_from_this));
     c.def("toWeak", py::overload_cast<>(&T::weak_from_this));
 
+    // Consistent with the equality and hash of the weak pointer proxy (see
+    // WeakPtrProxy), so that both can be mixed in sets and dictionaries.
+    // Comparing with a weak pointer returns NotImplemented here, so Python
+    // then calls the comparison of the proxy.
+    c.def_property_readonly("id", [](const T& self) { return owner_id(self); });
+    c.def("__hash__", [](const T& self) { return owner_hash(self); });
+    c.def(
+        "__eq__",
+        [](const T& a, const T& b) { return owner_id(a) == owner_id(b); },
+        py::is_operator());
+
     // Note: we need overload_cast to disambiguate between the const and
     // non-const version of shared_from_this (same for weak_from_this), see:
     //
@@ -107,66 +173,271 @@ void wrap_weak_and_shared_from_this(PyClass& c) {
     // ```
 }
 
+// Native implementation of the attribute access of the Python classes
+// wrapping std::weak_ptr<T> (e.g., ActionWeakPtr), which forward it to the
+// observed object.
+//
+// Binding `__getattribute__` and `__setattr__` would make each access go
+// through the pybind11 dispatcher, then through the generic call path of
+// `object.__getattribute__`. Instead, we directly set the tp_getattro and
+// tp_setattro slots of the type, which:
+//
+// - lock the weak_ptr,
+// - get the wrapper of the locked shared_ptr, in O(1) if the object already
+//   has one (see ../wrappercaster.h), otherwise by creating a new wrapper
+//   owning a copy of the shared_ptr,
+// - forward to the tp_getattro/tp_setattro of this wrapper, which resolves
+//   the attribute via the per-type attribute cache of CPython.
+//
+// Since the wrapper owns a shared_ptr, a bound method returned by the proxy
+// (e.g., `f = actionWeakPtr.executeCallback`) keeps the object alive until
+// the bound method is destroyed, in particular during the call.
+//
+// The attributes of the proxy class, including the ones inherited from its
+// bases (e.g., `refCount`, `__class__`, `__reduce_ex__`), are not forwarded.
+// Their names are cached on first access, once the class is fully defined.
+//
+// Equality and hash are also implemented as slots (tp_richcompare, tp_hash),
+// rather than as `__eq__` overloads resolved by pybind11. Equality compares
+// the control blocks (see owner_equal()), and the hash is the hash of the ID
+// of the observed object (see owner_id()), recorded in an extra field of the
+// proxy by its type caster (see WeakPtrProxyCaster) when the proxy is
+// created. Neither locks the weak_ptr, so they are still valid once the object
+// is destroyed, and neither changes any refcount.
+//
+// A proxy created from an already expired (or empty) weak_ptr has an ID of 0,
+// since the address of the object is not available anymore. It is still
+// equal to the other proxies of the same object, but could not have the same
+// hash, so hashing it raises a TypeError, like for unhashable types.
+//
 template<typename T>
-void wrap_weak_ptr(py::module& m, const char* className) {
-
+class WeakPtrProxy {
+public:
     using TWeakPtr = std::weak_ptr<T>;
     using TSharedPtr = std::shared_ptr<T>;
 
-    auto getattribute =
-        py::module::import("builtins").attr("object").attr("__getattribute__");
+    // To be passed to py::custom_type_setup(). Appends the ID field to the
+    // proxies, which Python zero-initializes.
+    //
+    static void setupType(PyHeapTypeObject* heapType) {
+        type_ = &heapType->ht_type;
+        idOffset_ = type_->tp_basicsize;
+        type_->tp_basicsize += static_cast<Py_ssize_t>(sizeof(uintptr_t));
+        type_->tp_getattro = &getattro_;
+        type_->tp_setattro = &setattro_;
+        type_->tp_hash = &hash_;
+        type_->tp_richcompare = &richcompare_;
+    }
+
+    // Records the ID of the observed object in a newly created proxy, see
+    // WeakPtrProxyCaster. Does nothing if already recorded.
+    //
+    static void initId(PyObject* self) {
+        uintptr_t& id = id_(self);
+        if (id == 0) {
+            if (TSharedPtr sharedPtr = lock_(self)) {
+                id = owner_id(sharedPtr);
+            }
+        }
+    }
+
+    static uintptr_t id(PyObject* self) {
+        return id_(self);
+    }
+
+private:
+    static inline PyTypeObject* type_ = nullptr;
+    static inline PyTypeObject* objectType_ = nullptr; // wrapper type of T
+    static inline Py_ssize_t idOffset_ = 0;
+    static inline PyObject* ownNames_ = nullptr; // frozenset, never released
+
+    // dir() of the type lists the attributes of all the classes of its MRO,
+    // including the ones of `object` whose tp_dict is not directly readable
+    // on all Python versions.
+    static int isOwnAttribute_(PyObject* name) {
+        if (!ownNames_) {
+            PyObject* names = PyObject_Dir(reinterpret_cast<PyObject*>(type_));
+            if (!names) {
+                return -1;
+            }
+            ownNames_ = PyFrozenSet_New(names);
+            Py_DECREF(names);
+            if (!ownNames_) {
+                return -1;
+            }
+        }
+        return PySet_Contains(ownNames_, name);
+    }
+
+    // Returns the value of a pybind11 instance, or nullptr if not initialized.
+    static void* value_(PyObject* instance) {
+        auto* inst = reinterpret_cast<py::detail::instance*>(instance);
+        return inst->get_value_and_holder().value_ptr();
+    }
+
+    // Returns a null pointer if the object is not alive anymore, or if the
+    // proxy was not initialized.
+    //
+    static TSharedPtr lock_(PyObject* self) {
+        void* value = value_(self);
+        return value ? telemetry::lock(*static_cast<TWeakPtr*>(value)) : TSharedPtr();
+    }
+
+    static uintptr_t& id_(PyObject* self) {
+        return *reinterpret_cast<uintptr_t*>(reinterpret_cast<char*>(self) + idOffset_);
+    }
+
+    // The weak_ptr of a proxy, or an empty one if not initialized.
+    static const TWeakPtr& weakPtr_(PyObject* self) {
+        static const TWeakPtr empty;
+        void* value = value_(self);
+        return value ? *static_cast<const TWeakPtr*>(value) : empty;
+    }
+
+    // Sets `isEqual` to whether `other` is a proxy observing, or a wrapper
+    // owning, the same object as `self`. Returns false if `other` is neither
+    // a proxy nor a wrapper of T.
+    //
+    static bool isEqual_(PyObject* self, PyObject* other, bool& isEqual) {
+        if (PyObject_TypeCheck(other, type_)) {
+            isEqual = owner_equal(weakPtr_(self), weakPtr_(other));
+            return true;
+        }
+        if (!objectType_) {
+            objectType_ = py::detail::get_type_info(typeid(T))->type;
+        }
+        if (PyObject_TypeCheck(other, objectType_)) {
+            auto* inst = reinterpret_cast<py::detail::instance*>(other);
+            py::detail::value_and_holder v_h = inst->get_value_and_holder();
+            isEqual = v_h.holder_constructed()
+                          ? owner_equal(weakPtr_(self), v_h.template holder<TSharedPtr>())
+                          : owner_equal(weakPtr_(self), TSharedPtr());
+            return true;
+        }
+        return false;
+    }
+
+    static Py_hash_t hash_(PyObject* self) {
+        uintptr_t id = id_(self);
+        if (id == 0) {
+            PyErr_SetString(
+                PyExc_TypeError,
+                "Cannot hash weak pointer: the object was not alive anymore when it was created.");
+            return -1;
+        }
+        Py_hash_t hash = static_cast<Py_hash_t>(owner_id_hash(id));
+        return hash == -1 ? -2 : hash; // -1 means error
+    }
+
+    static PyObject* richcompare_(PyObject* self, PyObject* other, int op) {
+        bool isEqual = false;
+        if ((op != Py_EQ && op != Py_NE) || !isEqual_(self, other, isEqual)) {
+            Py_RETURN_NOTIMPLEMENTED;
+        }
+        return PyBool_FromLong(isEqual == (op == Py_EQ));
+    }
+
+    static PyObject* getattro_(PyObject* self, PyObject* name) {
+        int isOwn = isOwnAttribute_(name);
+        if (isOwn != 0) {
+            return isOwn > 0 ? PyObject_GenericGetAttr(self, name) : nullptr;
+        }
+        try {
+            if (TSharedPtr sharedPtr = lock_(self)) {
+                py::object object = py::cast(std::move(sharedPtr));
+                return PyObject_GetAttr(object.ptr(), name);
+            }
+            PyErr_SetString(
+                PyExc_RuntimeError,
+                "Cannot get attribute of object: the object is not alive anymore.");
+        }
+        catch (py::error_already_set& e) {
+            e.restore();
+        }
+        catch (const std::exception& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+        }
+        return nullptr;
+    }
+
+    // Note: `value` is null when deleting the attribute.
+    //
+    static int setattro_(PyObject* self, PyObject* name, PyObject* value) {
+        int isOwn = isOwnAttribute_(name);
+        if (isOwn != 0) {
+            return isOwn > 0 ? PyObject_GenericSetAttr(self, name, value) : -1;
+        }
+        try {
+            if (TSharedPtr sharedPtr = lock_(self)) {
+                py::object object = py::cast(std::move(sharedPtr));
+                return PyObject_SetAttr(object.ptr(), name, value);
+            }
+            PyErr_SetString(
+                PyExc_RuntimeError,
+                "Cannot set attribute of object: the object is not alive anymore.");
+        }
+        catch (py::error_already_set& e) {
+            e.restore();
+        }
+        catch (const std::exception& e) {
+            PyErr_SetString(PyExc_RuntimeError, e.what());
+        }
+        return -1;
+    }
+};
+
+// Type caster of std::weak_ptr<T>, which records the ID of the observed
+// object in each proxy it returns, see WeakPtrProxy.
+//
+template<typename T>
+struct WeakPtrProxyCaster : py::detail::type_caster_base<std::weak_ptr<T>> {
+    using Base = py::detail::type_caster_base<std::weak_ptr<T>>;
+
+    template<typename TWeakPtr>
+    static py::handle cast(TWeakPtr&& src, rvp policy, py::handle parent) {
+        py::handle res = Base::cast(std::forward<TWeakPtr>(src), policy, parent);
+        if (res && !res.is_none()) {
+            WeakPtrProxy<T>::initId(res.ptr());
+        }
+        return res;
+    }
+};
+
+namespace pybind11::detail {
 
-    auto setattr = py::module::import("builtins").attr("object").attr("__setattr__");
+template<>
+struct type_caster<ActionWeakPtr> : WeakPtrProxyCaster<Action> {};
+
+template<>
+struct type_caster<WidgetWeakPtr> : WeakPtrProxyCaster<Widget> {};
+
+} // namespace pybind11::detail
+
+template<typename T>
+void wrap_weak_ptr(py::module& m, const char* className) {
+
+    using TWeakPtr = std::weak_ptr<T>;
 
     std::string weakPtrName = className;
     weakPtrName += "WeakPtr";
 
-    py::class_<TWeakPtr>(m, weakPtrName.c_str())
+    py::class_<TWeakPtr>(
+        m, weakPtrName.c_str(), py::custom_type_setup(&WeakPtrProxy<T>::setupType))
         .def("refCount", &TWeakPtr::use_count)
-        .def(
-            "__getattribute__",
-            [getattribute](TWeakPtr& weakPtr, py::str name) {
-                if (TSharedPtr sharedPtr = weakPtr.lock()) {
-                    return getattribute(*sharedPtr, name);
-                    // XXX: when `name` is a function/callable, I suppose getattribute only
-                    //      returns the function itself, without calling it yet. How to keep alive
-                    //      the sharedPtr until the end of the function call? Is it even possible?
-                    // Idea: detect if the returned value of getattribute is a callable, and if
-                    // so, return a new callable that stores a copy of the sharedPtr.
-                }
-                else {
-                    throw std::logic_error(
-                        "Cannot get attribute of object: the object is "
-                        "not alive anymore.");
-                }
-            })
-        .def(
-            "__setattr__", // Note: there is no "__setattribute__". Shouldn't we also use "__getattr__"?
-            [setattr](TWeakPtr& weakPtr, py::str name, py::object value) {
-                if (TSharedPtr sharedPtr = weakPtr.lock()) {
-                    return setattr(*sharedPtr, name, value);
-                }
-                else {
-                    throw std::logic_error(
-                        "Cannot set attribute of object: the object is "
-                        "not alive anymore.");
-                }
-            })
-        .def(
-            "__eq__",
-            [](const TWeakPtr& a, const TWeakPtr& b) { return owner_equal(a, b); },
-            py::is_operator())
-        .def(
-            "__eq__",
-            [](const TWeakPtr& a, const T& b) { return owner_equal(a, b); },
-            py::is_operator());
+        .def_property_readonly(
+            "id", [](py::handle self) { return WeakPtrProxy<T>::id(self.ptr()); });
+}
 
-    // Note: for some reason, it doesn't seem necessary to implement the mirror
-    // equality operator:
-    //
-    //   [](const T& a, const TWeakPtr& b) { return owner_equal(a, b); }
-    //
-    // It's probably pybind11 that already tests if the reverse operator exists
+// C++ function objects that can be passed to `Action.setCallback()` and are
+// then called without going through Python (see ../callbackcaster.h).
+//
+void wrap_callback(py::module& m) {
+    py::class_<CallbackObject, std::shared_ptr<CallbackObject>>(m, "CallbackObject")
+        .def("__call__", &CallbackObject::operator());
+
+    py::class_<CallCounter, CallbackObject, std::shared_ptr<CallCounter>>(m, "CallCounter")
+        .def(py::init<>())
+        .def_property_readonly("count", &CallCounter::count);
 }
 
 void wrap_action(py::module& m) {
@@ -174,7 +445,8 @@ void wrap_action(py::module& m) {
     py::class_<ActionRefCounter>(m, "ActionRefCounter")
         .def_property_readonly("count", &ActionRefCounter::count);
 
-    py::class_<Action, ActionSharedPtr> c(m, "Action");
+    py::class_<Action, ActionSharedPtr> c(
+        m, "Action", py::custom_type_setup(&wrapperslot::setupType<Action>));
     c.def(py::init(&Action::create))
         .def_property("name", &Action::name, &Action::setName)
         .def("setCallback", &Action::setCallback)
@@ -190,18 +462,146 @@ void wrap_widget(py::module& m) {
     py::class_<WidgetRefCounter>(m, "WidgetRefCounter")
         .def_property_readonly("count", &WidgetRefCounter::count);
 
-    py::class_<Widget, WidgetSharedPtr> c(m, "Widget");
+    py::class_<Widget, WidgetSharedPtr> c(
+        m, "Widget", py::custom_type_setup(&wrapperslot::setupType<Widget>));
     c.def(py::init(&Widget::create))
         .def_property("name", &Widget::name, &Widget::setName)
         .def_property("action", &Widget::action, &Widget::setAction)
         .def("triggerAction", &Widget::triggerAction)
+        .def_static(
+            "triggerAll",
+            [](const std::vector<Widget*>& widgets) {
+                Widget::triggerAll(widgets.data(), widgets.size());
+            },
+            py::arg("widgets"))
         .def("refCounter", &Widget::refCounter);
 
     wrap_weak_ptr<Widget>(m, "Widget");
     wrap_weak_and_shared_from_this<Widget>(c);
 }
 
+// Completion of an action posted from Python, setting the result of a
+// `concurrent.futures.Future`. It is shared by the copies of the completion,
+// which may be destroyed in a thread that doesn't hold the GIL.
+//
+class PyFutureSetter {
+public:
+    explicit PyFutureSetter(py::object future)
+        : future_(std::move(future)) {
+    }
+
+    ~PyFutureSetter() {
+        py::gil_scoped_acquire gil;
+        future_ = py::object();
+    }
+
+    void operator()(std::exception_ptr error) {
+        py::gil_scoped_acquire gil;
+        try {
+            if (!error) {
+                future_.attr("set_result")(py::none());
+                return;
+            }
+            try {
+                std::rethrow_exception(error);
+            }
+            catch (py::error_already_set& e) {
+                future_.attr("set_exception")(e.value());
+            }
+            catch (const std::exception& e) {
+                future_.attr("set_exception")(py::handle(PyExc_RuntimeError)(e.what()));
+            }
+        }
+        catch (py::error_already_set& e) {
+            e.discard_as_unraisable("ActionQueue completion");
+        }
+    }
+
+private:
+    py::object future_;
+};
+
+// Executes a batch of Python callbacks under a single acquisition of the GIL.
+// Each callback then sees that the GIL is already held (see
+// ../callbackcaster.h).
+//
+void runWithGil(void (*batch)(void*), void* data) {
+    py::gil_scoped_acquire gil;
+    batch(data);
+}
+
+// Destroying the queue waits for the pending actions, which may need the GIL.
+//
+void deleteActionQueue(ActionQueue* queue) {
+    if (PyGILState_Check()) {
+        py::gil_scoped_release release;
+        delete queue;
+    }
+    else {
+        delete queue;
+    }
+}
+
+void wrap_action_queue(py::module& m) {
+
+    py::enum_<ActionPriority>(m, "ActionPriority")
+        .value("Low", ActionPriority::Low)
+        .value("Normal", ActionPriority::Normal)
+        .value("High", ActionPriority::High);
+
+    // Latencies are in seconds, like `time.perf_counter()`.
+    using Stats = ActionQueueStats;
+    auto seconds = [](std::chrono::nanoseconds t) { return t.count() * 1e-9; };
+    py::class_<Stats>(m, "ActionQueueStats")
+        .def_readonly("depth", &Stats::depth)
+        .def_readonly("maxDepth", &Stats::maxDepth)
+        .def_readonly("numPosted", &Stats::numPosted)
+        .def_readonly("numCoalesced", &Stats::numCoalesced)
+        .def_readonly("numExecuted", &Stats::numExecuted)
+        .def_readonly("numFailed", &Stats::numFailed)
+        .def_readonly("numPythonBatches", &Stats::numPythonBatches)
+        .def_property_readonly(
+            "totalLatency", [=](const Stats& self) { return seconds(self.totalLatency); })
+        .def_property_readonly(
+            "maxLatency", [=](const Stats& self) { return seconds(self.maxLatency); })
+        .def_property_readonly("meanLatency", [=](const Stats& self) {
+            return self.numExecuted ? seconds(self.totalLatency) / self.numExecuted : 0.0;
+        });
+
+    // Returns a `concurrent.futures.Future`, which can be awaited in asyncio
+    // via `asyncio.wrap_future()`.
+    auto post = [](ActionQueue& self, ActionSharedPtr action, ActionPriority priority) {
+        static py::handle futureType =
+            py::module::import("concurrent.futures").attr("Future").release();
+        py::object future = futureType();
+        future.attr("set_running_or_notify_cancel")(); // cannot be cancelled anymore
+        auto setter = std::make_shared<PyFutureSetter>(future);
+        self.post(std::move(action), priority, [setter](std::exception_ptr error) {
+            (*setter)(error);
+        });
+        return future;
+    };
+
+    py::class_<ActionQueue, std::shared_ptr<ActionQueue>>(m, "ActionQueue")
+        .def(
+            py::init([](size_t numWorkers) {
+                std::shared_ptr<ActionQueue> queue(
+                    new ActionQueue(numWorkers), &deleteActionQueue);
+                queue->setPythonBatchScope(&runWithGil);
+                return queue;
+            }),
+            py::arg("numWorkers") = 0)
+        .def("post", post, py::arg("action"), py::arg("priority") = ActionPriority::Normal)
+        .def("drain", &ActionQueue::drain, py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("depth", &ActionQueue::depth)
+        .def_property_readonly("numWorkers", &ActionQueue::numWorkers)
+        .def("stats", &ActionQueue::stats);
+}
+
 PYBIND11_MODULE(x06, m) {
+    wrap_callback(m);
     wrap_action(m);
     wrap_widget(m);
+    wrap_action_queue(m);
+    pytelemetry::defStats(m, {telemetry::ObjectType::Action, telemetry::ObjectType::Widget});
 }
@@ -0,0 +1,88 @@
+// Measures the time to save a tree to a snapshot file, then to load it, which
+// is the cold-start time of a process whose tree is stored in a snapshot.
+// The snapshot is written to the current directory. Note that the file is
+// likely still in the page cache when loading it.
+//
+// See bench.py for a comparison of x02, x03, and x07 via their Python API.
+//
+// Usage: x07_bench [numNodes] [branchingFactor]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "tree.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Same names as x02/bench.cpp and x03/bench.cpp.
+//
+const std::vector<std::string>& names() {
+    static std::vector<std::string> res = []() {
+        std::vector<std::string> names;
+        for (int i = 0; i < 2000; ++i) {
+            names.push_back("transform_group_" + std::to_string(i));
+        }
+        return names;
+    }();
+    return res;
+}
+
+// Builds a tree of `numNodes` nodes (including the root) in breadth-first
+// order, where each node has `branchingFactor` children, except possibly in
+// the last level.
+//
+void build(Tree& tree, size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    std::vector<Node> queue;
+    queue.reserve(numNodes);
+    queue.push_back(tree.root());
+    size_t i = 0;
+    while (queue.size() < numNodes) {
+        Node parent = queue[i++];
+        for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+            const std::string& name = names_[queue.size() % names_.size()];
+            queue.push_back(parent.createChild(name));
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t numNodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t branchingFactor = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 8;
+    if (branchingFactor == 0) {
+        std::cerr << "The branching factor must be at least 1" << std::endl;
+        return 1;
+    }
+    std::string path = "x07_bench.snap";
+
+    std::cout << numNodes << " nodes, branching factor " << branchingFactor << std::endl;
+    Tree tree;
+    auto start = Clock::now();
+    build(tree, numNodes, branchingFactor);
+    double buildTime = secondsSince(start);
+
+    start = Clock::now();
+    tree.save(path);
+    double saveTime = secondsSince(start);
+
+    start = Clock::now();
+    std::unique_ptr<Tree> loaded = Tree::load(path);
+    double loadTime = secondsSince(start);
+    std::remove(path.c_str());
+
+    std::cout << "build " << buildTime << "s, save " << saveTime << "s, load " << loadTime
+              << "s (" << loaded->numNodes() << " nodes)" << std::endl;
+}
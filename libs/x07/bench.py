@@ -0,0 +1,68 @@
+#!/usr/bin/python3
+
+# Compares the pointer-based trees of x02 (unique_ptr) and x03 (shared_ptr)
+# with the flat tree of x07, via the same Python API.
+#
+# Usage: bench.py [numNodes] [branchingFactor]
+#
+# Requires the x02, x03, and x07 modules to be in the PYTHONPATH. Each module
+# is measured in its own Python process, since they all register a `Node` and
+# a `Tree` type with pybind11, which cannot be imported in the same process.
+
+import importlib
+import subprocess
+import sys
+import time
+
+def build(tree, numNodes, branchingFactor):
+    queue = [tree.root]
+    i = 0
+    n = 1
+    while n < numNodes:
+        parent = queue[i]
+        i += 1
+        for j in range(min(branchingFactor, numNodes - n)):
+            queue.append(parent.createChild("node"))
+            n += 1
+
+def traverse(node):
+    count = 0
+    stack = [node]
+    while stack:
+        node = stack.pop()
+        count += 1
+        for i in range(node.numChildren):
+            stack.append(node.child(i))
+    return count
+
+def timeit(label, f):
+    start = time.perf_counter()
+    res = f()
+    print(f"  {label}: {time.perf_counter() - start:.3f}s")
+    return res
+
+def main():
+    if len(sys.argv) > 1 and sys.argv[1] == "--module":
+        benchModule(sys.argv[2], int(sys.argv[3]), int(sys.argv[4]))
+        return
+    numNodes = int(sys.argv[1]) if len(sys.argv) > 1 else 1000000
+    branchingFactor = int(sys.argv[2]) if len(sys.argv) > 2 else 8
+    print(f"{numNodes} nodes, branching factor {branchingFactor}", flush=True)
+    for name in ["x02", "x03", "x07"]:
+        subprocess.run(
+            [sys.executable, __file__, "--module", name, str(numNodes), str(branchingFactor)],
+            check=True)
+
+def benchModule(name, numNodes, branchingFactor):
+    module = importlib.import_module(name)
+    print(f"{name}:")
+    tree = module.Tree()
+    timeit("build", lambda: build(tree, numNodes, branchingFactor))
+    timeit("traverse (Python)", lambda: traverse(tree.root))
+    if name == "x07":
+        timeit("subtreeSize (C++)", lambda: tree.root.subtreeSize())
+        timeit("countNodesNamed (C++)", lambda: tree.countNodesNamed("node"))
+    timeit("destroy", lambda: tree.root.clearChildren())
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,109 @@
+#!/usr/bin/python3
+
+import os
+import tempfile
+import unittest
+from x07 import Node, Tree
+
+def getRootOfNewTree():
+    tree = Tree()
+    return tree.root
+
+def getNodeOfNewTree():
+    tree = Tree()
+    node = tree.root.createChild("node1")
+    return node
+
+def subtreeNames(node):
+    res = [node.name]
+    for i in range(node.numChildren):
+        res.extend(subtreeNames(node.child(i)))
+    return res
+
+class TestTree(unittest.TestCase):
+
+    def testConstructor(self):
+        tree = Tree()
+        self.assertEqual(tree.root.name, "root")
+        self.assertEqual(tree.numNodes, 1)
+
+    def testKeepAliveRootToTree(self):
+        node = getRootOfNewTree()
+        self.assertEqual(node.name, "root")
+
+    def testKeepAliveNodeToTree(self):
+        node = getNodeOfNewTree()
+        self.assertEqual(node.name, "node1")
+
+    def testParentChild(self):
+        tree = Tree()
+        root = tree.root
+        self.assertIsNone(root.parent)
+        node1 = root.createChild("node1")
+        node2 = root.createChild("node2")
+        self.assertEqual(root.numChildren, 2)
+        self.assertEqual(root.child(0), node1)
+        self.assertEqual(root.child(1), node2)
+        self.assertEqual(node2.parent, root)
+        self.assertNotEqual(node1, node2)
+        self.assertRaises(IndexError, root.child, 2)
+        node2.name = "newName"
+        self.assertEqual(root.child(1).name, "newName")
+
+    # Compared to x02, this is not UB: the handle knows that the node has been
+    # removed from the tree, even if its slot has been reused by another node.
+    #
+    def testAccessingClearedChild(self):
+        tree = Tree()
+        root = tree.root
+        node = root.createChild("node1")
+        root.clearChildren()
+        self.assertFalse(node.isAlive)
+        root.createChild("node2")
+        self.assertEqual(tree.numNodes, 2)
+        with self.assertRaises(RuntimeError):
+            node.name
+
+    def testAggregations(self):
+        tree = Tree()
+        root = tree.root
+        for i in range(10):
+            child = root.createChild("a")
+            for j in range(10):
+                child.createChild("b" if j % 2 else "a")
+        self.assertEqual(tree.numNodes, 111)
+        self.assertEqual(root.subtreeSize(), 111)
+        self.assertEqual(root.child(3).subtreeSize(), 11)
+        self.assertEqual(tree.countNodesNamed("a"), 60)
+        self.assertEqual(tree.countNodesNamed("b"), 50)
+        self.assertEqual(tree.countNodesNamed("c"), 0)
+        root.child(3).clearChildren()
+        self.assertEqual(tree.numNodes, 101)
+        self.assertEqual(tree.countNodesNamed("a"), 55)
+
+    def testSaveLoad(self):
+        tree = Tree()
+        a = tree.root.createChild("a")
+        a.createChild("b")
+        a.createChild("a")
+        tree.root.createChild("b")
+        tree.root.name = "top"
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            tree.save(path)
+            loaded = Tree.load(path)
+        self.assertEqual(subtreeNames(loaded.root), ["top", "a", "b", "a", "b"])
+        self.assertEqual(subtreeNames(loaded.root), subtreeNames(tree.root))
+
+    def testLoadInvalid(self):
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "tree.snap")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)  # does not exist
+            with open(path, "wb") as f:
+                f.write(b"not a snapshot, but long enough to have a header")
+            with self.assertRaises(RuntimeError):
+                Tree.load(path)
+
+if __name__ == '__main__':
+    unittest.main()
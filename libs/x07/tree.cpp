@@ -0,0 +1,230 @@
+#include "tree.h"
+
+#include "../snapshot.h"
+
+std::optional<Node> Node::parent() const {
+    NodeId parent = tree_->parent_[checkedId_()];
+    if (parent == invalidNodeId) {
+        return std::nullopt;
+    }
+    return tree_->handle_(parent);
+}
+
+std::string_view Node::name() const {
+    return tree_->names_[tree_->nameId_[checkedId_()]];
+}
+
+void Node::setName(std::string_view name) {
+    tree_->nameId_[checkedId_()] = tree_->nameIdOf_(name);
+}
+
+size_t Node::numChildren() const {
+    return tree_->numChildren_[checkedId_()];
+}
+
+Node Node::child(size_t index) const {
+    return tree_->handle_(tree_->child_(checkedId_(), index));
+}
+
+Node Node::createChild(std::string_view name) {
+    return tree_->handle_(tree_->createNode_(checkedId_(), name));
+}
+
+void Node::clearChildren() {
+    tree_->clearChildren_(checkedId_());
+}
+
+size_t Node::subtreeSize() const {
+    size_t res = 0;
+    tree_->visitDepthFirst(checkedId_(), [&res](NodeId, size_t) { ++res; });
+    return res;
+}
+
+NodeId Node::checkedId_() const {
+    if (!isAlive()) {
+        throw std::logic_error("The node has been removed from the tree.");
+    }
+    return id_;
+}
+
+Tree::Tree() {
+    createNode_(invalidNodeId, "root");
+}
+
+size_t Tree::countNodesNamed(std::string_view name) const {
+    auto it = nameIds_.find(name);
+    if (it == nameIds_.end()) {
+        return 0;
+    }
+    NameId nameId = it->second;
+    size_t res = 0;
+    size_t n = nameId_.size();
+    for (size_t i = 0; i < n; ++i) {
+        res += nameId_[i] == nameId;
+    }
+    // Free slots keep the name of their last node, so we need to substract
+    // them. There are typically much fewer free slots than nodes.
+    for (NodeId id : freeIds_) {
+        res -= nameId_[id] == nameId;
+    }
+    return res;
+}
+
+void Tree::save(const std::string& path) const {
+    snapshot::Writer writer;
+    std::vector<uint32_t> ancestors; // index in the snapshot, by depth
+    visitDepthFirst(rootId, [&](NodeId id, size_t depth) {
+        ancestors.resize(depth);
+        uint32_t parent = depth == 0 ? snapshot::noParent : ancestors.back();
+        NameId nameId = nameId_[id];
+        ancestors.push_back(writer.addNode(parent, nameId, names_[nameId]));
+    });
+    writer.write(path);
+}
+
+std::unique_ptr<Tree> Tree::load(const std::string& path) {
+    snapshot::Reader reader(path);
+    auto tree = std::make_unique<Tree>();
+
+    // Names are distinct in a valid snapshot, so their ids are kept as is.
+    tree->names_.clear();
+    tree->nameIds_.clear();
+    for (NameId nameId = 0; nameId < reader.numNames(); ++nameId) {
+        const std::string& stored = tree->names_.emplace_back(reader.name(nameId));
+        if (!tree->nameIds_.emplace(stored, nameId).second) {
+            throw std::runtime_error("Invalid snapshot file " + path + ": duplicate name");
+        }
+    }
+
+    // Note: the root has no parent in both the snapshot and the tree.
+    static_assert(snapshot::noParent == invalidNodeId);
+    size_t n = reader.numNodes();
+    tree->parent_.assign(reader.parents(), reader.parents() + n);
+    tree->nameId_.assign(reader.nameIds(), reader.nameIds() + n);
+    tree->firstChild_.assign(n, invalidNodeId);
+    tree->lastChild_.assign(n, invalidNodeId);
+    tree->nextSibling_.assign(n, invalidNodeId);
+    tree->numChildren_.assign(n, 0);
+    tree->generation_.assign(n, 0);
+    for (NodeId id = 1; id < n; ++id) {
+        tree->appendChild_(tree->parent_[id], id);
+    }
+    return tree;
+}
+
+NameId Tree::nameIdOf_(std::string_view name) {
+    auto it = nameIds_.find(name);
+    if (it != nameIds_.end()) {
+        return it->second;
+    }
+    if (names_.size() == UINT32_MAX) {
+        throw std::length_error("Too many distinct names in the tree.");
+    }
+    NameId nameId = static_cast<NameId>(names_.size());
+    const std::string& stored = names_.emplace_back(name);
+    try {
+        nameIds_.emplace(stored, nameId);
+    }
+    catch (...) {
+        names_.pop_back();
+        throw;
+    }
+    return nameId;
+}
+
+NodeId Tree::createNode_(NodeId parent, std::string_view name) {
+    NameId nameId = nameIdOf_(name);
+    NodeId id;
+    if (freeIds_.empty()) {
+        if (parent_.size() == freeId) {
+            throw std::length_error("Too many nodes in the tree.");
+        }
+        id = static_cast<NodeId>(parent_.size());
+        parent_.push_back(parent);
+        firstChild_.push_back(invalidNodeId);
+        lastChild_.push_back(invalidNodeId);
+        nextSibling_.push_back(invalidNodeId);
+        numChildren_.push_back(0);
+        nameId_.push_back(nameId);
+        generation_.push_back(0);
+    }
+    else {
+        id = freeIds_.back();
+        freeIds_.pop_back();
+        parent_[id] = parent;
+        firstChild_[id] = invalidNodeId;
+        lastChild_[id] = invalidNodeId;
+        nextSibling_[id] = invalidNodeId;
+        numChildren_[id] = 0;
+        nameId_[id] = nameId;
+        // generation_[id] already incremented when the id was freed
+    }
+    if (parent != invalidNodeId) {
+        appendChild_(parent, id);
+    }
+    return id;
+}
+
+void Tree::appendChild_(NodeId parent, NodeId child) {
+    if (lastChild_[parent] == invalidNodeId) {
+        firstChild_[parent] = child;
+    }
+    else {
+        nextSibling_[lastChild_[parent]] = child;
+    }
+    lastChild_[parent] = child;
+    ++numChildren_[parent];
+}
+
+NodeId Tree::child_(NodeId parent, size_t index) const {
+    if (index >= numChildren_[parent]) {
+        throw std::out_of_range("Child index out of range.");
+    }
+    NodeId child;
+    size_t i;
+    if (cacheParent_ == parent && cacheIndex_ <= index) {
+        child = cacheChild_;
+        i = cacheIndex_;
+    }
+    else {
+        child = firstChild_[parent];
+        i = 0;
+    }
+    for (; i < index; ++i) {
+        child = nextSibling_[child];
+    }
+    cacheParent_ = parent;
+    cacheIndex_ = index;
+    cacheChild_ = child;
+    return child;
+}
+
+void Tree::clearChildren_(NodeId id) {
+    NodeId child = firstChild_[id];
+    if (child == invalidNodeId) {
+        return;
+    }
+
+    // Free all descendants. Their generation is incremented so that existing
+    // handles to them can detect that they've been removed.
+    //
+    // Note: we can only mark them as free after the traversal, since it
+    // relies on their parent links.
+    //
+    size_t begin = freeIds_.size();
+    visitDepthFirst(id, [this, id](NodeId descendant, size_t) {
+        if (descendant != id) {
+            freeIds_.push_back(descendant);
+        }
+    });
+    size_t end = freeIds_.size();
+    for (size_t i = begin; i < end; ++i) {
+        NodeId descendant = freeIds_[i];
+        parent_[descendant] = freeId;
+        ++generation_[descendant];
+    }
+    firstChild_[id] = invalidNodeId;
+    lastChild_[id] = invalidNodeId;
+    numChildren_[id] = 0;
+    cacheParent_ = invalidNodeId;
+}
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory> // unique_ptr
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../common.h"
+
+class Tree;
+class Node;
+
+// Index of a node in the columns of its tree.
+//
+// Note that after a node is removed, its index may be reused by a node created
+// later. Use the `Node` handle rather than a raw `NodeId` if you need to
+// detect that the node has been removed.
+//
+using NodeId = uint32_t;
+inline constexpr NodeId invalidNodeId = UINT32_MAX;
+
+// Index of a name in the name table of a tree.
+using NameId = uint32_t;
+
+// Hint the CPU that we are about to read the given address.
+inline void prefetch(const void* p) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+namespace detail {
+
+// Constructor of Node must be private-like so that only the tree can create
+// handles. We use the passkey idiom to give access to both Tree and Node.
+//
+struct NodeCreateKey {
+private:
+    friend Tree;
+    friend Node;
+    NodeCreateKey() = default;
+};
+
+} // namespace detail
+
+// A Node is a small copyable handle to a node stored in a Tree: it is not
+// the node itself. It stores the index of the node in the columns of the
+// tree, as well as the generation of this index, which allows to detect when
+// the node has been removed from the tree.
+//
+// All methods throw std::logic_error if the node has been removed from the
+// tree, instead of being UB like in x02.
+//
+class API Node {
+public:
+    Node(detail::NodeCreateKey, Tree* tree, NodeId id, uint32_t generation)
+        : tree_(tree)
+        , id_(id)
+        , generation_(generation) {
+    }
+
+    // guaranteed non-null by invariant. However, the handle does not keep
+    // the tree alive.
+    Tree& tree() const {
+        return *tree_;
+    }
+
+    NodeId id() const {
+        return id_;
+    }
+
+    // Whether the node still exists in the tree.
+    inline bool isAlive() const;
+
+    // Empty in case we're the root.
+    // Note: Node being a handle, we can use std::optional, unlike x02.
+    std::optional<Node> parent() const;
+
+    std::string_view name() const;
+
+    void setName(std::string_view name);
+
+    size_t numChildren() const;
+
+    // Throws std::out_of_range if it doesn't exist.
+    //
+    // Note: this is O(index) in general, since children are stored as a linked
+    // list. However, the tree caches the last accessed child, so iterating
+    // over child(0), child(1), ..., child(n-1) is O(n) overall.
+    //
+    Node child(size_t index) const;
+
+    Node createChild(std::string_view name);
+
+    void clearChildren();
+
+    // Number of nodes in the subtree rooted at this node, including itself.
+    size_t subtreeSize() const;
+
+    friend bool operator==(const Node& a, const Node& b) {
+        return a.tree_ == b.tree_ && a.id_ == b.id_ && a.generation_ == b.generation_;
+    }
+
+    friend bool operator!=(const Node& a, const Node& b) {
+        return !(a == b);
+    }
+
+private:
+    Tree* tree_;
+    NodeId id_;
+    uint32_t generation_;
+
+    NodeId checkedId_() const;
+};
+
+// Stores all nodes of the tree in contiguous "columns" (structure of arrays),
+// where each node is identified by its index in the columns (NodeId), rather
+// than as separate heap-allocated nodes storing pointers to their children.
+//
+// The parent-child relationships are stored as first-child / next-sibling
+// links. In addition to keeping the columns compact (no per-node vector of
+// children), this allows depth-first traversals without an explicit stack.
+//
+// Names are stored once in a per-tree name table, and each node only stores
+// the NameId of its name.
+//
+class API Tree {
+public:
+    // Cannot be copied or moved because node handles store the address of
+    // the tree. Would otherwise require custom copy/move implementations.
+    //
+    DISABLE_COPY_AND_MOVE(Tree);
+
+    Tree();
+
+    // guaranteed to exist: our tree is assumed to always has a root.
+    Node root() {
+        return handle_(rootId);
+    };
+
+    // Number of nodes in the tree, including the root.
+    size_t numNodes() const {
+        return parent_.size() - freeIds_.size();
+    }
+
+    // Number of nodes in the tree whose name is `name`.
+    //
+    // This is a linear scan of the name column, which is typically much faster
+    // than a traversal, since no parent-child link has to be followed.
+    //
+    size_t countNodesNamed(std::string_view name) const;
+
+    // Writes the names and topology of the tree to the given file, see
+    // ../snapshot.h. Nodes are written in depth-first pre-order, so a saved
+    // then loaded tree has no free NodeIds, and its NodeIds are in
+    // pre-order. Throws std::runtime_error if the file cannot be written.
+    //
+    void save(const std::string& path) const;
+
+    // Creates a tree from a file written by save().
+    //
+    // The snapshot format matches the columns of the tree: the parent and
+    // name columns, as well as the name table, are copied as is from the
+    // file mapped in memory, and the child and sibling links are derived in
+    // one linear pass. Throws std::runtime_error if the file cannot be read
+    // or is not a valid snapshot.
+    //
+    static std::unique_ptr<Tree> load(const std::string& path);
+
+    // Calls `f(NodeId id, size_t depth)` for each node of the subtree rooted
+    // at `id` (including `id` itself, at depth 0), in depth-first pre-order.
+    //
+    // Nodes must not be added or removed during the traversal.
+    //
+    template<typename F>
+    void visitDepthFirst(NodeId id, F&& f) const;
+
+    // Low-level accessors by NodeId. These do not check whether the given
+    // NodeId is valid: use the Node handles for that.
+    //
+    NodeId parentId(NodeId id) const {
+        return parent_[id];
+    }
+    NodeId firstChildId(NodeId id) const {
+        return firstChild_[id];
+    }
+    NodeId nextSiblingId(NodeId id) const {
+        return nextSibling_[id];
+    }
+    NameId nameId(NodeId id) const {
+        return nameId_[id];
+    }
+    std::string_view name(NameId nameId) const {
+        return names_[nameId];
+    }
+
+private:
+    friend Node;
+
+    static constexpr NodeId rootId = 0;
+
+    // Value of parent_[id] when the id is currently not used by any node.
+    static constexpr NodeId freeId = UINT32_MAX - 1;
+
+    // Columns: the i-th element of each vector is the data of the node i.
+    std::vector<NodeId> parent_;
+    std::vector<NodeId> firstChild_;
+    std::vector<NodeId> lastChild_;
+    std::vector<NodeId> nextSibling_;
+    std::vector<uint32_t> numChildren_;
+    std::vector<NameId> nameId_;
+    std::vector<uint32_t> generation_;
+
+    // Removed NodeIds, reused by subsequent nodes.
+    std::vector<NodeId> freeIds_;
+
+    // Name table. Note: we use a deque so that the string_view keys of
+    // nameIds_ are not invalidated when adding new names.
+    std::deque<std::string> names_;
+    std::unordered_map<std::string_view, NameId> nameIds_;
+
+    // Cache of the last child accessed via Node::child(), see its comment.
+    mutable NodeId cacheParent_ = invalidNodeId;
+    mutable size_t cacheIndex_ = 0;
+    mutable NodeId cacheChild_ = invalidNodeId;
+
+    Node handle_(NodeId id) {
+        return Node(detail::NodeCreateKey(), this, id, generation_[id]);
+    }
+
+    bool isAlive_(NodeId id, uint32_t generation) const {
+        return id < parent_.size() && generation_[id] == generation
+               && parent_[id] != freeId;
+    }
+
+    NameId nameIdOf_(std::string_view name);
+    NodeId createNode_(NodeId parent, std::string_view name);
+    void appendChild_(NodeId parent, NodeId child);
+    NodeId child_(NodeId parent, size_t index) const;
+    void clearChildren_(NodeId id);
+};
+
+inline bool Node::isAlive() const {
+    return tree_->isAlive_(id_, generation_);
+}
+
+template<typename F>
+void Tree::visitDepthFirst(NodeId id, F&& f) const {
+
+    // Thanks to the parent and next-sibling links, we don't need a stack: once
+    // a subtree is fully visited, we go up until we find a next sibling.
+    //
+    // When entering a node, we prefetch the links of its next sibling, which
+    // is visited right after it if it is a leaf (most nodes of a tree), or
+    // after its subtree otherwise. The links of the first child cannot be
+    // prefetched earlier than they are read, since reading firstChild[node]
+    // is how we know the child.
+    //
+    const NodeId* firstChild = firstChild_.data();
+    const NodeId* nextSibling = nextSibling_.data();
+    const NodeId* parent = parent_.data();
+    NodeId node = id;
+    size_t depth = 0;
+    while (true) {
+        NodeId sibling = nextSibling[node];
+        if (sibling != invalidNodeId) {
+            prefetch(firstChild + sibling);
+            prefetch(nextSibling + sibling);
+        }
+        f(node, depth);
+        NodeId next = firstChild[node];
+        if (next != invalidNodeId) {
+            node = next;
+            ++depth;
+            continue;
+        }
+        while (node != id && nextSibling[node] == invalidNodeId) {
+            node = parent[node];
+            --depth;
+        }
+        if (node == id) {
+            return;
+        }
+        node = nextSibling[node];
+    }
+}
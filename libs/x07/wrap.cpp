@@ -0,0 +1,82 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+namespace py = pybind11;
+using rvp = py::return_value_policy;
+
+#include "tree.h"
+
+// As opposed to x02 and x03, the Python `Node` wraps a small handle returned
+// by value, not the node itself. Therefore, each call to `child()` and
+// similar functions creates a new Python object. This is why we need to
+// implement `__eq__`, since `tree.root.child(0) is tree.root.child(0)` is
+// false.
+//
+// Every returned handle keeps alive the object it was obtained from (Tree or
+// Node), hence indirectly the tree, via py::keep_alive<0, 1>(). This is
+// necessary because the handle stores a raw pointer to the tree.
+//
+// Note that for properties, the keep_alive must be given to an explicit
+// cpp_function, since pybind11 would otherwise ignore it.
+//
+void wrap_node(py::module& m) {
+    py::class_<Node>(m, "Node")
+
+        // the tree should not keep alive the node, hence rvp::reference
+        .def_property_readonly("tree", &Node::tree, rvp::reference)
+
+        // the returned parent keeps alive `self`, hence the tree
+        .def_property_readonly(
+            "parent", py::cpp_function(&Node::parent, py::keep_alive<0, 1>()))
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python string
+        .def_property("name", &Node::name, &Node::setName)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python integer
+        .def_property_readonly("numChildren", &Node::numChildren)
+
+        // the returned child keeps alive `self`, hence the tree
+        .def("child", &Node::child, py::keep_alive<0, 1>())
+
+        // the created child keeps alive `self`, hence the tree
+        .def("createChild", &Node::createChild, py::keep_alive<0, 1>())
+
+        // the rvp does not matter here: no returned value
+        .def("clearChildren", &Node::clearChildren)
+
+        // x07-specific
+        .def_property_readonly("id", &Node::id)
+        .def_property_readonly("isAlive", &Node::isAlive)
+        .def("subtreeSize", &Node::subtreeSize)
+        .def(
+            "__eq__",
+            [](const Node& a, const Node& b) { return a == b; },
+            py::is_operator())
+        .def("__hash__", [](const Node& self) {
+            return std::hash<NodeId>()(self.id());
+        });
+}
+
+void wrap_tree(py::module& m) {
+    py::class_<Tree>(m, "Tree")
+
+        // constructor
+        .def(py::init<>())
+
+        // the root keeps alive the tree
+        .def_property_readonly(
+            "root", py::cpp_function(&Tree::root, py::keep_alive<0, 1>()))
+
+        // x07-specific
+        .def_property_readonly("numNodes", &Tree::numNodes)
+        .def("countNodesNamed", &Tree::countNodesNamed)
+
+        // Snapshots (see ../snapshot.h). Neither touches Python objects, so
+        // we release the GIL.
+        .def("save", &Tree::save, py::call_guard<py::gil_scoped_release>())
+        .def_static("load", &Tree::load, py::call_guard<py::gil_scoped_release>());
+}
+
+PYBIND11_MODULE(x07, m) {
+    wrap_node(m);
+    wrap_tree(m);
+}
@@ -0,0 +1 @@
+#include "action.h"
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "../common.h"
+#include "handle.h"
+
+using Callback = std::function<void(void)>;
+
+class Action;
+using ActionHandle = Handle<Action>;
+using ActionHandleLock = HandleLock<Action>;
+
+// Utility class for unit tests
+class ActionRefCounter {
+public:
+    size_t count() const {
+        return action_.useCount();
+    }
+
+private:
+    friend Action;
+    ActionHandle action_;
+    ActionRefCounter(Action& action);
+};
+
+// Same as x06, but using intrusive handles instead of shared_ptr and
+// enable_shared_from_this, see handle.h.
+//
+class API Action : public RefCounted<AtomicCounts> {
+    struct CreateKey {};
+
+public:
+    Action(CreateKey) {
+    }
+
+    static ActionHandleLock create() {
+        return makeHandleLock<Action>(CreateKey());
+    }
+
+    std::string_view name() const {
+        return name_;
+    }
+
+    void setName(std::string_view name) {
+        name_ = name;
+    }
+
+    void setCallback(Callback callback) {
+        callback_ = std::move(callback);
+    }
+
+    void executeCallback() {
+        callback_();
+    }
+
+    ActionRefCounter refCounter() {
+        return *this;
+    }
+
+private:
+    std::string name_;
+    Callback callback_;
+};
+
+inline ActionRefCounter::ActionRefCounter(Action& action)
+    : action_(action) {
+}
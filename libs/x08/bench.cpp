@@ -0,0 +1,223 @@
+// Memory per object and lock/unlock throughput of intrusive handles, compared
+// to shared_ptr + enable_shared_from_this.
+//
+// Usage: x08_bench [numObjects] [numIterations]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handle.h"
+#include "tree.h"
+
+#if defined(OS_WINDOWS)
+#    include <malloc.h> // _msize
+#elif defined(OS_MACOS)
+#    include <malloc/malloc.h> // malloc_size
+#else
+#    include <malloc.h> // malloc_usable_size
+#endif
+
+// Replace the global operator new/delete to keep track of the number of bytes
+// currently allocated, see x03/bench.cpp.
+//
+namespace {
+
+size_t allocatedBytes = 0;
+
+size_t allocationSize(void* p) {
+#if defined(OS_WINDOWS)
+    return _msize(p);
+#elif defined(OS_MACOS)
+    return malloc_size(p);
+#else
+    return malloc_usable_size(p);
+#endif
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    allocatedBytes += allocationSize(p);
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if (p) {
+        allocatedBytes -= allocationSize(p);
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+namespace {
+
+// Prevents the compiler from optimizing away the computation of `value`, in
+// particular non-atomic increments immediately followed by decrements.
+//
+template<typename T>
+void doNotOptimize(const T& value) {
+#if defined(COMPILER_GCC) || defined(COMPILER_CLANG)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+// The objects being compared all have the same payload.
+//
+struct Payload {
+    double x = 0;
+    double y = 0;
+};
+
+struct SharedObject : std::enable_shared_from_this<SharedObject> {
+    Payload payload;
+};
+
+struct AtomicObject : RefCounted<AtomicCounts> {
+    Payload payload;
+};
+
+struct NonAtomicObject : RefCounted<NonAtomicCounts> {
+    Payload payload;
+};
+
+template<typename F>
+void measureMemory(const char* name, size_t numObjects, F create) {
+    using Ptr = decltype(create());
+    std::vector<Ptr> objects;
+    objects.reserve(numObjects);
+    size_t before = allocatedBytes;
+    for (size_t i = 0; i < numObjects; ++i) {
+        objects.push_back(create());
+    }
+    size_t after = allocatedBytes;
+    std::cout << "  " << name << ": " << double(after - before) / numObjects
+              << " bytes/object" << std::endl;
+}
+
+void measureTreeMemory(size_t numNodes) {
+    size_t branchingFactor = 8;
+    std::vector<std::string> names;
+    for (int i = 0; i < 2000; ++i) {
+        names.push_back("transform_group_" + std::to_string(i));
+    }
+    for (const std::string& name : names) {
+        Atom atom(name); // intern beforehand, as in x03/bench.cpp
+    }
+    size_t before = allocatedBytes;
+    {
+        Tree tree;
+        std::vector<NodeHandleLock> queue;
+        queue.reserve(numNodes);
+        queue.push_back(tree.root().lock());
+        size_t i = 0;
+        while (queue.size() < numNodes) {
+            NodeHandleLock parent = queue[i++];
+            for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+                const std::string& name = names[queue.size() % names.size()];
+                queue.push_back(parent->createChild(name).lock());
+            }
+        }
+        size_t queueBytes = allocationSize(queue.data());
+        size_t after = allocatedBytes;
+        std::cout << "  Tree (branching factor " << branchingFactor
+                  << "): " << double(after - before - queueBytes) / numNodes
+                  << " bytes/node" << std::endl;
+    }
+}
+
+template<typename F>
+void measureTime(const char* name, size_t numIterations, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < numIterations; ++i) {
+        f();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << "  " << name << ": " << ns / numIterations << " ns" << std::endl;
+}
+
+// Measures, for the given weak and strong pointer types:
+// - locking a weak pointer then releasing the lock
+// - copying a strong pointer then releasing the copy
+// - creating a weak pointer from a reference then releasing it
+//
+template<typename Weak, typename Strong, typename FromThis>
+void measureLocks(
+    const char* name,
+    size_t numIterations,
+    const Strong& strong,
+    FromThis fromThis) {
+
+    Weak weak = strong;
+    std::cout << name << std::endl;
+    measureTime("lock + unlock", numIterations, [&]() {
+        auto lock = weak.lock();
+        doNotOptimize(lock);
+    });
+    measureTime("copy + release", numIterations, [&]() {
+        Strong copy = strong;
+        doNotOptimize(copy);
+    });
+    measureTime("weak from this + release", numIterations, [&]() {
+        Weak w = fromThis(*strong);
+        doNotOptimize(w);
+    });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t numObjects = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    size_t numIterations = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000000;
+
+    std::cout << "Memory (" << numObjects << " objects, " << sizeof(Payload)
+              << " bytes of payload)" << std::endl;
+    measureMemory("shared_ptr + enable_shared_from_this", numObjects, []() {
+        return std::make_shared<SharedObject>();
+    });
+    measureMemory("HandleLock (atomic)", numObjects, []() {
+        return makeHandleLock<AtomicObject>();
+    });
+    measureMemory("HandleLock (non-atomic)", numObjects, []() {
+        return makeHandleLock<NonAtomicObject>();
+    });
+    measureTreeMemory(numObjects);
+
+    // Note: libstdc++ uses non-atomic counts for shared_ptr as long as the
+    // process never started a second thread. We start one to measure the
+    // general case.
+    std::thread([]() {}).join();
+
+    std::cout << "Time (" << numIterations << " iterations)" << std::endl;
+    measureLocks<std::weak_ptr<SharedObject>>(
+        "shared_ptr + enable_shared_from_this",
+        numIterations,
+        std::make_shared<SharedObject>(),
+        [](SharedObject& obj) { return obj.weak_from_this(); });
+    measureLocks<Handle<AtomicObject>>(
+        "HandleLock (atomic)",
+        numIterations,
+        makeHandleLock<AtomicObject>(),
+        [](AtomicObject& obj) { return Handle<AtomicObject>(obj); });
+    measureLocks<Handle<NonAtomicObject>>(
+        "HandleLock (non-atomic)",
+        numIterations,
+        makeHandleLock<NonAtomicObject>(),
+        [](NonAtomicObject& obj) { return Handle<NonAtomicObject>(obj); });
+}
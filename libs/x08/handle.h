@@ -0,0 +1,528 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional> // hash
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "../common.h"
+
+// Intrusive reference-counted smart pointers:
+//
+// - `Handle<T>`: the equivalent of `std::weak_ptr<T>`. It does not keep the
+//   object alive, and must be locked to access the object.
+//
+// - `HandleLock<T>`: the equivalent of `std::shared_ptr<T>`. It keeps the
+//   object alive. As the name suggests, the intent is that a lock is only
+//   held temporarily, for memory safety, while handles are what is stored as
+//   data members. However, nothing prevents storing a lock as data member
+//   when actual ownership is desired (e.g., children of a node).
+//
+// As opposed to shared_ptr created via make_shared, there is no separate
+// control block with its own vtable, and no `enable_shared_from_this` weak
+// pointer stored in the object: the strong and weak counts are stored in a
+// small header directly preceding the object, in the same allocation:
+//
+//   [ strong count | weak count | object (T) ]
+//
+// This means that:
+//
+// - Both Handle<T> and HandleLock<T> are the size of a raw pointer.
+//
+// - Creating a Handle<T> or HandleLock<T> from a `T&` is O(1) and doesn't
+//   require creating a temporary weak_ptr as `weak_from_this()` does.
+//
+// - Comparing handles and locks is a pointer comparison.
+//
+// The object is destroyed when the strong count reaches zero. The memory,
+// including the header, is released when the weak count reaches zero. Like
+// for shared_ptr, all strong references collectively hold one weak
+// reference, so that the header outlives the object.
+//
+// Objects must derive from `RefCounted<CountPolicy>` and be created via
+// `makeHandleLock<T>()`. The count policy is a compile-time choice between
+// atomic counts (the default, required if handles are used from several
+// threads) and non-atomic counts (faster, but single-threaded only).
+//
+
+// Count policies.
+//
+struct AtomicCounts {};
+struct NonAtomicCounts {};
+
+// Base class of all objects managed by Handle<T> and HandleLock<T>.
+//
+// It has no data members, the counts being stored in the header preceding
+// the object. However, the destructor is virtual so that the object can be
+// destroyed via a HandleLock<Base>.
+//
+template<typename CountPolicy = AtomicCounts>
+class RefCounted {
+public:
+    using countPolicy = CountPolicy;
+
+    virtual ~RefCounted() = default;
+
+protected:
+    RefCounted() = default;
+    DISABLE_COPY_AND_MOVE(RefCounted);
+};
+
+template<typename T>
+class Handle;
+
+template<typename T>
+class HandleLock;
+
+template<typename T, typename... Args>
+HandleLock<T> makeHandleLock(Args&&... args);
+
+namespace detail {
+
+// Header preceding each object in memory.
+//
+template<typename CountPolicy>
+struct HandleHeader {
+    static constexpr bool isAtomic = std::is_same_v<CountPolicy, AtomicCounts>;
+    using Count = std::conditional_t<isAtomic, std::atomic<uint32_t>, uint32_t>;
+
+    Count strong;
+    Count weak;
+
+    HandleHeader()
+        : strong(1)
+        , weak(1) {
+    }
+
+    void incStrong() {
+        if constexpr (isAtomic) {
+            strong.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            ++strong;
+        }
+    }
+
+    // Returns whether the count reached zero.
+    bool decStrong() {
+        if constexpr (isAtomic) {
+            return strong.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+        else {
+            return --strong == 0;
+        }
+    }
+
+    // Increments the strong count unless it is zero. Returns whether it was
+    // incremented.
+    bool tryIncStrong() {
+        if constexpr (isAtomic) {
+            uint32_t n = strong.load(std::memory_order_relaxed);
+            while (n != 0) {
+                if (strong.compare_exchange_weak(
+                        n, n + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        else {
+            if (strong == 0) {
+                return false;
+            }
+            ++strong;
+            return true;
+        }
+    }
+
+    void incWeak() {
+        if constexpr (isAtomic) {
+            weak.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            ++weak;
+        }
+    }
+
+    bool decWeak() {
+        if constexpr (isAtomic) {
+            return weak.fetch_sub(1, std::memory_order_acq_rel) == 1;
+        }
+        else {
+            return --weak == 0;
+        }
+    }
+
+    uint32_t strongCount() const {
+        if constexpr (isAtomic) {
+            return strong.load(std::memory_order_relaxed);
+        }
+        else {
+            return strong;
+        }
+    }
+};
+
+// Fixed offset between the start of the allocation and the object. Objects
+// with a stricter alignment are not supported.
+//
+inline constexpr size_t handleHeaderSize = 8;
+static_assert(sizeof(HandleHeader<AtomicCounts>) == handleHeaderSize);
+static_assert(sizeof(HandleHeader<NonAtomicCounts>) == handleHeaderSize);
+
+template<typename T>
+using HandleHeaderOf = HandleHeader<typename T::countPolicy>;
+
+// Returns the header of the given object.
+//
+// Note: this relies on the RefCounted base of T being at offset 0 in T,
+// which is checked at creation.
+//
+template<typename T>
+HandleHeaderOf<T>* header(const T* p) {
+    using Base = RefCounted<typename T::countPolicy>;
+    const Base* base = p;
+    auto bytes = reinterpret_cast<char*>(const_cast<Base*>(base));
+    return std::launder(reinterpret_cast<HandleHeaderOf<T>*>(bytes - handleHeaderSize));
+}
+
+template<typename T>
+void releaseWeak(const T* p) {
+    using Header = HandleHeaderOf<T>;
+    Header* h = header(p);
+    if (h->decWeak()) {
+        h->~Header();
+        ::operator delete(h);
+    }
+}
+
+template<typename T>
+void releaseStrong(const T* p) {
+    if (header(p)->decStrong()) {
+        using Base = RefCounted<typename T::countPolicy>;
+        const Base* base = p;
+        base->~Base(); // virtual: destroys the most derived object
+        releaseWeak(base);
+    }
+}
+
+// Tag for constructing a HandleLock that adopts a strong count which has
+// already been incremented, see makeHandleLock() and Handle::lock().
+//
+struct AdoptKey {};
+
+} // namespace detail
+
+// Strong reference to an object, see the top of this file.
+//
+template<typename T>
+class HandleLock {
+public:
+    HandleLock() noexcept = default;
+
+    HandleLock(std::nullptr_t) noexcept {
+    }
+
+    // Locks the given object, which must have been created via
+    // makeHandleLock(). This is the equivalent of `shared_from_this()`.
+    //
+    // This constructor is also what allows pybind11 to safely construct a
+    // holder from a raw pointer (see PYBIND11_DECLARE_HOLDER_TYPE in wrap.cpp).
+    //
+    // Throws std::logic_error if the object is being destroyed (i.e., its
+    // strong count is zero, e.g., when called from its destructor), rather
+    // than resurrecting it, which would destroy it a second time.
+    //
+    explicit HandleLock(T* p)
+        : p_(p) {
+        if (p_ && !detail::header(p_)->tryIncStrong()) {
+            p_ = nullptr;
+            throw std::logic_error("Cannot lock an object which is being destroyed.");
+        }
+    }
+
+    explicit HandleLock(T& obj)
+        : HandleLock(&obj) {
+    }
+
+    HandleLock(detail::AdoptKey, T* p) noexcept
+        : p_(p) {
+    }
+
+    // Copies are always of a live object, so they only need an increment.
+    HandleLock(const HandleLock& other) noexcept
+        : p_(other.p_) {
+        if (p_) {
+            detail::header(p_)->incStrong();
+        }
+    }
+
+    HandleLock(HandleLock&& other) noexcept
+        : p_(std::exchange(other.p_, nullptr)) {
+    }
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    HandleLock(const HandleLock<U>& other) noexcept
+        : p_(other.get()) {
+        if (p_) {
+            detail::header(p_)->incStrong();
+        }
+    }
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    HandleLock(HandleLock<U>&& other) noexcept
+        : p_(other.release_()) {
+    }
+
+    ~HandleLock() {
+        if (p_) {
+            detail::releaseStrong(p_);
+        }
+    }
+
+    HandleLock& operator=(HandleLock other) noexcept {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+
+    void reset() noexcept {
+        HandleLock().swap(*this);
+    }
+
+    void swap(HandleLock& other) noexcept {
+        std::swap(p_, other.p_);
+    }
+
+    T* get() const noexcept {
+        return p_;
+    }
+
+    T& operator*() const noexcept {
+        return *p_;
+    }
+
+    T* operator->() const noexcept {
+        return p_;
+    }
+
+    explicit operator bool() const noexcept {
+        return p_ != nullptr;
+    }
+
+    // Returns the number of HandleLock to the object, or 0 if null.
+    size_t useCount() const noexcept {
+        return p_ ? detail::header(p_)->strongCount() : 0;
+    }
+
+private:
+    T* p_ = nullptr;
+
+    template<typename U>
+    friend class HandleLock;
+
+    T* release_() noexcept {
+        return std::exchange(p_, nullptr);
+    }
+};
+
+// Weak reference to an object, see the top of this file.
+//
+template<typename T>
+class Handle {
+public:
+    Handle() noexcept = default;
+
+    Handle(std::nullptr_t) noexcept {
+    }
+
+    // Creates a handle to the given object, which must be alive and have been
+    // created via makeHandleLock(). This is the equivalent of
+    // `weak_from_this()`.
+    //
+    explicit Handle(T& obj) noexcept
+        : p_(&obj) {
+        detail::header(p_)->incWeak();
+    }
+
+    Handle(const HandleLock<T>& lock) noexcept
+        : p_(lock.get()) {
+        if (p_) {
+            detail::header(p_)->incWeak();
+        }
+    }
+
+    Handle(const Handle& other) noexcept
+        : p_(other.p_) {
+        if (p_) {
+            detail::header(p_)->incWeak();
+        }
+    }
+
+    Handle(Handle&& other) noexcept
+        : p_(std::exchange(other.p_, nullptr)) {
+    }
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Handle(const Handle<U>& other) noexcept
+        : p_(other.p_) {
+        if (p_) {
+            detail::header(p_)->incWeak();
+        }
+    }
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Handle(const HandleLock<U>& lock) noexcept
+        : p_(lock.get()) {
+        if (p_) {
+            detail::header(p_)->incWeak();
+        }
+    }
+
+    ~Handle() {
+        if (p_) {
+            detail::releaseWeak(p_);
+        }
+    }
+
+    Handle& operator=(Handle other) noexcept {
+        std::swap(p_, other.p_);
+        return *this;
+    }
+
+    void reset() noexcept {
+        Handle().swap(*this);
+    }
+
+    void swap(Handle& other) noexcept {
+        std::swap(p_, other.p_);
+    }
+
+    // Returns a lock to the object, or a null lock if the object is not alive
+    // anymore (or if the handle is null).
+    //
+    HandleLock<T> lock() const noexcept {
+        if (p_ && detail::header(p_)->tryIncStrong()) {
+            return HandleLock<T>(detail::AdoptKey(), p_);
+        }
+        return HandleLock<T>();
+    }
+
+    bool isAlive() const noexcept {
+        return useCount() > 0;
+    }
+
+    bool isNull() const noexcept {
+        return p_ == nullptr;
+    }
+
+    // Returns the number of HandleLock to the object.
+    size_t useCount() const noexcept {
+        return p_ ? detail::header(p_)->strongCount() : 0;
+    }
+
+    // Returns the address of the object, which may not be alive anymore.
+    // This is the equivalent of C++26 `owner_hash()`, and can be used as key
+    // or for comparisons, but must not be dereferenced.
+    //
+    const void* address() const noexcept {
+        return p_;
+    }
+
+private:
+    T* p_ = nullptr;
+
+    template<typename U>
+    friend class Handle;
+};
+
+// Creates a new object and returns the only lock to it.
+//
+template<typename T, typename... Args>
+HandleLock<T> makeHandleLock(Args&&... args) {
+    using Header = detail::HandleHeaderOf<T>;
+    static_assert(
+        std::is_base_of_v<RefCounted<typename T::countPolicy>, T>,
+        "T must derive from RefCounted");
+    static_assert(
+        alignof(T) <= detail::handleHeaderSize,
+        "Over-aligned types are not supported");
+
+    void* p = ::operator new(detail::handleHeaderSize + sizeof(T));
+    Header* h = new (p) Header();
+    T* obj = nullptr;
+    try {
+        obj = new (static_cast<char*>(p) + detail::handleHeaderSize)
+            T(std::forward<Args>(args)...);
+    }
+    catch (...) {
+        h->~Header();
+        ::operator delete(p);
+        throw;
+    }
+    if (detail::header(obj) != h) {
+        obj->~T();
+        h->~Header();
+        ::operator delete(p);
+        throw std::logic_error("RefCounted must be the first base class of T.");
+    }
+    return HandleLock<T>(detail::AdoptKey(), obj);
+}
+
+// Comparisons are pointer comparisons: there is no aliasing constructor, so
+// the address of the object identifies its header.
+
+template<typename T, typename U>
+bool operator==(const Handle<T>& a, const Handle<U>& b) noexcept {
+    return a.address() == b.address();
+}
+
+template<typename T, typename U>
+bool operator==(const Handle<T>& a, const HandleLock<U>& b) noexcept {
+    return a.address() == b.get();
+}
+
+template<typename T, typename U>
+bool operator==(const HandleLock<T>& a, const Handle<U>& b) noexcept {
+    return b == a;
+}
+
+template<typename T, typename U>
+bool operator==(const HandleLock<T>& a, const HandleLock<U>& b) noexcept {
+    return a.get() == b.get();
+}
+
+template<typename T, typename U>
+bool operator==(const Handle<T>& a, const U* b) noexcept {
+    return a.address() == b;
+}
+
+template<typename T, typename U>
+bool operator!=(const Handle<T>& a, const Handle<U>& b) noexcept {
+    return !(a == b);
+}
+
+template<typename T, typename U>
+bool operator!=(const HandleLock<T>& a, const HandleLock<U>& b) noexcept {
+    return !(a == b);
+}
+
+namespace std {
+
+template<typename T>
+struct hash<Handle<T>> {
+    size_t operator()(const Handle<T>& h) const noexcept {
+        return std::hash<const void*>()(h.address());
+    }
+};
+
+template<typename T>
+struct hash<HandleLock<T>> {
+    size_t operator()(const HandleLock<T>& h) const noexcept {
+        return std::hash<const void*>()(h.get());
+    }
+};
+
+} // namespace std
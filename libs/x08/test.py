@@ -0,0 +1,250 @@
+#!/usr/bin/python3
+
+import gc
+import sys
+import unittest
+from x08 import Node, Tree, Action, Widget
+
+def changeName(x):
+    x.name = "newName"
+
+def pyRefcount(obj):
+    return sys.getrefcount(obj) - 2
+
+def getRootOfNewTree():
+    tree = Tree()
+    return tree.root
+
+def getNodeOfNewTree():
+    tree = Tree()
+    node = tree.root.createChild("node1")
+    return node
+
+class TestTree(unittest.TestCase):
+
+    def testConstructor(self):
+        tree = Tree()
+        self.assertEqual(tree.root.name, "root")
+
+    def testKeepAliveRootToTree(self):
+        node = getRootOfNewTree()
+        self.assertEqual(node.name, "root")
+
+    def testKeepAliveNodeToTree(self):
+        node = getNodeOfNewTree()
+        self.assertEqual(node.name, "node1")
+
+    # Same as x03: not UB, the node is kept alive but removed from the tree.
+    def testAccessingClearedChild(self):
+        tree = Tree()
+        root = tree.root
+        node = root.createChild("node1")
+        self.assertEqual(node.parent, root)
+        root.clearChildren()
+        self.assertEqual(node.name, "node1")
+        self.assertIsNone(node.parent)
+        self.assertIsNone(node.tree)
+
+    def testUseCount(self):
+        tree = Tree()
+        node = tree.root.createChild("node1")
+        self.assertEqual(node.useCount(), 2) # parent + `node`
+        node2 = tree.root.child(0)
+        self.assertIs(node, node2)
+        self.assertEqual(node.useCount(), 2) # same Python object
+        tree.root.clearChildren()
+        self.assertEqual(node.useCount(), 1) # `node`
+
+class TestActionWidget(unittest.TestCase):
+
+    def testAction(self):
+        action = Action()
+        self.assertEqual(action.name, "")
+        action.name = "myAction"
+        self.assertEqual(action.name, "myAction")
+        action.setCallback(lambda x = action : changeName(x))
+        action.executeCallback();
+        self.assertEqual(action.name, "newName")
+
+    def testWidget(self):
+        action = Action()
+        action.name = "myAction"
+        action.setCallback(lambda x = action : changeName(x))
+
+        widget = Widget()
+        widget.action = action
+        self.assertEqual(widget.action, action)
+        widget.triggerAction()
+        self.assertEqual(action.name, "newName")
+
+    def testActionHandle(self):
+        actionLock = Action()
+        actionLock2 = actionLock
+        action = actionLock.toHandle()
+        action2 = actionLock.toHandle()
+        self.assertEqual(action.name, "")
+        action.name = "myAction"
+        self.assertEqual(action.name, "myAction")
+        self.assertEqual(action2.name, "myAction")
+        self.assertEqual(actionLock.name, "myAction")
+        self.assertEqual(actionLock2.name, "myAction")
+        action.setCallback(lambda x = action : changeName(x))
+        action.executeCallback();
+        self.assertEqual(action.name, "newName")
+
+    def testWidgetHandle(self):
+        action = Action()
+        action.name = "myAction"
+        action.setCallback(lambda x = action : changeName(x))
+
+        widgetLock = Widget()
+        widget = widgetLock.toHandle()
+        widget.action = action
+        self.assertEqual(widget.action, action)
+        widget.triggerAction()
+        self.assertEqual(action.name, "newName")
+
+        self.assertEqual(widget, widget.toLock())
+        self.assertEqual(widgetLock, widgetLock.toHandle())
+        self.assertEqual(widget, widget.toLock().toHandle())
+
+    def testWidgetRefCounter(self):
+        widget = Widget()
+        refCounter = widget.refCounter()
+        self.assertEqual(pyRefcount(widget), 1)
+        self.assertEqual(refCounter.count, 1)
+
+        widgetAlias = widget # Two Python variables to the same C++ HandleLock
+        self.assertEqual(pyRefcount(widget), 2)
+        self.assertEqual(refCounter.count, 1)
+
+        # Test removing the alias
+        del widgetAlias
+        self.assertEqual(pyRefcount(widget), 1)
+        self.assertEqual(refCounter.count, 1)
+
+        # Test removing the last reference to widget
+        #
+        # Note that we cannot test sys.getrefcount(widget) == 0, since there is
+        # no widget anymore
+        #
+        # Also, the refCounter.count == 0 test assumes that the widget was
+        # garbage collected right after `del widget`, which is normally the
+        # case since there was no cycle, so it could directly see that the
+        # refcount went to 0.
+        #
+        del widget
+        self.assertEqual(refCounter.count, 0)
+
+    def testHandleDoesntIncreaseRefCount(self):
+        action = Action() # lock
+        actionRefCounter = action.refCounter()
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 1) # pybind11 holder for `action`
+
+        widget = Widget()
+        widget.action = action
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action`+ `widget.action_`
+
+        action2 = widget.action # handle
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action`+ `widget.action_`
+
+    def testConversionBetweenHandleAndLock(self):
+        action = Action() # lock
+        action2 = action.toHandle()
+
+        actionRefCounter = action.refCounter()
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 1) # pybind11 holder for `action`
+
+        widget = Widget()
+        widget.action = action
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action`+ `widget.action_`
+
+        action2 = widget.action # handle
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action`+ `widget.action_`
+
+    def testEqualityBetweenHandleAndLock(self):
+        action = Action() # lock
+        widget = Widget()
+        widget.action = action
+        action2 = widget.action # handle
+        self.assertEqual(action2, action)
+        self.assertEqual(action, action2)
+
+    def testMemoryLeak(self):
+        widget = Widget()
+        widget.name = "myWidget"
+        widgetRefCounter = widget.refCounter()
+        self.assertEqual(pyRefcount(widget), 1)
+        self.assertEqual(widgetRefCounter.count, 1)
+
+        action = Action()
+        action.name = "myAction"
+        action.setCallback(lambda x = widget : changeName(x))
+        actionRefCounter = action.refCounter()
+        self.assertEqual(pyRefcount(widget), 2)     # `widget` + lambda
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(widgetRefCounter.count, 1) # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 1) # pybind11 holder for `action`
+
+        widget.action = action
+        self.assertEqual(pyRefcount(widget), 2)     # `widget` + lambda
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(widgetRefCounter.count, 1) # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action` + `widget.action_`
+
+        widget.triggerAction()
+        self.assertEqual(widget.name, "newName")
+
+        del action
+        del widget
+        gc.collect()
+
+        # Memory leak due to cyclic dependency:
+        # - The widget instance stores a `HandleLock<Action>` in the Widget::action_ data member
+        # - the action instance stores a PyObject that indirectly stores a `HandleLock<Widget>`
+        #
+        self.assertEqual(widgetRefCounter.count, 1)  # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 1)  # `widget.action_`
+
+    def testFixMemoryLeak(self):
+        widget = Widget()
+        widget.name = "myWidget"
+        widgetRefCounter = widget.refCounter()
+        self.assertEqual(pyRefcount(widget), 1)
+        self.assertEqual(widgetRefCounter.count, 1)
+
+        action = Action()
+        action.name = "myAction"
+        action.setCallback(lambda x = widget.toHandle() : changeName(x))
+        actionRefCounter = action.refCounter()
+        self.assertEqual(pyRefcount(widget), 1)     # `widget` (the handle in the lambda is a separate PyObject)
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(widgetRefCounter.count, 1) # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 1) # pybind11 holder for `action`
+
+        widget.action = action
+        self.assertEqual(pyRefcount(widget), 1)     # `widget`
+        self.assertEqual(pyRefcount(action), 1)     # `action`
+        self.assertEqual(widgetRefCounter.count, 1) # pybind11 holder for `widget`
+        self.assertEqual(actionRefCounter.count, 2) # pybind11 holder for `action` + `widget.action_`
+
+        widget.triggerAction()
+        self.assertEqual(widget.name, "newName")
+
+        del action
+        del widget
+        gc.collect()
+
+        # No memory leak!
+        self.assertEqual(widgetRefCounter.count, 0)
+        self.assertEqual(actionRefCounter.count, 0)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1 @@
+#include "tree.h"
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <exception>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../atom.h"
+#include "../common.h"
+#include "handle.h"
+
+class Tree;
+class Node;
+
+using NodeHandle = Handle<Node>;
+using NodeHandleLock = HandleLock<Node>;
+
+namespace detail {
+
+// Constructor of Node must be private-like to enforce that it is created via
+// makeHandleLock. We use the passkey idiom to give access to both Tree and
+// Node.
+//
+struct NodeCreateKey {
+private:
+    friend Tree;
+    friend Node;
+    NodeCreateKey() = default;
+
+    static NodeHandleLock create(Tree* tree, Node* parent, std::string_view name) {
+        NodeCreateKey key;
+        return makeHandleLock<Node>(key, tree, parent, name);
+    }
+};
+
+} // namespace detail
+
+// Same as x03, but using intrusive handles instead of shared_ptr and
+// enable_shared_from_this, see handle.h.
+//
+class API Node : public RefCounted<AtomicCounts> {
+public:
+    // Note: as opposed to x03, we can create a handle from a raw pointer.
+    //
+    Node(detail::NodeCreateKey, Tree* tree, Node* parent, std::string_view name)
+        : tree_(tree)
+        , parent_(parent ? NodeHandle(*parent) : NodeHandle())
+        , name_(name) {
+    }
+
+    // Same as x03: the whole subtree is removed from the tree, even if some
+    // external observers still have locks to the node or any of its
+    // descendant.
+    //
+    ~Node() {
+        clearChildren();
+    }
+
+    DISABLE_COPY_AND_MOVE(Node);
+
+    // Null if the node has been removed from its tree, see x03.
+    Tree* tree() const {
+        return tree_;
+    }
+
+    // Null in case we're the root or we've been removed from the tree.
+    NodeHandle parent() const {
+        return parent_;
+    }
+
+    std::string_view name() const {
+        return name_.str();
+    }
+
+    void setName(std::string_view name) {
+        name_ = Atom(name);
+    }
+
+    size_t numChildren() const {
+        return children_.size();
+    }
+
+    // Guaranteed non-null if it exists, otherwise throws.
+    NodeHandle child(size_t index) const {
+        return children_.at(index);
+    }
+
+    // Guaranteed non-null, throws if memory allocation fails.
+    NodeHandle createChild(std::string_view name) {
+        children_.push_back(detail::NodeCreateKey::create(tree(), this, name));
+        return children_.back();
+    }
+
+    void clearChildren() {
+        for (const NodeHandleLock& child : children_) {
+            child->detach_();
+        }
+        children_.clear();
+    }
+
+private:
+    Tree* tree_;
+    NodeHandle parent_;
+    std::vector<NodeHandleLock> children_;
+    Atom name_;
+
+    // Note: as opposed to x03, we can lock `this` from the destructor of
+    // children, since a NodeHandleLock can be created from any live node.
+    //
+    friend Tree;
+    void detach_() {
+        std::vector<NodeHandleLock> stack; // allows non-recursive implementation
+        stack.emplace_back(*this);
+        while (!stack.empty()) {
+            NodeHandleLock node = std::move(stack.back());
+            stack.pop_back();
+            for (const NodeHandleLock& child : node->children_) {
+                stack.push_back(child);
+            }
+            node->tree_ = nullptr;
+            node->parent_.reset();
+            node->children_.clear();
+        }
+    }
+};
+
+class API Tree {
+public:
+    DISABLE_COPY_AND_MOVE(Tree);
+
+    Tree()
+        : root_(detail::NodeCreateKey::create(this, nullptr, "root")) {
+    }
+
+    ~Tree() {
+        root_->detach_();
+    }
+
+    // guaranteed non-null: our tree is assumed to always has a root.
+    NodeHandle root() {
+        return root_;
+    };
+
+private:
+    NodeHandleLock root_;
+};
@@ -0,0 +1 @@
+#include "widget.h"
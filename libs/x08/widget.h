@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "../common.h"
+#include "action.h"
+#include "handle.h"
+
+class Widget;
+using WidgetHandle = Handle<Widget>;
+using WidgetHandleLock = HandleLock<Widget>;
+
+// Utility class for unit tests
+class WidgetRefCounter {
+public:
+    size_t count() const {
+        return widget_.useCount();
+    }
+
+private:
+    friend Widget;
+    WidgetHandle widget_;
+    WidgetRefCounter(Widget& widget);
+};
+
+// Same as x06, but using intrusive handles instead of shared_ptr and
+// enable_shared_from_this, see handle.h.
+//
+// Layering: Action < Widget
+//
+class API Widget : public RefCounted<AtomicCounts> {
+    struct CreateKey {};
+
+public:
+    Widget(CreateKey) {
+    }
+
+    static WidgetHandleLock create() {
+        return makeHandleLock<Widget>(CreateKey());
+    }
+
+    std::string_view name() const {
+        return name_;
+    }
+
+    void setName(std::string_view name) {
+        name_ = name;
+    }
+
+    ActionHandle action() const {
+        return action_;
+    }
+
+    // Note: as opposed to x06, locking an action from a reference is O(1)
+    // and doesn't require `shared_from_this()`.
+    //
+    void setAction(Action& action) {
+        action_ = ActionHandleLock(action);
+    }
+
+    void triggerAction() {
+        if (ActionHandleLock action = action_) {
+            action->executeCallback();
+        }
+    }
+
+    WidgetRefCounter refCounter() {
+        return *this;
+    }
+
+private:
+    std::string name_;
+    ActionHandleLock action_;
+};
+
+inline WidgetRefCounter::WidgetRefCounter(Widget& widget)
+    : widget_(widget) {
+}
@@ -0,0 +1,182 @@
+#include <pybind11/functional.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+namespace py = pybind11;
+using rvp = py::return_value_policy;
+
+#include "action.h"
+#include "tree.h"
+#include "widget.h"
+
+// HandleLock<T> is used as holder type.
+//
+// The last argument (`true`) tells pybind11 that it is always safe to
+// construct a holder from a raw pointer, since the counts are stored with the
+// object. This is not the case for std::shared_ptr, where constructing a
+// second shared_ptr from the same raw pointer would create a second control
+// block, and eventually a double delete.
+//
+// In practice, this means that functions returning `T*` or `T&` with
+// rvp::reference still give Python a strong reference to the object.
+//
+PYBIND11_DECLARE_HOLDER_TYPE(T, HandleLock<T>, true);
+
+// See x03 for the rationale of rvp::reference_internal, and why we lock the
+// returned handles.
+//
+void wrap_node(py::module& m) {
+    py::class_<Node, NodeHandleLock>(m, "Node")
+
+        // the tree should not keep alive the node, hence rvp::reference
+        .def_property_readonly("tree", &Node::tree, rvp::reference)
+
+        // the parent should not keep alive the child, hence rvp::reference
+        .def_property_readonly(
+            "parent",
+            [](Node& self) -> NodeHandleLock { return self.parent().lock(); },
+            rvp::reference)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python string
+        .def_property("name", &Node::name, &Node::setName)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python integer
+        .def_property_readonly("numChildren", &Node::numChildren)
+
+        // the returned child should keep alive its parent.
+        .def(
+            "child",
+            [](Node& self, size_t i) -> NodeHandleLock { return self.child(i).lock(); },
+            rvp::reference_internal)
+
+        // the created child should keep alive its parent.
+        .def(
+            "createChild",
+            [](Node& self, std::string_view name) -> NodeHandleLock {
+                return self.createChild(name).lock();
+            },
+            rvp::reference_internal)
+
+        // the rvp does not matter here: no returned value
+        .def("clearChildren", &Node::clearChildren)
+
+        // x08-specific: number of NodeHandleLock to this node (including the
+        // one held by its parent, and the one held by this Python object).
+        .def("useCount", [](Node& self) { return NodeHandle(self).useCount(); });
+}
+
+void wrap_tree(py::module& m) {
+    py::class_<Tree>(m, "Tree")
+
+        // constructor
+        .def(py::init<>())
+
+        // the root should keep alive the tree
+        .def_property_readonly(
+            "root",
+            [](Tree& self) -> NodeHandleLock { return self.root().lock(); },
+            rvp::reference_internal);
+}
+
+// Same as `wrap_weak_and_shared_from_this()` in x06. Note that no temporary
+// weak_ptr is involved: both conversions are O(1) increments of a count.
+//
+template<typename T, typename PyClass>
+void wrap_handle_conversions(PyClass& c) {
+    c.def("toLock", [](T& self) { return HandleLock<T>(self); });
+    c.def("toHandle", [](T& self) { return Handle<T>(self); });
+}
+
+// Same as `wrap_weak_ptr()` in x06, see comments there.
+//
+template<typename T>
+void wrap_handle(py::module& m, const char* className) {
+
+    using THandle = Handle<T>;
+    using THandleLock = HandleLock<T>;
+
+    auto getattribute =
+        py::module::import("builtins").attr("object").attr("__getattribute__");
+
+    auto setattr = py::module::import("builtins").attr("object").attr("__setattr__");
+
+    std::string handleName = className;
+    handleName += "Handle";
+
+    py::class_<THandle>(m, handleName.c_str())
+        .def("useCount", &THandle::useCount)
+        .def(
+            "__getattribute__",
+            [getattribute](THandle& handle, py::str name) {
+                if (THandleLock lock = handle.lock()) {
+                    return getattribute(py::cast(lock), name);
+                }
+                else {
+                    throw std::logic_error(
+                        "Cannot get attribute of object: the object is "
+                        "not alive anymore.");
+                }
+            })
+        .def(
+            "__setattr__",
+            [setattr](THandle& handle, py::str name, py::object value) {
+                if (THandleLock lock = handle.lock()) {
+                    return setattr(py::cast(lock), name, value);
+                }
+                else {
+                    throw std::logic_error(
+                        "Cannot set attribute of object: the object is "
+                        "not alive anymore.");
+                }
+            })
+
+        // Equality is a pointer comparison, see handle.h. No need for
+        // owner_equal and temporary weak pointers as in x06.
+        .def(
+            "__eq__",
+            [](const THandle& a, const THandle& b) { return a == b; },
+            py::is_operator())
+        .def(
+            "__eq__",
+            [](const THandle& a, const T& b) { return a == &b; },
+            py::is_operator())
+        .def("__hash__", [](const THandle& self) { return std::hash<THandle>()(self); });
+}
+
+void wrap_action(py::module& m) {
+
+    py::class_<ActionRefCounter>(m, "ActionRefCounter")
+        .def_property_readonly("count", &ActionRefCounter::count);
+
+    py::class_<Action, ActionHandleLock> c(m, "Action");
+    c.def(py::init(&Action::create))
+        .def_property("name", &Action::name, &Action::setName)
+        .def("setCallback", &Action::setCallback)
+        .def("executeCallback", &Action::executeCallback)
+        .def("refCounter", &Action::refCounter);
+
+    wrap_handle<Action>(m, "Action");
+    wrap_handle_conversions<Action>(c);
+}
+
+void wrap_widget(py::module& m) {
+
+    py::class_<WidgetRefCounter>(m, "WidgetRefCounter")
+        .def_property_readonly("count", &WidgetRefCounter::count);
+
+    py::class_<Widget, WidgetHandleLock> c(m, "Widget");
+    c.def(py::init(&Widget::create))
+        .def_property("name", &Widget::name, &Widget::setName)
+        .def_property("action", &Widget::action, &Widget::setAction)
+        .def("triggerAction", &Widget::triggerAction)
+        .def("refCounter", &Widget::refCounter);
+
+    wrap_handle<Widget>(m, "Widget");
+    wrap_handle_conversions<Widget>(c);
+}
+
+PYBIND11_MODULE(x08, m) {
+    wrap_node(m);
+    wrap_tree(m);
+    wrap_action(m);
+    wrap_widget(m);
+}
@@ -0,0 +1,146 @@
+// Throughput of concurrent readers traversing the tree while a writer
+// modifies it, comparing lock-free readers (epoch::ReadGuard) with readers
+// and writer synchronized via a std::shared_mutex.
+//
+// Usage: x09_bench [numNodes] [numReaders] [seconds]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tree.h"
+
+namespace {
+
+// Builds a tree of `numNodes` nodes (including the root) in breadth-first
+// order, where each node has `branchingFactor` children, except possibly in
+// the last level. Returns the nodes whose children are all leaves.
+//
+std::vector<Node*> build(Tree& tree, size_t numNodes, size_t branchingFactor) {
+    std::vector<Node*> queue;
+    queue.reserve(numNodes);
+    queue.push_back(tree.root());
+    size_t i = 0;
+    while (queue.size() < numNodes) {
+        Node* parent = queue[i++];
+        for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+            std::string name = "transform_group_" + std::to_string(queue.size() % 2000);
+            queue.push_back(parent->createChild(name).get());
+        }
+    }
+    std::vector<Node*> res;
+    for (Node* node : queue) {
+        bool hasOnlyLeaves = node->numChildren() > 0;
+        node->forEachChild([&](Node* child) {
+            hasOnlyLeaves = hasOnlyLeaves && child->numChildren() == 0;
+        });
+        if (hasOnlyLeaves) {
+            res.push_back(node);
+        }
+    }
+    return res;
+}
+
+// Visits all nodes with a recursive depth-first traversal, returning the
+// number of visited nodes. The caller must hold an epoch::ReadGuard.
+//
+size_t traverse(const Node* node, Atom name, size_t& numNamed) {
+    size_t res = 1;
+    if (node->nameAtom() == name) {
+        ++numNamed;
+    }
+    node->forEachChild([&](const Node* child) { res += traverse(child, name, numNamed); });
+    return res;
+}
+
+enum class Mode {
+    Epoch,
+    SharedMutex
+};
+
+void run(Mode mode, size_t numNodes, size_t numReaders, double seconds) {
+    Tree tree;
+    std::vector<Node*> parentsOfLeaves = build(tree, numNodes, 8);
+    Atom name("transform_group_42");
+
+    std::shared_mutex mutex; // only used in Mode::SharedMutex
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> numTraversals = 0;
+    std::atomic<size_t> numVisited = 0;
+    size_t numWrites = 0;
+
+    // Note: readers also check the time, since with a reader-preferring
+    // shared_mutex, the writer may never get the lock.
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::duration<double>(seconds);
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < numReaders; ++i) {
+        readers.emplace_back([&]() {
+            size_t traversals = 0;
+            size_t visited = 0;
+            size_t numNamed = 0;
+            while (!stop.load(std::memory_order_relaxed)
+                   && std::chrono::steady_clock::now() < end) {
+                if (mode == Mode::Epoch) {
+                    epoch::ReadGuard guard;
+                    visited += traverse(tree.root(), name, numNamed);
+                }
+                else {
+                    std::shared_lock<std::shared_mutex> lock(mutex);
+                    visited += traverse(tree.root(), name, numNamed);
+                }
+                ++traversals;
+            }
+            numTraversals += traversals;
+            numVisited += visited;
+        });
+    }
+
+    // Writer: repeatedly replaces the leaf children of a random node by new
+    // leaves, so that the size of the tree stays roughly the same.
+    std::mt19937 rng(42);
+    while (std::chrono::steady_clock::now() < end) {
+        std::unique_lock<std::shared_mutex> lock(mutex, std::defer_lock);
+        if (mode == Mode::SharedMutex) {
+            lock.lock();
+        }
+        Node* node = parentsOfLeaves[rng() % parentsOfLeaves.size()];
+        node->clearChildren();
+        for (int i = 0; i < 8; ++i) {
+            node->createChild("transform_group_" + std::to_string(i));
+        }
+        ++numWrites;
+    }
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << (mode == Mode::Epoch ? "epoch" : "shared_mutex") << ":\n"
+              << "  reader traversals: " << numTraversals / elapsed << " /s\n"
+              << "  reader visited nodes: " << numVisited / elapsed / 1e6 << " M/s\n"
+              << "  writer operations: " << numWrites / elapsed << " /s\n"
+              << "  pending retired objects: " << epoch::collect() << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t numNodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+    size_t numReaders = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 3;
+    double seconds = argc > 3 ? std::strtod(argv[3], nullptr) : 2;
+
+    std::cout << numNodes << " nodes, " << numReaders << " readers, 1 writer, "
+              << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    run(Mode::Epoch, numNodes, numReaders, seconds);
+    run(Mode::SharedMutex, numNodes, numReaders, seconds);
+}
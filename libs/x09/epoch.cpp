@@ -0,0 +1,197 @@
+#include "epoch.h"
+
+#include <utility>
+#include <vector>
+
+namespace epoch {
+
+namespace detail {
+
+// One record per reader thread, on its own cache line. Records are never
+// freed: when a thread exits, its record is released and can be reused by
+// another thread.
+//
+struct alignas(64) ReaderRecord {
+    // Epoch observed by the outermost guard, or 0 if not reading.
+    std::atomic<uint64_t> epoch{0};
+
+    // Whether a thread currently owns this record.
+    std::atomic<bool> inUse{false};
+
+    // Only accessed by the owning thread.
+    int nesting = 0;
+
+    // Immutable once the record is published.
+    ReaderRecord* next = nullptr;
+};
+
+} // namespace detail
+
+namespace {
+
+using detail::ReaderRecord;
+
+struct Retired {
+    void* p;
+    void (*deleter)(void*);
+    uint64_t epoch;
+};
+
+// Calls collect() every this many calls to retire().
+constexpr size_t collectPeriod = 64;
+
+class Domain {
+public:
+    // Note: starting at 1, since 0 means "not reading" in reader records.
+    std::atomic<uint64_t> epoch{1};
+
+    // Lock-free list of reader records, only ever prepended to.
+    std::atomic<ReaderRecord*> records{nullptr};
+
+    std::mutex mutex;
+    std::deque<Retired> retired; // sorted by epoch
+    size_t numRetiresSinceCollect = 0;
+
+    ReaderRecord* acquireRecord() {
+        ReaderRecord* head = records.load(std::memory_order_acquire);
+        for (ReaderRecord* r = head; r; r = r->next) {
+            bool expected = false;
+            if (!r->inUse.load(std::memory_order_relaxed)
+                && r->inUse.compare_exchange_strong(expected, true)) {
+                return r;
+            }
+        }
+        ReaderRecord* r = new ReaderRecord();
+        r->inUse.store(true, std::memory_order_relaxed);
+        r->next = head;
+        while (!records.compare_exchange_weak(r->next, r)) {
+        }
+        return r;
+    }
+
+    // Advances the epoch if all active readers have observed the current
+    // epoch. Must be called with the mutex locked.
+    //
+    void tryAdvance() {
+        // Pairs with the fence in ReadGuard(): either the reader sees that
+        // retired objects have been unpublished, or we see its record.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t e = epoch.load();
+        for (ReaderRecord* r = records.load(); r; r = r->next) {
+            uint64_t re = r->epoch.load();
+            if (re != 0 && re != e) {
+                return;
+            }
+        }
+        epoch.store(e + 1);
+    }
+
+    // Removes from the list the objects that can be freed. Must be called
+    // with the mutex locked.
+    //
+    std::vector<Retired> popReclaimable() {
+        std::vector<Retired> res;
+        uint64_t e = epoch.load();
+        while (!retired.empty() && retired.front().epoch + 2 <= e) {
+            res.push_back(retired.front());
+            retired.pop_front();
+        }
+        return res;
+    }
+};
+
+// Intentionally leaked, like the atom table, so that it can be used during
+// the destruction of other static objects. Objects still retired at exit are
+// not freed.
+//
+Domain& domain() {
+    static Domain* d = new Domain();
+    return *d;
+}
+
+// Releases the record of the current thread when it exits.
+//
+struct ThreadRecord {
+    ReaderRecord* record = nullptr;
+
+    ~ThreadRecord() {
+        if (record) {
+            record->inUse.store(false, std::memory_order_release);
+        }
+    }
+
+    ReaderRecord* get() {
+        if (!record) {
+            record = domain().acquireRecord();
+        }
+        return record;
+    }
+};
+
+thread_local ThreadRecord threadRecord;
+
+void freeAll(const std::vector<Retired>& objects) {
+    for (const Retired& r : objects) {
+        r.deleter(r.p);
+    }
+}
+
+} // namespace
+
+ReadGuard::ReadGuard()
+    : record_(threadRecord.get()) {
+
+    if (record_->nesting++ == 0) {
+        // The fence ensures that the announced epoch is visible to writers
+        // before we read any shared data.
+        Domain& d = domain();
+        record_->epoch.store(d.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+ReadGuard::~ReadGuard() {
+    if (--record_->nesting == 0) {
+        record_->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void retire(void* p, void (*deleter)(void*)) {
+    Domain& d = domain();
+    std::vector<Retired> reclaimable;
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.retired.push_back({p, deleter, d.epoch.load()});
+        if (++d.numRetiresSinceCollect >= collectPeriod) {
+            d.numRetiresSinceCollect = 0;
+            d.tryAdvance();
+            reclaimable = d.popReclaimable();
+        }
+    }
+    freeAll(reclaimable);
+}
+
+size_t collect() {
+    Domain& d = domain();
+    std::vector<Retired> reclaimable;
+    size_t remaining = 0;
+    {
+        std::lock_guard<std::mutex> lock(d.mutex);
+        d.numRetiresSinceCollect = 0;
+
+        // Advancing twice allows objects retired at the current epoch to be
+        // freed right away if there are no active readers.
+        d.tryAdvance();
+        d.tryAdvance();
+        reclaimable = d.popReclaimable();
+        remaining = d.retired.size();
+    }
+    freeAll(reclaimable);
+    return remaining;
+}
+
+uint64_t currentEpoch() {
+    return domain().epoch.load();
+}
+
+} // namespace epoch
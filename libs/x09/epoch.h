@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "../common.h"
+
+// Epoch-based reclamation.
+//
+// Readers access shared data within a `ReadGuard`. Writers never free memory
+// that readers may still be accessing: instead, after unpublishing an object
+// (e.g., replacing it by a new version with an atomic store), they retire it
+// via `retire()`, and it is only freed once all the readers that may have
+// seen it have released their guard.
+//
+// This is implemented with a global epoch counter, and one record per reader
+// thread announcing the epoch observed when its outermost guard was created.
+// The global epoch can only advance when all active readers have observed the
+// current epoch. An object retired at epoch `e` is freed once the global epoch
+// reaches `e + 2`, since by then all readers active at the time of its
+// retirement have released their guard.
+//
+// Creating and destroying a guard is two stores and a fence on a cache line
+// owned by the current thread: there is no shared counter, so readers never
+// contend with each other. Retiring and reclaiming objects is serialized by a
+// mutex, which is fine since this is only done by writers.
+//
+// There is a single, process-wide epoch domain.
+//
+namespace epoch {
+
+namespace detail {
+
+struct ReaderRecord;
+
+} // namespace detail
+
+// Marks the current thread as reading shared data for the lifetime of the
+// guard. Guards can be nested, in which case only the outermost one has an
+// effect.
+//
+class API ReadGuard {
+public:
+    ReadGuard();
+    ~ReadGuard();
+
+    DISABLE_COPY_AND_MOVE(ReadGuard);
+
+private:
+    detail::ReaderRecord* record_;
+};
+
+// Retires the given object: `deleter(p)` will be called once no reader may
+// be accessing it anymore. This may be called from any thread, including
+// while holding a ReadGuard.
+//
+// This may free some previously retired objects, calling their deleter in
+// the current thread, after releasing the internal mutex. Therefore, deleters
+// may call `retire()` themselves.
+//
+API void retire(void* p, void (*deleter)(void*));
+
+// Convenient overload of retire() for objects allocated with `new`.
+template<typename T>
+void retire(T* p) {
+    retire(static_cast<void*>(p), [](void* q) { delete static_cast<T*>(q); });
+}
+
+// Tries to advance the epoch and frees all the objects that can be freed.
+// Returns the number of objects that are still waiting to be freed.
+//
+// This is called automatically every once in a while by retire(), but can be
+// called explicitly, e.g., when the writer is idle.
+//
+API size_t collect();
+
+// Returns the current global epoch, for tests and benchmarks.
+API uint64_t currentEpoch();
+
+} // namespace epoch
@@ -0,0 +1,66 @@
+#!/usr/bin/python3
+
+import unittest
+from x09 import Node, Tree, collect
+
+def getRootOfNewTree():
+    tree = Tree()
+    return tree.root
+
+def getNodeOfNewTree():
+    tree = Tree()
+    node = tree.root.createChild("node1")
+    return node
+
+class TestTree(unittest.TestCase):
+
+    def testConstructor(self):
+        tree = Tree()
+        self.assertEqual(tree.root.name, "root")
+
+    def testKeepAliveRootToTree(self):
+        node = getRootOfNewTree()
+        self.assertEqual(node.name, "root")
+
+    def testKeepAliveNodeToTree(self):
+        node = getNodeOfNewTree()
+        self.assertEqual(node.name, "node1")
+
+    def testChildren(self):
+        tree = Tree()
+        root = tree.root
+        for i in range(100):
+            root.createChild("node" + str(i))
+        self.assertEqual(root.numChildren, 100)
+        self.assertEqual(root.child(42).name, "node42")
+        self.assertEqual(root.child(42).parent, root)
+        with self.assertRaises(IndexError):
+            root.child(100)
+
+    # Same as x03: not UB, the node is kept alive but removed from the tree.
+    def testAccessingClearedChild(self):
+        tree = Tree()
+        root = tree.root
+        node = root.createChild("node1")
+        grandchild = node.createChild("grandchild")
+        root.clearChildren()
+        self.assertEqual(root.numChildren, 0)
+        self.assertEqual(node.name, "node1")
+        self.assertEqual(node.numChildren, 0)
+        self.assertIsNone(node.parent)
+        self.assertIsNone(grandchild.parent)
+
+        # Removed nodes cannot be modified anymore
+        with self.assertRaises(RuntimeError):
+            node.createChild("node2")
+
+    def testCollect(self):
+        tree = Tree()
+        root = tree.root
+        for i in range(1000):
+            root.createChild("node")
+        root.clearChildren()
+        self.assertEqual(collect(), 0) # no concurrent readers
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,106 @@
+#include "tree.h"
+
+#include <stdexcept>
+
+namespace {
+
+void throwRemovedFromTree() {
+    throw std::logic_error(
+        "Cannot modify the children of a node that has been removed from its tree.");
+}
+
+} // namespace
+
+Node* Node::child(size_t index) const {
+    const detail::ChildArray* children = children_.load(std::memory_order_acquire);
+    size_t n = children ? children->size.load(std::memory_order_acquire) : 0;
+    if (index >= n) {
+        throw std::out_of_range("Node::child(index): index out of range.");
+    }
+    return children->slots[index].get();
+}
+
+NodeSharedPtr Node::createChild(std::string_view name) {
+    Tree* tree = tree_.load(std::memory_order_acquire);
+    if (!tree) {
+        throwRemovedFromTree();
+    }
+    std::lock_guard<std::mutex> lock(tree->writeMutex_);
+    if (tree_.load(std::memory_order_relaxed) != tree) {
+        throwRemovedFromTree(); // removed by another thread while we waited
+    }
+
+    NodeSharedPtr child = detail::NodeCreateKey::create(tree, this, name);
+    detail::ChildArray* children = children_.load(std::memory_order_relaxed);
+    size_t n = children ? children->size.load(std::memory_order_relaxed) : 0;
+    if (!children || n == children->capacity) {
+        // Note: we copy rather than move the shared pointers, since readers
+        // may still be reading the old array.
+        auto newChildren = std::make_unique<detail::ChildArray>(n == 0 ? 4 : 2 * n);
+        for (size_t i = 0; i < n; ++i) {
+            newChildren->slots[i] = children->slots[i];
+        }
+        newChildren->size.store(n, std::memory_order_relaxed);
+        children_.store(newChildren.get(), std::memory_order_release);
+        if (children) {
+            epoch::retire(children);
+        }
+        children = newChildren.release();
+    }
+    children->slots[n] = child;
+    children->size.store(n + 1, std::memory_order_release);
+    return child;
+}
+
+void Node::clearChildren() {
+    Tree* tree = tree_.load(std::memory_order_acquire);
+    if (!tree) {
+        throwRemovedFromTree();
+    }
+    std::lock_guard<std::mutex> lock(tree->writeMutex_);
+    if (tree_.load(std::memory_order_relaxed) != tree) {
+        throwRemovedFromTree();
+    }
+
+    detail::ChildArray* children = children_.exchange(nullptr, std::memory_order_acq_rel);
+    if (children) {
+        std::vector<Node*> nodes;
+        size_t n = children->size.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i) {
+            nodes.push_back(children->slots[i].get());
+        }
+        detach_(std::move(nodes), {children});
+    }
+}
+
+// Note: we only retire the arrays once all nodes are detached, since retiring
+// may free arrays retired earlier, and therefore nodes that we are visiting.
+//
+void Node::detach_(std::vector<Node*> nodes, std::vector<detail::ChildArray*> arrays) {
+    while (!nodes.empty()) {
+        Node* node = nodes.back();
+        nodes.pop_back();
+        node->tree_.store(nullptr, std::memory_order_release);
+        node->parent_.store(nullptr, std::memory_order_release);
+        detail::ChildArray* children =
+            node->children_.exchange(nullptr, std::memory_order_acq_rel);
+        if (children) {
+            size_t n = children->size.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < n; ++i) {
+                nodes.push_back(children->slots[i].get());
+            }
+            arrays.push_back(children);
+        }
+    }
+    for (detail::ChildArray* array : arrays) {
+        epoch::retire(array);
+    }
+}
+
+Tree::~Tree() {
+    std::lock_guard<std::mutex> lock(writeMutex_);
+    Node::detach_({root_.get()}, {});
+
+    // Readers may still be reading the root.
+    epoch::retire(new NodeSharedPtr(std::move(root_)));
+}
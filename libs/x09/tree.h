@@ -0,0 +1,188 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory> // shared_ptr
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../atom.h"
+#include "../common.h"
+#include "epoch.h"
+
+class Tree;
+class Node;
+
+using NodeSharedPtr = std::shared_ptr<Node>;
+using NodeWeakPtr = std::weak_ptr<Node>;
+
+namespace detail {
+
+// Constructor of Node must be private-like to enforce that it is created via
+// make_shared. We use the passkey idiom to give access to both Tree and Node.
+//
+struct NodeCreateKey {
+private:
+    friend Tree;
+    friend Node;
+    NodeCreateKey() = default;
+
+    static NodeSharedPtr create(Tree* tree, Node* parent, std::string_view name) {
+        NodeCreateKey key;
+        return std::make_shared<Node>(key, tree, parent, name);
+    }
+};
+
+// Children of a node.
+//
+// Slots [0, size) are immutable once published: appending a child writes the
+// next slot then increments `size` with release semantics, so readers can
+// read the first `size` slots without any lock. When the capacity is
+// exceeded, a new array is allocated, published in place of the old one,
+// and the old one is retired (see epoch.h).
+//
+struct ChildArray {
+    explicit ChildArray(size_t capacity)
+        : capacity(capacity)
+        , slots(new NodeSharedPtr[capacity]) {
+    }
+
+    std::atomic<size_t> size = 0;
+    const size_t capacity;
+    const std::unique_ptr<NodeSharedPtr[]> slots;
+};
+
+} // namespace detail
+
+// Same as x03, except that the tree can be read concurrently with
+// modifications, see README.md.
+//
+// Threading model:
+//
+// - Readers can traverse the tree from any thread, without locks, as long as
+//   they hold an `epoch::ReadGuard`. The raw pointers returned by `child()`
+//   and `parent()` are valid until the guard is released.
+//
+// - Modifications (createChild(), clearChildren(), setName()) can be called
+//   from any thread, and are serialized by a mutex owned by the tree.
+//   Readers never wait for this mutex.
+//
+// - A reader may observe a node that has just been removed from the tree
+//   (its tree() becomes null), but never a destroyed node.
+//
+class API Node : public std::enable_shared_from_this<Node> {
+public:
+    Node(detail::NodeCreateKey, Tree* tree, Node* parent, std::string_view name)
+        : tree_(tree)
+        , parent_(parent)
+        , name_(Atom(name)) {
+    }
+
+    // No need to detach the children here: a node can only be destroyed once
+    // it has been removed from its tree, at which point its child array has
+    // already been retired and set to null, see detach_(). Deleting it is
+    // only a safety net.
+    //
+    ~Node() {
+        delete children_.load(std::memory_order_relaxed);
+    }
+
+    DISABLE_COPY_AND_MOVE(Node);
+
+    // Null if the node has been removed from its tree.
+    Tree* tree() const {
+        return tree_.load(std::memory_order_acquire);
+    }
+
+    // Null in case we're the root or we've been removed from the tree.
+    // Readers: valid while holding an epoch::ReadGuard.
+    Node* parent() const {
+        return parent_.load(std::memory_order_acquire);
+    }
+
+    std::string_view name() const {
+        return nameAtom().str();
+    }
+
+    Atom nameAtom() const {
+        return name_.load(std::memory_order_relaxed);
+    }
+
+    // Atomic: concurrent readers see either the old or the new name.
+    void setName(std::string_view name) {
+        name_.store(Atom(name), std::memory_order_relaxed);
+    }
+
+    size_t numChildren() const {
+        const detail::ChildArray* children = children_.load(std::memory_order_acquire);
+        return children ? children->size.load(std::memory_order_acquire) : 0;
+    }
+
+    // Guaranteed non-null if it exists, otherwise throws.
+    // Readers: valid while holding an epoch::ReadGuard.
+    Node* child(size_t index) const;
+
+    // Calls `f(Node*)` for each child, loading the child array only once.
+    // Readers: must hold an epoch::ReadGuard.
+    template<typename F>
+    void forEachChild(F&& f) const {
+        const detail::ChildArray* children = children_.load(std::memory_order_acquire);
+        if (children) {
+            size_t n = children->size.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; ++i) {
+                f(children->slots[i].get());
+            }
+        }
+    }
+
+    // Guaranteed non-null, throws if memory allocation fails, or if this node
+    // has been removed from its tree.
+    NodeSharedPtr createChild(std::string_view name);
+
+    // Removes all the children from the tree. They are destroyed once all
+    // readers that may access them have released their guard, and all
+    // external shared pointers to them are released.
+    void clearChildren();
+
+private:
+    std::atomic<Tree*> tree_;
+    std::atomic<Node*> parent_;
+    std::atomic<detail::ChildArray*> children_ = nullptr;
+    std::atomic<Atom> name_;
+
+    // Removes the given nodes and all their descendants from the tree, then
+    // retires their child arrays as well as the given arrays. Must be called
+    // with the write mutex locked.
+    //
+    friend Tree;
+    static void detach_(std::vector<Node*> nodes, std::vector<detail::ChildArray*> arrays);
+};
+
+class API Tree {
+public:
+    DISABLE_COPY_AND_MOVE(Tree);
+
+    Tree()
+        : root_(detail::NodeCreateKey::create(this, nullptr, "root")) {
+    }
+
+    // The tree must not be destroyed while other threads are modifying it.
+    // Readers are allowed: they will see the root removed from the tree.
+    //
+    ~Tree();
+
+    // guaranteed non-null: our tree is assumed to always has a root.
+    // The root is never removed from the tree, so readers don't need a guard
+    // to access it, as long as the tree is alive.
+    Node* root() const {
+        return root_.get();
+    }
+
+private:
+    NodeSharedPtr root_;
+
+    friend Node;
+    std::mutex writeMutex_;
+};
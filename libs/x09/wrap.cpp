@@ -0,0 +1,81 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+namespace py = pybind11;
+using rvp = py::return_value_policy;
+
+#include "tree.h"
+
+// Same as x03, see comments there.
+//
+// The C++ API returns raw pointers, only valid while holding an
+// epoch::ReadGuard. Before returning them to Python, we convert them to
+// shared pointers within a guard: Python objects then keep the nodes alive
+// regardless of concurrent modifications by other threads.
+//
+// Note: shared_from_this() is safe here since the guard ensures that the node
+// is not destroyed, hence its use count is not zero.
+//
+namespace {
+
+NodeSharedPtr lock(Node* node) {
+    return node ? node->shared_from_this() : NodeSharedPtr();
+}
+
+} // namespace
+
+void wrap_node(py::module& m) {
+    py::class_<Node, NodeSharedPtr>(m, "Node")
+
+        // the tree should not keep alive the node, hence rvp::reference
+        .def_property_readonly("tree", &Node::tree, rvp::reference)
+
+        // the parent should not keep alive the child, hence rvp::reference
+        .def_property_readonly(
+            "parent",
+            [](Node& self) -> NodeSharedPtr {
+                epoch::ReadGuard guard;
+                return lock(self.parent());
+            },
+            rvp::reference)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python string
+        .def_property("name", &Node::name, &Node::setName)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python integer
+        .def_property_readonly("numChildren", &Node::numChildren)
+
+        // the returned child should keep alive its parent.
+        .def(
+            "child",
+            [](Node& self, size_t i) -> NodeSharedPtr {
+                epoch::ReadGuard guard;
+                return lock(self.child(i));
+            },
+            rvp::reference_internal)
+
+        // the created child should keep alive its parent.
+        .def("createChild", &Node::createChild, rvp::reference_internal)
+
+        // Other threads may be reading the tree, but they never block the
+        // writer, so there is no need to release the GIL.
+        .def("clearChildren", &Node::clearChildren);
+}
+
+void wrap_tree(py::module& m) {
+    py::class_<Tree>(m, "Tree")
+
+        // constructor
+        .def(py::init<>())
+
+        // the root should keep alive the tree
+        .def_property_readonly(
+            "root",
+            [](Tree& self) -> NodeSharedPtr { return lock(self.root()); },
+            rvp::reference_internal);
+}
+
+PYBIND11_MODULE(x09, m) {
+    wrap_node(m);
+    wrap_tree(m);
+    m.def("collect", &epoch::collect);
+}
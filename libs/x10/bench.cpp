@@ -0,0 +1,156 @@
+// Standardized workloads of ../benchmark.h, plus the costs specific to
+// persistent trees:
+//
+// - snapshot: taking a snapshot of the tree
+// - setName: renaming random nodes, without any snapshot, so in place
+// - setNameWithSnapshots: same, but taking a snapshot before each rename,
+//   so that each rename copies the path from the root to the node
+//
+// Usage: x10_bench [numNodes] [branchingFactor] [--json path]
+
+#include <algorithm> // min
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../benchmark.h"
+#include "tree.h"
+
+namespace {
+
+// Names of the nodes: a few thousand distinct names, long enough not to fit
+// in the small string optimization buffer.
+//
+const std::vector<std::string>& names() {
+    static std::vector<std::string> res = []() {
+        std::vector<std::string> names;
+        for (int i = 0; i < 2000; ++i) {
+            names.push_back("transform_group_" + std::to_string(i));
+        }
+        return names;
+    }();
+    return res;
+}
+
+// Builds a tree of `numNodes` nodes (including the root) in breadth-first
+// order, where each node has `branchingFactor` children, except possibly in
+// the last level. Returns the paths of all the nodes.
+//
+std::vector<NodePath> build(Tree& tree, size_t numNodes, size_t branchingFactor) {
+    const std::vector<std::string>& names_ = names();
+    std::vector<NodePath> queue;
+    queue.reserve(numNodes);
+    queue.push_back({});
+    size_t i = 0;
+    while (queue.size() < numNodes) {
+        NodePath parent = queue[i++];
+        for (size_t j = 0; j < branchingFactor && queue.size() < numNodes; ++j) {
+            const std::string& name = names_[queue.size() % names_.size()];
+            NodePath path = parent;
+            path.push_back(tree.createChild(parent, name));
+            queue.push_back(std::move(path));
+        }
+    }
+    return queue;
+}
+
+// Returns the number of visited nodes.
+size_t dfs(const Node& root) {
+    size_t count = 0;
+    std::vector<const Node*> stack;
+    stack.push_back(&root);
+    while (!stack.empty()) {
+        const Node* node = stack.back();
+        stack.pop_back();
+        ++count;
+        for (size_t i = node->numChildren(); i-- > 0;) {
+            stack.push_back(node->child(i).get());
+        }
+    }
+    return count;
+}
+
+void runWorkloads(benchmark::Report& report, size_t numNodes, size_t branchingFactor) {
+    using benchmark::Clock;
+    using benchmark::nanosecondsSince;
+    benchmark::Params params = {{"numNodes", numNodes}, {"branchingFactor", branchingFactor}};
+    benchmark::useAtomicRefCounts();
+
+    auto tree = std::make_unique<Tree>();
+    auto start = Clock::now();
+    std::vector<NodePath> paths = build(*tree, numNodes, branchingFactor);
+    report.add("build", params, nanosecondsSince(start) / numNodes, "ns/node");
+
+    std::optional<TreeSnapshot> snapshot = tree->snapshot();
+    start = Clock::now();
+    size_t count = dfs(*snapshot->root());
+    report.add("dfs", params, nanosecondsSince(start) / count, "ns/node");
+
+    benchmark::Random random;
+    size_t numAccesses = numNodes;
+    const Node* root = snapshot->root().get();
+    const Node* node = root;
+    start = Clock::now();
+    for (size_t i = 0; i < numAccesses; ++i) {
+        size_t n = node->numChildren();
+        node = n > 0 ? node->child(random(n)).get() : root;
+    }
+    report.add("randomChildAccess", params, nanosecondsSince(start) / numAccesses, "ns/access");
+    benchmark::doNotOptimize(node);
+
+    size_t numSnapshots = 1000000;
+    start = Clock::now();
+    for (size_t i = 0; i < numSnapshots; ++i) {
+        TreeSnapshot s = tree->snapshot();
+        benchmark::doNotOptimize(s.root().get());
+    }
+    report.add("snapshot", params, nanosecondsSince(start) / numSnapshots, "ns/snapshot");
+    snapshot.reset();
+
+    const std::vector<std::string>& names_ = names();
+    size_t numRenames = std::min<size_t>(numNodes, 100000);
+    start = Clock::now();
+    for (size_t i = 0; i < numRenames; ++i) {
+        tree->setName(paths[random(paths.size())], names_[i % names_.size()]);
+    }
+    report.add("setName", params, nanosecondsSince(start) / numRenames, "ns/rename");
+
+    start = Clock::now();
+    for (size_t i = 0; i < numRenames; ++i) {
+        snapshot = tree->snapshot();
+        tree->setName(paths[random(paths.size())], names_[i % names_.size()]);
+    }
+    report.add("setNameWithSnapshots", params, nanosecondsSince(start) / numRenames, "ns/rename");
+    snapshot.reset();
+
+    start = Clock::now();
+    tree->clearChildren({});
+    report.add("clearChildren", params, nanosecondsSince(start) / numNodes, "ns/node");
+
+    build(*tree, numNodes, branchingFactor);
+    start = Clock::now();
+    tree.reset();
+    report.add("destroy", params, nanosecondsSince(start) / numNodes, "ns/node");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    benchmark::Args args(argc, argv);
+    size_t numNodes = args.get(0, 1000000);
+    size_t branchingFactor = args.get(1, 8);
+    if (branchingFactor == 0) {
+        std::cerr << "The branching factor must be at least 1" << std::endl;
+        return 1;
+    }
+
+    std::cout << numNodes << " nodes, branching factor " << branchingFactor << std::endl;
+    benchmark::Report report("x10");
+    runWorkloads(report, numNodes, branchingFactor);
+    if (!report.save(args.jsonPath)) {
+        std::cerr << "Cannot write " << args.jsonPath << std::endl;
+        return 1;
+    }
+}
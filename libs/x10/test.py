@@ -0,0 +1,151 @@
+#!/usr/bin/python3
+
+import unittest
+import x10
+from x10 import Node, Tree, TreeSnapshot
+
+def getRootOfNewTree():
+    tree = Tree()
+    tree.createChild([], "node1")
+    return tree.root
+
+def names(node):
+    return [node.child(i).name for i in range(node.numChildren)]
+
+class TestTree(unittest.TestCase):
+
+    def testConstructor(self):
+        tree = Tree()
+        self.assertEqual(tree.root.name, "root")
+        self.assertEqual(tree.root.numChildren, 0)
+        self.assertEqual(tree.version, 0)
+
+    def testKeepAliveRootToTree(self):
+        node = getRootOfNewTree()
+        self.assertEqual(node.name, "root")
+        self.assertEqual(node.child(0).name, "node1")
+
+    def testCreateChild(self):
+        tree = Tree()
+        self.assertEqual(tree.createChild([], "a"), 0)
+        self.assertEqual(tree.createChild([], "b"), 1)
+        self.assertEqual(tree.createChild([0], "a1"), 0)
+        self.assertEqual(tree.createChild((0, 0), "a11"), 0)
+        root = tree.root
+        self.assertEqual(names(root), ["a", "b"])
+        self.assertEqual(root.child(0).child(0).child(0).name, "a11")
+        self.assertEqual(root.subtreeSize, 5)
+        self.assertEqual(root.child(0).subtreeSize, 3)
+        self.assertEqual(tree.version, 4)
+
+    def testInvalidPath(self):
+        tree = Tree()
+        tree.createChild([], "a")
+        with self.assertRaises(IndexError):
+            tree.createChild([1], "b")
+        with self.assertRaises(IndexError):
+            tree.removeChild([], 1)
+        with self.assertRaises(IndexError):
+            tree.root.child(1)
+        self.assertEqual(tree.version, 1)  # unchanged
+        self.assertEqual(tree.root.subtreeSize, 2)
+
+    def testSnapshotIsImmutable(self):
+        tree = Tree()
+        tree.createChild([], "a")
+        tree.createChild([0], "a1")
+        snapshot = tree.snapshot()
+        tree.setName([0], "renamed")
+        tree.createChild([], "b")
+        tree.clearChildren([0])
+        self.assertEqual(snapshot.version, 2)
+        self.assertEqual(snapshot.numNodes, 3)
+        self.assertEqual(names(snapshot.root), ["a"])
+        self.assertEqual(names(snapshot.root.child(0)), ["a1"])
+        self.assertEqual(names(tree.root), ["renamed", "b"])
+        self.assertEqual(tree.root.child(0).numChildren, 0)
+        self.assertEqual(tree.snapshot().numNodes, 3)
+
+    def testStructuralSharing(self):
+        tree = Tree()
+        for name in ["a", "b", "c"]:
+            tree.createChild([], name)
+            tree.createChild([tree.root.numChildren - 1], name + "1")
+        before = tree.snapshot()
+        tree.setName([1, 0], "renamed")
+        after = tree.snapshot()
+        # Only the path from the root to the renamed node is copied
+        self.assertIsNot(before.root, after.root)
+        self.assertIsNot(before.root.child(1), after.root.child(1))
+        self.assertIs(before.root.child(0), after.root.child(0))
+        self.assertIs(before.root.child(2), after.root.child(2))
+        self.assertEqual(before.root.child(1).child(0).name, "b1")
+        self.assertEqual(after.root.child(1).child(0).name, "renamed")
+
+    # Nodes held by Python are shared, so they are never modified.
+    def testNodeHeldByPythonIsImmutable(self):
+        tree = Tree()
+        tree.createChild([], "a")
+        a = tree.root.child(0)
+        tree.createChild([0], "a1")
+        tree.setName([0], "renamed")
+        self.assertEqual(a.name, "a")
+        self.assertEqual(a.numChildren, 0)
+        self.assertEqual(tree.root.child(0).name, "renamed")
+
+    def testRemoveChild(self):
+        tree = Tree()
+        for name in ["a", "b", "c"]:
+            tree.createChild([], name)
+        tree.createChild([1], "b1")
+        snapshot = tree.snapshot()
+        tree.removeChild([], 1)
+        self.assertEqual(names(tree.root), ["a", "c"])
+        self.assertEqual(tree.root.subtreeSize, 3)
+        self.assertEqual(names(snapshot.root), ["a", "b", "c"])
+        self.assertEqual(snapshot.numNodes, 5)
+
+    def testChildren(self):
+        tree = Tree()
+        for i in range(10):
+            tree.createChild([], "node" + str(i))
+        children = tree.root.children()
+        self.assertEqual(len(children), 10)
+        self.assertEqual(children[3].name, "node3")
+
+    def testDeepTree(self):
+        tree = Tree()
+        path = []
+        for i in range(1000):
+            tree.createChild(path, "n")
+            path.append(0)
+        snapshot = tree.snapshot()
+        tree.setName(path, "leaf")
+        self.assertEqual(snapshot.numNodes, 1001)
+        del snapshot
+        tree.clearChildren([])
+        self.assertEqual(tree.root.subtreeSize, 1)
+
+    def testOldVersionsAreFreed(self):
+        stats = x10.stats()["Node"]
+        if not x10.TELEMETRY_ENABLED:
+            self.assertEqual(stats["created"], 0)
+            return
+        tree = Tree()
+        for i in range(10):
+            tree.createChild([], "n")
+        snapshots = []
+        for i in range(10):
+            snapshots.append(tree.snapshot())
+            tree.setName([i], "renamed")  # copies the root and one child
+        after = x10.stats()["Node"]
+        self.assertEqual(after["live"] - stats["live"], 11 + 10 * 2)
+        del snapshots
+        after = x10.stats()["Node"]
+        self.assertEqual(after["live"] - stats["live"], 11)
+        del tree
+        final = x10.stats()["Node"]
+        self.assertEqual(final["live"], stats["live"])
+
+if __name__ == '__main__':
+    unittest.main()
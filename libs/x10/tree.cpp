@@ -0,0 +1,201 @@
+#include "tree.h"
+
+#include <atomic> // atomic_thread_fence
+#include <cstddef>
+#include <stdexcept>
+#include <utility> // move
+
+namespace {
+
+// Nodes are never created const, so modifying them via const_cast is
+// well-defined, and only done while they are not shared.
+//
+Node& mutableNode(const NodeSharedPtr& node) {
+    return const_cast<Node&>(*node);
+}
+
+NodeSharedPtr& mutableChild(const Node& parent, size_t index) {
+    return const_cast<NodeSharedPtr&>(parent.child(index));
+}
+
+void throwInvalidPath() {
+    throw std::out_of_range("Tree: invalid node path.");
+}
+
+// Children of the nodes being destroyed by the outermost ~Node() of this
+// thread, if any.
+//
+thread_local std::vector<NodeSharedPtr>* pendingNodes = nullptr;
+
+} // namespace
+
+// Releasing a child only destroys it if this node was its last owner, which
+// would recurse into its own children. Instead, the outermost destructor
+// releases the children iteratively, and nested destructors only append
+// their children to its list.
+//
+// Note: we cannot check whether a child is only owned by this node with
+// use_count(), since other owners may be concurrently released by other
+// threads (e.g., older snapshots).
+//
+Node::~Node() {
+    if (pendingNodes) {
+        for (NodeSharedPtr& child : children_) {
+            pendingNodes->push_back(std::move(child));
+        }
+    }
+    else {
+        std::vector<NodeSharedPtr> pending = std::move(children_);
+        pendingNodes = &pending;
+        while (!pending.empty()) {
+            NodeSharedPtr node = std::move(pending.back());
+            pending.pop_back();
+            node.reset(); // may append to `pending`
+        }
+        pendingNodes = nullptr;
+    }
+    TELEMETRY_DESTROYED(Node);
+}
+
+NodeSharedPtr Node::copy_() const {
+    auto res = std::make_shared<Node>(detail::NodeCreateKey(), name_);
+    res->children_ = children_;
+    res->subtreeSize_ = subtreeSize_;
+    return res;
+}
+
+Tree::Tree()
+    : root_(std::make_shared<Node>(detail::NodeCreateKey(), Atom("root"))) {
+}
+
+TreeSnapshot Tree::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return TreeSnapshot(root_, version_);
+}
+
+NodeSharedPtr Tree::root() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return root_;
+}
+
+uint64_t Tree::version() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return version_;
+}
+
+// A node on the path can be modified in place if it and all its ancestors
+// are only owned by their parent (or by the tree, for the root): no snapshot
+// or external pointer can reach it. Below the first shared node, all nodes
+// are reachable from another owner via this shared node, so they must be
+// copied, even if their own use count is 1.
+//
+// All the copies are made before modifying any node in place, so that the
+// tree is left unchanged if an allocation throws.
+//
+// The replaced node, if any, is released after unlocking the mutex, in case
+// its other owners released it in the meantime.
+//
+template<typename F>
+void Tree::update_(const NodePath& path, F&& f) {
+    NodeSharedPtr replaced;
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // The nodes from the root to the target.
+    std::vector<const Node*> nodes;
+    nodes.reserve(path.size() + 1);
+    nodes.push_back(root_.get());
+    size_t numUnique = root_.use_count() == 1 ? 1 : 0;
+    for (size_t index : path) {
+        const Node* parent = nodes.back();
+        if (index >= parent->numChildren()) {
+            throwInvalidPath();
+        }
+        const NodeSharedPtr& child = parent->child(index);
+        if (numUnique == nodes.size() && child.use_count() == 1) {
+            ++numUnique;
+        }
+        nodes.push_back(child.get());
+    }
+
+    // Synchronizes with the release of the other owners (if any) of the
+    // nodes that we are about to modify in place, which may have been
+    // reading them from other threads.
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    size_t n = nodes.size();
+    if (numUnique == n) {
+        std::ptrdiff_t delta = f(const_cast<Node&>(*nodes.back()));
+        for (size_t i = 0; i < n; ++i) {
+            const_cast<Node*>(nodes[i])->addToSubtreeSize_(delta);
+        }
+    }
+    else {
+        // Copy the target and its shared ancestors, bottom-up.
+        NodeSharedPtr copy = nodes.back()->copy_();
+        std::ptrdiff_t delta = f(mutableNode(copy));
+        mutableNode(copy).addToSubtreeSize_(delta);
+        for (size_t i = n - 1; i-- > numUnique;) {
+            NodeSharedPtr parentCopy = nodes[i]->copy_();
+            mutableChild(*parentCopy, path[i]) = std::move(copy);
+            mutableNode(parentCopy).addToSubtreeSize_(delta);
+            copy = std::move(parentCopy);
+        }
+
+        // Attach the copies to the deepest unique ancestor, if any.
+        if (numUnique == 0) {
+            replaced = std::exchange(root_, std::move(copy));
+        }
+        else {
+            NodeSharedPtr& slot = mutableChild(*nodes[numUnique - 1], path[numUnique - 1]);
+            replaced = std::exchange(slot, std::move(copy));
+            for (size_t i = 0; i < numUnique; ++i) {
+                const_cast<Node*>(nodes[i])->addToSubtreeSize_(delta);
+            }
+        }
+    }
+    ++version_;
+}
+
+size_t Tree::createChild(const NodePath& parent, std::string_view name) {
+    Atom atom(name);
+    size_t index = 0;
+    update_(parent, [&](Node& node) -> std::ptrdiff_t {
+        auto child = std::make_shared<Node>(detail::NodeCreateKey(), atom);
+        index = node.children_.size();
+        node.children_.push_back(std::move(child));
+        return 1;
+    });
+    return index;
+}
+
+void Tree::setName(const NodePath& path, std::string_view name) {
+    Atom atom(name);
+    update_(path, [&](Node& node) -> std::ptrdiff_t {
+        node.name_ = atom;
+        return 0;
+    });
+}
+
+// The removed subtrees are only destroyed once the mutex is unlocked, so
+// that destroying a large subtree doesn't block other calls.
+//
+void Tree::removeChild(const NodePath& parent, size_t index) {
+    NodeSharedPtr removed;
+    update_(parent, [&](Node& node) -> std::ptrdiff_t {
+        if (index >= node.children_.size()) {
+            throwInvalidPath();
+        }
+        removed = std::move(node.children_[index]);
+        node.children_.erase(node.children_.begin() + static_cast<std::ptrdiff_t>(index));
+        return -static_cast<std::ptrdiff_t>(removed->subtreeSize_);
+    });
+}
+
+void Tree::clearChildren(const NodePath& path) {
+    std::vector<NodeSharedPtr> removed;
+    update_(path, [&](Node& node) -> std::ptrdiff_t {
+        std::ptrdiff_t delta = 1 - static_cast<std::ptrdiff_t>(node.subtreeSize_);
+        removed.swap(node.children_);
+        return delta;
+    });
+}
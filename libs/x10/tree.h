@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory> // shared_ptr
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "../atom.h"
+#include "../common.h"
+#include "../telemetry.h"
+
+class Tree;
+class Node;
+
+// Nodes are immutable once reachable from a snapshot, so they are only
+// exposed as const.
+//
+using NodeSharedPtr = std::shared_ptr<const Node>;
+
+// Path of a node from the root, as the indices of the successive children,
+// e.g., {} for the root, or {2, 0} for the first child of its third child.
+//
+using NodePath = std::vector<size_t>;
+
+namespace detail {
+
+// Constructor of Node must be private-like to enforce that it is created via
+// make_shared. We use the passkey idiom to give access to both Tree and Node.
+//
+struct NodeCreateKey {
+private:
+    friend Tree;
+    friend Node;
+    NodeCreateKey() = default;
+};
+
+} // namespace detail
+
+// Node of a persistent tree, see README.md.
+//
+// Unlike in x03, a node has no parent or tree: the same node can be shared by
+// several versions of the tree, and by several parents within a version, so
+// nodes are identified by their path from the root.
+//
+class API Node {
+public:
+    static constexpr telemetry::ObjectType objectType = telemetry::ObjectType::Node;
+
+    Node(detail::NodeCreateKey, Atom name)
+        : name_(name) {
+        TELEMETRY_CREATED(Node);
+    }
+
+    // Non-recursive, to avoid stack overflow when destructing deep trees.
+    ~Node();
+
+    DISABLE_COPY_AND_MOVE(Node);
+
+    std::string_view name() const {
+        return name_.str();
+    }
+
+    Atom nameAtom() const {
+        return name_;
+    }
+
+    size_t numChildren() const {
+        return children_.size();
+    }
+
+    // guaranteed non-null if it exists, otherwise throws
+    const NodeSharedPtr& child(size_t index) const {
+        return children_.at(index);
+    }
+
+    // Number of nodes in the subtree rooted at this node, including itself.
+    size_t subtreeSize() const {
+        return subtreeSize_;
+    }
+
+private:
+    Atom name_;
+    std::vector<NodeSharedPtr> children_;
+    size_t subtreeSize_ = 1;
+
+    // Nodes are only modified by the tree, and only while they are not
+    // shared, see Tree::update_().
+    friend Tree;
+    NodeSharedPtr copy_() const;
+
+    void addToSubtreeSize_(std::ptrdiff_t delta) {
+        subtreeSize_ += static_cast<size_t>(delta); // modular arithmetic
+    }
+};
+
+// An immutable version of a tree. Copying a snapshot is O(1), and keeps the
+// whole version alive.
+//
+class API TreeSnapshot {
+public:
+    TreeSnapshot(NodeSharedPtr root, uint64_t version)
+        : root_(std::move(root))
+        , version_(version) {
+    }
+
+    // guaranteed non-null
+    const NodeSharedPtr& root() const {
+        return root_;
+    }
+
+    // Number of modifications of the tree before this snapshot was taken.
+    uint64_t version() const {
+        return version_;
+    }
+
+    size_t numNodes() const {
+        return root_->subtreeSize();
+    }
+
+private:
+    NodeSharedPtr root_;
+    uint64_t version_;
+};
+
+// A persistent tree: taking a snapshot is O(1), and later modifications of
+// the tree do not affect existing snapshots.
+//
+// Each modification creates a new version of the tree by path copying: the
+// modified node and its ancestors are copied, while all other subtrees are
+// shared with the previous version. Nodes that are not shared (i.e., only
+// owned by the current version, and not reachable from any snapshot or
+// external shared pointer) are modified in place instead, so editing a tree
+// without snapshots does not copy anything.
+//
+// Old versions are freed automatically once no snapshot or shared pointer
+// refers to them, except for the nodes they share with other versions.
+//
+// Threading model: all member functions of Tree can be called concurrently
+// (they are serialized by a mutex), and snapshots, as well as nodes obtained
+// from them, can be read from any thread without synchronization.
+//
+// Modifications throw std::out_of_range if a path or index is invalid, in
+// which case the tree is left unchanged.
+//
+class API Tree {
+public:
+    DISABLE_COPY_AND_MOVE(Tree);
+
+    Tree();
+
+    // O(1): only copies a shared pointer to the current root.
+    TreeSnapshot snapshot() const;
+
+    // Same as `snapshot().root()`.
+    NodeSharedPtr root() const;
+
+    uint64_t version() const;
+
+    // Appends a child named `name` to the node at the given path, and returns
+    // its index.
+    size_t createChild(const NodePath& parent, std::string_view name);
+
+    void setName(const NodePath& path, std::string_view name);
+
+    void removeChild(const NodePath& parent, size_t index);
+
+    void clearChildren(const NodePath& path);
+
+private:
+    mutable std::mutex mutex_;
+    NodeSharedPtr root_;
+    uint64_t version_ = 0;
+
+    // Applies `f(Node& node)` to the node at the given path, or to a copy of
+    // it, then updates the subtree sizes of the node and its ancestors. `f`
+    // returns the change in the size of the subtree of the node, and must
+    // leave the node unchanged if it throws.
+    //
+    template<typename F>
+    void update_(const NodePath& path, F&& f);
+};
@@ -0,0 +1,104 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+namespace py = pybind11;
+using rvp = py::return_value_policy;
+
+#include <memory>
+#include <string_view>
+
+#include "../pytelemetry.h"
+#include "tree.h"
+
+// [1] Const nodes:
+//
+// pybind11 doesn't support holders of const types, so nodes are bound with
+// std::shared_ptr<Node> as holder, and we cast away the constness of the
+// shared pointers returned by the C++ API. This is safe since the bindings of
+// Node only expose const member functions: nodes remain immutable from
+// Python.
+//
+// Python objects hold a shared pointer to their node, so a node obtained from
+// Python keeps its subtree alive, as it was when the node was obtained,
+// regardless of later modifications of the tree. It also means that
+// modifying the tree always copies the nodes observed from Python, since
+// they are shared (see Tree::update_()).
+//
+// [2] Paths:
+//
+// Since nodes can be shared by several versions and have no parent, they are
+// modified via the tree, which takes paths of child indices from the root,
+// given as any sequence of integers (e.g., a list or a tuple).
+//
+namespace {
+
+std::shared_ptr<Node> toPython(const NodeSharedPtr& node) {
+    return std::const_pointer_cast<Node>(node);
+}
+
+} // namespace
+
+void wrap_node(py::module& m) {
+    py::class_<Node, std::shared_ptr<Node>>(m, "Node")
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python string
+        .def_property_readonly("name", &Node::name)
+
+        // the rvp does not matter here: pybind11 will make a copy into a Python integer
+        .def_property_readonly("numChildren", &Node::numChildren)
+        .def_property_readonly("subtreeSize", &Node::subtreeSize)
+
+        // the returned child holds a shared pointer, so it keeps its subtree
+        // alive without keeping alive its parent [1]
+        .def("child", [](const Node& self, size_t i) { return toPython(self.child(i)); })
+
+        .def("children", [](const Node& self) {
+            size_t n = self.numChildren();
+            py::list res(n);
+            for (size_t i = 0; i < n; ++i) {
+                res[i] = py::cast(toPython(self.child(i)));
+            }
+            return res;
+        });
+}
+
+void wrap_tree_snapshot(py::module& m) {
+    py::class_<TreeSnapshot>(m, "TreeSnapshot")
+        .def_property_readonly("root", [](const TreeSnapshot& self) { return toPython(self.root()); })
+        .def_property_readonly("version", &TreeSnapshot::version)
+        .def_property_readonly("numNodes", &TreeSnapshot::numNodes);
+}
+
+void wrap_tree(py::module& m) {
+    py::class_<Tree>(m, "Tree")
+
+        // constructor
+        .def(py::init<>())
+
+        // the root of the current version [1]
+        .def_property_readonly("root", [](const Tree& self) { return toPython(self.root()); })
+        .def_property_readonly("version", &Tree::version)
+        .def("snapshot", &Tree::snapshot)
+
+        // Modifications [2]. Removing children may destroy large subtrees,
+        // which doesn't involve any Python object, so we release the GIL.
+        .def("createChild", &Tree::createChild, py::arg("parent"), py::arg("name"))
+        .def("setName", &Tree::setName, py::arg("path"), py::arg("name"))
+        .def(
+            "removeChild",
+            &Tree::removeChild,
+            py::arg("parent"),
+            py::arg("index"),
+            py::call_guard<py::gil_scoped_release>())
+        .def(
+            "clearChildren",
+            &Tree::clearChildren,
+            py::arg("path"),
+            py::call_guard<py::gil_scoped_release>());
+}
+
+PYBIND11_MODULE(x10, m) {
+    wrap_node(m);
+    wrap_tree_snapshot(m);
+    wrap_tree(m);
+    pytelemetry::defStats(m, {telemetry::ObjectType::Node});
+}